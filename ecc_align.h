@@ -0,0 +1,373 @@
+// Time alignment of detector readings with stage positions (ALIGN in ecc_mqtt_streaming)
+//
+// Positions arrive from the sampler every tick. Detector readings arrive later and at their
+// own rate: a picoammeter burst is delivered seconds after it was taken. PositionAligner
+// keeps the last latency budget of positions plus the readings still waiting for the
+// samples after them, and turns each reading into a FusedRecord: the reading with all four
+// axis positions interpolated at its timestamp.
+//
+// Each axis is interpolated between its own readings. An axis the sampler reads only every
+// Nth tick (SET_AXIS_RATE) is invalid on the ticks in between, so its neighbours around a
+// reading are further apart than those of the fast axes, but it is placed all the same.
+//
+// - LINEAR interpolates between the axis samples before and after the reading.
+// - CUBIC uses a cubic Hermite spline through the four axis samples around the reading, with
+//   Catmull-Rom tangents that account for uneven sample spacing. The spline is local (C1,
+//   no global solve), follows accelerating moves where linear interpolation cuts corners,
+//   and needs one more sample after the reading.
+// A reading waits at most the latency budget for the samples it needs. After that the axes
+// are interpolated linearly where they can be and left invalid where not; a reading newer
+// than every position is counted as expired. A reading older than the positions kept is
+// counted as late. One whose neighbouring samples on an axis span a tick gap wider than the
+// maximum gap (a sampler stall) is counted as a gap.
+//
+// Interpolation runs in two passes: weights per reading and axis (scalar), then one kernel
+// that combines four samples x four axes per reading with AVX or SSE2.
+//
+// Fused recordings (FusedFileWriter) are a FusedFileHeader followed by packed FusedRecords.
+
+#ifndef ECC_ALIGN_H
+#define ECC_ALIGN_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "ecc_picoammeter.h"
+
+enum AlignMethod { ALIGN_LINEAR = 0, ALIGN_CUBIC = 1 };
+
+const char* const ALIGN_METHOD_NAMES[2] = {"LINEAR", "CUBIC"};
+
+struct __attribute__((packed)) FusedRecord {
+    uint64_t timestamp_ns;         // Reading time, same clock as the position stream
+    double current_a;
+    double position[4];            // X, Y, Z, R at timestamp_ns (nm/µ°)
+    uint8_t valid_mask;            // Axis placed from valid samples of that axis
+};
+
+// One valid reading of one axis
+struct AlignPoint {
+    uint64_t timestamp_ns;
+    double position;
+    uint64_t stalls;               // Sampler stalls seen up to this tick
+};
+
+// Kernel input: out[axis] = sum of weights[j][axis] * values[j][axis] over the four points
+struct AlignQuery {
+    double values[4][4];
+    double weights[4][4];
+};
+
+inline void align_kernel(const AlignQuery* queries, size_t count, double* out) {
+    for (size_t i = 0; i < count; ++i, out += 4) {
+        const AlignQuery& q = queries[i];
+#if defined(__AVX__)
+        __m256d acc = _mm256_mul_pd(_mm256_loadu_pd(q.weights[0]), _mm256_loadu_pd(q.values[0]));
+        for (int j = 1; j < 4; ++j) {
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(q.weights[j]), _mm256_loadu_pd(q.values[j])));
+        }
+        _mm256_storeu_pd(out, acc);
+#elif defined(__SSE2__)
+        __m128d lo = _mm_mul_pd(_mm_loadu_pd(q.weights[0]), _mm_loadu_pd(q.values[0]));
+        __m128d hi = _mm_mul_pd(_mm_loadu_pd(q.weights[0] + 2), _mm_loadu_pd(q.values[0] + 2));
+        for (int j = 1; j < 4; ++j) {
+            lo = _mm_add_pd(lo, _mm_mul_pd(_mm_loadu_pd(q.weights[j]), _mm_loadu_pd(q.values[j])));
+            hi = _mm_add_pd(hi, _mm_mul_pd(_mm_loadu_pd(q.weights[j] + 2), _mm_loadu_pd(q.values[j] + 2)));
+        }
+        _mm_storeu_pd(out, lo);
+        _mm_storeu_pd(out + 2, hi);
+#else
+        for (int a = 0; a < 4; ++a) {
+            out[a] = q.weights[0][a] * q.values[0][a] + q.weights[1][a] * q.values[1][a] +
+                     q.weights[2][a] * q.values[2][a] + q.weights[3][a] * q.values[3][a];
+        }
+#endif
+    }
+}
+
+class PositionAligner {
+public:
+    void configure(AlignMethod method, uint64_t latency_budget_ns, uint64_t max_gap_ns) {
+        method_ = method;
+        latency_budget_ns_ = latency_budget_ns;
+        max_gap_ns_ = max_gap_ns;
+    }
+
+    // Samples must come in time order; older or repeated timestamps are ignored. Every tick
+    // counts for stall detection, even one without a valid axis.
+    void push_position(uint64_t timestamp_ns, const int32_t position[4], uint8_t valid_mask) {
+        if (last_tick_ns_ != 0 && timestamp_ns <= last_tick_ns_) return;
+        if (last_tick_ns_ != 0 && timestamp_ns - last_tick_ns_ > max_gap_ns_) stalls_++;
+        last_tick_ns_ = timestamp_ns;
+        for (int a = 0; a < 4; ++a) {
+            if (!(valid_mask & (1 << a))) continue;
+            AlignPoint point;
+            point.timestamp_ns = timestamp_ns;
+            point.position = position[a];
+            point.stalls = stalls_;
+            axes_[a].push_back(point);
+        }
+    }
+
+    void push_reading(const CurrentReading& reading) {
+        if (pending_.empty() || reading.timestamp_ns >= pending_.back().timestamp_ns) {
+            pending_.push_back(reading);
+        } else {
+            auto it = std::upper_bound(pending_.begin(), pending_.end(), reading.timestamp_ns,
+                [](uint64_t t, const CurrentReading& r) { return t < r.timestamp_ns; });
+            pending_.insert(it, reading);
+        }
+    }
+
+    // Appends a FusedRecord for every reading that has its samples, or has waited longer
+    // than the budget at now_ns (flush: all of them). Returns the records appended.
+    size_t emit(uint64_t now_ns, std::vector<FusedRecord>& out, bool flush = false) {
+        queries_.clear();
+        records_.clear();
+        uint64_t oldest = UINT64_MAX;
+        for (int a = 0; a < 4; ++a) {
+            if (!axes_[a].empty()) oldest = std::min(oldest, axes_[a].front().timestamp_ns);
+        }
+        size_t done = 0;
+        for (; done < pending_.size(); ++done) {
+            const CurrentReading& reading = pending_[done];
+            uint64_t t = reading.timestamp_ns;
+            bool expired = flush || now_ns > t + latency_budget_ns_;
+            if (oldest == UINT64_MAX || t > last_tick_ns_) {
+                if (!expired) break;       // Later readings wait too
+                expired_++;
+                continue;
+            }
+            if (t < oldest) {
+                late_++;
+                continue;
+            }
+
+            AlignQuery query;
+            FusedRecord record;
+            record.timestamp_ns = t;
+            record.current_a = reading.current_a;
+            record.valid_mask = 0;
+            bool wait = false, gap = false;
+            for (int a = 0; a < 4; ++a) {
+                int placed = place_axis(a, t, expired, query);
+                if (placed == AXIS_PLACED) record.valid_mask |= 1 << a;
+                wait |= placed == AXIS_WAIT;
+                gap |= placed == AXIS_GAP;
+            }
+            if (wait) break;
+            if (gap) {
+                gaps_++;
+                continue;
+            }
+            queries_.push_back(query);
+            records_.push_back(record);
+        }
+        pending_.erase(pending_.begin(), pending_.begin() + done);
+
+        interpolated_.resize(queries_.size() * 4);
+        align_kernel(queries_.data(), queries_.size(), interpolated_.data());
+        for (size_t i = 0; i < records_.size(); ++i) {
+            std::memcpy(records_[i].position, &interpolated_[i * 4], sizeof(records_[i].position));
+        }
+        out.insert(out.end(), records_.begin(), records_.end());
+        fused_ += records_.size();
+
+        // Keep the budget, whatever pending readings still need, and one sample of each axis before it
+        uint64_t cutoff = last_tick_ns_ > latency_budget_ns_ ? last_tick_ns_ - latency_budget_ns_ : 0;
+        if (!pending_.empty()) cutoff = std::min(cutoff, pending_.front().timestamp_ns);
+        for (int a = 0; a < 4; ++a) {
+            std::deque<AlignPoint>& points = axes_[a];
+            while (points.size() > 2 && points[1].timestamp_ns < cutoff) points.pop_front();
+            if (!points.empty() && points.back().timestamp_ns < cutoff) points.clear();   // Axis no longer read
+        }
+        return records_.size();
+    }
+
+    void clear() {
+        for (int a = 0; a < 4; ++a) axes_[a].clear();
+        pending_.clear();
+        last_tick_ns_ = 0;
+        stalls_ = 0;
+    }
+
+    AlignMethod method() const { return method_; }
+    uint64_t latency_budget_ns() const { return latency_budget_ns_; }
+    size_t pending() const { return pending_.size(); }
+    size_t positions_held() const { return axes_[0].size() + axes_[1].size() + axes_[2].size() + axes_[3].size(); }
+    uint64_t fused() const { return fused_; }
+    uint64_t late() const { return late_; }
+    uint64_t expired() const { return expired_; }
+    uint64_t gaps() const { return gaps_; }
+
+private:
+    enum { AXIS_NONE, AXIS_PLACED, AXIS_WAIT, AXIS_GAP };
+
+    // Weights of axis a at t in the query. An axis without samples on both sides of t is left
+    // out (weights 0), unless a later sample of it is still expected within the budget.
+    int place_axis(int a, uint64_t t, bool expired, AlignQuery& query) const {
+        for (int j = 0; j < 4; ++j) {
+            query.values[j][a] = 0.0;
+            query.weights[j][a] = 0.0;
+        }
+        const std::deque<AlignPoint>& points = axes_[a];
+        if (points.empty() || t < points.front().timestamp_ns) return AXIS_NONE;
+        bool more = !expired;              // Axis still being read and the reading can wait
+        if (t > points.back().timestamp_ns) return more ? AXIS_WAIT : AXIS_NONE;
+
+        size_t k = std::upper_bound(points.begin(), points.end(), t,
+            [](uint64_t value, const AlignPoint& p) { return value < p.timestamp_ns; }) - points.begin() - 1;
+        const AlignPoint& p1 = points[k];
+        if (p1.timestamp_ns == t) {
+            query.values[1][a] = p1.position;
+            query.weights[1][a] = 1.0;
+            return AXIS_PLACED;
+        }
+        const AlignPoint& p2 = points[k + 1];
+        if (p2.stalls != p1.stalls) return AXIS_GAP;
+        double d = static_cast<double>(p2.timestamp_ns - p1.timestamp_ns);
+        double u = (t - p1.timestamp_ns) / d;
+
+        bool cubic = method_ == ALIGN_CUBIC && k >= 1;
+        if (cubic && k + 2 >= points.size()) {
+            if (more) return AXIS_WAIT;    // Wait for the sample after next
+            cubic = false;
+        }
+        if (cubic) {
+            const AlignPoint& p0 = points[k - 1];
+            const AlignPoint& p3 = points[k + 2];
+            cubic = p1.stalls == p0.stalls && p3.stalls == p2.stalls;
+            if (cubic) {
+                double u2 = u * u, u3 = u2 * u;
+                double h00 = 2 * u3 - 3 * u2 + 1, h10 = u3 - 2 * u2 + u;
+                double h01 = -2 * u3 + 3 * u2, h11 = u3 - u2;
+                double ta = d / (p2.timestamp_ns - p0.timestamp_ns);   // Tangent scale at p1
+                double tb = d / (p3.timestamp_ns - p1.timestamp_ns);   // Tangent scale at p2
+                query.values[0][a] = p0.position;
+                query.values[1][a] = p1.position;
+                query.values[2][a] = p2.position;
+                query.values[3][a] = p3.position;
+                query.weights[0][a] = -h10 * ta;
+                query.weights[1][a] = h00 - h11 * tb;
+                query.weights[2][a] = h01 + h10 * ta;
+                query.weights[3][a] = h11 * tb;
+            }
+        }
+        if (!cubic) {
+            query.values[1][a] = p1.position;
+            query.values[2][a] = p2.position;
+            query.weights[1][a] = 1.0 - u;
+            query.weights[2][a] = u;
+        }
+        return AXIS_PLACED;
+    }
+
+    AlignMethod method_ = ALIGN_LINEAR;
+    uint64_t latency_budget_ns_ = 3000000000ull;
+    uint64_t max_gap_ns_ = 50000000;
+    std::deque<AlignPoint> axes_[4];               // Valid readings per axis, oldest first
+    uint64_t last_tick_ns_ = 0;
+    uint64_t stalls_ = 0;
+    std::deque<CurrentReading> pending_;
+    std::vector<AlignQuery> queries_;
+    std::vector<FusedRecord> records_;
+    std::vector<double> interpolated_;
+    uint64_t fused_ = 0, late_ = 0, expired_ = 0, gaps_ = 0;
+};
+
+// --- Fused recordings ---------------------------------------------------------------------
+
+const char FUSED_MAGIC[8] = {'E', 'C', 'C', 'F', 'U', 'S', '0', '1'};
+const uint32_t FUSED_VERSION = 1;
+
+struct __attribute__((packed)) FusedFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;          // sizeof(FusedRecord)
+    uint32_t method;               // AlignMethod
+    uint32_t latency_budget_ms;
+    uint64_t start_time_ns;        // Epoch time the file was opened
+};
+
+// Appends fused records to "<directory>/ecc_<start_ns>.fus", flushed after every batch
+class FusedFileWriter {
+public:
+    ~FusedFileWriter() { close(); }
+
+    bool open(const std::string& directory, uint64_t start_time_ns, AlignMethod method, uint32_t latency_budget_ms) {
+        close();
+        char name[64];
+        std::snprintf(name, sizeof(name), "/ecc_%020llu.fus", static_cast<unsigned long long>(start_time_ns));
+        path_ = directory + name;
+        file_ = std::fopen(path_.c_str(), "wb");
+        if (!file_) {
+            error_ = "Cannot create " + path_;
+            return false;
+        }
+        FusedFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, FUSED_MAGIC, sizeof(FUSED_MAGIC));
+        header.version = FUSED_VERSION;
+        header.record_size = sizeof(FusedRecord);
+        header.method = method;
+        header.latency_budget_ms = latency_budget_ms;
+        header.start_time_ns = start_time_ns;
+        records_ = 0;
+        return write(&header, sizeof(header));
+    }
+
+    bool append(const FusedRecord* records, size_t count) {
+        if (!file_ || count == 0) return file_ != nullptr;
+        if (!write(records, count * sizeof(FusedRecord))) return false;
+        records_ += count;
+        return true;
+    }
+
+    void close() {
+        if (file_) std::fclose(file_);
+        file_ = nullptr;
+    }
+
+    bool is_open() const { return file_ != nullptr; }
+    uint64_t records() const { return records_; }
+    const std::string& path() const { return path_; }
+    const std::string& error() const { return error_; }
+
+private:
+    bool write(const void* data, size_t bytes) {
+        if (std::fwrite(data, 1, bytes, file_) != bytes || std::fflush(file_) != 0) {
+            error_ = "Write failed for " + path_;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    FILE* file_ = nullptr;
+    uint64_t records_ = 0;
+    std::string path_;
+    std::string error_;
+};
+
+// Reads a whole fused recording; a truncated last record is ignored
+inline bool read_fused_file(const std::string& path, FusedFileHeader& header, std::vector<FusedRecord>& out) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+              std::memcmp(header.magic, FUSED_MAGIC, sizeof(FUSED_MAGIC)) == 0 && header.record_size == sizeof(FusedRecord);
+    FusedRecord record;
+    while (ok && std::fread(&record, sizeof(record), 1, file) == 1) out.push_back(record);
+    std::fclose(file);
+    return ok;
+}
+
+#endif // ECC_ALIGN_H
@@ -0,0 +1,309 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <dirent.h>
+#include "ecc_recorder.h"
+#include "ecc_archive.h"
+
+int build_archive(const std::string& recording_dir, const std::string& archive_path);
+int show_info(const std::string& archive_path);
+int query_range(const std::string& archive_path, const std::string& axis, const std::string& t0, const std::string& t1);
+int query_threshold(const std::string& archive_path, const std::string& axis, int32_t threshold, bool above,
+                    const std::string& t0, const std::string& t1);
+int benchmark_archive(double hours, int rate_hz, const std::string& archive_path);
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "ECC100 Position Archive Tool\n"
+                  << "Usage:\n"
+                  << "  " << argv[0] << " build <recording_dir> <archive_file>\n"
+                  << "  " << argv[0] << " info <archive_file>\n"
+                  << "  " << argv[0] << " range <archive_file> <axis> <t0_ns|-> <t1_ns|->\n"
+                  << "  " << argv[0] << " above <archive_file> <axis> <threshold> [t0_ns|- t1_ns|-]\n"
+                  << "  " << argv[0] << " below <archive_file> <axis> <threshold> [t0_ns|- t1_ns|-]\n"
+                  << "  " << argv[0] << " bench [hours] [rate_hz] [archive_file]\n";
+        return 1;
+    }
+
+    std::string command = argv[1];
+
+    if (command == "build" && argc >= 4) {
+        return build_archive(argv[2], argv[3]);
+    } else if (command == "info" && argc >= 3) {
+        return show_info(argv[2]);
+    } else if (command == "range" && argc >= 6) {
+        return query_range(argv[2], argv[3], argv[4], argv[5]);
+    } else if ((command == "above" || command == "below") && argc >= 5) {
+        std::string t0 = (argc >= 6) ? argv[5] : "-";
+        std::string t1 = (argc >= 7) ? argv[6] : "-";
+        return query_threshold(argv[2], argv[3], std::atoi(argv[4]), command == "above", t0, t1);
+    } else if (command == "bench") {
+        double hours = (argc >= 3) ? std::atof(argv[2]) : 24.0;
+        int rate_hz = (argc >= 4) ? std::atoi(argv[3]) : 10000;
+        std::string path = (argc >= 5) ? argv[4] : "ecc_bench_archive.eca";
+        return benchmark_archive(hours, rate_hz, path);
+    }
+
+    std::cerr << "Invalid command or insufficient arguments\n";
+    return 1;
+}
+
+// "-" selects the start or end of the archive
+uint64_t parse_time(const std::string& text, uint64_t open_value) {
+    return text == "-" ? open_value : std::strtoull(text.c_str(), nullptr, 10);
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool open_archive(ArchiveReader& reader, const std::string& path) {
+    if (!reader.open(path)) {
+        std::cerr << "Cannot open archive " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+int build_archive(const std::string& recording_dir, const std::string& archive_path) {
+    // Segment names sort by start time
+    std::vector<std::string> segments;
+    DIR* dir = opendir(recording_dir.c_str());
+    if (!dir) {
+        std::cerr << "Cannot open directory " << recording_dir << "\n";
+        return 1;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".rec") == 0) {
+            segments.push_back(recording_dir + "/" + name);
+        }
+    }
+    closedir(dir);
+    std::sort(segments.begin(), segments.end());
+    if (segments.empty()) {
+        std::cerr << "No .rec segments in " << recording_dir << "\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ArchiveWriter writer;
+    uint64_t samples = 0, dropped = 0, raw_bytes = 0;
+
+    for (const std::string& path : segments) {
+        RecordingSegment segment;
+        if (!segment.open(path)) {
+            std::cerr << "Skipping unreadable segment " << path << "\n";
+            continue;
+        }
+        const RecordHeader* h = segment.header();
+        if (samples == 0 && raw_bytes == 0) {
+            char names[ARCHIVE_AXES][4];
+            std::memset(names, 0, sizeof(names));
+            for (uint32_t a = 0; a < std::min(h->num_axes, ARCHIVE_AXES); ++a) {
+                std::memcpy(names[a], h->axes[a].name, sizeof(names[a]));
+            }
+            if (!writer.open(archive_path, names)) {
+                std::cerr << writer.error() << "\n";
+                return 1;
+            }
+        }
+        uint64_t count = segment.count();
+        const RecordSample* records = segment.records();
+        for (uint64_t i = 0; i < count; ++i) {
+            if (!writer.add(records[i])) {
+                std::cerr << writer.error() << "\n";
+                return 1;
+            }
+        }
+        samples += count;
+        dropped += h->dropped_in_segment;
+        raw_bytes += RECORD_HEADER_SIZE + count * sizeof(RecordSample);
+        std::cout << path << ": " << count << " samples at " << h->sample_rate_hz << " Hz"
+                  << (h->closed ? "" : " (not closed cleanly)") << "\n";
+    }
+
+    if (!writer.close()) {
+        std::cerr << writer.error() << "\n";
+        return 1;
+    }
+    std::cout << std::fixed << std::setprecision(1)
+              << "Archived " << samples << " samples (" << dropped << " dropped while recording) from "
+              << segments.size() << " segments in " << elapsed_ms(start) << " ms\n"
+              << "Size: " << writer.bytes_written() << " bytes (" << std::setprecision(2)
+              << (samples ? static_cast<double>(writer.bytes_written()) / samples : 0) << " bytes/sample, recording "
+              << raw_bytes << " bytes)\n";
+    return 0;
+}
+
+int show_info(const std::string& archive_path) {
+    ArchiveReader reader;
+    if (!open_archive(reader, archive_path)) return 1;
+    const ArchiveHeader& h = reader.header();
+    std::cout << "Samples: " << h.sample_count << " in " << h.block_count << " blocks of up to "
+              << h.block_samples << "\n"
+              << "Time span: " << h.first_timestamp_ns << " - " << h.last_timestamp_ns << " ("
+              << std::fixed << std::setprecision(3) << (h.last_timestamp_ns - h.first_timestamp_ns) / 1e9 << " s)\n"
+              << "Size: " << reader.file_size() << " bytes (" << std::setprecision(2)
+              << (h.sample_count ? static_cast<double>(reader.file_size()) / h.sample_count : 0) << " bytes/sample)\n";
+    for (uint32_t a = 0; a < ARCHIVE_AXES; ++a) {
+        int32_t lo = INT32_MAX, hi = INT32_MIN;
+        uint64_t valid = 0;
+        for (size_t i = 0; i < reader.block_count(); ++i) {
+            const ArchiveBlockIndex& b = reader.block(i);
+            if (b.valid_count[a] == 0) continue;
+            lo = std::min(lo, b.min[a]);
+            hi = std::max(hi, b.max[a]);
+            valid += b.valid_count[a];
+        }
+        std::cout << "Axis " << h.axis_names[a] << ": " << valid << " valid samples";
+        if (valid) std::cout << ", range " << lo << " .. " << hi;
+        std::cout << "\n";
+    }
+    return 0;
+}
+
+int query_range(const std::string& archive_path, const std::string& axis, const std::string& t0, const std::string& t1) {
+    ArchiveReader reader;
+    if (!open_archive(reader, archive_path)) return 1;
+    int a = reader.axis_index(axis);
+    if (a < 0) {
+        std::cerr << "Unknown axis " << axis << "\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t matches = 0;
+    size_t blocks = reader.for_each_in_range(a, parse_time(t0, 0), parse_time(t1, UINT64_MAX),
+        [&matches](uint64_t t, int32_t position) {
+            std::cout << t << "," << position << "\n";
+            matches++;
+        });
+    std::cerr << matches << " samples, " << blocks << " of " << reader.block_count() << " blocks decoded in "
+              << std::fixed << std::setprecision(3) << elapsed_ms(start) << " ms\n";
+    return 0;
+}
+
+int query_threshold(const std::string& archive_path, const std::string& axis, int32_t threshold, bool above,
+                    const std::string& t0, const std::string& t1) {
+    ArchiveReader reader;
+    if (!open_archive(reader, archive_path)) return 1;
+    int a = reader.axis_index(axis);
+    if (a < 0) {
+        std::cerr << "Unknown axis " << axis << "\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ArchiveInterval> intervals;
+    size_t decoded = reader.find_threshold(a, threshold, above, parse_time(t0, 0), parse_time(t1, UINT64_MAX), intervals);
+    for (const ArchiveInterval& iv : intervals) {
+        std::cout << iv.start_ns << "," << iv.end_ns << "\n";
+    }
+    std::cerr << intervals.size() << " intervals, " << decoded << " of " << reader.block_count()
+              << " blocks decoded in " << std::fixed << std::setprecision(3) << elapsed_ms(start) << " ms\n";
+    return 0;
+}
+
+// Synthetic stage data: X raster sweeps, Y line steps, Z focus with rare excursions,
+// R fixed; timestamps with scheduling jitter and a few invalid samples
+int benchmark_archive(double hours, int rate_hz, const std::string& archive_path) {
+    const uint64_t total = static_cast<uint64_t>(hours * 3600 * rate_hz);
+    const uint64_t interval_ns = 1000000000ull / rate_hz;
+    const uint64_t t_start = 1735689600000000000ull;  // 2025-01-01 00:00:00 UTC
+    const int32_t z_excursion = 50000;                // Focus excursions go above this
+
+    std::cout << "=== Archive Benchmark ===\n"
+              << "Synthetic data: " << hours << " h at " << rate_hz << " Hz = " << total << " samples\n";
+
+    std::mt19937_64 rng(42);
+    std::normal_distribution<double> noise(0.0, 3.0);
+    std::uniform_int_distribution<int> jitter(-2000, 2000);
+    char names[ARCHIVE_AXES][4] = {"X", "Y", "Z", "R"};
+
+    auto start = std::chrono::steady_clock::now();
+    ArchiveWriter writer;
+    if (!writer.open(archive_path, names)) {
+        std::cerr << writer.error() << "\n";
+        return 1;
+    }
+    for (uint64_t i = 0; i < total; ++i) {
+        double t = static_cast<double>(i) / rate_hz;
+        RecordSample s;
+        s.timestamp_ns = t_start + i * interval_ns + jitter(rng);
+        double phase = std::fmod(t, 2.0) / 2.0;                        // 2 s line period
+        s.position[0] = static_cast<int32_t>(100000 * (phase < 0.5 ? 2 * phase : 2 - 2 * phase) + noise(rng));
+        s.position[1] = static_cast<int32_t>(500 * static_cast<int64_t>(t / 2.0) % 200000 + noise(rng));
+        bool excursion = std::fmod(t, 3600.0) < 30.0;                  // 30 s per hour
+        s.position[2] = static_cast<int32_t>((excursion ? 60000 : 20000) + noise(rng));
+        s.position[3] = 90000;
+        s.valid_mask = (i % 100003 == 0) ? 0x0B : 0x0F;                // Occasional Z read failure
+        if (!writer.add(s)) {
+            std::cerr << writer.error() << "\n";
+            return 1;
+        }
+    }
+    if (!writer.close()) {
+        std::cerr << writer.error() << "\n";
+        return 1;
+    }
+    double build_ms = elapsed_ms(start);
+
+    ArchiveReader reader;
+    if (!open_archive(reader, archive_path)) return 1;
+    double raw_bytes = static_cast<double>(total) * sizeof(RecordSample);
+    std::cout << std::fixed << std::setprecision(1)
+              << "Build: " << build_ms << " ms (" << total / (build_ms / 1000) / 1e6 << " M samples/s)\n"
+              << "Size: " << reader.file_size() / 1048576.0 << " MiB, " << std::setprecision(2)
+              << reader.file_size() / static_cast<double>(total) << " bytes/sample (recording "
+              << raw_bytes / 1048576.0 << " MiB, " << raw_bytes / reader.file_size() << "x larger)\n"
+              << "Blocks: " << reader.block_count() << "\n\n";
+
+    // Random short range queries
+    const uint64_t span_ns = reader.header().last_timestamp_ns - reader.header().first_timestamp_ns;
+    struct RangeCase { const char* name; uint64_t width_ns; int queries; };
+    const RangeCase cases[] = {{"X, 1 s window", 1000000000ull, 1000}, {"X, 1 min window", 60000000000ull, 100}};
+    std::uniform_real_distribution<double> where(0.0, 1.0);
+    std::cout << "Query                          mean ms    p99 ms   blocks  samples\n";
+    for (const RangeCase& c : cases) {
+        if (c.width_ns > span_ns) continue;
+        std::vector<double> times;
+        uint64_t blocks = 0, samples = 0;
+        for (int q = 0; q < c.queries; ++q) {
+            uint64_t t0 = reader.header().first_timestamp_ns + static_cast<uint64_t>(where(rng) * (span_ns - c.width_ns));
+            auto qs = std::chrono::steady_clock::now();
+            blocks += reader.for_each_in_range(0, t0, t0 + c.width_ns, [&samples](uint64_t, int32_t) { samples++; });
+            times.push_back(elapsed_ms(qs));
+        }
+        std::sort(times.begin(), times.end());
+        double sum = 0;
+        for (double v : times) sum += v;
+        std::cout << "  " << std::left << std::setw(28) << c.name << std::right << std::setprecision(3)
+                  << std::setw(8) << sum / times.size() << std::setw(10) << times[times.size() * 99 / 100]
+                  << std::setw(9) << blocks / c.queries << std::setw(9) << samples / c.queries << "\n";
+    }
+
+    // Threshold query over the whole archive
+    std::vector<ArchiveInterval> intervals;
+    auto qs = std::chrono::steady_clock::now();
+    size_t decoded = reader.find_threshold(2, z_excursion, true, 0, UINT64_MAX, intervals);
+    double threshold_ms = elapsed_ms(qs);
+    std::cout << "  " << std::left << std::setw(28) << "Z above 50000, full span" << std::right
+              << std::setw(8) << threshold_ms << std::setw(10) << threshold_ms << std::setw(9) << decoded
+              << "        -  (" << intervals.size() << " intervals)\n";
+
+    // Baseline: decode every block of X
+    qs = std::chrono::steady_clock::now();
+    uint64_t scanned = 0;
+    reader.for_each_in_range(0, 0, UINT64_MAX, [&scanned](uint64_t, int32_t) { scanned++; });
+    double scan_ms = elapsed_ms(qs);
+    std::cout << "  " << std::left << std::setw(28) << "X full scan (baseline)" << std::right
+              << std::setw(8) << scan_ms << std::setw(10) << scan_ms << std::setw(9) << reader.block_count()
+              << std::setw(9) << scanned << "\n";
+    return 0;
+}
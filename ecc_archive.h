@@ -0,0 +1,417 @@
+// Time-indexed columnar archive of recorded position data
+//
+// File layout: ArchiveHeader | blocks | block index. A block holds up to
+// ARCHIVE_BLOCK_SAMPLES consecutive samples stored as separate columns:
+// timestamps (delta-of-delta, zigzag varint), valid masks (run-length) and one
+// column per axis (delta, zigzag varint; invalid samples repeat the previous
+// value). The index at the end has one entry per block with its time span,
+// column offsets and per-axis min/max over valid samples. Range and threshold
+// queries use it to decode only the blocks and columns they need.
+
+#ifndef ECC_ARCHIVE_H
+#define ECC_ARCHIVE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ecc_recorder.h"
+
+const char ARCHIVE_MAGIC[8] = {'E', 'C', 'C', 'A', 'R', 'C', '0', '1'};
+const uint32_t ARCHIVE_VERSION = 1;
+const uint32_t ARCHIVE_BLOCK_SAMPLES = 4096;
+const uint32_t ARCHIVE_AXES = RECORD_MAX_AXES;
+
+struct ArchiveHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_samples;
+    uint64_t sample_count;
+    uint64_t block_count;
+    uint64_t index_offset;         // Written on close; 0 means the archive is incomplete
+    uint64_t first_timestamp_ns;
+    uint64_t last_timestamp_ns;
+    char axis_names[ARCHIVE_AXES][4];
+};
+
+struct ArchiveColumn {
+    uint64_t offset;               // From the start of the file, or of the block for in-memory blocks
+    uint32_t bytes;
+    uint32_t reserved;
+};
+
+struct ArchiveBlockIndex {
+    uint64_t first_timestamp_ns;
+    uint64_t last_timestamp_ns;
+    uint32_t count;
+    uint32_t reserved;
+    ArchiveColumn timestamps;
+    ArchiveColumn valid;
+    ArchiveColumn axis[ARCHIVE_AXES];
+    int32_t min[ARCHIVE_AXES];     // Over valid samples only
+    int32_t max[ARCHIVE_AXES];
+    uint32_t valid_count[ARCHIVE_AXES];
+};
+
+// Time span where an axis satisfied a threshold query (first and last matching sample)
+struct ArchiveInterval {
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+inline void archive_put_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint64_t archive_get_varint(const uint8_t*& p) {
+    uint64_t value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= static_cast<uint64_t>(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= static_cast<uint64_t>(*p++) << shift;
+    return value;
+}
+
+inline uint64_t archive_zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+inline int64_t archive_unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+// Encodes count samples as one block appended to out. Column offsets are relative to
+// the start of out; callers that store the bytes elsewhere rebase them.
+inline void archive_encode_block(const RecordSample* samples, size_t count, ArchiveBlockIndex& block,
+                                 std::vector<uint8_t>& out) {
+    std::memset(&block, 0, sizeof(block));
+    block.count = static_cast<uint32_t>(count);
+    block.first_timestamp_ns = samples[0].timestamp_ns;
+    block.last_timestamp_ns = samples[count - 1].timestamp_ns;
+
+    // Timestamps: delta of deltas, nearly always small for a fixed-rate sampler
+    block.timestamps.offset = out.size();
+    int64_t prev_delta = 0;
+    for (size_t i = 1; i < count; ++i) {
+        int64_t delta = static_cast<int64_t>(samples[i].timestamp_ns - samples[i - 1].timestamp_ns);
+        archive_put_varint(out, archive_zigzag(delta - prev_delta));
+        prev_delta = delta;
+    }
+    block.timestamps.bytes = static_cast<uint32_t>(out.size() - block.timestamps.offset);
+
+    // Valid masks: (mask, run length) pairs
+    block.valid.offset = out.size();
+    for (size_t i = 0; i < count;) {
+        size_t run = 1;
+        while (i + run < count && samples[i + run].valid_mask == samples[i].valid_mask) run++;
+        out.push_back(samples[i].valid_mask);
+        archive_put_varint(out, run);
+        i += run;
+    }
+    block.valid.bytes = static_cast<uint32_t>(out.size() - block.valid.offset);
+
+    for (uint32_t a = 0; a < ARCHIVE_AXES; ++a) {
+        block.axis[a].offset = out.size();
+        int32_t prev = 0;
+        block.min[a] = INT32_MAX;
+        block.max[a] = INT32_MIN;
+        for (size_t i = 0; i < count; ++i) {
+            const RecordSample& s = samples[i];
+            int32_t value = prev;
+            if (s.valid_mask & (1 << a)) {
+                value = s.position[a];
+                block.min[a] = std::min(block.min[a], value);
+                block.max[a] = std::max(block.max[a], value);
+                block.valid_count[a]++;
+            }
+            archive_put_varint(out, archive_zigzag(static_cast<int64_t>(value) - prev));
+            prev = value;
+        }
+        block.axis[a].bytes = static_cast<uint32_t>(out.size() - block.axis[a].offset);
+    }
+}
+
+inline void archive_rebase_block(ArchiveBlockIndex& block, uint64_t base_offset) {
+    block.timestamps.offset += base_offset;
+    block.valid.offset += base_offset;
+    for (uint32_t a = 0; a < ARCHIVE_AXES; ++a) block.axis[a].offset += base_offset;
+}
+
+// Column decoders; base is what the block's column offsets are relative to
+inline void archive_decode_timestamps(const uint8_t* base, const ArchiveBlockIndex& b, std::vector<uint64_t>& out) {
+    out.resize(b.count);
+    const uint8_t* p = base + b.timestamps.offset;
+    uint64_t t = b.first_timestamp_ns;
+    int64_t delta = 0;
+    out[0] = t;
+    for (uint32_t i = 1; i < b.count; ++i) {
+        delta += archive_unzigzag(archive_get_varint(p));
+        t += delta;
+        out[i] = t;
+    }
+}
+
+inline void archive_decode_valid(const uint8_t* base, const ArchiveBlockIndex& b, std::vector<uint8_t>& out) {
+    out.resize(b.count);
+    const uint8_t* p = base + b.valid.offset;
+    for (uint32_t i = 0; i < b.count;) {
+        uint8_t mask = *p++;
+        uint64_t run = archive_get_varint(p);
+        std::fill(out.begin() + i, out.begin() + i + run, mask);
+        i += static_cast<uint32_t>(run);
+    }
+}
+
+inline void archive_decode_axis(const uint8_t* base, const ArchiveBlockIndex& b, int axis, std::vector<int32_t>& out) {
+    out.resize(b.count);
+    const uint8_t* p = base + b.axis[axis].offset;
+    int64_t value = 0;
+    for (uint32_t i = 0; i < b.count; ++i) {
+        value += archive_unzigzag(archive_get_varint(p));
+        out[i] = static_cast<int32_t>(value);
+    }
+}
+
+// Streams samples (in time order) into an archive file
+class ArchiveWriter {
+public:
+    ArchiveWriter() {}
+    ~ArchiveWriter() { close(); }
+
+    bool open(const std::string& path, const char axis_names[ARCHIVE_AXES][4]) {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+            error_ = "Cannot create " + path;
+            return false;
+        }
+        std::memset(&header_, 0, sizeof(header_));
+        std::memcpy(header_.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+        header_.version = ARCHIVE_VERSION;
+        header_.block_samples = ARCHIVE_BLOCK_SAMPLES;
+        std::memcpy(header_.axis_names, axis_names, sizeof(header_.axis_names));
+        offset_ = sizeof(header_);
+        pending_.reserve(ARCHIVE_BLOCK_SAMPLES);
+        return std::fwrite(&header_, sizeof(header_), 1, file_) == 1;
+    }
+
+    bool add(const RecordSample& sample) {
+        pending_.push_back(sample);
+        return pending_.size() < ARCHIVE_BLOCK_SAMPLES || flush_block();
+    }
+
+    bool close() {
+        if (!file_) return true;
+        bool ok = flush_block();
+        header_.block_count = index_.size();
+        header_.index_offset = offset_;
+        if (ok && !index_.empty()) {
+            ok = std::fwrite(index_.data(), sizeof(ArchiveBlockIndex), index_.size(), file_) == index_.size();
+        }
+        ok = ok && std::fseek(file_, 0, SEEK_SET) == 0 && std::fwrite(&header_, sizeof(header_), 1, file_) == 1;
+        ok = (std::fclose(file_) == 0) && ok;
+        file_ = nullptr;
+        if (!ok && error_.empty()) error_ = "Write failed";
+        return ok;
+    }
+
+    uint64_t bytes_written() const { return offset_ + index_.size() * sizeof(ArchiveBlockIndex); }
+    const std::string& error() const { return error_; }
+
+private:
+    bool flush_block() {
+        if (pending_.empty()) return true;
+
+        ArchiveBlockIndex block;
+        archive_encode_block(pending_.data(), pending_.size(), block, buffer_);
+        archive_rebase_block(block, offset_);
+        bool ok = std::fwrite(buffer_.data(), 1, buffer_.size(), file_) == buffer_.size();
+        offset_ += buffer_.size();
+        buffer_.clear();
+
+        if (header_.sample_count == 0) header_.first_timestamp_ns = block.first_timestamp_ns;
+        header_.last_timestamp_ns = block.last_timestamp_ns;
+        header_.sample_count += block.count;
+        index_.push_back(block);
+        pending_.clear();
+        if (!ok) error_ = "Write failed";
+        return ok;
+    }
+
+    FILE* file_ = nullptr;
+    ArchiveHeader header_;
+    uint64_t offset_ = 0;
+    std::vector<RecordSample> pending_;
+    std::vector<ArchiveBlockIndex> index_;
+    std::vector<uint8_t> buffer_;
+    std::string error_;
+};
+
+// Memory-mapped read access and queries
+class ArchiveReader {
+public:
+    ArchiveReader() {}
+    ~ArchiveReader() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ArchiveHeader)) {
+            close();
+            return false;
+        }
+        size_ = st.st_size;
+        void* map = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            close();
+            return false;
+        }
+        map_ = static_cast<const uint8_t*>(map);
+        const ArchiveHeader& h = header();
+        if (std::memcmp(h.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 || h.version != ARCHIVE_VERSION ||
+            h.index_offset == 0 || h.index_offset + h.block_count * sizeof(ArchiveBlockIndex) > size_) {
+            close();
+            return false;
+        }
+        index_ = reinterpret_cast<const ArchiveBlockIndex*>(map_ + h.index_offset);
+        return true;
+    }
+
+    void close() {
+        if (map_) munmap(const_cast<uint8_t*>(map_), size_);
+        if (fd_ >= 0) ::close(fd_);
+        map_ = nullptr;
+        index_ = nullptr;
+        fd_ = -1;
+        size_ = 0;
+    }
+
+    const ArchiveHeader& header() const { return *reinterpret_cast<const ArchiveHeader*>(map_); }
+    size_t block_count() const { return header().block_count; }
+    const ArchiveBlockIndex& block(size_t i) const { return index_[i]; }
+    uint64_t file_size() const { return size_; }
+
+    // Axis index by name ("X"), -1 if unknown
+    int axis_index(const std::string& name) const {
+        for (uint32_t a = 0; a < ARCHIVE_AXES; ++a) {
+            if (name == header().axis_names[a]) return a;
+        }
+        return -1;
+    }
+
+    // Half-open range [first, last) of blocks overlapping [t0, t1], by binary search on the index
+    void blocks_in_range(uint64_t t0, uint64_t t1, size_t& first, size_t& last) const {
+        const ArchiveBlockIndex* end = index_ + block_count();
+        first = std::lower_bound(index_, end, t0, [](const ArchiveBlockIndex& b, uint64_t t) {
+            return b.last_timestamp_ns < t;
+        }) - index_;
+        last = std::upper_bound(index_ + first, end, t1, [](uint64_t t, const ArchiveBlockIndex& b) {
+            return t < b.first_timestamp_ns;
+        }) - index_;
+    }
+
+    void decode_timestamps(const ArchiveBlockIndex& b, std::vector<uint64_t>& out) const {
+        archive_decode_timestamps(map_, b, out);
+    }
+
+    void decode_valid(const ArchiveBlockIndex& b, std::vector<uint8_t>& out) const {
+        archive_decode_valid(map_, b, out);
+    }
+
+    void decode_axis(const ArchiveBlockIndex& b, int axis, std::vector<int32_t>& out) const {
+        archive_decode_axis(map_, b, axis, out);
+    }
+
+    // Calls fn(timestamp_ns, position) for valid samples of one axis in [t0, t1].
+    // Returns the number of blocks decoded.
+    template <typename Fn>
+    size_t for_each_in_range(int axis, uint64_t t0, uint64_t t1, Fn fn) const {
+        size_t first, last;
+        blocks_in_range(t0, t1, first, last);
+        std::vector<uint64_t> timestamps;
+        std::vector<uint8_t> valid;
+        std::vector<int32_t> values;
+        for (size_t i = first; i < last; ++i) {
+            const ArchiveBlockIndex& b = index_[i];
+            if (b.valid_count[axis] == 0) continue;
+            decode_timestamps(b, timestamps);
+            decode_valid(b, valid);
+            decode_axis(b, axis, values);
+            for (uint32_t j = 0; j < b.count; ++j) {
+                if (timestamps[j] >= t0 && timestamps[j] <= t1 && (valid[j] & (1 << axis))) fn(timestamps[j], values[j]);
+            }
+        }
+        return last - first;
+    }
+
+    // Intervals in [t0, t1] where the axis was above (or below) the threshold. Blocks
+    // entirely on one side are decided from their min/max without decoding.
+    // Returns the number of blocks decoded.
+    size_t find_threshold(int axis, int32_t threshold, bool above, uint64_t t0, uint64_t t1,
+                          std::vector<ArchiveInterval>& out) const {
+        size_t first, last, decoded = 0;
+        blocks_in_range(t0, t1, first, last);
+        std::vector<uint64_t> timestamps;
+        std::vector<uint8_t> valid;
+        std::vector<int32_t> values;
+        bool open = false;
+        ArchiveInterval current = {0, 0};
+
+        for (size_t i = first; i < last; ++i) {
+            const ArchiveBlockIndex& b = index_[i];
+            if (b.valid_count[axis] == 0) continue;
+            bool none = above ? b.max[axis] <= threshold : b.min[axis] >= threshold;
+            bool all = above ? b.min[axis] > threshold : b.max[axis] < threshold;
+            bool inside = b.first_timestamp_ns >= t0 && b.last_timestamp_ns <= t1;
+
+            if (inside && none) {
+                if (open) out.push_back(current);
+                open = false;
+                continue;
+            }
+            if (inside && all) {
+                if (!open) current.start_ns = b.first_timestamp_ns;
+                current.end_ns = b.last_timestamp_ns;
+                open = true;
+                continue;
+            }
+
+            decoded++;
+            decode_timestamps(b, timestamps);
+            decode_valid(b, valid);
+            decode_axis(b, axis, values);
+            for (uint32_t j = 0; j < b.count; ++j) {
+                if (timestamps[j] < t0 || timestamps[j] > t1 || !(valid[j] & (1 << axis))) continue;
+                bool match = above ? values[j] > threshold : values[j] < threshold;
+                if (match) {
+                    if (!open) current.start_ns = timestamps[j];
+                    current.end_ns = timestamps[j];
+                    open = true;
+                } else if (open) {
+                    out.push_back(current);
+                    open = false;
+                }
+            }
+        }
+        if (open) out.push_back(current);
+        return decoded;
+    }
+
+private:
+    int fd_ = -1;
+    const uint8_t* map_ = nullptr;
+    const ArchiveBlockIndex* index_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif // ECC_ARCHIVE_H
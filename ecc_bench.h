@@ -0,0 +1,198 @@
+// ECC100 throughput benchmark shared by ecc_tool and ecc_mqtt_streaming
+//
+// Measures on live hardware how fast ECC_getPosition can be called for one
+// axis, for all axes serially (what the sampler does every tick), and with one
+// thread per controller in parallel, plus the latency of the status getters.
+// From the serial sweep rate it recommends a sustainable sampling rate.
+// An optional cancel check is polled between calls, so the owner can abort a run.
+
+#ifndef ECC_BENCH_H
+#define ECC_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ecc.h"
+
+struct BenchAxis {
+    Int32 handle;
+    int axis;
+    std::string name;
+};
+
+struct BenchLatency {
+    std::string name;
+    int calls = 0;
+    int errors = 0;
+    double mean_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+};
+
+struct BenchReport {
+    double single_axis_calls_per_sec = 0;   // ECC_getPosition on the first axis only
+    double serial_sweeps_per_sec = 0;       // All axes read back to back (sampler behaviour)
+    double parallel_sweeps_per_sec = 0;     // One thread per controller, limited by the slowest
+    int controllers = 0;
+    std::vector<BenchLatency> latencies;    // Per-axis getPosition and status getters
+    int recommended_rate_hz = 0;
+    bool cancelled = false;                 // Aborted by the cancel check; figures are incomplete
+};
+
+const double BENCH_HEADROOM = 0.7;          // Leave 30% of bus time for commands and jitter
+const int BENCH_MIN_RATE_HZ = 100;
+const int BENCH_MAX_RATE_HZ = 15000;
+
+inline double bench_elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline BenchLatency bench_summarize(const std::string& name, std::vector<double>& samples_us, int errors) {
+    BenchLatency lat;
+    lat.name = name;
+    lat.calls = static_cast<int>(samples_us.size());
+    lat.errors = errors;
+    if (samples_us.empty()) return lat;
+
+    std::sort(samples_us.begin(), samples_us.end());
+    double sum = 0;
+    for (double v : samples_us) sum += v;
+    lat.mean_us = sum / samples_us.size();
+    lat.p99_us = samples_us[std::min(samples_us.size() - 1, samples_us.size() * 99 / 100)];
+    lat.max_us = samples_us.back();
+    return lat;
+}
+
+// Read every axis in the list once per sweep for duration_ms, return sweeps per second
+inline double bench_sweep_rate(const std::vector<BenchAxis>& axes, int duration_ms, bool (*cancelled)() = nullptr) {
+    if (axes.empty()) return 0;
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::milliseconds(duration_ms);
+    uint64_t sweeps = 0;
+    Int32 pos;
+
+    while (std::chrono::steady_clock::now() < end && !(cancelled && cancelled())) {
+        for (const BenchAxis& a : axes) {
+            ECC_getPosition(a.handle, a.axis, &pos);
+        }
+        sweeps++;
+    }
+    return sweeps / (bench_elapsed_us(start) / 1e6);
+}
+
+// Time individual calls of a getter; fn(handle, axis) returns the ECC result code
+template <typename Fn>
+BenchLatency bench_getter(const std::string& name, const BenchAxis& a, int calls, Fn fn, bool (*cancelled)() = nullptr) {
+    std::vector<double> samples;
+    samples.reserve(calls);
+    int errors = 0;
+
+    for (int i = 0; i < calls && !(cancelled && cancelled()); ++i) {
+        auto start = std::chrono::steady_clock::now();
+        int rc = fn(a.handle, a.axis);
+        samples.push_back(bench_elapsed_us(start));
+        if (rc != NCB_Ok) errors++;
+    }
+    return bench_summarize(name, samples, errors);
+}
+
+inline BenchReport run_ecc_benchmark(const std::vector<BenchAxis>& axes, int duration_ms, 
+                                     bool (*cancelled)() = nullptr) {
+    BenchReport report;
+    if (axes.empty()) return report;
+
+    // Single axis and serial sweep over all axes
+    std::vector<BenchAxis> first_axis(1, axes[0]);
+    report.single_axis_calls_per_sec = bench_sweep_rate(first_axis, duration_ms, cancelled);
+    report.serial_sweeps_per_sec = bench_sweep_rate(axes, duration_ms, cancelled);
+
+    // Parallel: group axes by controller handle, one thread each
+    std::vector<std::vector<BenchAxis>> groups;
+    for (const BenchAxis& a : axes) {
+        bool placed = false;
+        for (auto& g : groups) {
+            if (g[0].handle == a.handle) {
+                g.push_back(a);
+                placed = true;
+                break;
+            }
+        }
+        if (!placed) groups.push_back(std::vector<BenchAxis>(1, a));
+    }
+    report.controllers = static_cast<int>(groups.size());
+
+    std::vector<double> group_rates(groups.size(), 0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        workers.emplace_back([&groups, &group_rates, i, duration_ms, cancelled]() {
+            group_rates[i] = bench_sweep_rate(groups[i], duration_ms, cancelled);
+        });
+    }
+    for (auto& w : workers) w.join();
+    report.parallel_sweeps_per_sec = *std::min_element(group_rates.begin(), group_rates.end());
+
+    // Per-call latencies
+    const int calls = 500;
+    for (const BenchAxis& a : axes) {
+        report.latencies.push_back(bench_getter("ECC_getPosition " + a.name, a, calls,
+            [](Int32 h, int ax) { Int32 v; return ECC_getPosition(h, ax, &v); }, cancelled));
+    }
+    const BenchAxis& a = axes[0];
+    report.latencies.push_back(bench_getter("ECC_getStatusMoving " + a.name, a, calls,
+        [](Int32 h, int ax) { Int32 v; return ECC_getStatusMoving(h, ax, &v); }, cancelled));
+    report.latencies.push_back(bench_getter("ECC_getStatusTargetRange " + a.name, a, calls,
+        [](Int32 h, int ax) { Bln32 v; return ECC_getStatusTargetRange(h, ax, &v); }, cancelled));
+    report.latencies.push_back(bench_getter("ECC_getStatusEotFwd " + a.name, a, calls,
+        [](Int32 h, int ax) { Bln32 v; return ECC_getStatusEotFwd(h, ax, &v); }, cancelled));
+    report.latencies.push_back(bench_getter("ECC_getStatusError " + a.name, a, calls,
+        [](Int32 h, int ax) { Bln32 v; return ECC_getStatusError(h, ax, &v); }, cancelled));
+    report.latencies.push_back(bench_getter("ECC_getStatusReference " + a.name, a, calls,
+        [](Int32 h, int ax) { Bln32 v; return ECC_getStatusReference(h, ax, &v); }, cancelled));
+    report.latencies.push_back(bench_getter("ECC_controlAmplitude(get) " + a.name, a, calls,
+        [](Int32 h, int ax) { Int32 v; return ECC_controlAmplitude(h, ax, &v, 0); }, cancelled));
+
+    if (cancelled && cancelled()) {
+        report.cancelled = true;
+        return report;
+    }
+
+    // The sampler reads all axes serially once per tick
+    int recommended = static_cast<int>(report.serial_sweeps_per_sec * BENCH_HEADROOM);
+    recommended = (recommended / 100) * 100;
+    report.recommended_rate_hz = std::max(BENCH_MIN_RATE_HZ, std::min(BENCH_MAX_RATE_HZ, recommended));
+
+    return report;
+}
+
+inline std::string format_bench_report(const BenchReport& report, size_t num_axes) {
+    std::ostringstream out;
+    out << std::fixed;
+    out << "=== ECC100 Throughput Benchmark ===\n";
+    out << "Axes: " << num_axes << ", Controllers: " << report.controllers << "\n";
+    out << std::setprecision(0);
+    out << "Single axis getPosition: " << report.single_axis_calls_per_sec << " calls/s\n";
+    out << "All axes serial: " << report.serial_sweeps_per_sec << " sweeps/s ("
+        << report.serial_sweeps_per_sec * num_axes << " calls/s)\n";
+    out << "Controllers in parallel: " << report.parallel_sweeps_per_sec << " sweeps/s\n\n";
+
+    out << "Call latency (us):          mean     p99     max  errors\n";
+    out << std::setprecision(1);
+    for (const BenchLatency& lat : report.latencies) {
+        out << "  " << std::left << std::setw(34) << lat.name << std::right
+            << std::setw(8) << lat.mean_us << std::setw(8) << lat.p99_us
+            << std::setw(8) << lat.max_us << std::setw(8) << lat.errors << "\n";
+    }
+
+    out << "\nRecommended maximum SET_RATE: " << report.recommended_rate_hz << " Hz"
+        << " (" << static_cast<int>(BENCH_HEADROOM * 100) << "% of serial sweep rate)\n";
+    return out.str();
+}
+
+#endif // ECC_BENCH_H
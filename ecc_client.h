@@ -0,0 +1,570 @@
+// Consumer library for the ECC100 position stream (header-only)
+//
+// Decodes every format ecc_mqtt_streaming produces into structure-of-arrays PositionBlocks:
+// - MQTT batches on microscope/stage/position: "ts/x/y/z/r" lines, NaN for invalid axes
+// - per-axis batches on microscope/stage/position/<X|Y|Z|R> (AXIS_TOPICS)
+// - GET_HISTORY chunks on microscope/stage/history, TEXT or BINARY
+// - the TCP stream (ecc_stream.h), TEXT lines with selected axes or BINARY frames
+// - UDP multicast packets (ecc_multicast.h)
+// StreamSubscriber connects to the TCP stream and does the framing. MQTT payloads come from
+// the application's own mosquitto callback and go straight into decode_mqtt_batch.
+//
+// Text is split with SSE2: 64 bytes at a time are compared against '/' and '\n' and the
+// separators are walked as a bitmask, so each field costs one bit scan instead of a
+// byte-by-byte search. Digits are converted eight at a time in a 64-bit register.
+// Without SSE2 (or with vectorized = false) the same parser runs on a scalar scan.
+//
+// GapDetector reports lost samples from stream indexes (TCP BINARY, multicast) or, for
+// formats without indexes, from timestamp steps longer than the sampling period.
+
+#ifndef ECC_CLIENT_H
+#define ECC_CLIENT_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ecc_stream.h"
+#include "ecc_multicast.h"
+
+const int CLIENT_AXES = 4;
+const char CLIENT_AXIS_NAMES[CLIENT_AXES] = {'X', 'Y', 'Z', 'R'};
+
+// Samples as columns, ready for vectorized analysis
+struct PositionBlock {
+    std::vector<uint64_t> timestamp_ns;
+    std::vector<int32_t> position[CLIENT_AXES];   // X, Y, Z, R; 0 where the axis is not valid
+    std::vector<uint8_t> valid_mask;              // Bit per axis, same as the MQTT stream
+    std::vector<uint64_t> index;                  // Stream index; empty for formats without one
+    uint8_t axis_mask = 0x0F;                     // Axes the source carried
+
+    size_t size() const { return timestamp_ns.size(); }
+    bool has_index() const { return !index.empty(); }
+
+    void clear() {
+        timestamp_ns.clear();
+        for (int a = 0; a < CLIENT_AXES; ++a) position[a].clear();
+        valid_mask.clear();
+        index.clear();
+    }
+
+    void reserve(size_t n) {
+        timestamp_ns.reserve(n);
+        for (int a = 0; a < CLIENT_AXES; ++a) position[a].reserve(n);
+        valid_mask.reserve(n);
+    }
+
+    void push(uint64_t timestamp, const int32_t values[CLIENT_AXES], uint8_t valid) {
+        timestamp_ns.push_back(timestamp);
+        for (int a = 0; a < CLIENT_AXES; ++a) position[a].push_back(values[a]);
+        valid_mask.push_back(valid);
+    }
+};
+
+// --- Text ---------------------------------------------------------------------------------
+
+// Walks the '/' and '\n' positions of a buffer in order
+class SeparatorScanner {
+public:
+    SeparatorScanner(const char* begin, const char* end, bool vectorized = true)
+        : end_(end), block_(begin), mask_(0), vectorized_(vectorized) {
+        load(block_);
+    }
+
+    // Next separator, or end when there is none
+    const char* next() {
+        while (mask_ == 0) {
+            block_ += 64;
+            if (block_ >= end_) return end_;
+            load(block_);
+        }
+        const char* p = block_ + __builtin_ctzll(mask_);
+        mask_ &= mask_ - 1;
+        return p;
+    }
+
+private:
+    void load(const char* p) {
+        mask_ = 0;
+        if (p >= end_) return;
+#ifdef __SSE2__
+        if (vectorized_ && end_ - p >= 64) {
+            const __m128i slash = _mm_set1_epi8('/');
+            const __m128i newline = _mm_set1_epi8('\n');
+            for (int i = 0; i < 4; ++i) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+                uint32_t m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(v, newline)));
+                mask_ |= static_cast<uint64_t>(m) << (16 * i);
+            }
+            return;
+        }
+#endif
+        size_t n = std::min<size_t>(64, end_ - p);
+        for (size_t i = 0; i < n; ++i) {
+            if (p[i] == '/' || p[i] == '\n') mask_ |= 1ull << i;
+        }
+    }
+
+    const char* end_;
+    const char* block_;
+    uint64_t mask_;
+    bool vectorized_;
+};
+
+// Eight ASCII digits to their value (little-endian load), false if any byte is not a digit
+inline bool client_parse_8_digits(const char* p, uint32_t& value) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    // Every byte 0x30-0x39: high nibble 3, and still 3 after adding 6
+    if ((v & 0xF0F0F0F0F0F0F0F0ull) != 0x3030303030303030ull ||
+        ((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) != 0x3030303030303030ull) {
+        return false;
+    }
+    v -= 0x3030303030303030ull;
+    v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FFull;
+    v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFFull;
+    v = (v * 10000 + (v >> 32)) & 0xFFFFFFFFull;
+    value = static_cast<uint32_t>(v);
+    return true;
+}
+
+// Up to 19 digits
+inline bool client_parse_uint(const char* p, const char* end, uint64_t& value) {
+    size_t n = end - p;
+    if (n == 0 || n > 19) return false;
+    uint64_t result = 0;
+    while (n >= 8) {
+        uint32_t chunk;
+        if (!client_parse_8_digits(p, chunk)) return false;
+        result = result * 100000000ull + chunk;
+        p += 8;
+        n -= 8;
+    }
+    for (; n > 0; --n, ++p) {
+        unsigned digit = static_cast<unsigned char>(*p) - '0';
+        if (digit > 9) return false;
+        result = result * 10 + digit;
+    }
+    value = result;
+    return true;
+}
+
+// Signed 32-bit value, or NaN which clears valid
+inline bool client_parse_axis(const char* p, const char* end, int32_t& value, bool& valid) {
+    if (end - p == 3 && p[0] == 'N' && p[1] == 'a' && p[2] == 'N') {
+        value = 0;
+        valid = false;
+        return true;
+    }
+    bool negative = p < end && *p == '-';
+    uint64_t magnitude;
+    if (!client_parse_uint(p + negative, end, magnitude) || magnitude > (negative ? 2147483648ull : 2147483647ull)) {
+        return false;
+    }
+    value = static_cast<int32_t>(negative ? -static_cast<int64_t>(magnitude) : static_cast<int64_t>(magnitude));
+    valid = true;
+    return true;
+}
+
+// Decodes "ts/a1/a2..." lines carrying the axes in axis_mask (X, Y, Z, R order). With
+// complete = false a trailing line without '\n' is left for the next call. Returns the bytes
+// consumed; lines that do not parse are skipped and counted in malformed.
+inline size_t decode_text(const char* data, size_t length, uint8_t axis_mask, PositionBlock& out, bool complete,
+                          size_t* malformed = nullptr, bool vectorized = true) {
+    int axes[CLIENT_AXES];
+    int num_axes = 0;
+    for (int a = 0; a < CLIENT_AXES; ++a) {
+        if (axis_mask & (1 << a)) axes[num_axes++] = a;
+    }
+    out.axis_mask = axis_mask;
+
+    const char* end = data + length;
+    const char* line = data;
+    SeparatorScanner scanner(data, end, vectorized);
+    while (line < end) {
+        uint64_t timestamp = 0;
+        int32_t values[CLIENT_AXES] = {0, 0, 0, 0};
+        uint8_t valid = 0;
+        bool ok = true;
+        int field = 0;
+        const char* start = line;
+        const char* sep;
+        while (true) {
+            sep = scanner.next();
+            if (sep == end && !complete) return line - data;   // Rest of the line has not arrived
+            bool eol = sep == end || *sep == '\n';
+            const char* field_end = sep;
+            if (eol && field_end > start && field_end[-1] == '\r') field_end--;
+            if (field == 0) {
+                if (eol && field_end == start) break;              // Empty line
+                ok = ok && client_parse_uint(start, field_end, timestamp);
+            } else if (field <= num_axes) {
+                bool axis_valid = false;
+                int axis = axes[field - 1];
+                ok = ok && client_parse_axis(start, field_end, values[axis], axis_valid);
+                if (axis_valid) valid |= 1 << axis;
+            } else {
+                ok = false;
+            }
+            field++;
+            if (eol) break;
+            start = sep + 1;
+        }
+        if (field > 0) {
+            if (ok && field == num_axes + 1) {
+                out.push(timestamp, values, valid);
+            } else if (malformed) {
+                (*malformed)++;
+            }
+        }
+        line = sep == end ? end : sep + 1;
+    }
+    return length;
+}
+
+// One MQTT position batch (all four axes, newline separated)
+inline size_t decode_mqtt_batch(const void* payload, size_t length, PositionBlock& out, size_t* malformed = nullptr) {
+    size_t before = out.size();
+    decode_text(static_cast<const char*>(payload), length, 0x0F, out, true, malformed);
+    return out.size() - before;
+}
+
+struct AxisBatchInfo {
+    uint64_t sequence = 0;         // Publisher batch number, the same on all four axis topics
+    uint64_t base_ns = 0;          // Timestamp of the batch's first sample
+    uint32_t decimation = 1;
+};
+
+// One per-axis topic message: "<sequence>/<base_ns>/<decimation>" then "<offset_ns>/<position>"
+// lines. Samples land in position[axis]; the other axes stay invalid.
+inline bool decode_axis_batch(const void* payload, size_t length, int axis, PositionBlock& out, AxisBatchInfo& info,
+                              size_t* malformed = nullptr) {
+    const char* data = static_cast<const char*>(payload);
+    if (axis < 0 || axis >= CLIENT_AXES) return false;
+    const char* newline = static_cast<const char*>(std::memchr(data, '\n', length));
+    std::string line(data, newline ? newline : data + length);
+    unsigned long long sequence = 0, base = 0;
+    unsigned decimation = 0;
+    if (std::sscanf(line.c_str(), "%llu/%llu/%u", &sequence, &base, &decimation) != 3) return false;
+    info.sequence = sequence;
+    info.base_ns = base;
+    info.decimation = decimation;
+    if (!newline) return true;
+
+    size_t first = out.size();
+    const char* body = newline + 1;
+    decode_text(body, data + length - body, static_cast<uint8_t>(1 << axis), out, true, malformed);
+    for (size_t i = first; i < out.size(); ++i) out.timestamp_ns[i] += base;
+    return true;
+}
+
+// --- Binary -------------------------------------------------------------------------------
+
+// Decodes whole TCP stream BINARY frames; returns the bytes consumed (a partial frame is left
+// for the next call) or sets error on a corrupt header
+inline size_t decode_stream_frames(const char* data, size_t length, PositionBlock& out, bool& error) {
+    error = false;
+    size_t offset = 0;
+    while (length - offset >= sizeof(StreamFrameHeader)) {
+        StreamFrameHeader header;
+        std::memcpy(&header, data + offset, sizeof(header));
+        if (header.magic != STREAM_FRAME_MAGIC || header.version != STREAM_FRAME_VERSION || header.decimation == 0) {
+            error = true;
+            break;
+        }
+        size_t record_size = stream_record_size(header.axis_mask);
+        size_t frame_size = sizeof(header) + header.count * record_size;
+        if (length - offset < frame_size) break;
+
+        out.axis_mask = header.axis_mask;
+        const char* record = data + offset + sizeof(header);
+        for (uint32_t i = 0; i < header.count; ++i, record += record_size) {
+            uint64_t timestamp;
+            std::memcpy(&timestamp, record, sizeof(timestamp));
+            uint8_t valid = static_cast<uint8_t>(record[sizeof(timestamp)]);
+            int32_t values[CLIENT_AXES] = {0, 0, 0, 0};
+            const char* p = record + sizeof(timestamp) + 1;
+            for (int a = 0; a < CLIENT_AXES; ++a) {
+                if (!(header.axis_mask & (1 << a))) continue;
+                std::memcpy(&values[a], p, sizeof(int32_t));
+                if (!(valid & (1 << a))) values[a] = 0;
+                p += sizeof(int32_t);
+            }
+            out.push(timestamp, values, valid & header.axis_mask);
+            out.index.push_back(header.first_index + static_cast<uint64_t>(i) * header.decimation);
+        }
+        offset += frame_size;
+    }
+    return offset;
+}
+
+// Records laid out as MulticastSample (also the GET_HISTORY BINARY and recording layout)
+inline void decode_packed_samples(const char* data, size_t count, PositionBlock& out, uint64_t first_index, bool indexed) {
+    for (size_t i = 0; i < count; ++i) {
+        MulticastSample sample;
+        std::memcpy(&sample, data + i * sizeof(sample), sizeof(sample));
+        int32_t values[CLIENT_AXES];
+        for (int a = 0; a < CLIENT_AXES; ++a) values[a] = (sample.valid_mask & (1 << a)) ? sample.position[a] : 0;
+        out.push(sample.timestamp_ns, values, sample.valid_mask & 0x0F);
+        if (indexed) out.index.push_back(first_index + i);
+    }
+}
+
+// One multicast datagram; header receives the packet header for MulticastGapTracker
+inline bool decode_multicast_packet(const void* data, size_t length, PositionBlock& out, MulticastPacketHeader& header) {
+    if (length < sizeof(header)) return false;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != MULTICAST_MAGIC || header.version != MULTICAST_VERSION ||
+        header.count > header.samples_per_packet || length < multicast_packet_size(header.samples_per_packet)) {
+        return false;
+    }
+    out.axis_mask = 0x0F;
+    decode_packed_samples(static_cast<const char*>(data) + sizeof(header), header.count, out, header.first_index, true);
+    return true;
+}
+
+// --- GET_HISTORY --------------------------------------------------------------------------
+
+struct HistoryChunkInfo {
+    uint64_t request_id = 0;       // Command id of the GET_HISTORY request
+    uint32_t chunk = 0;
+    uint32_t chunks = 0;
+    uint32_t samples = 0;
+    bool binary = false;
+};
+
+// "HISTORY/<request>/<chunk>/<chunks>/<samples>/<TEXT|BINARY>\n" followed by the samples
+inline bool decode_history_chunk(const void* payload, size_t length, PositionBlock& out, HistoryChunkInfo& info) {
+    const char* data = static_cast<const char*>(payload);
+    const char* newline = static_cast<const char*>(std::memchr(data, '\n', length));
+    if (!newline || length < 8 || std::memcmp(data, "HISTORY/", 8) != 0) return false;
+    std::string line(data + 8, newline);
+    char format[8] = {0};
+    unsigned long long request = 0;
+    if (std::sscanf(line.c_str(), "%llu/%u/%u/%u/%7s", &request, &info.chunk, &info.chunks, &info.samples, format) != 5) {
+        return false;
+    }
+    info.request_id = request;
+    info.binary = std::strcmp(format, "BINARY") == 0;
+    const char* body = newline + 1;
+    size_t body_length = data + length - body;
+    if (info.binary) {
+        if (body_length < static_cast<size_t>(info.samples) * sizeof(MulticastSample)) return false;
+        out.axis_mask = 0x0F;
+        decode_packed_samples(body, info.samples, out, 0, false);
+        return true;
+    }
+    decode_text(body, body_length, 0x0F, out, true);
+    return true;
+}
+
+// --- Gaps ---------------------------------------------------------------------------------
+
+// Counts lost samples across blocks. Uses the index column when the block has one, else
+// timestamp steps longer than 1.5 sampling periods.
+class GapDetector {
+public:
+    // step: expected index step (the TCP decimation); sample_rate_hz 0 learns the period
+    // from the median step of the first block
+    explicit GapDetector(uint64_t step = 1, double sample_rate_hz = 0)
+        : step_(step ? step : 1), period_ns_(sample_rate_hz > 0 ? 1e9 / sample_rate_hz : 0) {}
+
+    // Returns the samples missing before and within this block
+    uint64_t check(const PositionBlock& block) {
+        uint64_t missing = 0;
+        if (block.has_index()) {
+            for (size_t i = 0; i < block.size(); ++i) {
+                uint64_t index = block.index[i];
+                if (started_ && index > next_index_) {
+                    missing += (index - next_index_) / step_;
+                    gaps_++;
+                }
+                if (!started_ || index >= next_index_) next_index_ = index + step_;
+                started_ = true;
+            }
+        } else {
+            if (period_ns_ <= 0) learn_period(block);
+            if (period_ns_ <= 0) return 0;
+            for (size_t i = 0; i < block.size(); ++i) {
+                uint64_t t = block.timestamp_ns[i];
+                if (started_ && t > last_timestamp_ && t - last_timestamp_ > 1.5 * period_ns_) {
+                    missing += static_cast<uint64_t>((t - last_timestamp_) / period_ns_ + 0.5) - 1;
+                    gaps_++;
+                }
+                last_timestamp_ = t;
+                started_ = true;
+            }
+        }
+        missing_ += missing;
+        return missing;
+    }
+
+    void reset() { started_ = false; }
+    uint64_t missing() const { return missing_; }
+    uint64_t gaps() const { return gaps_; }
+    double period_ns() const { return period_ns_; }
+
+private:
+    void learn_period(const PositionBlock& block) {
+        std::vector<uint64_t> steps;
+        for (size_t i = 1; i < block.size() && steps.size() < 256; ++i) {
+            if (block.timestamp_ns[i] > block.timestamp_ns[i - 1]) {
+                steps.push_back(block.timestamp_ns[i] - block.timestamp_ns[i - 1]);
+            }
+        }
+        if (steps.size() < 8) return;
+        std::nth_element(steps.begin(), steps.begin() + steps.size() / 2, steps.end());
+        period_ns_ = static_cast<double>(steps[steps.size() / 2]);
+    }
+
+    uint64_t step_;
+    double period_ns_;
+    bool started_ = false;
+    uint64_t next_index_ = 0;
+    uint64_t last_timestamp_ = 0;
+    uint64_t missing_ = 0;
+    uint64_t gaps_ = 0;
+};
+
+// --- TCP subscription ---------------------------------------------------------------------
+
+// Connects to the daemon's TCP stream and hands out decoded blocks
+class StreamSubscriber {
+public:
+    StreamSubscriber() {}
+    ~StreamSubscriber() { close(); }
+
+    // axes: any of "XYZR"; binary selects frames with stream indexes
+    bool connect(const std::string& host, int port, bool binary = true, const std::string& axes = "XYZR",
+                 int decimation = 1) {
+        close();
+        struct addrinfo hints, *result = nullptr;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || !result) {
+            error_ = "Cannot resolve " + host;
+            return false;
+        }
+        for (struct addrinfo* ai = result; ai && fd_ < 0; ai = ai->ai_next) {
+            fd_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd_ >= 0 && ::connect(fd_, ai->ai_addr, ai->ai_addrlen) != 0) {
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+        freeaddrinfo(result);
+        if (fd_ < 0) {
+            error_ = "Cannot connect to " + host + ":" + std::to_string(port) + ": " + strerror(errno);
+            return false;
+        }
+
+        binary_ = binary;
+        decimation_ = decimation;
+        subscribed_ = false;
+        input_.clear();
+        std::string request = std::string("SUBSCRIBE ") + (binary ? "BINARY " : "TEXT ") + axes + " " +
+                              std::to_string(decimation) + "\n";
+        if (send(fd_, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+            error_ = "Cannot send SUBSCRIBE";
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Waits up to timeout_ms for data and appends the complete samples to out. False when the
+    // connection is gone or the server refused the subscription (see error()).
+    bool read(PositionBlock& out, int timeout_ms) {
+        if (fd_ < 0) return false;
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready == 0) return true;
+        char buffer[65536];
+        ssize_t n = ready > 0 ? recv(fd_, buffer, sizeof(buffer), 0) : -1;
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) return true;
+            error_ = n == 0 ? "Connection closed by server" : std::string("Receive failed: ") + strerror(errno);
+            close();
+            return false;
+        }
+        input_.append(buffer, n);
+
+        size_t offset = 0;
+        if (!subscribed_) {
+            size_t newline = input_.find('\n');
+            if (newline == std::string::npos) return true;
+            std::string reply = input_.substr(0, newline);
+            if (reply.compare(0, 3, "OK ") != 0) {
+                error_ = reply;
+                close();
+                return false;
+            }
+            char format[8] = {0}, axes[8] = {0};
+            unsigned long long index = 0;
+            std::sscanf(reply.c_str() + 3, "%7s %7s %d %llu", format, axes, &decimation_, &index);
+            axis_mask_ = 0;
+            for (const char* c = axes; *c; ++c) {
+                const char* found = std::find(CLIENT_AXIS_NAMES, CLIENT_AXIS_NAMES + CLIENT_AXES, *c);
+                if (found != CLIENT_AXIS_NAMES + CLIENT_AXES) axis_mask_ |= 1 << (found - CLIENT_AXIS_NAMES);
+            }
+            start_index_ = index;
+            subscribed_ = true;
+            offset = newline + 1;
+        }
+
+        if (binary_) {
+            bool corrupt = false;
+            offset += decode_stream_frames(input_.data() + offset, input_.size() - offset, out, corrupt);
+            if (corrupt) {
+                error_ = "Corrupt frame header";
+                close();
+                return false;
+            }
+        } else {
+            offset += decode_text(input_.data() + offset, input_.size() - offset, axis_mask_, out, false, &malformed_);
+        }
+        input_.erase(0, offset);
+        return true;
+    }
+
+    void close() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool is_connected() const { return fd_ >= 0; }
+    bool subscribed() const { return subscribed_; }
+    uint8_t axis_mask() const { return axis_mask_; }
+    int decimation() const { return decimation_; }
+    uint64_t start_index() const { return start_index_; }
+    size_t malformed() const { return malformed_; }
+    const std::string& error() const { return error_; }
+
+private:
+    int fd_ = -1;
+    bool binary_ = true;
+    bool subscribed_ = false;
+    uint8_t axis_mask_ = 0x0F;
+    int decimation_ = 1;
+    uint64_t start_index_ = 0;
+    size_t malformed_ = 0;
+    std::string input_;
+    std::string error_;
+};
+
+#endif // ECC_CLIENT_H
@@ -0,0 +1,238 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include "ecc_client.h"
+
+// Decode throughput of ecc_client.h on synthetic data in every stream format, against the
+// getline/split parsing the downstream tools used so far
+
+struct BenchBatch {
+    std::vector<std::string> payloads;  // As they arrive: MQTT messages, TCP frames, datagrams
+    size_t bytes = 0;
+};
+
+struct SourceSamples {
+    std::vector<uint64_t> timestamp_ns;
+    std::vector<int32_t> position[CLIENT_AXES];
+    std::vector<uint8_t> valid_mask;
+};
+
+SourceSamples make_samples(size_t count);
+BenchBatch make_text_batches(const SourceSamples& s, size_t per_batch);
+BenchBatch make_stream_frames(const SourceSamples& s, size_t per_frame);
+BenchBatch make_multicast_packets(const SourceSamples& s, uint16_t per_packet);
+size_t decode_getline_split(const std::string& payload, PositionBlock& out);
+bool verify(const SourceSamples& s, const PositionBlock& block);
+
+int main(int argc, char* argv[]) {
+    size_t count = (argc >= 2) ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    int runs = (argc >= 3) ? std::atoi(argv[2]) : 5;
+    if (count == 0 || runs <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [samples] [runs]\n";
+        return 1;
+    }
+
+    SourceSamples samples = make_samples(count);
+    BenchBatch text = make_text_batches(samples, 100);
+    BenchBatch frames = make_stream_frames(samples, 150);
+    BenchBatch packets = make_multicast_packets(samples, MULTICAST_DEFAULT_SAMPLES);
+
+    struct Case {
+        const char* name;
+        const BenchBatch* batch;
+        int kind;
+    };
+    const Case cases[] = {
+        {"text getline/split", &text, 0},
+        {"text scalar scan", &text, 1},
+        {"text SSE2 scan", &text, 2},
+        {"TCP binary frames", &frames, 3},
+        {"multicast packets", &packets, 4},
+    };
+
+#ifndef __SSE2__
+    std::cout << "Built without SSE2; the SSE2 case runs the scalar scan\n";
+#endif
+    std::cout << count << " samples, best of " << runs << " runs\n";
+    std::cout << std::left << std::setw(22) << "Format" << std::right << std::setw(12) << "MB/s"
+              << std::setw(14) << "Msamples/s" << std::setw(10) << "Speedup" << "  Check\n";
+
+    PositionBlock block;
+    block.reserve(count);
+    double baseline = 0;
+    for (const Case& c : cases) {
+        double best = 1e30;
+        bool ok = true;
+        for (int r = 0; r < runs; ++r) {
+            block.clear();
+            auto start = std::chrono::steady_clock::now();
+            for (const std::string& payload : c.batch->payloads) {
+                if (c.kind == 0) {
+                    decode_getline_split(payload, block);
+                } else if (c.kind == 1 || c.kind == 2) {
+                    decode_text(payload.data(), payload.size(), 0x0F, block, true, nullptr, c.kind == 2);
+                } else if (c.kind == 3) {
+                    bool error;
+                    decode_stream_frames(payload.data(), payload.size(), block, error);
+                } else {
+                    MulticastPacketHeader header;
+                    decode_multicast_packet(payload.data(), payload.size(), block, header);
+                }
+            }
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            ok = ok && verify(samples, block);
+        }
+        double rate = count / best / 1e6;
+        if (c.kind == 0) baseline = rate;
+        std::cout << std::left << std::setw(22) << c.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << c.batch->bytes / best / 1e6 << std::setw(14) << std::setprecision(2) << rate
+                  << std::setw(9) << std::setprecision(1) << rate / baseline << "x  " << (ok ? "OK" : "MISMATCH") << "\n";
+    }
+
+    // Gap detection on a stream with two holes
+    PositionBlock gapped;
+    bool error;
+    for (size_t i = 0; i < frames.payloads.size(); ++i) {
+        if (i == 10 || i == 20) continue;
+        decode_stream_frames(frames.payloads[i].data(), frames.payloads[i].size(), gapped, error);
+    }
+    GapDetector by_index;
+    by_index.check(gapped);
+    PositionBlock gapped_text;
+    decode_mqtt_batch(text.payloads[0].data(), text.payloads[0].size(), gapped_text);
+    decode_mqtt_batch(text.payloads[2].data(), text.payloads[2].size(), gapped_text);
+    GapDetector by_time;
+    by_time.check(gapped_text);
+    std::cout << "Gap check: index " << by_index.missing() << " missing in " << by_index.gaps() << " gaps (expected 300 in 2), "
+              << "timestamp " << by_time.missing() << " missing in " << by_time.gaps() << " gaps (expected 100 in 1)\n";
+    return 0;
+}
+
+// 10 kHz stream with random walks, and an occasional invalid axis
+SourceSamples make_samples(size_t count) {
+    SourceSamples s;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> step(-500, 500);
+    std::uniform_int_distribution<int> fault(0, 999);
+    int32_t pos[CLIENT_AXES] = {1250000, -340000, 5000000, 90000};
+    uint64_t t = 1792244682995987973ull;
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t valid = 0x0F;
+        for (int a = 0; a < CLIENT_AXES; ++a) {
+            pos[a] += step(rng);
+            if (fault(rng) == 0) valid &= ~(1 << a);
+            s.position[a].push_back((valid & (1 << a)) ? pos[a] : 0);
+        }
+        s.timestamp_ns.push_back(t + static_cast<uint64_t>(i) * 100000);
+        s.valid_mask.push_back(valid);
+    }
+    return s;
+}
+
+// Same text as FastStringBuffer::format_position, newline separated like the publisher
+BenchBatch make_text_batches(const SourceSamples& s, size_t per_batch) {
+    BenchBatch batch;
+    std::string msg;
+    char line[96];
+    for (size_t i = 0; i < s.timestamp_ns.size(); ++i) {
+        int n = std::snprintf(line, sizeof(line), "%llu", static_cast<unsigned long long>(s.timestamp_ns[i]));
+        for (int a = 0; a < CLIENT_AXES; ++a) {
+            if (s.valid_mask[i] & (1 << a)) {
+                n += std::snprintf(line + n, sizeof(line) - n, "/%d", s.position[a][i]);
+            } else {
+                n += std::snprintf(line + n, sizeof(line) - n, "/NaN");
+            }
+        }
+        if (!msg.empty()) msg += '\n';
+        msg.append(line, n);
+        if ((i + 1) % per_batch == 0 || i + 1 == s.timestamp_ns.size()) {
+            batch.bytes += msg.size();
+            batch.payloads.push_back(msg);
+            msg.clear();
+        }
+    }
+    return batch;
+}
+
+BenchBatch make_stream_frames(const SourceSamples& s, size_t per_frame) {
+    BenchBatch batch;
+    for (size_t begin = 0; begin < s.timestamp_ns.size(); begin += per_frame) {
+        size_t end = std::min(s.timestamp_ns.size(), begin + per_frame);
+        StreamFrameHeader header = {STREAM_FRAME_MAGIC, STREAM_FRAME_VERSION, 0x0F, 0,
+                                    static_cast<uint32_t>(end - begin), 1, begin};
+        std::string frame(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (size_t i = begin; i < end; ++i) {
+            frame.append(reinterpret_cast<const char*>(&s.timestamp_ns[i]), sizeof(uint64_t));
+            frame += static_cast<char>(s.valid_mask[i]);
+            for (int a = 0; a < CLIENT_AXES; ++a) frame.append(reinterpret_cast<const char*>(&s.position[a][i]), sizeof(int32_t));
+        }
+        batch.bytes += frame.size();
+        batch.payloads.push_back(frame);
+    }
+    return batch;
+}
+
+BenchBatch make_multicast_packets(const SourceSamples& s, uint16_t per_packet) {
+    BenchBatch batch;
+    uint64_t sequence = 0;
+    for (size_t begin = 0; begin < s.timestamp_ns.size(); begin += per_packet) {
+        size_t end = std::min(s.timestamp_ns.size(), begin + per_packet);
+        std::string packet(multicast_packet_size(per_packet), '\0');
+        MulticastPacketHeader header = {MULTICAST_MAGIC, MULTICAST_VERSION, per_packet, 1,
+                                        static_cast<uint32_t>(end - begin), sequence++, begin, 10000, 0};
+        std::memcpy(&packet[0], &header, sizeof(header));
+        for (size_t i = begin; i < end; ++i) {
+            MulticastSample sample;
+            sample.timestamp_ns = s.timestamp_ns[i];
+            for (int a = 0; a < CLIENT_AXES; ++a) sample.position[a] = s.position[a][i];
+            sample.valid_mask = s.valid_mask[i];
+            std::memcpy(&packet[sizeof(header) + (i - begin) * sizeof(sample)], &sample, sizeof(sample));
+        }
+        batch.bytes += packet.size();
+        batch.payloads.push_back(packet);
+    }
+    return batch;
+}
+
+// What the downstream tools do today: getline per line, getline per field, stoll
+size_t decode_getline_split(const std::string& payload, PositionBlock& out) {
+    size_t decoded = 0;
+    std::istringstream lines(payload);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string field;
+        std::vector<std::string> parts;
+        while (std::getline(fields, field, '/')) parts.push_back(field);
+        if (parts.size() != 1 + CLIENT_AXES) continue;
+        int32_t values[CLIENT_AXES];
+        uint8_t valid = 0;
+        for (int a = 0; a < CLIENT_AXES; ++a) {
+            if (parts[1 + a] == "NaN") {
+                values[a] = 0;
+            } else {
+                values[a] = static_cast<int32_t>(std::stoll(parts[1 + a]));
+                valid |= 1 << a;
+            }
+        }
+        out.push(std::stoull(parts[0]), values, valid);
+        decoded++;
+    }
+    return decoded;
+}
+
+bool verify(const SourceSamples& s, const PositionBlock& block) {
+    if (block.size() != s.timestamp_ns.size() || block.timestamp_ns != s.timestamp_ns || block.valid_mask != s.valid_mask) {
+        return false;
+    }
+    for (int a = 0; a < CLIENT_AXES; ++a) {
+        if (block.position[a] != s.position[a]) return false;
+    }
+    return true;
+}
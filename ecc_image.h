@@ -0,0 +1,244 @@
+// Live image assembly from (position, value) pairs (IMAGE/START in ecc_mqtt_streaming)
+//
+// A ScanGrid maps two stage axes onto a width x height pixel grid: the range [x0, x1) is
+// split into width columns and [y0, y1) into height rows (x1 < x0 scans the other way).
+// Every pair that lands in the grid updates its pixel's count, mean and sum of squared
+// deviations with Welford's method, which stays exact for detector currents around 1e-10 A
+// where a sum of squares would cancel. The pixel sum is count * mean.
+//
+// Pixels are stored in 16 x 16 tiles, each contiguous (about 5 KB), so a raster line
+// touches one tile at a time and a tile update is a single memcpy-friendly block. Tiles
+// changed since the last update are collected and sent as ImageUpdate messages:
+// an ImageUpdateHeader followed by tile_count ImageTileRecords, all little-endian.
+// A consumer that keeps an ImageFrame and applies every message has the live image;
+// IMAGE/REFRESH resends all tiles for consumers that join mid-scan.
+
+#ifndef ECC_IMAGE_H
+#define ECC_IMAGE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+const uint32_t IMAGE_MAGIC = 0x49434345;           // "ECCI" in little-endian byte order
+const uint16_t IMAGE_VERSION = 1;
+const uint32_t IMAGE_TILE = 16;                     // Tile edge in pixels
+const uint32_t IMAGE_TILE_PIXELS = IMAGE_TILE * IMAGE_TILE;
+const uint32_t IMAGE_MAX_SIDE = 2048;               // 20 bytes per pixel: 84 MB at the limit
+
+struct ScanGrid {
+    uint8_t axis_x = 0;            // Logical axis along the columns (0 = X ... 3 = R)
+    uint8_t axis_y = 1;            // Logical axis along the rows
+    int32_t x0 = 0, x1 = 0;        // Column range in nm/µ°, [x0, x1)
+    int32_t y0 = 0, y1 = 0;        // Row range
+    uint32_t width = 0, height = 0;
+};
+
+struct __attribute__((packed)) ImageUpdateHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t tile_size;            // IMAGE_TILE
+    uint32_t scan_id;              // New value for every IMAGE/START
+    uint32_t sequence;             // Message number within the scan
+    uint16_t width;
+    uint16_t height;
+    uint16_t tile_count;           // ImageTileRecords following the header
+    uint8_t axis_x;
+    uint8_t axis_y;
+    int32_t x0, x1, y0, y1;
+    uint64_t pairs;                // Pairs binned so far
+};
+
+// Pixel (tile_x * 16 + i % 16, tile_y * 16 + i / 16); pixels past the grid edge have count 0
+struct __attribute__((packed)) ImageTileRecord {
+    uint16_t tile_x;
+    uint16_t tile_y;
+    float mean[IMAGE_TILE_PIXELS];
+    float stddev[IMAGE_TILE_PIXELS];       // Sample standard deviation, 0 below two values
+    uint32_t count[IMAGE_TILE_PIXELS];
+};
+
+inline bool check_scan_grid(const ScanGrid& grid, std::string& error) {
+    if (grid.axis_x > 3 || grid.axis_y > 3 || grid.axis_x == grid.axis_y) {
+        error = "Axes must be two different axes of X, Y, Z, R";
+    } else if (grid.width == 0 || grid.height == 0 || grid.width > IMAGE_MAX_SIDE || grid.height > IMAGE_MAX_SIDE) {
+        error = "Image size must be 1-" + std::to_string(IMAGE_MAX_SIDE) + " pixels per side";
+    } else if (grid.x0 == grid.x1 || grid.y0 == grid.y1) {
+        error = "Scan range must not be empty";
+    } else {
+        return true;
+    }
+    return false;
+}
+
+class ImageBuilder {
+public:
+    // Starts a new image; all previous pixels are discarded
+    void configure(const ScanGrid& grid, uint32_t scan_id) {
+        grid_ = grid;
+        scan_id_ = scan_id;
+        sequence_ = 0;
+        pairs_ = 0;
+        outside_ = 0;
+        tiles_x_ = (grid.width + IMAGE_TILE - 1) / IMAGE_TILE;
+        tiles_y_ = (grid.height + IMAGE_TILE - 1) / IMAGE_TILE;
+        scale_x_ = grid.width / (static_cast<double>(grid.x1) - grid.x0);
+        scale_y_ = grid.height / (static_cast<double>(grid.y1) - grid.y0);
+        tiles_.assign(static_cast<size_t>(tiles_x_) * tiles_y_, Tile());
+        dirty_flag_.assign(tiles_.size(), 0);
+        dirty_.clear();
+    }
+
+    // Bins one pair; false if the position is outside the grid
+    bool add(double x, double y, double value) {
+        double fx = (x - grid_.x0) * scale_x_;
+        double fy = (y - grid_.y0) * scale_y_;
+        if (!(fx >= 0 && fx < grid_.width && fy >= 0 && fy < grid_.height)) {
+            outside_++;
+            return false;
+        }
+        uint32_t px = static_cast<uint32_t>(fx), py = static_cast<uint32_t>(fy);
+        size_t t = static_cast<size_t>(py / IMAGE_TILE) * tiles_x_ + px / IMAGE_TILE;
+        uint32_t i = (py % IMAGE_TILE) * IMAGE_TILE + px % IMAGE_TILE;
+        Tile& tile = tiles_[t];
+        uint32_t n = ++tile.count[i];
+        double delta = value - tile.mean[i];
+        tile.mean[i] += delta / n;
+        tile.m2[i] += delta * (value - tile.mean[i]);
+        if (!dirty_flag_[t]) {
+            dirty_flag_[t] = 1;
+            dirty_.push_back(static_cast<uint32_t>(t));
+        }
+        pairs_++;
+        return true;
+    }
+
+    void mark_all_dirty() {
+        dirty_.clear();
+        for (size_t t = 0; t < tiles_.size(); ++t) {
+            dirty_flag_[t] = 1;
+            dirty_.push_back(static_cast<uint32_t>(t));
+        }
+    }
+
+    // Moves up to max_tiles changed tiles into one update message; returns the tiles written
+    size_t take_update(std::string& out, size_t max_tiles) {
+        size_t n = std::min(max_tiles, dirty_.size());
+        out.assign(sizeof(ImageUpdateHeader) + n * sizeof(ImageTileRecord), '\0');
+        ImageUpdateHeader header;
+        header.magic = IMAGE_MAGIC;
+        header.version = IMAGE_VERSION;
+        header.tile_size = IMAGE_TILE;
+        header.scan_id = scan_id_;
+        header.sequence = sequence_++;
+        header.width = static_cast<uint16_t>(grid_.width);
+        header.height = static_cast<uint16_t>(grid_.height);
+        header.tile_count = static_cast<uint16_t>(n);
+        header.axis_x = grid_.axis_x;
+        header.axis_y = grid_.axis_y;
+        header.x0 = grid_.x0;
+        header.x1 = grid_.x1;
+        header.y0 = grid_.y0;
+        header.y1 = grid_.y1;
+        header.pairs = pairs_;
+        std::memcpy(&out[0], &header, sizeof(header));
+
+        ImageTileRecord record;
+        for (size_t k = 0; k < n; ++k) {
+            uint32_t t = dirty_[dirty_.size() - n + k];
+            dirty_flag_[t] = 0;
+            const Tile& tile = tiles_[t];
+            record.tile_x = static_cast<uint16_t>(t % tiles_x_);
+            record.tile_y = static_cast<uint16_t>(t / tiles_x_);
+            for (uint32_t i = 0; i < IMAGE_TILE_PIXELS; ++i) {
+                record.mean[i] = static_cast<float>(tile.mean[i]);
+                record.stddev[i] = tile.count[i] > 1 ? static_cast<float>(std::sqrt(tile.m2[i] / (tile.count[i] - 1))) : 0.0f;
+                record.count[i] = tile.count[i];
+            }
+            std::memcpy(&out[sizeof(header) + k * sizeof(record)], &record, sizeof(record));
+        }
+        dirty_.resize(dirty_.size() - n);
+        return n;
+    }
+
+    size_t dirty_tiles() const { return dirty_.size(); }
+    uint64_t pairs() const { return pairs_; }
+    uint64_t outside() const { return outside_; }
+    const ScanGrid& grid() const { return grid_; }
+
+private:
+    struct Tile {
+        uint32_t count[IMAGE_TILE_PIXELS];
+        double mean[IMAGE_TILE_PIXELS];
+        double m2[IMAGE_TILE_PIXELS];      // Sum of squared deviations from the mean
+        Tile() {
+            std::memset(count, 0, sizeof(count));
+            std::memset(mean, 0, sizeof(mean));
+            std::memset(m2, 0, sizeof(m2));
+        }
+    };
+
+    ScanGrid grid_;
+    uint32_t scan_id_ = 0;
+    uint32_t sequence_ = 0;
+    uint32_t tiles_x_ = 0, tiles_y_ = 0;
+    double scale_x_ = 0, scale_y_ = 0;
+    uint64_t pairs_ = 0;
+    uint64_t outside_ = 0;
+    std::vector<Tile> tiles_;
+    std::vector<uint8_t> dirty_flag_;
+    std::vector<uint32_t> dirty_;          // Tile indexes with dirty_flag_ set
+};
+
+// Consumer side: the image as row-major arrays, kept current by applying every update
+class ImageFrame {
+public:
+    // False for a message that is not an image update; a new scan_id resets the frame
+    bool apply(const void* payload, size_t length) {
+        ImageUpdateHeader header;
+        if (length < sizeof(header)) return false;
+        std::memcpy(&header, payload, sizeof(header));
+        if (header.magic != IMAGE_MAGIC || header.version != IMAGE_VERSION || header.tile_size != IMAGE_TILE ||
+            length < sizeof(header) + header.tile_count * sizeof(ImageTileRecord)) {
+            return false;
+        }
+        if (header.scan_id != scan_id || header.width != width || header.height != height || mean.empty()) {
+            scan_id = header.scan_id;
+            width = header.width;
+            height = header.height;
+            mean.assign(static_cast<size_t>(width) * height, 0.0f);
+            stddev.assign(mean.size(), 0.0f);
+            count.assign(mean.size(), 0);
+        }
+        pairs = header.pairs;
+
+        const char* p = static_cast<const char*>(payload) + sizeof(header);
+        ImageTileRecord record;
+        for (uint16_t k = 0; k < header.tile_count; ++k, p += sizeof(record)) {
+            std::memcpy(&record, p, sizeof(record));
+            for (uint32_t i = 0; i < IMAGE_TILE_PIXELS; ++i) {
+                uint32_t x = record.tile_x * IMAGE_TILE + i % IMAGE_TILE;
+                uint32_t y = record.tile_y * IMAGE_TILE + i / IMAGE_TILE;
+                if (x >= width || y >= height) continue;
+                size_t pixel = static_cast<size_t>(y) * width + x;
+                mean[pixel] = record.mean[i];
+                stddev[pixel] = record.stddev[i];
+                count[pixel] = record.count[i];
+            }
+        }
+        return true;
+    }
+
+    uint32_t scan_id = 0;
+    uint32_t width = 0, height = 0;
+    uint64_t pairs = 0;
+    std::vector<float> mean;
+    std::vector<float> stddev;
+    std::vector<uint32_t> count;
+};
+
+#endif // ECC_IMAGE_H
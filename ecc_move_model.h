@@ -0,0 +1,142 @@
+// Learned move-time model shared by ecc_tool and ecc_mqtt_streaming
+//
+// Predicts how long a closed-loop move takes from its distance, direction and
+// drive amplitude/frequency. Each direction has a piecewise-linear curve of
+// duration over distance with knots at decades of distance. A completed move
+// corrects the two knots around its distance (LMS on the hat basis), starting
+// from a prior derived from the drive parameters. Durations are normalized to
+// the reference amplitude and frequency, treating step rate and step size as
+// proportional to them. The recent relative prediction error sets how much
+// slack the timeout bound gets.
+
+#ifndef ECC_MOVE_MODEL_H
+#define ECC_MOVE_MODEL_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+const int MOVE_MODEL_KNOTS = 7;
+const double MOVE_MODEL_KNOT_DISTANCE[MOVE_MODEL_KNOTS] = {0, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7};
+const int MOVE_MODEL_HISTORY = 64;              // Completed moves kept per axis
+const int MOVE_MODEL_MIN_MOVES = 5;             // Per direction before the learned bound applies
+const double MOVE_MODEL_LEARNING_RATE = 0.3;
+const double MOVE_MODEL_PRIOR_OVERHEAD_S = 0.05;
+const double MOVE_MODEL_PRIOR_STEP = 50;        // Units per drive cycle at the reference amplitude
+const double MOVE_MODEL_REF_AMPLITUDE_MV = 30000;
+const double MOVE_MODEL_REF_FREQUENCY_MHZ = 1000000;
+const double MOVE_TIMEOUT_MIN_S = 1.0;          // Learned bound never goes below this
+const double MOVE_TIMEOUT_PRIOR_MIN_S = 5.0;    // Bound while the model is still on its prior
+
+struct MoveRecord {
+    int32_t distance;          // Signed, target - start
+    float duration_s;
+    int32_t amplitude_mv;
+    int32_t frequency_mhz;
+};
+
+struct MovePrediction {
+    double eta_s = 0;
+    double timeout_s = 0;
+    bool learned = false;      // Enough completed moves in this direction
+};
+
+class MoveTimeModel {
+public:
+    MoveTimeModel() { reset(); }
+
+    void reset() {
+        for (int dir = 0; dir < 2; ++dir) {
+            for (int k = 0; k < MOVE_MODEL_KNOTS; ++k) {
+                knots_[dir][k] = MOVE_MODEL_PRIOR_OVERHEAD_S + MOVE_MODEL_KNOT_DISTANCE[k] /
+                    (MOVE_MODEL_PRIOR_STEP * MOVE_MODEL_REF_FREQUENCY_MHZ / 1000.0);
+            }
+            moves_[dir] = 0;
+            relative_error_[dir] = 0.5;
+        }
+        history_count_ = 0;
+    }
+
+    MovePrediction predict(int32_t distance, int32_t amplitude_mv, int32_t frequency_mhz) const {
+        int dir = distance >= 0 ? 0 : 1;
+        MovePrediction p;
+        p.eta_s = curve(dir, std::fabs(static_cast<double>(distance))) / drive_factor(amplitude_mv, frequency_mhz);
+        p.learned = moves_[dir] >= MOVE_MODEL_MIN_MOVES;
+        if (p.learned) {
+            p.timeout_s = std::max(MOVE_TIMEOUT_MIN_S, p.eta_s * (1.5 + 4 * relative_error_[dir]) + 0.5);
+        } else {
+            p.timeout_s = std::max(MOVE_TIMEOUT_PRIOR_MIN_S, p.eta_s * 4 + 2);
+        }
+        return p;
+    }
+
+    void record(int32_t distance, double duration_s, int32_t amplitude_mv, int32_t frequency_mhz) {
+        MoveRecord& r = history_[history_count_ % MOVE_MODEL_HISTORY];
+        r.distance = distance;
+        r.duration_s = static_cast<float>(duration_s);
+        r.amplitude_mv = amplitude_mv;
+        r.frequency_mhz = frequency_mhz;
+        history_count_++;
+
+        int dir = distance >= 0 ? 0 : 1;
+        double d = std::fabs(static_cast<double>(distance));
+        double normalized = duration_s * drive_factor(amplitude_mv, frequency_mhz);
+        double predicted = curve(dir, d);
+        double error = normalized - predicted;
+        relative_error_[dir] = 0.8 * relative_error_[dir] + 0.2 * std::fabs(error) / std::max(predicted, 0.01);
+        moves_[dir]++;
+
+        int k = segment(d);
+        double w = std::min(1.0, weight(k, d));
+        knots_[dir][k] = std::max(0.0, knots_[dir][k] + MOVE_MODEL_LEARNING_RATE * (1 - w) * error);
+        knots_[dir][k + 1] = std::max(0.0, knots_[dir][k + 1] + MOVE_MODEL_LEARNING_RATE * w * error);
+
+        // Longer moves never take less time
+        for (int i = 1; i < MOVE_MODEL_KNOTS; ++i) {
+            knots_[dir][i] = std::max(knots_[dir][i], knots_[dir][i - 1]);
+        }
+    }
+
+    uint64_t moves(int dir) const { return moves_[dir]; }
+    double relative_error(int dir) const { return relative_error_[dir]; }
+    size_t history_size() const { return std::min<size_t>(history_count_, MOVE_MODEL_HISTORY); }
+
+    // i = 0 is the most recent move
+    const MoveRecord& history(size_t i) const {
+        return history_[(history_count_ - 1 - i) % MOVE_MODEL_HISTORY];
+    }
+
+private:
+    static double drive_factor(int32_t amplitude_mv, int32_t frequency_mhz) {
+        double factor = 1.0;
+        if (amplitude_mv > 0) factor *= amplitude_mv / MOVE_MODEL_REF_AMPLITUDE_MV;
+        if (frequency_mhz > 0) factor *= frequency_mhz / MOVE_MODEL_REF_FREQUENCY_MHZ;
+        return factor;
+    }
+
+    static int segment(double d) {
+        int k = 0;
+        while (k < MOVE_MODEL_KNOTS - 2 && d > MOVE_MODEL_KNOT_DISTANCE[k + 1]) k++;
+        return k;
+    }
+
+    // Position within segment k; above 1 past the last knot (linear extrapolation)
+    static double weight(int k, double d) {
+        return (d - MOVE_MODEL_KNOT_DISTANCE[k]) / (MOVE_MODEL_KNOT_DISTANCE[k + 1] - MOVE_MODEL_KNOT_DISTANCE[k]);
+    }
+
+    double curve(int dir, double d) const {
+        int k = segment(d);
+        double w = weight(k, d);
+        return knots_[dir][k] + w * (knots_[dir][k + 1] - knots_[dir][k]);
+    }
+
+    double knots_[2][MOVE_MODEL_KNOTS];   // Normalized duration (s) at each knot distance
+    uint64_t moves_[2];
+    double relative_error_[2];
+    MoveRecord history_[MOVE_MODEL_HISTORY];
+    uint64_t history_count_;
+};
+
+#endif // ECC_MOVE_MODEL_H
@@ -12,14 +12,20 @@
 #include <atomic>
 #include <algorithm>
 #include <string>
-#include <queue>
+#include <deque>
 #include <cstring>
+#include <cerrno>
 #include <array>
+#include <map>
+#include <memory>
 
 // Network includes
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 
 // MQTT includes
 #include <mosquitto.h>
@@ -34,18 +40,95 @@
 #endif
 
 #include "ecc.h"
+#include "ecc_bench.h"
+#include "ecc_move_model.h"
+#include "ecc_recorder.h"
+#include "ecc_archive.h"
+#include "ecc_shm.h"
+#include "ecc_stream.h"
+#include "ecc_multicast.h"
+#include "ecc_picoammeter.h"
+#include "ecc_image.h"
+#include "ecc_align.h"
+#include "ecc_trigger.h"
+#include "ecc_stats.h"
 
 // Global configuration (made non-const for runtime changes)
-int g_sample_rate_hz = 80;  // Changeable sampling rate
-int g_sample_interval_ns = 1000000000 / g_sample_rate_hz;  // Updated dynamically
+std::atomic<int> g_sample_rate_hz{80};  // Changeable sampling rate
+std::atomic<int> g_sample_interval_ns{1000000000 / 80};  // Updated dynamically, read by the sampler every tick
+const int AXIS_RATE_MIN_HZ = 20;  // Held readings stay younger than get_current_position's 50 ms limit
 const int BUFFER_SIZE = 1000;     // Batch size for MQTT publishing
 const int TCP_PORT = 8080;
+const int STREAM_PORT = 8081;     // TCP position stream, see ecc_stream.h
 const std::string MQTT_BROKER = "localhost";
 const int MQTT_PORT = 1883;
-const std::string MQTT_TOPIC_POSITION = "microscope/stage/position";
+const std::string MQTT_TOPIC_POSITION = "microscope/stage/position";  // Per-axis topics append /X, /Y, /Z, /R
 const std::string MQTT_TOPIC_COMMAND = "microscope/stage/command";
 const std::string MQTT_TOPIC_RESULT = "microscope/stage/result";
 const std::string MQTT_TOPIC_STATUS = "microscope/stage/status";
+const std::string MQTT_TOPIC_SETPOINT = "microscope/stage/setpoint";  // Streamed targets, last value wins
+const std::string MQTT_TOPIC_HISTORY = "microscope/stage/history";    // GET_HISTORY replies
+const std::string MQTT_TOPIC_CURRENT = "microscope/stage/current";    // Picoammeter readings on the position clock
+const std::string MQTT_TOPIC_IMAGE = "microscope/stage/image";        // Live image tile updates (ecc_image.h)
+const std::string MQTT_TOPIC_TRIGGER = "microscope/stage/trigger";    // Position trigger markers (ecc_trigger.h)
+const std::string MQTT_TOPIC_STATS = "microscope/stage/stats";        // Rolling axis statistics (ecc_stats.h)
+const int SETPOINT_RATE_HZ = 200;          // Maximum target write rate per axis
+const int32_t SETPOINT_MOTION_THRESHOLD = 50;  // nm/µ° moved towards target that counts as motion
+const uint64_t BENCH_SETPOINT_QUIET_NS = 1000000000;  // BENCH is refused this long after a setpoint
+const double PROFILE_SETTLE_TIMEOUT_S = 2.0;   // MOVE_VEL: time allowed after the profile ends to reach target range
+const int32_t APPROACH_DEFAULT_OVERSHOOT = 5000;  // Unidirectional approach: overshoot distance (nm/µ°)
+const int32_t APPROACH_DEFAULT_MIN_RANGE = 100;   // Lower bound for the tuned target range
+const double APPROACH_SETTLE_FAST_S = 0.2;        // Settles faster than this shrink the target range
+const double APPROACH_SETTLE_SLOW_S = 1.0;        // Settles slower than this grow the target range
+const uint64_t MOVE_SETTLE_WINDOW_NS = 20000000;      // Must stay in range this long to count as settled
+const size_t MOVE_QUEUE_CAPACITY = 4096;              // Pending MOVE_QUEUE targets per axis
+const size_t RECORD_BUFFER_SAMPLES = 1 << 18;         // Recorder backlog before samples are dropped (26 s at 10 kHz)
+const uint64_t RECORD_SEGMENT_BYTES = 256ull << 20;   // Segment rotation by size...
+const uint32_t RECORD_SEGMENT_SECONDS = 3600;         // ...or by age
+const std::string RECORD_DEFAULT_DIRECTORY = "recordings";
+const size_t HISTORY_BUFFER_SAMPLES = 1 << 16;        // Sampler -> history encoder backlog
+const uint32_t HISTORY_WINDOW_S = 600;                // In-memory history kept for GET_HISTORY...
+const uint64_t HISTORY_MAX_BYTES = 64ull << 20;       // ...unless the compressed blocks outgrow this
+const size_t HISTORY_BLOCK_SAMPLES = 1024;            // Block closes when full...
+const uint64_t HISTORY_BLOCK_NS = 250000000;          // ...or this old, which bounds how far history lags
+const size_t HISTORY_CHUNK_SAMPLES = 5000;            // Samples per reply message
+const size_t HISTORY_MAX_REPLY_SAMPLES = 1000000;     // Longer replies are truncated
+const size_t HISTORY_MAX_PENDING_QUERIES = 16;        // GET_HISTORY requests waiting for the query thread
+const size_t SNAPSHOT_BUFFER_SAMPLES = 1 << 16;       // Sampler -> flight recorder backlog
+const size_t SNAPSHOT_WINDOW_SAMPLES = 1 << 16;       // Full-rate samples retained (4.3 s at 15 kHz)
+const uint64_t SNAPSHOT_PRE_NS = 2000000000;          // Captured before a trigger...
+const uint64_t SNAPSHOT_POST_NS = 1000000000;         // ...and after it
+const int SNAPSHOT_STATUS_HZ = 10;                    // EOT/error/in-target poll rate
+const uint64_t SNAPSHOT_MISSED_DEADLINES = 10;        // Missed sampler deadlines within 1 s that trigger
+const uint64_t SNAPSHOT_HOLDOFF_NS = 10000000000ull;  // Automatic triggers ignored this long after a snapshot
+const std::string SNAPSHOT_DIRECTORY = "snapshots";
+const size_t STREAM_BUFFER_SAMPLES = 1 << 16;         // Sampler -> stream server backlog
+const size_t STREAM_MAX_CLIENTS = 64;
+const size_t STREAM_CLIENT_MAX_BUFFER = 16 << 20;     // Unsent bytes before a client counts as too slow
+const int STREAM_BATCH_MS = 10;                       // Stream server batch interval
+const size_t MULTICAST_BUFFER_SAMPLES = 1 << 16;      // Sampler -> multicast sink backlog
+const uint64_t MULTICAST_FLUSH_NS = 5000000;          // Send a partial packet after 5 ms
+const int MULTICAST_TTL = 1;                          // Stay on the lab subnet
+const std::string PICO_DEFAULT_DEVICE = "/dev/ttyUSB0";
+const uint32_t PICO_DEFAULT_POINTS = 100;             // Burst size
+const double PICO_DEFAULT_NPLC = 1.0;                 // Integration time in power line cycles
+const uint64_t PICO_PUBLISH_NS = 100000000;           // Single readings are batched this long
+const uint64_t PICO_RETRY_NS = 2000000000;            // Reopen delay after a serial or instrument error
+const int IMAGE_PUBLISH_HZ = 10;                      // Tile updates at display rate
+const size_t IMAGE_MAX_TILES_PER_MESSAGE = 64;        // 197 KB per update message
+const size_t ALIGN_BUFFER_SAMPLES = 1 << 16;          // Sampler -> alignment backlog
+const uint32_t ALIGN_DEFAULT_LATENCY_MS = 3000;       // Covers a default picoammeter burst
+const uint32_t ALIGN_MAX_LATENCY_MS = 60000;          // 600000 positions held at 10 kHz
+const uint32_t ALIGN_MAX_GAP_INTERVALS = 4;           // Wider sample gaps are not interpolated across
+const size_t ALIGN_MAX_BACKLOG = 1 << 20;             // Readings or fused records queued for a thread
+const size_t TRIGGER_EVENT_BUFFER = 4096;             // Sampler -> trigger thread backlog
+const int32_t TRIGGER_DEFAULT_HYSTERESIS = 100;       // nm/µ°, above the stage noise
+const int32_t TRIGGER_MAX_HYSTERESIS = 10000000;
+const int PICO_TRIGGER_POLL_US = 100;                 // Armed burst: check for a trigger this often
+const size_t STATS_BUFFER_SAMPLES = 1 << 16;          // Sampler -> statistics backlog
+const uint32_t STATS_DEFAULT_INTERVAL_MS = 1000;      // Statistics publish interval
+const size_t STATS_MAX_WINDOWS = 4;
+const uint32_t STATS_MAX_WINDOW_S = 3600;             // 36000 blocks per axis at the limit
 
 // Optimized position data structure (POD for cache efficiency)
 struct __attribute__((packed)) PositionSample {
@@ -55,20 +138,29 @@ struct __attribute__((packed)) PositionSample {
     int32_t z_position;
     int32_t r_position;
     uint8_t valid_mask;        // Bit flags for valid positions (X=1, Y=2, Z=4, R=8)
+    uint8_t read_mask;         // Axes due this tick (SET_AXIS_RATE); the others are left invalid
     
     PositionSample() : timestamp_ns(0), x_position(0), y_position(0), 
-                      z_position(0), r_position(0), valid_mask(0) {}
+                      z_position(0), r_position(0), valid_mask(0), read_mask(0x0F) {}
+};
+
+// Sample for the indexed streams (TCP, multicast), with the samples that did not fit into
+// the buffer just before it, so the consumer puts the gap in its index where it happened
+struct IndexedSample {
+    PositionSample sample;
+    uint32_t dropped_before = 0;
 };
 
 // Lock-free circular buffer for high-speed producer-consumer
+template <size_t Capacity = BUFFER_SIZE * 4, typename Item = PositionSample>  // 4x buffer for safety
 class LockFreeBuffer {
 private:
-    alignas(64) std::array<PositionSample, BUFFER_SIZE * 4> buffer;  // 4x buffer for safety
+    alignas(64) std::array<Item, Capacity> buffer;
     alignas(64) std::atomic<size_t> write_pos{0};
     alignas(64) std::atomic<size_t> read_pos{0};
     
 public:
-    bool try_write(const PositionSample& sample) {
+    bool try_write(const Item& sample) {
         size_t current_write = write_pos.load(std::memory_order_relaxed);
         size_t next_write = (current_write + 1) % buffer.size();
         
@@ -81,7 +173,7 @@ public:
         return true;
     }
     
-    bool try_read(PositionSample& sample) {
+    bool try_read(Item& sample) {
         size_t current_read = read_pos.load(std::memory_order_relaxed);
         if (current_read == write_pos.load(std::memory_order_acquire)) {
             return false;  // Buffer empty
@@ -99,6 +191,79 @@ public:
     }
 };
 
+// Latest sample as seen by readers of the seqlock slot
+struct LatestSample {
+    PositionSample sample;
+    uint64_t monotonic_ns = 0;   // When the sampler stored it
+    uint64_t tick = 0;           // Sampler tick number (0 = never written)
+};
+
+// Seqlock-protected latest sample: one writer (sampler), any number of readers.
+// The writer never waits; readers retry only if they overlap a write.
+class SeqlockSample {
+private:
+    alignas(64) std::atomic<uint32_t> sequence{0};
+    std::atomic<uint64_t> timestamp_ns{0};
+    std::atomic<uint64_t> monotonic_ns{0};
+    std::atomic<uint64_t> tick{0};
+    std::array<std::atomic<int32_t>, 4> positions;
+    std::atomic<uint8_t> valid_mask{0};
+    
+public:
+    SeqlockSample() {
+        for (auto& p : positions) p.store(0, std::memory_order_relaxed);
+    }
+    
+    void store(const PositionSample& sample, uint64_t now_ns, uint64_t tick_number) {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);  // Odd: write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        
+        timestamp_ns.store(sample.timestamp_ns, std::memory_order_relaxed);
+        monotonic_ns.store(now_ns, std::memory_order_relaxed);
+        tick.store(tick_number, std::memory_order_relaxed);
+        positions[0].store(sample.x_position, std::memory_order_relaxed);
+        positions[1].store(sample.y_position, std::memory_order_relaxed);
+        positions[2].store(sample.z_position, std::memory_order_relaxed);
+        positions[3].store(sample.r_position, std::memory_order_relaxed);
+        valid_mask.store(sample.valid_mask, std::memory_order_relaxed);
+        
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+    
+    LatestSample load() const {
+        LatestSample out;
+        while (true) {
+            uint32_t seq1 = sequence.load(std::memory_order_acquire);
+            if (seq1 & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            
+            out.sample.timestamp_ns = timestamp_ns.load(std::memory_order_relaxed);
+            out.monotonic_ns = monotonic_ns.load(std::memory_order_relaxed);
+            out.tick = tick.load(std::memory_order_relaxed);
+            out.sample.x_position = positions[0].load(std::memory_order_relaxed);
+            out.sample.y_position = positions[1].load(std::memory_order_relaxed);
+            out.sample.z_position = positions[2].load(std::memory_order_relaxed);
+            out.sample.r_position = positions[3].load(std::memory_order_relaxed);
+            out.sample.valid_mask = valid_mask.load(std::memory_order_relaxed);
+            
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == seq1) {
+                return out;
+            }
+        }
+    }
+};
+
+// What the publisher sends: the combined stream, per-axis topics, or both
+enum AxisTopicMode {
+    AXIS_TOPICS_OFF = 0,
+    AXIS_TOPICS_ON,        // Combined and per-axis
+    AXIS_TOPICS_ONLY       // Per-axis only
+};
+
 // Pre-allocated string buffer to avoid malloc in hot path
 class FastStringBuffer {
 private:
@@ -148,6 +313,36 @@ public:
         return buffer.data();
     }
     
+    // Timestamp and the axes in axis_mask (X=1, Y=2, Z=4, R=8), same field format
+    const char* format_axes(const PositionSample& sample, uint8_t axis_mask) {
+        const int32_t values[4] = {sample.x_position, sample.y_position, sample.z_position, sample.r_position};
+        int pos = uint64_to_string(sample.timestamp_ns, buffer.data());
+        for (int a = 0; a < 4; ++a) {
+            if (!(axis_mask & (1 << a))) continue;
+            buffer[pos++] = '/';
+            if (sample.valid_mask & (1 << a)) {
+                pos += int32_to_string(values[a], buffer.data() + pos);
+            } else {
+                buffer[pos++] = 'N'; buffer[pos++] = 'a'; buffer[pos++] = 'N';
+            }
+        }
+        buffer[pos] = '\0';
+        return buffer.data();
+    }
+    
+    // Per-axis topic line: offset from the batch base timestamp and one position
+    const char* format_axis_sample(uint64_t offset_ns, int32_t value, bool valid) {
+        int pos = uint64_to_string(offset_ns, buffer.data());
+        buffer[pos++] = '/';
+        if (valid) {
+            pos += int32_to_string(value, buffer.data() + pos);
+        } else {
+            buffer[pos++] = 'N'; buffer[pos++] = 'a'; buffer[pos++] = 'N';
+        }
+        buffer[pos] = '\0';
+        return buffer.data();
+    }
+    
 private:
     int uint64_to_string(uint64_t value, char* buf) {
         if (value == 0) {
@@ -194,16 +389,380 @@ private:
     }
 };
 
+// Monotonic clock for latency measurement (not affected by wall-clock steps)
+inline uint64_t get_monotonic_ns() {
+    auto duration = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+// Prometheus histogram bucket upper bounds (nanoseconds, exported in seconds)
+const uint64_t HISTOGRAM_BOUNDS_NS[] = {
+    10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 100000000
+};
+const int HISTOGRAM_NUM_BOUNDS = sizeof(HISTOGRAM_BOUNDS_NS) / sizeof(HISTOGRAM_BOUNDS_NS[0]);
+
+// Lock-free latency histogram (writers never block, scrapes read relaxed counts)
+class LatencyHistogram {
+private:
+    std::array<std::atomic<uint64_t>, HISTOGRAM_NUM_BOUNDS + 1> counts;  // Last bucket is +Inf
+    std::atomic<uint64_t> sum_ns{0};
+    
+public:
+    LatencyHistogram() {
+        for (auto& c : counts) c.store(0, std::memory_order_relaxed);
+    }
+    
+    void observe_ns(uint64_t ns) {
+        int bucket = 0;
+        while (bucket < HISTOGRAM_NUM_BOUNDS && ns > HISTOGRAM_BOUNDS_NS[bucket]) {
+            bucket++;
+        }
+        counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+    
+    // Append cumulative buckets, sum and count in Prometheus text format
+    void write_prometheus(std::ostream& out, const std::string& name, const std::string& labels) const {
+        std::string sep = labels.empty() ? "" : ",";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < HISTOGRAM_NUM_BOUNDS; ++i) {
+            cumulative += counts[i].load(std::memory_order_relaxed);
+            out << name << "_bucket{" << labels << sep << "le=\"" 
+                << (HISTOGRAM_BOUNDS_NS[i] / 1e9) << "\"} " << cumulative << "\n";
+        }
+        cumulative += counts[HISTOGRAM_NUM_BOUNDS].load(std::memory_order_relaxed);
+        out << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << cumulative << "\n";
+        out << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " " 
+            << (sum_ns.load(std::memory_order_relaxed) / 1e9) << "\n";
+        out << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << cumulative << "\n";
+    }
+};
+
+// Command types counted for metrics (index into g_command_counts)
+enum CommandType {
+    CMD_STATUS = 0,
+    CMD_SET_RATE,
+    CMD_SET_AMP,
+    CMD_SET_FREQ,
+    CMD_MOVE,
+    CMD_STOP,
+    CMD_MOVE_VEL,
+    CMD_SET_APPROACH,
+    CMD_MOVE_QUEUE,
+    CMD_TRACE,
+    CMD_RECORD,
+    CMD_GET_HISTORY,
+    CMD_SNAPSHOT,
+    CMD_MULTICAST,
+    CMD_AXIS_TOPICS,
+    CMD_SET_AXIS_RATE,
+    CMD_PICO,
+    CMD_IMAGE,
+    CMD_ALIGN,
+    CMD_TRIGGER,
+    CMD_STATS,
+    CMD_BENCH,
+    CMD_UNKNOWN,
+    CMD_TYPE_COUNT
+};
+const char* const COMMAND_TYPE_NAMES[CMD_TYPE_COUNT] = {
+    "STATUS", "SET_RATE", "SET_AMP", "SET_FREQ", "MOVE", "STOP", "MOVE_VEL", "SET_APPROACH", "MOVE_QUEUE", "TRACE", "RECORD", "GET_HISTORY", "SNAPSHOT", "MULTICAST", "AXIS_TOPICS", "SET_AXIS_RATE", "PICO", "IMAGE", "ALIGN", "TRIGGER", "STATS", "BENCH", "UNKNOWN"
+};
+
+// Queued command with identity for result correlation and tracing
+struct QueuedCommand {
+    std::string text;
+    uint64_t id;               // Monotonic command sequence number
+    uint64_t received_ns;      // Monotonic receive time (MQTT callback)
+};
+
+// Lifecycle tracing (Chrome/Perfetto trace JSON). Each thread owns one ring.
+enum TraceThread {
+    TRACE_SAMPLER = 0,
+    TRACE_PUBLISHER,
+    TRACE_COMMAND,
+    TRACE_MQTT,
+    TRACE_THREAD_COUNT
+};
+const char* const TRACE_THREAD_NAMES[TRACE_THREAD_COUNT] = {
+    "sampler", "batch_publisher", "command_processor", "mqtt_callback"
+};
+
+enum TraceEventName {
+    TR_TICK = 0,
+    TR_GET_POSITION_X,         // TR_GET_POSITION_X + logical axis
+    TR_GET_POSITION_Y,
+    TR_GET_POSITION_Z,
+    TR_GET_POSITION_R,
+    TR_ENQUEUE,
+    TR_DEQUEUE,
+    TR_ENCODE,
+    TR_PUBLISH,
+    TR_SAMPLE_FLOW,
+    TR_MQTT_RECEIVE,
+    TR_CMD_PARSE,
+    TR_CMD_EXECUTE,
+    TR_COMMAND_FLOW,
+    TR_ECC_TARGET_POSITION,
+    TR_ECC_MOVE,
+    TR_ECC_AMPLITUDE,
+    TR_ECC_FREQUENCY,
+    TR_NAME_COUNT
+};
+const char* const TRACE_EVENT_NAMES[TR_NAME_COUNT] = {
+    "tick", "ECC_getPosition X", "ECC_getPosition Y", "ECC_getPosition Z", "ECC_getPosition R",
+    "ring enqueue", "ring dequeue", "encode", "publish", "sample",
+    "mqtt receive", "parse", "execute", "command",
+    "ECC_controlTargetPosition", "ECC_controlMove", "ECC_controlAmplitude", "ECC_controlFrequency"
+};
+
+const uint8_t TRACE_SAMPLE_FLAG = 0x80;   // valid_mask bit marking a traced sample (not an axis)
+const size_t TRACE_BUFFER_EVENTS = 1 << 16;  // Per thread, power of two
+
+struct TraceEvent {
+    uint64_t start_ns;         // Monotonic
+    uint64_t id;               // Sample timestamp or command id
+    uint32_t duration_ns;
+    uint16_t name;             // TraceEventName
+    char phase;                // 'X' complete, 'i' instant, 's'/'f' flow start/end
+};
+
+// Single-writer trace ring: the owning thread records, dumps copy a consistent tail
+class TraceBuffer {
+private:
+    std::array<TraceEvent, TRACE_BUFFER_EVENTS> events;
+    alignas(64) std::atomic<uint64_t> write_count{0};
+    
+public:
+    void record(uint16_t name, char phase, uint64_t start_ns, uint64_t end_ns, uint64_t id) {
+        uint64_t n = write_count.load(std::memory_order_relaxed);
+        TraceEvent& ev = events[n & (TRACE_BUFFER_EVENTS - 1)];
+        ev.start_ns = start_ns;
+        ev.id = id;
+        ev.duration_ns = static_cast<uint32_t>(std::min<uint64_t>(end_ns - start_ns, UINT32_MAX));
+        ev.name = name;
+        ev.phase = phase;
+        write_count.store(n + 1, std::memory_order_release);
+    }
+    
+    // Copy retained events, discarding any the writer may have overwritten meanwhile
+    void snapshot(std::vector<TraceEvent>& out) const {
+        uint64_t end = write_count.load(std::memory_order_acquire);
+        uint64_t begin = (end > TRACE_BUFFER_EVENTS) ? end - TRACE_BUFFER_EVENTS : 0;
+        std::vector<TraceEvent> copy;
+        copy.reserve(end - begin);
+        for (uint64_t i = begin; i < end; ++i) {
+            copy.push_back(events[i & (TRACE_BUFFER_EVENTS - 1)]);
+        }
+        uint64_t after = write_count.load(std::memory_order_acquire);
+        uint64_t safe_begin = (after > TRACE_BUFFER_EVENTS) ? after - TRACE_BUFFER_EVENTS : 0;
+        for (uint64_t i = std::max(begin, safe_begin); i < end; ++i) {
+            out.push_back(copy[i - begin]);
+        }
+    }
+    
+    uint64_t recorded() const {
+        return write_count.load(std::memory_order_relaxed);
+    }
+};
+
+// Last-value-wins setpoint for one axis (written by the MQTT callback, read by the streamer)
+struct SetpointSlot {
+    std::atomic<uint64_t> sequence{0};     // Incremented for every received setpoint
+    std::atomic<int32_t> target{0};
+    std::atomic<uint64_t> received_ns{0};  // Monotonic receive time of the latest setpoint
+};
+
+// Host-side trapezoidal velocity profile (positions in nm/µ°, time in seconds)
+struct MotionProfile {
+    int32_t start = 0;
+    int32_t target = 0;
+    double max_velocity = 0;
+    double max_accel = 0;
+    double accel_time = 0;
+    double cruise_time = 0;
+    double peak_velocity = 0;
+    double total_time = 0;
+    
+    void plan(int32_t from, int32_t to, double v_max, double a_max) {
+        start = from;
+        target = to;
+        max_velocity = v_max;
+        max_accel = a_max;
+        
+        double distance = std::abs(static_cast<double>(to) - from);
+        accel_time = v_max / a_max;
+        double accel_distance = 0.5 * a_max * accel_time * accel_time;
+        
+        if (2 * accel_distance >= distance) {
+            // Triangular: never reaches v_max
+            accel_time = std::sqrt(distance / a_max);
+            cruise_time = 0;
+            peak_velocity = a_max * accel_time;
+        } else {
+            cruise_time = (distance - 2 * accel_distance) / v_max;
+            peak_velocity = v_max;
+        }
+        total_time = 2 * accel_time + cruise_time;
+    }
+    
+    int32_t position_at(double t) const {
+        if (t <= 0) return start;
+        if (t >= total_time) return target;
+        
+        double travelled;
+        if (t < accel_time) {
+            travelled = 0.5 * max_accel * t * t;
+        } else if (t < accel_time + cruise_time) {
+            travelled = 0.5 * max_accel * accel_time * accel_time + peak_velocity * (t - accel_time);
+        } else {
+            double remaining = total_time - t;
+            double distance = std::abs(static_cast<double>(target) - start);
+            travelled = distance - 0.5 * max_accel * remaining * remaining;
+        }
+        
+        double direction = (target >= start) ? 1.0 : -1.0;
+        return static_cast<int32_t>(std::lround(start + direction * travelled));
+    }
+};
+
+// Active MOVE supervised from the sample stream (owned by the setpoint streamer after hand-off)
+struct TrackedMove {
+    bool active = false;
+    bool approach = false;         // Unidirectional approach policy applies
+    bool staged = false;           // Still heading for the overshoot point
+    int32_t start = 0;
+    int32_t via = 0;
+    int32_t target = 0;
+    int32_t target_range = 0;
+    int32_t amplitude_mv = 0;      // Drive parameters for the move-time model
+    int32_t frequency_mhz = 0;
+    double eta_s = 0;
+    double timeout_s = 0;
+    uint64_t start_ns = 0;
+    uint64_t final_leg_ns = 0;     // When the final target was written
+    uint64_t in_range_since_ns = 0;
+    uint64_t checked_ns = 0;       // Last timeout check
+    uint64_t frozen_ns = 0;        // Time without fresh samples, not counted against the timeout
+};
+
+// Motion hand-off from the command thread to the setpoint streamer
+struct MotionRequest {
+    bool start = false;            // Start the MOVE_VEL profile
+    bool start_tracking = false;   // Supervise a MOVE until it settles
+    bool cancel = false;
+    MotionProfile profile;
+    int32_t target_range = 0;
+    TrackedMove tracked;
+    std::string cancel_reason;
+};
+
+// Sampler-side trigger for the next MOVE_QUEUE target. The setpoint streamer arms it;
+// the sampler writes the next target on the first tick that sees the current one in range.
+enum QueueArmState { ARM_IDLE, ARM_ARMED, ARM_FIRING, ARM_FIRED, ARM_FAILED };
+
+struct QueueArm {
+    std::atomic<int> state{ARM_IDLE};
+    std::atomic<int32_t> current{0};   // Target being approached
+    std::atomic<int32_t> range{0};
+    std::atomic<int32_t> next{0};
+    std::atomic<uint64_t> fired_ns{0}; // Monotonic time of the sample that triggered the write
+};
+
+// Compressed block of the in-memory history, immutable once published
+struct HistoryBlock {
+    ArchiveBlockIndex index;       // Column offsets relative to data
+    std::vector<uint8_t> data;
+};
+
+// Validated GET_HISTORY request, answered by the history query thread
+struct HistoryQuery {
+    uint64_t request_id = 0;
+    uint64_t t0 = 0;
+    uint64_t t1 = 0;
+    uint32_t decimation = 1;
+    bool binary = false;
+};
+
+// Flight recorder trigger; triggers during a capture are merged into it
+struct SnapshotTrigger {
+    uint64_t timestamp_ns;         // Epoch, same clock as the samples
+    std::string reason;
+    bool manual;                   // SNAPSHOT command, not subject to the holdoff
+};
+
+// Axis status flags polled by the flight recorder, per logical axis
+const uint8_t SNAPSHOT_FLAG_EOT_FWD = 1;
+const uint8_t SNAPSHOT_FLAG_EOT_BKWD = 2;
+const uint8_t SNAPSHOT_FLAG_ERROR = 4;
+const uint8_t SNAPSHOT_FLAG_IN_TARGET = 8;
+const uint8_t SNAPSHOT_FLAG_DISCONNECTED = 0x80;
+
+struct SnapshotStatus {
+    uint64_t timestamp_ns;
+    uint8_t flags[4];
+};
+
+// Connection of the TCP stream server
+struct StreamClient {
+    int fd = -1;
+    bool subscribed = false;
+    bool binary = false;
+    uint8_t axis_mask = 0x0F;
+    uint32_t decimation = 1;
+    uint64_t next_index = 0;       // Stream index of the next sample to send
+    bool want_write = false;       // EPOLLOUT registered
+    std::string input;             // SUBSCRIBE line so far
+    std::string output;            // Unsent bytes from output_offset on
+    size_t output_offset = 0;
+};
+
+// Per-axis unidirectional approach policy and target range tuning state
+struct ApproachConfig {
+    int direction = 0;             // +1: final approach moving positive, -1: negative, 0: off
+    int32_t overshoot = APPROACH_DEFAULT_OVERSHOOT;
+    int32_t min_range = APPROACH_DEFAULT_MIN_RANGE;
+    int32_t max_range = 0;
+    int32_t tuned_range = 0;       // Target range used for the next approach
+    uint32_t settles = 0;
+    double last_settle_s = 0;
+};
+
 // Global variables
 std::atomic<bool> g_running(true);
 std::atomic<bool> g_controllers_connected(false);
 std::atomic<bool> g_mqtt_connected(false);
+std::atomic<bool> g_sampler_paused(false);   // Set by BENCH to get exclusive bus access
+std::atomic<bool> g_sampler_idle(false);     // Sampler acknowledges the pause
+std::atomic<int> g_bench_recommended_rate_hz{0};  // 0 until a BENCH has been run
+std::atomic<bool> g_streamer_paused(false);  // Set by BENCH so no target writes share the bus with it
+std::atomic<bool> g_streamer_idle(false);    // Streamer acknowledges the pause
+std::atomic<bool> g_bench_running(false);    // A BENCH worker owns the bus
+std::atomic<const char*> g_bench_abort_reason(nullptr);  // Command that aborted the running BENCH
 std::mutex g_command_mutex;
-std::queue<std::string> g_command_queue;  // Simplified command structure
+std::deque<QueuedCommand> g_command_queue;  // Pending MOVEs may be superseded in place
+std::atomic<uint64_t> g_next_command_id{1};
 std::mutex g_error_mutex;
 
 // High-performance buffers
-LockFreeBuffer g_position_buffer;
+LockFreeBuffer<> g_position_buffer;
+LockFreeBuffer<RECORD_BUFFER_SAMPLES> g_record_buffer;  // Sampler -> recorder, filled only while recording
+SeqlockSample g_latest_sample;     // Written by the sampler every tick
+ShmWriter g_shm_writer;            // Same-host readers (ecc_shm.h), written by the sampler every tick
+std::array<SetpointSlot, 4> g_setpoints;                // Per logical axis X, Y, Z, R
+std::array<std::atomic<bool>, 4> g_closed_loop_enabled;  // ECC_controlMove state as set by this program
+std::array<std::atomic<bool>, 4> g_axis_motion_active;   // MOVE, MOVE_VEL or MOVE_QUEUE supervised by the streamer
+std::array<std::mutex, 4> g_axis_write_mutex;        // Target/closed-loop writes from commands and the streamer
+std::mutex g_motion_mutex;                           // Taken after g_axis_write_mutex when both are held
+std::array<MotionRequest, 4> g_motion_requests;       // Guarded by g_motion_mutex
+std::array<ApproachConfig, 4> g_approach_config;      // Guarded by g_motion_mutex
+std::array<MoveTimeModel, 4> g_move_models;           // Guarded by g_motion_mutex
+std::array<std::deque<int32_t>, 4> g_move_queues;     // Pending MOVE_QUEUE targets, guarded by g_motion_mutex
+std::array<QueueArm, 4> g_queue_arms;
+std::array<std::atomic<int32_t>, 4> g_saved_target_range;  // Put back after an approach MOVE, 0 = none
+std::array<std::atomic<int32_t>, 4> g_drive_amplitude_mv;   // Last known drive parameters, 0 = not read yet
+std::array<std::atomic<int32_t>, 4> g_drive_frequency_mhz;
 thread_local FastStringBuffer g_string_buffer;
 
 // MQTT client
@@ -226,6 +785,202 @@ std::atomic<uint64_t> g_samples_dropped{0};
 std::atomic<uint64_t> g_total_captured{0};
 std::atomic<uint64_t> g_total_published{0};
 std::atomic<uint64_t> g_total_dropped{0};
+std::atomic<int> g_axis_topic_mode{AXIS_TOPICS_OFF};
+std::array<std::atomic<int>, 4> g_axis_rate_hz{{{0}, {0}, {0}, {0}}};       // SET_AXIS_RATE, 0 = every tick
+std::array<std::atomic<uint64_t>, 4> g_axis_schedule{{{1ull << 32}, {1ull << 32}, {1ull << 32}, {1ull << 32}}};  // divider << 32 | phase
+std::array<std::atomic<uint32_t>, 4> g_axis_decimation{{{1}, {1}, {1}, {1}}};  // Per-axis topics, X, Y, Z, R
+
+// Metrics (scraped by the HTTP server on TCP_PORT)
+std::array<LatencyHistogram, 4> g_ecc_position_latency;  // Per logical axis X, Y, Z, R
+std::array<LatencyHistogram, CMD_TYPE_COUNT> g_command_latency;  // Handler execution (ECC calls + result)
+LatencyHistogram g_mqtt_publish_latency;                 // mosquitto_publish for position batches
+std::atomic<uint64_t> g_ecc_position_errors{0};
+std::atomic<uint64_t> g_missed_deadlines{0};
+std::atomic<uint64_t> g_batches_published{0};
+std::atomic<uint64_t> g_axis_messages_published{0};  // Per-axis topic messages
+std::atomic<uint64_t> g_publish_failures{0};
+std::atomic<uint64_t> g_mqtt_connects{0};
+std::atomic<uint64_t> g_mqtt_disconnects{0};
+std::atomic<size_t> g_command_queue_depth{0};
+std::atomic<uint64_t> g_commands_superseded{0};     // Queued MOVEs replaced by a newer MOVE
+std::atomic<uint64_t> g_moves_completed{0};
+std::atomic<uint64_t> g_moves_timed_out{0};         // Exceeded the move-time model bound
+std::array<std::atomic<uint64_t>, CMD_TYPE_COUNT> g_command_counts;
+std::atomic<uint64_t> g_metrics_scrapes{0};
+std::atomic<uint64_t> g_latest_sample_hits{0};       // Position queries served from the sampler
+std::atomic<uint64_t> g_latest_sample_fallbacks{0};  // Queries that had to call ECC_getPosition
+std::atomic<uint64_t> g_setpoints_received{0};
+std::atomic<uint64_t> g_setpoints_written{0};
+std::atomic<uint64_t> g_setpoints_coalesced{0};      // Superseded before being written
+std::atomic<uint64_t> g_setpoint_errors{0};
+LatencyHistogram g_setpoint_write_latency;           // MQTT receive -> ECC_controlTargetPosition done
+LatencyHistogram g_setpoint_motion_latency;          // MQTT receive -> sampler sees motion towards target
+std::atomic<uint64_t> g_queue_steps{0};              // MOVE_QUEUE targets reached
+LatencyHistogram g_queue_transition_latency;         // In-range sample -> next target written
+
+// Binary recorder (Thread 6)
+std::atomic<bool> g_recording{false};
+std::mutex g_record_mutex;
+std::string g_record_directory = RECORD_DEFAULT_DIRECTORY;  // Guarded by g_record_mutex
+std::string g_record_segment;                               // Current segment path, guarded by g_record_mutex
+std::string g_record_error;                                 // Last writer error, guarded by g_record_mutex
+std::atomic<uint64_t> g_record_samples{0};
+std::atomic<uint64_t> g_record_dropped{0};   // Recorder buffer full or no segment could be opened
+std::atomic<uint64_t> g_record_segments{0};
+std::vector<FusedRecord> g_record_fused;                    // From the aligner while recording, guarded by g_record_mutex
+std::string g_record_fused_path;                            // Current fused file, guarded by g_record_mutex
+std::atomic<uint64_t> g_record_fused_records{0};
+
+// In-memory history (Thread 7). The sampler only touches g_history_buffer; the mutex is
+// shared by the history thread and GET_HISTORY, which copy block pointers and decode unlocked.
+LockFreeBuffer<HISTORY_BUFFER_SAMPLES> g_history_buffer;
+std::mutex g_history_mutex;
+std::deque<std::shared_ptr<const HistoryBlock>> g_history_blocks;  // Oldest first, guarded by g_history_mutex
+std::atomic<uint64_t> g_history_samples{0};     // Currently held
+std::atomic<uint64_t> g_history_bytes{0};
+std::atomic<uint64_t> g_history_first_ns{0};    // Oldest sample held, 0 if empty
+std::atomic<uint64_t> g_history_dropped{0};     // History buffer full
+std::atomic<uint64_t> g_history_queries{0};
+std::mutex g_history_query_mutex;
+std::deque<HistoryQuery> g_history_query_queue;  // Guarded by g_history_query_mutex
+
+// Flight recorder (Thread 8)
+LockFreeBuffer<SNAPSHOT_BUFFER_SAMPLES> g_snapshot_buffer;
+std::mutex g_snapshot_mutex;
+std::vector<SnapshotTrigger> g_snapshot_triggers;   // Pending, guarded by g_snapshot_mutex
+std::string g_snapshot_last;                        // Last snapshot directory, guarded by g_snapshot_mutex
+std::atomic<uint64_t> g_snapshots_written{0};
+std::atomic<uint64_t> g_snapshot_triggers_suppressed{0};  // Automatic triggers within the holdoff
+std::atomic<uint64_t> g_snapshot_dropped{0};        // Flight recorder buffer full
+
+// TCP stream server (Thread 9)
+LockFreeBuffer<STREAM_BUFFER_SAMPLES, IndexedSample> g_stream_buffer;  // Filled only while clients are subscribed
+std::atomic<int> g_stream_clients{0};               // Subscribed clients
+std::atomic<uint64_t> g_stream_bytes_sent{0};
+std::atomic<uint64_t> g_stream_slow_disconnects{0};
+std::atomic<uint64_t> g_stream_dropped{0};          // Stream buffer full
+
+// UDP multicast sink (Thread 10)
+LockFreeBuffer<MULTICAST_BUFFER_SAMPLES, IndexedSample> g_multicast_buffer;  // Filled only while the sink is on
+std::atomic<bool> g_multicast_enabled{false};
+std::atomic<uint64_t> g_multicast_generation{0};             // Bumped by every MULTICAST/ON
+std::mutex g_multicast_mutex;
+std::string g_multicast_group = MULTICAST_DEFAULT_GROUP;    // Guarded by g_multicast_mutex
+uint16_t g_multicast_port = MULTICAST_DEFAULT_PORT;         // Guarded by g_multicast_mutex
+uint16_t g_multicast_samples = MULTICAST_DEFAULT_SAMPLES;   // Per packet, guarded by g_multicast_mutex
+std::string g_multicast_interface;                          // Empty: default route, guarded by g_multicast_mutex
+std::string g_multicast_error;                              // Last socket error, guarded by g_multicast_mutex
+std::atomic<uint64_t> g_multicast_packets{0};
+std::atomic<uint64_t> g_multicast_samples_sent{0};
+std::atomic<uint64_t> g_multicast_send_errors{0};
+std::atomic<uint64_t> g_multicast_dropped{0};       // Multicast buffer full
+
+// Picoammeter channel (Thread 11)
+enum PicoMode { PICO_SINGLE = 0, PICO_BURST = 1, PICO_TRIGGERED = 2 };
+std::atomic<bool> g_pico_enabled{false};
+std::atomic<bool> g_pico_armed{false};                      // Triggered mode: burst armed, waiting for a trigger
+std::atomic<bool> g_pico_reconfigure{false};                // Settings changed while on
+std::mutex g_pico_mutex;
+std::string g_pico_device = PICO_DEFAULT_DEVICE;            // Guarded by g_pico_mutex
+int g_pico_baud = PICO_DEFAULT_BAUD;                        // Guarded by g_pico_mutex
+int g_pico_mode = PICO_SINGLE;                              // Guarded by g_pico_mutex
+uint32_t g_pico_points = PICO_DEFAULT_POINTS;               // Guarded by g_pico_mutex
+double g_pico_nplc = PICO_DEFAULT_NPLC;                     // Guarded by g_pico_mutex
+std::string g_pico_identity;                                // *IDN? reply, guarded by g_pico_mutex
+std::string g_pico_error;                                   // Last driver error, guarded by g_pico_mutex
+std::atomic<uint64_t> g_pico_readings{0};
+std::atomic<uint64_t> g_pico_messages{0};
+std::atomic<uint64_t> g_pico_errors{0};
+
+// Live image builder (Thread 12)
+std::atomic<bool> g_image_enabled{false};
+std::atomic<uint32_t> g_image_scan_id{0};                   // Incremented by every IMAGE/START
+std::atomic<bool> g_image_refresh{false};                   // Resend all tiles
+std::mutex g_image_mutex;
+ScanGrid g_image_grid;                                      // Guarded by g_image_mutex
+std::vector<FusedRecord> g_image_fused;                     // From the aligner, guarded by g_image_mutex
+std::atomic<uint64_t> g_image_pairs{0};                     // Binned into the grid
+std::atomic<uint64_t> g_image_outside{0};                   // Position outside the grid
+std::atomic<uint64_t> g_image_unmatched{0};                 // Image axis invalid at the reading
+std::atomic<uint64_t> g_image_updates{0};                   // Tile update messages published
+
+// Position/detector alignment (Thread 13), runs while the picoammeter is on
+LockFreeBuffer<ALIGN_BUFFER_SAMPLES> g_align_buffer;        // Filled only while the picoammeter is on
+std::atomic<bool> g_align_reconfigure{false};
+std::mutex g_align_mutex;
+int g_align_method = ALIGN_LINEAR;                          // Guarded by g_align_mutex
+uint32_t g_align_latency_ms = ALIGN_DEFAULT_LATENCY_MS;     // Guarded by g_align_mutex
+std::vector<CurrentReading> g_align_readings;               // From the picoammeter, guarded by g_align_mutex
+std::atomic<uint64_t> g_align_fused{0};
+std::atomic<uint64_t> g_align_late{0};                      // Older than the positions held
+std::atomic<uint64_t> g_align_expired{0};                   // No samples after the reading within the budget
+std::atomic<uint64_t> g_align_gaps{0};                      // Sampler gap around the reading
+std::atomic<uint64_t> g_align_dropped{0};                   // Alignment buffer or a backlog full
+std::atomic<uint64_t> g_align_pending{0};                   // Readings waiting for positions
+
+// Position triggers, evaluated by the sampler; markers published by Thread 14
+std::mutex g_trigger_mutex;                                 // The sampler only ever try_locks it
+std::vector<TriggerSpec> g_trigger_specs;                   // Guarded by g_trigger_mutex
+std::atomic<uint64_t> g_trigger_version{0};                 // Incremented on every table change
+TriggerBank g_trigger_bank;                                 // Sampler's copy of the table, sampler only
+LockFreeBuffer<TRIGGER_EVENT_BUFFER, TriggerEvent> g_trigger_events;
+std::atomic<uint64_t> g_trigger_burst_request{0};           // Monotonic time of the crossing, 0 = none
+std::array<std::atomic<uint64_t>, 3> g_trigger_fired{{{0}, {0}, {0}}};  // By action
+std::atomic<uint64_t> g_trigger_bursts_missed{0};           // BURST while no burst was armed
+std::atomic<uint64_t> g_trigger_dropped{0};                 // Event buffer full
+LatencyHistogram g_trigger_burst_latency;                   // Crossing sample -> INIT written
+LatencyHistogram g_trigger_marker_latency;                  // Crossing sample -> marker published
+
+// Rolling axis statistics (Thread 15)
+LockFreeBuffer<STATS_BUFFER_SAMPLES> g_stats_buffer;        // Filled only while statistics are on
+std::atomic<bool> g_stats_enabled{true};
+std::atomic<bool> g_stats_reconfigure{false};
+std::mutex g_stats_mutex;
+std::vector<uint32_t> g_stats_windows_s = {1, 10, 60};      // Guarded by g_stats_mutex
+uint32_t g_stats_interval_ms = STATS_DEFAULT_INTERVAL_MS;   // Guarded by g_stats_mutex
+std::vector<StatsMoments> g_stats_latest;                   // Axis-major, one per window; guarded by g_stats_mutex
+std::vector<uint32_t> g_stats_latest_windows_s;             // Windows of g_stats_latest, guarded by g_stats_mutex
+std::atomic<uint64_t> g_stats_messages{0};
+std::atomic<uint64_t> g_stats_dropped{0};                   // Statistics buffer full
+
+// Tracing state (g_trace_every_n == 0 disables tracing)
+std::atomic<uint32_t> g_trace_every_n{0};
+std::array<TraceBuffer, TRACE_THREAD_COUNT> g_trace_buffers;
+
+inline bool trace_enabled() {
+    return g_trace_every_n.load(std::memory_order_relaxed) != 0;
+}
+
+inline void trace_complete(TraceThread thread, TraceEventName name, uint64_t start_ns, uint64_t end_ns, uint64_t id) {
+    g_trace_buffers[thread].record(name, 'X', start_ns, end_ns, id);
+}
+
+inline void trace_instant(TraceThread thread, TraceEventName name, uint64_t ts_ns, uint64_t id) {
+    g_trace_buffers[thread].record(name, 'i', ts_ns, ts_ns, id);
+}
+
+inline void trace_flow(TraceThread thread, TraceEventName name, char phase, uint64_t ts_ns, uint64_t id) {
+    g_trace_buffers[thread].record(name, phase, ts_ns, ts_ns, id);
+}
+
+// Records a complete event for the enclosing scope when tracing is enabled
+class TraceScope {
+private:
+    TraceThread thread;
+    TraceEventName name;
+    uint64_t id;
+    bool active;
+    uint64_t start_ns;
+    
+public:
+    TraceScope(TraceThread t, TraceEventName n, uint64_t event_id)
+        : thread(t), name(n), id(event_id), active(trace_enabled()), 
+          start_ns(active ? get_monotonic_ns() : 0) {}
+    
+    ~TraceScope() {
+        if (active) trace_complete(thread, name, start_ns, get_monotonic_ns(), id);
+    }
+};
 
 // Function prototypes
 bool initialize_controllers();
@@ -233,14 +988,46 @@ void cleanup_controllers();
 void high_speed_sampler_thread();      // Thread 1: Ultra-fast sampling
 void batch_publisher_thread();         // Thread 2: Batched MQTT publishing  
 void command_processor_thread();       // Thread 3: Command processing
+void metrics_http_thread();            // Thread 4: Prometheus /metrics endpoint
+void setpoint_streamer_thread();       // Thread 5: Rate-limited setpoint writes
+void recorder_thread();                // Thread 6: Binary recording to mmap segments
+void history_thread();                 // Thread 7: Compressed in-memory history
+void flight_recorder_thread();         // Thread 8: Snapshots around faults and commands
+void stream_server_thread();           // Thread 9: epoll TCP position stream
+void multicast_thread();               // Thread 10: UDP multicast sink
+void picoammeter_thread();             // Thread 11: Picoammeter readings
+void image_thread();                   // Thread 12: Live image assembly
+void align_thread();                   // Thread 13: Position/detector alignment
+void trigger_thread();                 // Thread 14: Position trigger markers
+void stats_thread();                   // Thread 15: Rolling axis statistics
+void history_query_thread();           // Thread 16: GET_HISTORY replies
 bool initialize_mqtt();
 void cleanup_mqtt();
 void mqtt_on_connect(struct mosquitto *mosq, void *userdata, int result);
 void mqtt_on_message(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message);
 void mqtt_on_disconnect(struct mosquitto *mosq, void *userdata, int rc);
-PositionSample read_all_positions_fast();
+PositionSample read_all_positions_fast(bool traced = false, uint8_t axes = 0x0F);
+void update_axis_schedule();
+uint8_t scheduled_axes(uint64_t tick);
 uint64_t get_nanosecond_timestamp();
 std::string get_axis_name(int controller, int axis);
+int get_logical_axis(int controller, int axis);
+bool parse_axis_name(const std::string& name, int& controller, int& axis);
+void handle_setpoint_message(const char* payload, int length);
+bool publish_axis_batches(const std::vector<PositionSample>& batch, uint64_t sequence, uint64_t counters[4]);
+int32_t get_sample_axis(const PositionSample& sample, int logical_axis);
+void set_sample_axis(PositionSample& sample, int logical_axis, int32_t value);
+bool get_current_position(int controller, int axis, Int32& position, uint64_t* age_ns = nullptr);
+Int32 get_target_range(int controller, int axis);
+void get_drive_parameters(int controller, int axis, int32_t& amplitude_mv, int32_t& frequency_mhz);
+CommandType classify_command(const std::string& cmd);
+std::string get_command_axis(const std::string& cmd);
+void publish_result(const std::string& command, const std::string& axis, 
+                    const std::string& status, const std::string& message);
+void cancel_motion(int logical_axis, const std::string& reason);
+void disarm_queue(int logical_axis);
+std::string render_metrics();
+std::string render_trace_json();
 
 // Optimized utility functions
 inline uint64_t get_nanosecond_timestamp() {
@@ -249,6 +1036,23 @@ inline uint64_t get_nanosecond_timestamp() {
     return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
 }
 
+// Timed ECC_getPosition for the sampler (latency recorded per logical axis)
+inline bool read_position_timed(int controller, int axis, int logical_axis, Int32& pos, 
+                                bool traced, uint64_t sample_id) {
+    uint64_t start = get_monotonic_ns();
+    bool ok = ECC_getPosition(g_controllers[controller].handle, axis, &pos) == 0;
+    uint64_t end = get_monotonic_ns();
+    g_ecc_position_latency[logical_axis].observe_ns(end - start);
+    if (traced) {
+        trace_complete(TRACE_SAMPLER, static_cast<TraceEventName>(TR_GET_POSITION_X + logical_axis), 
+                       start, end, sample_id);
+    }
+    if (!ok) {
+        g_ecc_position_errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ok;
+}
+
 std::string get_axis_name(int controller, int axis) {
     if (controller == 0) {
         if (axis == 0) return "X";
@@ -260,32 +1064,229 @@ std::string get_axis_name(int controller, int axis) {
     return "UNKNOWN";
 }
 
-// High-speed position reading (optimized for cache efficiency)
-PositionSample read_all_positions_fast() {
+// Logical axis index (X=0, Y=1, Z=2, R=3, matching valid_mask bits), -1 if unmapped
+int get_logical_axis(int controller, int axis) {
+    if (controller == 0 && axis >= 0 && axis < 3) return axis;
+    if (controller == 1 && axis == 0) return 3;
+    return -1;
+}
+
+// Map logical axis names to controller/axis numbers
+bool parse_axis_name(const std::string& name, int& controller, int& axis) {
+    if (name == "X") { controller = 0; axis = 0; return true; }
+    if (name == "Y") { controller = 0; axis = 1; return true; }
+    if (name == "Z") { controller = 0; axis = 2; return true; }
+    if (name == "R") { controller = 1; axis = 0; return true; }
+    return false;
+}
+
+int32_t get_sample_axis(const PositionSample& sample, int logical_axis) {
+    switch (logical_axis) {
+        case 0: return sample.x_position;
+        case 1: return sample.y_position;
+        case 2: return sample.z_position;
+        default: return sample.r_position;
+    }
+}
+
+void set_sample_axis(PositionSample& sample, int logical_axis, int32_t value) {
+    switch (logical_axis) {
+        case 0: sample.x_position = value; break;
+        case 1: sample.y_position = value; break;
+        case 2: sample.z_position = value; break;
+        default: sample.r_position = value; break;
+    }
+}
+
+// Age beyond which the latest sample no longer stands for the current position
+uint64_t latest_sample_max_age_ns() {
+    return std::max<uint64_t>(50000000ULL, 3ULL * g_sample_interval_ns.load());
+}
+
+// Move timeouts only run while the sample stream is live: with the sampler paused (BENCH)
+// or stalled, the streamer cannot see a stage arrive. Returns the live time since start_ns.
+double live_elapsed_s(uint64_t start_ns, uint64_t& checked_ns, uint64_t& frozen_ns, const LatestSample& latest, 
+                      uint64_t now_ns) {
+    if (now_ns <= start_ns) return 0;
+    uint64_t since = std::max(start_ns, checked_ns);
+    bool frozen = g_sampler_paused.load(std::memory_order_acquire) || latest.tick == 0 ||
+                  now_ns - std::min(now_ns, latest.monotonic_ns) > latest_sample_max_age_ns();
+    if (frozen && now_ns > since) frozen_ns += now_ns - since;
+    checked_ns = std::max(checked_ns, now_ns);
+    return (now_ns - start_ns - std::min(frozen_ns, now_ns - start_ns)) / 1e9;
+}
+
+// Position from the sampler's latest sample when fresh, otherwise a direct ECC read.
+// Avoids extra bus calls competing with the sampler.
+bool get_current_position(int controller, int axis, Int32& position, uint64_t* age_ns) {
+    int logical = get_logical_axis(controller, axis);
+    if (logical >= 0) {
+        LatestSample latest = g_latest_sample.load();
+        uint64_t age = get_monotonic_ns() - latest.monotonic_ns;
+        
+        if (latest.tick != 0 && (latest.sample.valid_mask & (1 << logical)) && age <= latest_sample_max_age_ns()) {
+            position = get_sample_axis(latest.sample, logical);
+            if (age_ns) *age_ns = age;
+            g_latest_sample_hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    
+    g_latest_sample_fallbacks.fetch_add(1, std::memory_order_relaxed);
+    if (age_ns) *age_ns = 0;
+    return ECC_getPosition(g_controllers[controller].handle, axis, &position) == 0;
+}
+
+// Controller target range, used as the in-range threshold for MOVE completion
+Int32 get_target_range(int controller, int axis) {
+    Int32 range = 0;
+    if (ECC_controlTargetRange(g_controllers[controller].handle, axis, &range, 0) != 0 || range <= 0) {
+        range = 1000;
+    }
+    return range;
+}
+
+// Drive amplitude and frequency, read from the controller once and then kept by SET_AMP/SET_FREQ
+void get_drive_parameters(int controller, int axis, int32_t& amplitude_mv, int32_t& frequency_mhz) {
+    int logical = get_logical_axis(controller, axis);
+    if (g_drive_amplitude_mv[logical] == 0) {
+        Int32 value = 0;
+        if (ECC_controlAmplitude(g_controllers[controller].handle, axis, &value, 0) == 0) g_drive_amplitude_mv[logical] = value;
+    }
+    if (g_drive_frequency_mhz[logical] == 0) {
+        Int32 value = 0;
+        if (ECC_controlFrequency(g_controllers[controller].handle, axis, &value, 0) == 0) g_drive_frequency_mhz[logical] = value;
+    }
+    amplitude_mv = g_drive_amplitude_mv[logical];
+    frequency_mhz = g_drive_frequency_mhz[logical];
+}
+
+CommandType classify_command(const std::string& cmd) {
+    if (cmd == "STATUS") return CMD_STATUS;
+    if (cmd.find("TRACE/") == 0) return CMD_TRACE;
+    if (cmd.find("RECORD/") == 0) return CMD_RECORD;
+    if (cmd.find("GET_HISTORY/") == 0) return CMD_GET_HISTORY;
+    if (cmd == "SNAPSHOT" || cmd.find("SNAPSHOT/") == 0) return CMD_SNAPSHOT;
+    if (cmd.find("MULTICAST/") == 0) return CMD_MULTICAST;
+    if (cmd.find("AXIS_TOPICS/") == 0) return CMD_AXIS_TOPICS;
+    if (cmd.find("SET_AXIS_RATE/") == 0) return CMD_SET_AXIS_RATE;
+    if (cmd.find("PICO/") == 0) return CMD_PICO;
+    if (cmd.find("IMAGE/") == 0) return CMD_IMAGE;
+    if (cmd.find("ALIGN/") == 0) return CMD_ALIGN;
+    if (cmd.find("TRIGGER/") == 0) return CMD_TRIGGER;
+    if (cmd.find("STATS/") == 0) return CMD_STATS;
+    if (cmd == "BENCH" || cmd.find("BENCH/") == 0) return CMD_BENCH;
+    if (cmd.find("SET_RATE/") == 0) return CMD_SET_RATE;
+    if (cmd.find("SET_AMP/") == 0) return CMD_SET_AMP;
+    if (cmd.find("SET_FREQ/") == 0) return CMD_SET_FREQ;
+    if (cmd.find("MOVE/") == 0) return CMD_MOVE;
+    if (cmd.find("MOVE_VEL/") == 0) return CMD_MOVE_VEL;
+    if (cmd.find("SET_APPROACH/") == 0) return CMD_SET_APPROACH;
+    if (cmd.find("MOVE_QUEUE/") == 0) return CMD_MOVE_QUEUE;
+    if (cmd.find("STOP/") == 0) return CMD_STOP;
+    return CMD_UNKNOWN;
+}
+
+// Axis token of per-axis commands ("MOVE/X/100" -> "X"), empty for global commands
+std::string get_command_axis(const std::string& cmd) {
+    CommandType type = classify_command(cmd);
+    if (type != CMD_MOVE && type != CMD_STOP && type != CMD_SET_AMP && type != CMD_SET_FREQ && 
+        type != CMD_MOVE_VEL && type != CMD_SET_APPROACH && type != CMD_MOVE_QUEUE) {
+        return "";
+    }
+    size_t start = cmd.find('/') + 1;
+    size_t end = cmd.find('/', start);
+    return cmd.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+// Ask the flight recorder to capture the window around now
+void request_snapshot(const std::string& reason, bool manual = false) {
+    SnapshotTrigger trigger;
+    trigger.timestamp_ns = get_nanosecond_timestamp();
+    trigger.reason = reason;
+    trigger.manual = manual;
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    g_snapshot_triggers.push_back(trigger);
+}
+
+// Publish "timestamp/COMMAND/<command>/<axis>/<status>/<message>" to the result topic
+void publish_result(const std::string& command, const std::string& axis, 
+                    const std::string& status, const std::string& message) {
+    if (!g_mqtt_connected) return;
+    std::string timestamp = std::to_string(get_nanosecond_timestamp());
+    std::string result_msg = timestamp + "/COMMAND/" + command + "/" + axis + "/" + status + "/" + message;
+    mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_RESULT.c_str(), 
+                    result_msg.length(), result_msg.c_str(), 1, false);
+}
+
+// Take back an armed MOVE_QUEUE target; waits out a write the sampler has already begun
+void disarm_queue(int logical_axis) {
+    QueueArm& arm = g_queue_arms[logical_axis];
+    int state = arm.state.load(std::memory_order_acquire);
+    while (true) {
+        if (state == ARM_FIRING) {
+            std::this_thread::yield();
+            state = arm.state.load(std::memory_order_acquire);
+        } else if (arm.state.compare_exchange_weak(state, ARM_IDLE, std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+}
+
+// Ask the setpoint streamer to abandon a running MOVE_VEL profile, tracked MOVE or
+// MOVE_QUEUE on this axis. Pending queue targets are dropped before the caller writes
+// its own target, so the sampler cannot overwrite it. A caller that writes afterwards
+// holds g_axis_write_mutex across both, which keeps the streamer out until it is done.
+void cancel_motion(int logical_axis, const std::string& reason) {
+    if (logical_axis < 0) return;
+    std::lock_guard<std::mutex> lock(g_motion_mutex);
+    disarm_queue(logical_axis);    // Under the mutex: the streamer arms only while holding it
+    g_move_queues[logical_axis].clear();
+    g_motion_requests[logical_axis].start = false;
+    g_motion_requests[logical_axis].start_tracking = false;
+    g_motion_requests[logical_axis].cancel = true;
+    g_motion_requests[logical_axis].cancel_reason = reason;
+}
+
+// Put back the target range an approach MOVE replaced with its tuned range. Called with
+// g_axis_write_mutex held, once the move has ended and before the range is read again.
+void restore_target_range(int logical_axis) {
+    Int32 range = g_saved_target_range[logical_axis].exchange(0);
+    if (range <= 0) return;
+    int controller = (logical_axis < 3) ? 0 : 1;
+    int axis = (logical_axis < 3) ? logical_axis : 0;
+    ECC_controlTargetRange(g_controllers[controller].handle, axis, &range, 1);
+}
+
+// High-speed position reading (optimized for cache efficiency). Only the logical axes in
+// axes are read; the sampler fills in the others from the previous tick.
+PositionSample read_all_positions_fast(bool traced, uint8_t axes) {
     PositionSample sample;
     sample.timestamp_ns = get_nanosecond_timestamp();
+    sample.read_mask = axes;
+    const uint64_t id = sample.timestamp_ns;  // Trace id follows the sample through the pipeline
     
     // Controller 0: X(axis0), Y(axis1), Z(axis2)
     if (g_controllers[0].connected) {
         Int32 pos;
-        if (g_controllers[0].axes_connected[0] && ECC_getPosition(g_controllers[0].handle, 0, &pos) == 0) {
+        if ((axes & 1) && g_controllers[0].axes_connected[0] && read_position_timed(0, 0, 0, pos, traced, id)) {
             sample.x_position = pos;
             sample.valid_mask |= 1;
         }
-        if (g_controllers[0].axes_connected[1] && ECC_getPosition(g_controllers[0].handle, 1, &pos) == 0) {
+        if ((axes & 2) && g_controllers[0].axes_connected[1] && read_position_timed(0, 1, 1, pos, traced, id)) {
             sample.y_position = pos;
             sample.valid_mask |= 2;
         }
-        if (g_controllers[0].axes_connected[2] && ECC_getPosition(g_controllers[0].handle, 2, &pos) == 0) {
+        if ((axes & 4) && g_controllers[0].axes_connected[2] && read_position_timed(0, 2, 2, pos, traced, id)) {
             sample.z_position = pos;
             sample.valid_mask |= 4;
         }
     }
     
     // Controller 1: R(axis0)
-    if (g_controllers[1].connected && g_controllers[1].axes_connected[0]) {
+    if ((axes & 8) && g_controllers[1].connected && g_controllers[1].axes_connected[0]) {
         Int32 pos;
-        if (ECC_getPosition(g_controllers[1].handle, 0, &pos) == 0) {
+        if (read_position_timed(1, 0, 3, pos, traced, id)) {
             sample.r_position = pos;
             sample.valid_mask |= 8;
         }
@@ -294,6 +1295,118 @@ PositionSample read_all_positions_fast() {
     return sample;
 }
 
+// Turns the SET_AXIS_RATE rates into dividers of the sampler tick (an axis is read every
+// divider-th tick) and staggers the phases so the slow axes share out the ticks: with X/Y
+// at full rate and Z, R at half rate, Z is read on even ticks and R on odd ones. Phases are
+// chosen greedily, fastest axis first, to keep the most reads on any one tick low over the
+// common period of all dividers.
+void update_axis_schedule() {
+    int tick_hz = g_sample_rate_hz.load();
+    uint32_t divider[4];
+    uint64_t period = 1;
+    for (int a = 0; a < 4; ++a) {
+        int hz = g_axis_rate_hz[a].load();
+        divider[a] = (hz <= 0 || hz >= tick_hz) ? 1 : static_cast<uint32_t>(std::lround(static_cast<double>(tick_hz) / hz));
+        uint64_t x = period, y = divider[a];
+        while (y) { uint64_t t = x % y; x = y; y = t; }
+        period = std::min<uint64_t>(period / x * divider[a], 1 << 16);
+    }
+    
+    int order[4] = {0, 1, 2, 3};
+    std::stable_sort(order, order + 4, [&divider](int a, int b) { return divider[a] < divider[b]; });
+    std::vector<int> load(period, 0);
+    uint32_t phase[4] = {0, 0, 0, 0};
+    for (int a : order) {
+        int best_peak = INT32_MAX;
+        long best_sum = 0;
+        for (uint32_t p = 0; p < divider[a]; ++p) {
+            int peak = 0;
+            long sum = 0;
+            for (uint64_t t = p; t < period; t += divider[a]) {
+                peak = std::max(peak, load[t]);
+                sum += load[t];
+            }
+            if (peak < best_peak || (peak == best_peak && sum < best_sum)) {
+                best_peak = peak;
+                best_sum = sum;
+                phase[a] = p;
+            }
+        }
+        for (uint64_t t = phase[a]; t < period; t += divider[a]) load[t]++;
+    }
+    
+    for (int a = 0; a < 4; ++a) {
+        g_axis_schedule[a].store((static_cast<uint64_t>(divider[a]) << 32) | phase[a], std::memory_order_relaxed);
+    }
+}
+
+// Logical axes due on this sampler tick
+uint8_t scheduled_axes(uint64_t tick) {
+    uint8_t axes = 0;
+    for (int a = 0; a < 4; ++a) {
+        uint64_t entry = g_axis_schedule[a].load(std::memory_order_relaxed);
+        uint32_t divider = static_cast<uint32_t>(entry >> 32);
+        if (divider <= 1 || tick % divider == (entry & 0xFFFFFFFFu)) axes |= 1 << a;
+    }
+    return axes;
+}
+
+// MOVE_QUEUE transitions: write the next target as soon as this tick shows the current
+// one in range, without waiting for the streamer or a client round trip
+void fire_queued_targets(const PositionSample& sample, uint64_t sample_ns) {
+    for (int logical = 0; logical < 4; ++logical) {
+        QueueArm& arm = g_queue_arms[logical];
+        if (arm.state.load(std::memory_order_acquire) != ARM_ARMED || !(sample.valid_mask & (1 << logical))) continue;
+        
+        int32_t position = get_sample_axis(sample, logical);
+        if (std::abs(position - arm.current.load(std::memory_order_relaxed)) > arm.range.load(std::memory_order_relaxed)) continue;
+        
+        int expected = ARM_ARMED;
+        if (!arm.state.compare_exchange_strong(expected, ARM_FIRING, std::memory_order_acq_rel)) continue;
+        
+        int controller = (logical < 3) ? 0 : 1;
+        int axis = (logical < 3) ? logical : 0;
+        Int32 next = arm.next.load(std::memory_order_relaxed);
+        bool ok = ECC_controlTargetPosition(g_controllers[controller].handle, axis, &next, 1) == 0;
+        g_queue_transition_latency.observe_ns(get_monotonic_ns() - sample_ns);
+        arm.fired_ns.store(sample_ns, std::memory_order_relaxed);
+        arm.state.store(ok ? ARM_FIRED : ARM_FAILED, std::memory_order_release);
+    }
+}
+
+// Position triggers (ecc_trigger.h): a crossing in this tick is acted on in this tick.
+// BURST starts the armed picoammeter burst; every crossing goes to the trigger thread as a
+// marker. Table changes are picked up with try_lock, so the sampler never waits for the
+// command thread; a tick that finds the mutex taken keeps the old table until the next.
+void evaluate_triggers(const PositionSample& sample, uint64_t sample_ns) {
+    if (g_trigger_version.load(std::memory_order_acquire) != g_trigger_bank.version() && g_trigger_mutex.try_lock()) {
+        g_trigger_bank.load(g_trigger_specs, g_trigger_version.load(std::memory_order_relaxed));
+        g_trigger_mutex.unlock();
+    }
+    if (g_trigger_bank.size() == 0) return;
+    
+    const int32_t position[4] = {sample.x_position, sample.y_position, sample.z_position, sample.r_position};
+    uint32_t reverse;
+    uint32_t fired = g_trigger_bank.evaluate(position, sample.valid_mask, reverse);
+    while (fired) {
+        int i = __builtin_ctz(fired);
+        fired &= fired - 1;
+        TriggerEvent event;
+        g_trigger_bank.fire(i, sample.timestamp_ns, sample_ns, position, (reverse >> i) & 1, event);
+        if (event.action == TRIGGER_BURST) {
+            if (g_pico_armed.load(std::memory_order_acquire)) {
+                g_trigger_burst_request.store(sample_ns, std::memory_order_release);
+            } else {
+                g_trigger_bursts_missed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        g_trigger_fired[event.action].fetch_add(1, std::memory_order_relaxed);
+        if (!g_trigger_events.try_write(event)) {
+            g_trigger_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
 // Ultra-high-speed sampling thread with real-time priority
 void high_speed_sampler_thread() {
     std::cout << "High-speed sampler thread started (" << g_sample_rate_hz << " Hz)\n";
@@ -313,23 +1426,102 @@ void high_speed_sampler_thread() {
     CPU_SET(1, &cpuset);  // Use CPU core 1
     pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
     
-    const auto target_interval = std::chrono::nanoseconds(g_sample_interval_ns);
     auto next_sample_time = std::chrono::high_resolution_clock::now();
     
     uint64_t sample_count = 0;
     uint64_t dropped_count = 0;
     uint64_t debug_counter = 0;
+    PositionSample last_sample;    // Source of held readings for axes not due this tick
+    IndexedSample stream_item;     // dropped_before counts up while the stream buffer is full
+    IndexedSample multicast_item;  // Same for the multicast buffer
     
     while (g_running && g_controllers_connected) {
-        // Read positions (extremely fast - ~50ns)
-        PositionSample sample = read_all_positions_fast();
+        // Yield the bus while a benchmark runs
+        if (g_sampler_paused.load(std::memory_order_acquire)) {
+            g_sampler_idle.store(true, std::memory_order_release);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            next_sample_time = std::chrono::high_resolution_clock::now();
+            continue;
+        }
+        g_sampler_idle.store(false, std::memory_order_relaxed);
+        
+        // Trace every Nth tick when tracing is enabled
+        uint32_t trace_every_n = g_trace_every_n.load(std::memory_order_relaxed);
+        bool traced = trace_every_n != 0 && (debug_counter % trace_every_n) == 0;
+        uint64_t tick_start = traced ? get_monotonic_ns() : 0;
+        
+        // Read positions (extremely fast - ~50ns), only the axes due this tick
+        uint8_t due = scheduled_axes(debug_counter);
+        PositionSample sample = read_all_positions_fast(traced, due);
+        if (traced) {
+            sample.valid_mask |= TRACE_SAMPLE_FLAG;
+        }
+        
+        // Axes not due this tick stay invalid in the sample handed on; only the latest-sample
+        // slot carries their last reading forward
+        PositionSample latest = sample;
+        uint8_t held = ~due & last_sample.valid_mask & 0x0F;
+        for (int a = 0; a < 4; ++a) {
+            if (!(held & (1 << a))) continue;
+            set_sample_axis(latest, a, get_sample_axis(last_sample, a));
+            latest.valid_mask |= 1 << a;
+        }
+        last_sample = latest;
+        
+        // Publish to the latest-sample slot for STATUS and command handlers
+        uint64_t sample_ns = get_monotonic_ns();
+        g_latest_sample.store(latest, sample_ns, debug_counter + 1);
+        if (g_shm_writer.is_open()) {
+            const int32_t positions[4] = {sample.x_position, sample.y_position, sample.z_position, sample.r_position};
+            g_shm_writer.publish(sample.timestamp_ns, positions, sample.valid_mask & 0x0F);
+        }
+        fire_queued_targets(sample, sample_ns);
+        evaluate_triggers(sample, sample_ns);
         
         // Debug output every 10000 samples (减少频率)
         if (++debug_counter % 10000 == 0) {
             std::cout << "Sampler: " << debug_counter << " samples processed\n";
         }
         
+        // Recorder gets its own copy; a stalled disk must never stall sampling
+        if (g_recording.load(std::memory_order_relaxed) && !g_record_buffer.try_write(sample)) {
+            g_record_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!g_history_buffer.try_write(sample)) {
+            g_history_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!g_snapshot_buffer.try_write(sample)) {
+            g_snapshot_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (g_stream_clients.load(std::memory_order_relaxed) > 0) {
+            stream_item.sample = sample;
+            if (g_stream_buffer.try_write(stream_item)) {
+                stream_item.dropped_before = 0;
+            } else {
+                stream_item.dropped_before++;
+                g_stream_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (g_multicast_enabled.load(std::memory_order_relaxed)) {
+            multicast_item.sample = sample;
+            if (g_multicast_buffer.try_write(multicast_item)) {
+                multicast_item.dropped_before = 0;
+            } else {
+                multicast_item.dropped_before++;
+                g_multicast_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        } else {
+            multicast_item.dropped_before = 0;    // A new session starts its index at 0
+        }
+        if (g_pico_enabled.load(std::memory_order_relaxed) && !g_align_buffer.try_write(sample)) {
+            g_align_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (g_stats_enabled.load(std::memory_order_relaxed) && !g_stats_buffer.try_write(sample)) {
+            g_stats_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        
         // Try to write to lock-free buffer
+        uint64_t enqueue_start = traced ? get_monotonic_ns() : 0;
         if (g_position_buffer.try_write(sample)) {
             sample_count++;
             g_total_captured.fetch_add(1, std::memory_order_relaxed);
@@ -338,12 +1530,21 @@ void high_speed_sampler_thread() {
             g_total_dropped.fetch_add(1, std::memory_order_relaxed);
         }
         
-        // Precise timing control
-        next_sample_time += target_interval;
+        if (traced) {
+            uint64_t tick_end = get_monotonic_ns();
+            trace_complete(TRACE_SAMPLER, TR_ENQUEUE, enqueue_start, tick_end, sample.timestamp_ns);
+            trace_flow(TRACE_SAMPLER, TR_SAMPLE_FLOW, 's', tick_end, sample.timestamp_ns);
+            trace_complete(TRACE_SAMPLER, TR_TICK, tick_start, tick_end, sample.timestamp_ns);
+        }
+        
+        // Precise timing control (interval re-read so SET_RATE applies immediately)
+        next_sample_time += std::chrono::nanoseconds(g_sample_interval_ns.load(std::memory_order_relaxed));
         
         // Busy wait for precision (last few microseconds)
         auto now = std::chrono::high_resolution_clock::now();
-        if (now < next_sample_time) {
+        if (now >= next_sample_time) {
+            g_missed_deadlines.fetch_add(1, std::memory_order_relaxed);
+        } else {
             // Hybrid sleep: coarse sleep + fine busy-wait
             auto sleep_time = next_sample_time - now;
             if (sleep_time > std::chrono::microseconds(100)) {
@@ -364,6 +1565,41 @@ void high_speed_sampler_thread() {
 }
 
 // Batched MQTT publishing thread
+// Publishes one message per logical axis on MQTT_TOPIC_POSITION/<axis>. All four carry the
+// batch sequence and base timestamp (first sample of the batch) in a first line
+// "<sequence>/<base_ns>/<decimation>", followed by "<offset_ns>/<position>" lines, so a
+// consumer of one axis downloads only that axis and can still line it up with the others.
+// Only ticks that read the axis count (see SET_AXIS_RATE); counters keep each axis's
+// decimation phase across batches.
+bool publish_axis_batches(const std::vector<PositionSample>& batch, uint64_t sequence, uint64_t counters[4]) {
+    static const char* const names[4] = {"X", "Y", "Z", "R"};
+    uint64_t base_ns = batch.front().timestamp_ns;
+    bool ok = true;
+    std::string msg;
+    for (int a = 0; a < 4; ++a) {
+        uint32_t decimation = std::max<uint32_t>(1, g_axis_decimation[a].load(std::memory_order_relaxed));
+        msg = std::to_string(sequence) + "/" + std::to_string(base_ns) + "/" + std::to_string(decimation);
+        for (const PositionSample& sample : batch) {
+            if (!(sample.read_mask & (1 << a)) || counters[a]++ % decimation != 0) continue;
+            msg += '\n';
+            msg += g_string_buffer.format_axis_sample(sample.timestamp_ns - base_ns, get_sample_axis(sample, a), 
+                                                      (sample.valid_mask & (1 << a)) != 0);
+        }
+        std::string topic = MQTT_TOPIC_POSITION + "/" + names[a];
+        uint64_t publish_start = get_monotonic_ns();
+        int rc = mosquitto_publish(g_mqtt_client, nullptr, topic.c_str(), msg.length(), msg.c_str(), 0, false);
+        g_mqtt_publish_latency.observe_ns(get_monotonic_ns() - publish_start);
+        if (rc == MOSQ_ERR_SUCCESS) {
+            g_axis_messages_published.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            ok = false;
+            g_publish_failures.fetch_add(1, std::memory_order_relaxed);
+            std::cout << "Failed to publish " << topic << ": " << mosquitto_strerror(rc) << "\n";
+        }
+    }
+    return ok;
+}
+
 void batch_publisher_thread() {
     std::cout << "Batch publisher thread started\n";
     
@@ -372,13 +1608,21 @@ void batch_publisher_thread() {
     
     uint64_t published_count = 0;
     uint64_t batch_count = 0;
+    uint64_t axis_counters[4] = {0, 0, 0, 0};   // Samples seen per axis topic, for decimation
     const auto batch_interval = std::chrono::milliseconds(100);  // 10Hz batch rate for easier debugging
     auto next_batch_time = std::chrono::steady_clock::now() + batch_interval;
     
     while (g_running) {
         // Collect batch of samples
         PositionSample sample;
+        bool batch_traced = false;
         while (batch.size() < BUFFER_SIZE && g_position_buffer.try_read(sample)) {
+            if (sample.valid_mask & TRACE_SAMPLE_FLAG) {
+                uint64_t now = get_monotonic_ns();
+                trace_flow(TRACE_PUBLISHER, TR_SAMPLE_FLOW, 'f', now, sample.timestamp_ns);
+                trace_instant(TRACE_PUBLISHER, TR_DEQUEUE, now, sample.timestamp_ns);
+                batch_traced = true;
+            }
             batch.push_back(sample);
         }
         
@@ -390,8 +1634,19 @@ void batch_publisher_thread() {
                 std::cout << "Published batch " << batch_count << " (total: " << published_count << " samples)\n";
             }
             
-            if (g_mqtt_connected) {
-                // Create batched message (more efficient than individual messages)
+            int axis_mode = g_axis_topic_mode.load(std::memory_order_relaxed);
+            if (g_mqtt_connected && axis_mode != AXIS_TOPICS_OFF) {
+                bool ok = publish_axis_batches(batch, batch_count, axis_counters);
+                if (axis_mode == AXIS_TOPICS_ONLY && ok) {
+                    published_count += batch.size();
+                    g_total_published.fetch_add(batch.size(), std::memory_order_relaxed);
+                    g_batches_published.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            
+            if (g_mqtt_connected && axis_mode != AXIS_TOPICS_ONLY) {
+                // Create batched message (more efficient than individual messages)
+                uint64_t encode_start = batch_traced ? get_monotonic_ns() : 0;
                 std::ostringstream batch_msg;
                 
                 for (size_t i = 0; i < batch.size(); ++i) {
@@ -403,16 +1658,26 @@ void batch_publisher_thread() {
                 }
                 
                 std::string msg = batch_msg.str();
+                uint64_t publish_start = get_monotonic_ns();
                 int rc = mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_POSITION.c_str(), 
                                          msg.length(), msg.c_str(), 0, false);
+                uint64_t publish_end = get_monotonic_ns();
+                g_mqtt_publish_latency.observe_ns(publish_end - publish_start);
+                
+                if (batch_traced) {
+                    trace_complete(TRACE_PUBLISHER, TR_ENCODE, encode_start, publish_start, batch_count);
+                    trace_complete(TRACE_PUBLISHER, TR_PUBLISH, publish_start, publish_end, batch_count);
+                }
                 
                 if (rc == MOSQ_ERR_SUCCESS) {
                     published_count += batch.size();
                     g_total_published.fetch_add(batch.size(), std::memory_order_relaxed);
+                    g_batches_published.fetch_add(1, std::memory_order_relaxed);
                 } else {
+                    g_publish_failures.fetch_add(1, std::memory_order_relaxed);
                     std::cout << "Failed to publish batch: " << mosquitto_strerror(rc) << "\n";
                 }
-            } else {
+            } else if (!g_mqtt_connected) {
                 std::cout << "MQTT not connected, skipping batch\n";
             }
             
@@ -428,19 +1693,180 @@ void batch_publisher_thread() {
     std::cout << "Publisher thread stopped. Published: " << published_count << "\n";
 }
 
+// GET_HISTORY time argument: epoch nanoseconds, or seconds relative to now when <= 0 ("-60", "0")
+bool parse_history_time(const std::string& text, uint64_t now_ns, uint64_t& out) {
+    if (text.empty()) return false;
+    char* end = nullptr;
+    if (text[0] == '-' || text == "0") {
+        double seconds = std::strtod(text.c_str(), &end);
+        if (*end != '\0' || seconds > 0) return false;
+        uint64_t back_ns = static_cast<uint64_t>(-seconds * 1e9);
+        out = now_ns > back_ns ? now_ns - back_ns : 0;
+        return true;
+    }
+    out = std::strtoull(text.c_str(), &end, 10);
+    return *end == '\0';
+}
+
+// Every decimation-th sample in [t0, t1] from the in-memory history, at most limit of them.
+// Returns false if the reply was cut at the limit.
+bool query_history(uint64_t t0, uint64_t t1, uint32_t decimation, size_t limit, std::vector<RecordSample>& out) {
+    std::vector<std::shared_ptr<const HistoryBlock>> blocks;
+    {
+        std::lock_guard<std::mutex> lock(g_history_mutex);
+        auto it = std::lower_bound(g_history_blocks.begin(), g_history_blocks.end(), t0,
+            [](const std::shared_ptr<const HistoryBlock>& b, uint64_t t) { return b->index.last_timestamp_ns < t; });
+        for (; it != g_history_blocks.end() && (*it)->index.first_timestamp_ns <= t1; ++it) {
+            blocks.push_back(*it);
+        }
+    }
+    
+    std::vector<uint64_t> timestamps;
+    std::vector<uint8_t> valid;
+    std::array<std::vector<int32_t>, ARCHIVE_AXES> values;
+    uint64_t matched = 0;
+    for (const std::shared_ptr<const HistoryBlock>& block : blocks) {
+        const ArchiveBlockIndex& b = block->index;
+        archive_decode_timestamps(block->data.data(), b, timestamps);
+        archive_decode_valid(block->data.data(), b, valid);
+        for (uint32_t a = 0; a < ARCHIVE_AXES; ++a) {
+            if (b.valid_count[a] > 0) {
+                archive_decode_axis(block->data.data(), b, a, values[a]);
+            } else {
+                values[a].assign(b.count, 0);
+            }
+        }
+        for (uint32_t j = 0; j < b.count; ++j) {
+            if (timestamps[j] < t0 || timestamps[j] > t1 || matched++ % decimation != 0) continue;
+            if (out.size() >= limit) return false;
+            RecordSample r;
+            r.timestamp_ns = timestamps[j];
+            for (uint32_t a = 0; a < ARCHIVE_AXES; ++a) r.position[a] = values[a][j];
+            r.valid_mask = valid[j];
+            out.push_back(r);
+        }
+    }
+    return true;
+}
+
+// Publishes a GET_HISTORY reply as chunks on MQTT_TOPIC_HISTORY. Each chunk starts with
+// "HISTORY/<request>/<chunk>/<chunks>/<samples>/<TEXT|BINARY>\n", followed by position lines
+// in the live stream format or packed 25-byte RecordSamples. Returns the number of chunks.
+size_t publish_history(uint64_t request_id, const std::vector<RecordSample>& samples, bool binary) {
+    size_t chunks = std::max<size_t>(1, (samples.size() + HISTORY_CHUNK_SAMPLES - 1) / HISTORY_CHUNK_SAMPLES);
+    std::string msg;
+    for (size_t c = 0; c < chunks; ++c) {
+        size_t begin = c * HISTORY_CHUNK_SAMPLES;
+        size_t end = std::min(samples.size(), begin + HISTORY_CHUNK_SAMPLES);
+        msg = "HISTORY/" + std::to_string(request_id) + "/" + std::to_string(c) + "/" + std::to_string(chunks) + 
+              "/" + std::to_string(end - begin) + (binary ? "/BINARY\n" : "/TEXT\n");
+        if (binary) {
+            msg.append(reinterpret_cast<const char*>(samples.data() + begin), (end - begin) * sizeof(RecordSample));
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                PositionSample p;
+                p.timestamp_ns = samples[i].timestamp_ns;
+                p.x_position = samples[i].position[0];
+                p.y_position = samples[i].position[1];
+                p.z_position = samples[i].position[2];
+                p.r_position = samples[i].position[3];
+                p.valid_mask = samples[i].valid_mask;
+                if (i > begin) msg += "\n";
+                msg += g_string_buffer.format_position(p);
+            }
+        }
+        if (g_mqtt_connected) {
+            mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_HISTORY.c_str(), 
+                            msg.length(), msg.data(), 1, false);
+        }
+    }
+    return chunks;
+}
+
+// Motion needs the bus and the setpoint streamer back: abort a running BENCH
+void abort_bench(const char* reason) {
+    if (g_bench_running.load(std::memory_order_acquire)) g_bench_abort_reason.store(reason);
+}
+
+bool bench_abort_requested() {
+    return g_bench_abort_reason.load() != nullptr || !g_running;
+}
+
+// Axis with a MOVE, MOVE_VEL, MOVE_QUEUE or recent setpoint, empty if none. Called with the
+// streamer paused, so its activity flags and the pending requests agree.
+std::string bench_blocking_axis() {
+    uint64_t now = get_monotonic_ns();
+    std::lock_guard<std::mutex> lock(g_motion_mutex);
+    for (int logical = 0; logical < 4; ++logical) {
+        const MotionRequest& request = g_motion_requests[logical];
+        uint64_t setpoint_ns = g_setpoints[logical].received_ns.load(std::memory_order_relaxed);
+        bool setpoint = setpoint_ns != 0 && setpoint_ns + BENCH_SETPOINT_QUIET_NS > now;
+        if (g_axis_motion_active[logical] || request.start || request.start_tracking || 
+            !g_move_queues[logical].empty() || setpoint) {
+            return get_axis_name((logical < 3) ? 0 : 1, (logical < 3) ? logical : 0);
+        }
+    }
+    return "";
+}
+
+// BENCH worker: runs off the command thread so a STOP is handled (and aborts it) meanwhile
+void bench_worker_thread(std::vector<BenchAxis> axes, int duration_ms) {
+    std::string result_msg = std::to_string(get_nanosecond_timestamp()) + "/COMMAND/BENCH/ALL/";
+    
+    // Pause the sampler and the streamer so the benchmark measures the bus alone
+    g_sampler_idle = false;
+    g_streamer_idle = false;
+    g_sampler_paused = true;
+    g_streamer_paused = true;
+    auto pause_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while (((!g_sampler_idle && g_controllers_connected) || !g_streamer_idle) && g_running &&
+           std::chrono::steady_clock::now() < pause_deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    
+    std::string busy_axis = bench_blocking_axis();
+    if (!busy_axis.empty()) {
+        result_msg += "FAILED/Motion in progress on " + busy_axis;
+    } else {
+        std::cout << "Running benchmark (" << duration_ms << " ms per phase, sampling paused)...\n";
+        BenchReport report = run_ecc_benchmark(axes, duration_ms, bench_abort_requested);
+        if (report.cancelled) {
+            const char* reason = g_bench_abort_reason.load();
+            result_msg += "CANCELLED/Aborted by " + std::string(reason ? reason : "shutdown");
+        } else {
+            g_bench_recommended_rate_hz = report.recommended_rate_hz;
+            std::string text = format_bench_report(report, axes.size());
+            std::cout << text;
+            result_msg += "SUCCESS/" + text;
+        }
+    }
+    g_streamer_paused = false;
+    g_sampler_paused = false;
+    
+    if (g_mqtt_connected) {
+        mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_RESULT.c_str(), 
+                        result_msg.length(), result_msg.c_str(), 1, false);
+    }
+    g_bench_running = false;
+}
+
 // Simplified command processing thread
 void command_processor_thread() {
     std::cout << "Command processor thread started\n";
+    std::thread bench_worker;
     
     while (g_running) {
         std::string cmd;
+        uint64_t cmd_id = 0;
         bool has_command = false;
         
         {
             std::lock_guard<std::mutex> lock(g_command_mutex);
             if (!g_command_queue.empty()) {
-                cmd = g_command_queue.front();
-                g_command_queue.pop();
+                cmd = g_command_queue.front().text;
+                cmd_id = g_command_queue.front().id;
+                g_command_queue.pop_front();
+                g_command_queue_depth.store(g_command_queue.size(), std::memory_order_relaxed);
                 has_command = true;
             }
         }
@@ -448,6 +1874,21 @@ void command_processor_thread() {
         if (has_command) {
             std::cout << "Processing command: " << cmd << "\n";
             
+            bool traced = trace_enabled();
+            uint64_t cmd_start = get_monotonic_ns();
+            if (traced) {
+                trace_flow(TRACE_COMMAND, TR_COMMAND_FLOW, 'f', cmd_start, cmd_id);
+            }
+            
+            CommandType cmd_type = classify_command(cmd);
+            g_command_counts[cmd_type].fetch_add(1, std::memory_order_relaxed);
+            if (traced) {
+                trace_complete(TRACE_COMMAND, TR_CMD_PARSE, cmd_start, get_monotonic_ns(), cmd_id);
+            }
+            if (cmd_type == CMD_MOVE || cmd_type == CMD_MOVE_VEL || cmd_type == CMD_MOVE_QUEUE || cmd_type == CMD_STOP) {
+                abort_bench(COMMAND_TYPE_NAMES[cmd_type]);
+            }
+            
             // Parse and execute commands
             if (cmd == "STATUS") {
                 // Generate status report with proper formatting
@@ -456,10 +1897,130 @@ void command_processor_thread() {
                 status << "MQTT Connected: " << (g_mqtt_connected ? "YES" : "NO") << "\n";
                 status << "Controllers Connected: " << (g_controllers_connected ? "YES" : "NO") << "\n";
                 status << "Sample Rate: " << g_sample_rate_hz << " Hz\n";
+                {
+                    static const char* const names[4] = {"X", "Y", "Z", "R"};
+                    status << "Axis Rates:";
+                    for (int a = 0; a < 4; ++a) {
+                        uint64_t entry = g_axis_schedule[a].load();
+                        status << (a ? ", " : " ") << names[a] << " " << g_sample_rate_hz.load() / (entry >> 32) 
+                               << " Hz (every " << (entry >> 32) << ", phase " << (entry & 0xFFFFFFFFu) << ")";
+                    }
+                    status << "\n";
+                }
                 status << "Total Captured: " << g_total_captured.load() << "\n";
                 status << "Total Published: " << g_total_published.load() << "\n";
+                {
+                    static const char* const mode_names[3] = {"OFF", "ON", "ONLY"};
+                    status << "Axis Topics: " << mode_names[g_axis_topic_mode.load()] << " (decimation X " 
+                           << g_axis_decimation[0].load() << ", Y " << g_axis_decimation[1].load() 
+                           << ", Z " << g_axis_decimation[2].load() << ", R " << g_axis_decimation[3].load() << ")\n";
+                }
                 status << "Total Dropped: " << g_total_dropped.load() << "\n";
-                status << "Buffer Usage: " << g_position_buffer.available() << "/" << (BUFFER_SIZE * 4) << "\n\n";
+                status << "Buffer Usage: " << g_position_buffer.available() << "/" << (BUFFER_SIZE * 4) << "\n";
+                
+                {
+                    std::lock_guard<std::mutex> lock(g_record_mutex);
+                    status << "Recording: " << (g_recording.load() ? "ON " + g_record_segment : std::string("OFF"))
+                           << " (" << g_record_samples.load() << " samples, " << g_record_dropped.load() 
+                           << " dropped, " << g_record_segments.load() << " segments)\n";
+                    if (!g_record_fused_path.empty()) {
+                        status << "Fused Recording: " << g_record_fused_path << " (" << g_record_fused_records.load() << " records)\n";
+                    }
+                    if (!g_record_error.empty()) status << "Recorder Error: " << g_record_error << "\n";
+                }
+                {
+                    std::lock_guard<std::mutex> lock(g_multicast_mutex);
+                    status << "Multicast: " << (g_multicast_enabled.load() ? "ON " + g_multicast_group + ":" + 
+                                                std::to_string(g_multicast_port) : std::string("OFF"))
+                           << " (" << g_multicast_packets.load() << " packets, " << g_multicast_samples_sent.load() 
+                           << " samples, " << g_multicast_dropped.load() << " dropped)\n";
+                    if (!g_multicast_error.empty()) status << "Multicast Error: " << g_multicast_error << "\n";
+                }
+                {
+                    std::lock_guard<std::mutex> lock(g_pico_mutex);
+                    status << "Picoammeter: " << (g_pico_enabled.load() ? "ON " + g_pico_device : std::string("OFF"))
+                           << " (" << (g_pico_mode == PICO_SINGLE ? std::string("single") : 
+                                       (g_pico_mode == PICO_BURST ? "burst " : "triggered burst ") + 
+                                       std::to_string(g_pico_points) + " points") << ", NPLC " << g_pico_nplc << ", " 
+                           << g_pico_readings.load() << " readings, " << g_pico_errors.load() << " errors)\n";
+                    if (!g_pico_identity.empty()) status << "Picoammeter Identity: " << g_pico_identity << "\n";
+                    if (!g_pico_error.empty()) status << "Picoammeter Error: " << g_pico_error << "\n";
+                }
+                {
+                    std::lock_guard<std::mutex> lock(g_align_mutex);
+                    status << "Alignment: " << ALIGN_METHOD_NAMES[g_align_method] << ", " << g_align_latency_ms 
+                           << " ms budget (" << g_align_fused.load() << " fused, " << g_align_pending.load() << " pending, " 
+                           << g_align_late.load() << " late, " << g_align_expired.load() << " expired, " 
+                           << g_align_gaps.load() << " gaps)\n";
+                }
+                {
+                    static const char* const names[4] = {"X", "Y", "Z", "R"};
+                    std::lock_guard<std::mutex> lock(g_trigger_mutex);
+                    status << "Triggers: " << g_trigger_specs.size() << " defined (" 
+                           << g_trigger_fired[TRIGGER_MARK].load() + g_trigger_fired[TRIGGER_LINE].load() + 
+                              g_trigger_fired[TRIGGER_BURST].load() << " fired, " 
+                           << g_trigger_bursts_missed.load() << " bursts missed)\n";
+                    for (const TriggerSpec& t : g_trigger_specs) {
+                        status << "  " << t.name << ": " << names[t.axis] << " " << t.position << " " 
+                               << TRIGGER_DIRECTION_NAMES[t.direction] << " -> " << TRIGGER_ACTION_NAMES[t.action] 
+                               << ", hysteresis " << t.hysteresis << "\n";
+                    }
+                }
+                {
+                    static const char* const names[4] = {"X", "Y", "Z", "R"};
+                    std::lock_guard<std::mutex> lock(g_stats_mutex);
+                    status << "Statistics: " << (g_stats_enabled.load() ? "ON" : "OFF") << ", windows";
+                    for (uint32_t window_s : g_stats_windows_s) status << " " << window_s;
+                    status << " s, every " << g_stats_interval_ms << " ms (" << g_stats_messages.load() << " messages, " 
+                           << g_stats_dropped.load() << " dropped)\n";
+                    size_t windows = g_stats_latest_windows_s.size();
+                    for (size_t i = 0; i < g_stats_latest.size() && windows > 0; ++i) {
+                        const StatsMoments& m = g_stats_latest[i];
+                        if (m.count == 0) continue;
+                        status << "  " << names[i / windows] << " " << g_stats_latest_windows_s[i % windows] << " s: mean " 
+                               << std::fixed << std::setprecision(1) << m.mean_x << ", std " << std::setprecision(2) 
+                               << m.stddev() << ", p2p " << m.peak_to_peak() << ", drift " << std::setprecision(3) 
+                               << m.drift_per_s() << "/s\n" << std::defaultfloat << std::setprecision(6);
+                    }
+                }
+                {
+                    static const char* const names[4] = {"X", "Y", "Z", "R"};
+                    std::lock_guard<std::mutex> lock(g_image_mutex);
+                    const ScanGrid& grid = g_image_grid;
+                    status << "Image: " << (g_image_enabled.load() ? "ON" : "OFF");
+                    if (grid.width > 0) {
+                        status << " scan " << g_image_scan_id.load() << ", " << grid.width << "x" << grid.height << " " 
+                               << names[grid.axis_x] << " " << grid.x0 << ".." << grid.x1 << ", " 
+                               << names[grid.axis_y] << " " << grid.y0 << ".." << grid.y1;
+                    }
+                    status << " (" << g_image_pairs.load() << " pairs, " << g_image_outside.load() << " outside, " 
+                           << g_image_unmatched.load() << " unmatched)\n";
+                }
+                uint64_t history_first = g_history_first_ns.load();
+                status << "History: " << g_history_samples.load() << " samples, " 
+                       << g_history_bytes.load() / 1024 << " KiB, " 
+                       << (history_first ? (get_nanosecond_timestamp() - history_first) / 1000000000ull : 0) 
+                       << " s of " << HISTORY_WINDOW_S << " s window\n";
+                {
+                    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+                    status << "Snapshots: " << g_snapshots_written.load() << " written" 
+                           << (g_snapshot_last.empty() ? std::string() : ", last " + g_snapshot_last) << "\n";
+                }
+                status << "Stream Clients: " << g_stream_clients.load() << " on port " << STREAM_PORT 
+                       << ", " << g_stream_slow_disconnects.load() << " dropped as too slow\n";
+                status << "Commands Superseded: " << g_commands_superseded.load() << "\n";
+                status << "Setpoints: received " << g_setpoints_received.load() 
+                       << ", written " << g_setpoints_written.load() 
+                       << ", coalesced " << g_setpoints_coalesced.load() << "\n";
+                
+                // Consistent multi-axis snapshot from the sampler
+                LatestSample latest = g_latest_sample.load();
+                if (latest.tick != 0) {
+                    status << "Latest Sample: tick " << latest.tick << ", age " 
+                           << (get_monotonic_ns() - latest.monotonic_ns) / 1000 << " us, "
+                           << g_string_buffer.format_position(latest.sample) << "\n";
+                }
+                status << "\n";
                 
                 // Controller details with amplitude and frequency
                 for (int i = 0; i < 2; ++i) {
@@ -477,9 +2038,9 @@ void command_processor_thread() {
                                 std::string axis_name = get_axis_name(i, axis);
                                 status << "  Axis " << axis << " (" << axis_name << "):";
                                 
-                                // Current position
+                                // Current position (from the sampler when fresh)
                                 Int32 position = 0;
-                                if (ECC_getPosition(g_controllers[i].handle, axis, &position) == 0) {
+                                if (get_current_position(i, axis, position)) {
                                     status << " " << position;
                                     
                                     // Get actor type for units
@@ -511,6 +2072,37 @@ void command_processor_thread() {
                                 if (ECC_controlAmplitude(g_controllers[i].handle, axis, &amplitude, 0) == 0) {
                                     status << "    Amplitude: " << amplitude << " mV\n";
                                 }
+                                
+                                ApproachConfig approach;
+                                uint64_t moves_pos, moves_neg;
+                                double error_pos, error_neg;
+                                {
+                                    std::lock_guard<std::mutex> lock(g_motion_mutex);
+                                    approach = g_approach_config[get_logical_axis(i, axis)];
+                                    const MoveTimeModel& model = g_move_models[get_logical_axis(i, axis)];
+                                    moves_pos = model.moves(0);
+                                    moves_neg = model.moves(1);
+                                    error_pos = model.relative_error(0);
+                                    error_neg = model.relative_error(1);
+                                }
+                                size_t queued;
+                                {
+                                    std::lock_guard<std::mutex> lock(g_motion_mutex);
+                                    queued = g_move_queues[get_logical_axis(i, axis)].size();
+                                }
+                                if (queued > 0) {
+                                    status << "    Move Queue: " << queued << " targets pending\n";
+                                }
+                                status << "    Move Model: " << moves_pos << " moves +, " << moves_neg 
+                                       << " moves -, prediction error " << static_cast<int>(error_pos * 100) 
+                                       << "% / " << static_cast<int>(error_neg * 100) << "%\n";
+                                if (approach.direction != 0) {
+                                    status << "    Approach: " << (approach.direction > 0 ? "POS" : "NEG") 
+                                           << ", overshoot " << approach.overshoot 
+                                           << ", tuned target range " << approach.tuned_range 
+                                           << " (" << approach.settles << " settles, last " 
+                                           << approach.last_settle_s << " s)\n";
+                                }
                                 if (ECC_controlFrequency(g_controllers[i].handle, axis, &frequency, 0) == 0) {
                                     status << "    Frequency: " << frequency << " mHz\n";
                                 }
@@ -586,14 +2178,24 @@ void command_processor_thread() {
                     
                     if (new_rate >= 100 && new_rate <= 15000) {  // Reasonable limits
                         g_sample_rate_hz = new_rate;
-                        g_sample_interval_ns = 1000000000 / g_sample_rate_hz;
+                        g_sample_interval_ns = 1000000000 / new_rate;
+                        g_shm_writer.set_sample_rate(new_rate);
+                        update_axis_schedule();
                         
                         std::cout << "Sampling rate changed to " << g_sample_rate_hz << " Hz\n";
                         
+                        // Warn when above the rate the last BENCH found sustainable
+                        std::string warning;
+                        int recommended = g_bench_recommended_rate_hz.load();
+                        if (recommended > 0 && new_rate > recommended) {
+                            warning = " (WARNING: above measured sustainable rate " + std::to_string(recommended) + " Hz)";
+                            std::cout << "Warning: rate exceeds BENCH recommendation of " << recommended << " Hz\n";
+                        }
+                        
                         // Publish success result
                         if (g_mqtt_connected) {
                             std::string timestamp = std::to_string(get_nanosecond_timestamp());
-                            std::string result_msg = timestamp + "/COMMAND/SET_RATE/ALL/SUCCESS/Sampling rate set to " + rate_str + " Hz";
+                            std::string result_msg = timestamp + "/COMMAND/SET_RATE/ALL/SUCCESS/Sampling rate set to " + rate_str + " Hz" + warning;
                             
                             mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_RESULT.c_str(), 
                                             result_msg.length(), result_msg.c_str(), 1, false);
@@ -641,10 +2243,15 @@ void command_processor_thread() {
                             
                             // Set amplitude
                             Int32 amp = amplitude;
-                            int result = ECC_controlAmplitude(g_controllers[controller].handle, axis, &amp, 1);
+                            int result;
+                            {
+                                TraceScope trace(TRACE_COMMAND, TR_ECC_AMPLITUDE, cmd_id);
+                                result = ECC_controlAmplitude(g_controllers[controller].handle, axis, &amp, 1);
+                            }
                             
                             if (result == 0) {
                                 std::cout << "Successfully set amplitude: " << axis_str << " = " << amplitude << " mV\n";
+                                g_drive_amplitude_mv[get_logical_axis(controller, axis)] = amplitude;
                                 
                                 // Publish success result
                                 if (g_mqtt_connected) {
@@ -656,6 +2263,7 @@ void command_processor_thread() {
                                 }
                             } else {
                                 std::cout << "Failed to set amplitude for " << axis_str << "\n";
+                                request_snapshot("SET_AMP/" + axis_str + ": failed to set amplitude");
                                 
                                 // Publish failure result
                                 if (g_mqtt_connected) {
@@ -703,10 +2311,15 @@ void command_processor_thread() {
                             
                             // Set frequency
                             Int32 freq = frequency;
-                            int result = ECC_controlFrequency(g_controllers[controller].handle, axis, &freq, 1);
+                            int result;
+                            {
+                                TraceScope trace(TRACE_COMMAND, TR_ECC_FREQUENCY, cmd_id);
+                                result = ECC_controlFrequency(g_controllers[controller].handle, axis, &freq, 1);
+                            }
                             
                             if (result == 0) {
                                 std::cout << "Successfully set frequency: " << axis_str << " = " << frequency << " mHz\n";
+                                g_drive_frequency_mhz[get_logical_axis(controller, axis)] = frequency;
                                 
                                 // Publish success result
                                 if (g_mqtt_connected) {
@@ -718,6 +2331,7 @@ void command_processor_thread() {
                                 }
                             } else {
                                 std::cout << "Failed to set frequency for " << axis_str << "\n";
+                                request_snapshot("SET_FREQ/" + axis_str + ": failed to set frequency");
                                 
                                 // Publish failure result
                                 if (g_mqtt_connected) {
@@ -764,32 +2378,130 @@ void command_processor_thread() {
                         if (g_controllers[controller].connected && 
                             g_controllers[controller].axes_connected[axis]) {
                             
+                            int logical = get_logical_axis(controller, axis);
+                            std::lock_guard<std::mutex> axis_lock(g_axis_write_mutex[logical]);
+                            cancel_motion(logical, "Superseded by MOVE");
+                            restore_target_range(logical);
+                            
                             // Execute movement
+                            Int32 start_position = 0;
+                            bool have_start = get_current_position(controller, axis, start_position);
+                            
+                            // Unidirectional approach: go to the overshoot point first when the
+                            // final approach would otherwise come from the wrong side
+                            ApproachConfig approach;
+                            {
+                                std::lock_guard<std::mutex> lock(g_motion_mutex);
+                                approach = g_approach_config[logical];
+                            }
+                            bool approach_mode = approach.direction != 0 && have_start;
+                            bool staged = false;
+                            Int32 first_target = target_position;
+                            if (approach_mode) {
+                                int travel = (target_position > start_position) - (target_position < start_position);
+                                if (travel != approach.direction) {
+                                    first_target = target_position - approach.direction * approach.overshoot;
+                                    staged = true;
+                                }
+                                // The configured range comes back when the move ends (restore_target_range)
+                                Int32 range = 0;
+                                if (ECC_controlTargetRange(g_controllers[controller].handle, axis, &range, 0) == 0 && range > 0) {
+                                    g_saved_target_range[logical] = range;
+                                }
+                                range = approach.tuned_range;
+                                ECC_controlTargetRange(g_controllers[controller].handle, axis, &range, 1);
+                            }
+                            
+                            // ETA and timeout bound from the learned move-time model
+                            TrackedMove tracked;
+                            tracked.approach = approach_mode;
+                            tracked.staged = staged;
+                            tracked.start = start_position;
+                            tracked.via = first_target;
+                            tracked.target = target_position;
+                            if (have_start) {
+                                tracked.target_range = approach_mode ? approach.tuned_range : get_target_range(controller, axis);
+                                get_drive_parameters(controller, axis, tracked.amplitude_mv, tracked.frequency_mhz);
+                                
+                                std::lock_guard<std::mutex> lock(g_motion_mutex);
+                                const MoveTimeModel& model = g_move_models[logical];
+                                MovePrediction leg = model.predict(first_target - start_position, 
+                                                                   tracked.amplitude_mv, tracked.frequency_mhz);
+                                tracked.eta_s = leg.eta_s;
+                                tracked.timeout_s = leg.timeout_s;
+                                if (staged) {
+                                    leg = model.predict(target_position - first_target, tracked.amplitude_mv, tracked.frequency_mhz);
+                                    tracked.eta_s += leg.eta_s;
+                                    tracked.timeout_s += leg.timeout_s;
+                                }
+                            }
                             std::cout << "Executing move: Controller " << controller 
-                                      << " Axis " << axis << " -> " << target_position << "\n";
+                                      << " Axis " << axis << " -> " << target_position;
+                            if (have_start) {
+                                std::cout << " (from " << start_position << ", distance " 
+                                          << std::abs(target_position - start_position) << ")";
+                            }
+                            std::cout << "\n";
                             
                             // Set target position
-                            Int32 target = target_position;
-                            int result1 = ECC_controlTargetPosition(g_controllers[controller].handle, axis, &target, 1);
+                            Int32 target = first_target;
+                            int result1;
+                            {
+                                TraceScope trace(TRACE_COMMAND, TR_ECC_TARGET_POSITION, cmd_id);
+                                result1 = ECC_controlTargetPosition(g_controllers[controller].handle, axis, &target, 1);
+                            }
                             
                             if (result1 == 0) {
                                 // Enable movement
                                 Bln32 enable = 1;
-                                int result2 = ECC_controlMove(g_controllers[controller].handle, axis, &enable, 1);
+                                int result2;
+                                {
+                                    TraceScope trace(TRACE_COMMAND, TR_ECC_MOVE, cmd_id);
+                                    result2 = ECC_controlMove(g_controllers[controller].handle, axis, &enable, 1);
+                                }
                                 
                                 if (result2 == 0) {
+                                    g_closed_loop_enabled[logical] = true;
+                                    
+                                    // Completion is reported by the setpoint streamer from the sample stream
+                                    if (have_start) {
+                                        MotionRequest request;
+                                        request.start_tracking = true;
+                                        request.tracked = tracked;
+                                        request.tracked.start_ns = get_monotonic_ns();
+                                        request.tracked.final_leg_ns = request.tracked.start_ns;
+                                        std::lock_guard<std::mutex> lock(g_motion_mutex);
+                                        g_motion_requests[logical] = request;
+                                    }
                                     std::cout << "Successfully started movement: " << axis_str << " -> " << target_position << "\n";
                                     
                                     // Publish success result
                                     if (g_mqtt_connected) {
                                         std::string timestamp = std::to_string(get_nanosecond_timestamp());
                                         std::string result_msg = timestamp + "/COMMAND/MOVE/" + axis_str + "/SUCCESS/Movement started to " + pos_str;
+                                        if (have_start) {
+                                            result_msg += " from " + std::to_string(start_position);
+                                        }
+                                        if (staged) {
+                                            result_msg += " via " + std::to_string(first_target);
+                                        }
+                                        if (approach_mode) {
+                                            result_msg += " (approach target range " + std::to_string(approach.tuned_range) + ")";
+                                        }
+                                        if (have_start) {
+                                            std::ostringstream eta;
+                                            eta << std::fixed << std::setprecision(3) << ", ETA " << tracked.eta_s 
+                                                << " s, timeout " << tracked.timeout_s << " s";
+                                            result_msg += eta.str();
+                                        }
                                         
                                         mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_RESULT.c_str(), 
                                                         result_msg.length(), result_msg.c_str(), 1, false);
                                     }
                                 } else {
+                                    restore_target_range(logical);
                                     std::cout << "Failed to enable movement for " << axis_str << "\n";
+                                    request_snapshot("MOVE/" + axis_str + ": failed to enable movement");
                                     
                                     // Publish failure result
                                     if (g_mqtt_connected) {
@@ -801,7 +2513,9 @@ void command_processor_thread() {
                                     }
                                 }
                             } else {
+                                restore_target_range(logical);
                                 std::cout << "Failed to set target position for " << axis_str << "\n";
+                                request_snapshot("MOVE/" + axis_str + ": failed to set target position");
                                 
                                 // Publish failure result
                                 if (g_mqtt_connected) {
@@ -840,6 +2554,176 @@ void command_processor_thread() {
                     std::cout << "Invalid MOVE command format: " << cmd << "\n";
                 }
                 
+            } else if (cmd.find("MOVE_VEL/") == 0) {
+                // Handle velocity-limited moves: "MOVE_VEL/X/5000/2000/10000"
+                // (target, max velocity in units/s, max acceleration in units/s^2)
+                std::istringstream iss(cmd);
+                std::string move_cmd, axis_str, pos_str, vel_str, acc_str;
+                
+                if (std::getline(iss, move_cmd, '/') && std::getline(iss, axis_str, '/') &&
+                    std::getline(iss, pos_str, '/') && std::getline(iss, vel_str, '/') && 
+                    std::getline(iss, acc_str)) {
+                    
+                    int32_t target_position = std::atoi(pos_str.c_str());
+                    double max_velocity = std::atof(vel_str.c_str());
+                    double max_accel = std::atof(acc_str.c_str());
+                    int controller = -1, axis = -1;
+                    
+                    if (!parse_axis_name(axis_str, controller, axis)) {
+                        std::cout << "Invalid axis for MOVE_VEL: " << axis_str << "\n";
+                        publish_result("MOVE_VEL", axis_str, "FAILED", "Invalid axis name");
+                    } else if (!g_controllers[controller].connected || 
+                               !g_controllers[controller].axes_connected[axis]) {
+                        std::cout << "Axis " << axis_str << " not connected\n";
+                        publish_result("MOVE_VEL", axis_str, "FAILED", "Axis not connected");
+                    } else if (max_velocity <= 0 || max_accel <= 0) {
+                        publish_result("MOVE_VEL", axis_str, "FAILED", "Velocity and acceleration must be positive");
+                    } else {
+                        Int32 start_position = 0;
+                        Int32 target_range = 0;
+                        if (!get_current_position(controller, axis, start_position)) {
+                            publish_result("MOVE_VEL", axis_str, "FAILED", "Cannot read current position");
+                        } else {
+                            int logical = get_logical_axis(controller, axis);
+                            std::lock_guard<std::mutex> axis_lock(g_axis_write_mutex[logical]);
+                            cancel_motion(logical, "Superseded by MOVE_VEL");
+                            restore_target_range(logical);
+                            ECC_controlTargetRange(g_controllers[controller].handle, axis, &target_range, 0);
+                            
+                            MotionRequest request;
+                            request.start = true;
+                            request.profile.plan(start_position, target_position, max_velocity, max_accel);
+                            request.target_range = std::max<Int32>(target_range, 1);
+                            double duration = request.profile.total_time;
+                            
+                            {
+                                std::lock_guard<std::mutex> lock(g_motion_mutex);
+                                g_motion_requests[logical] = request;
+                            }
+                            
+                            std::ostringstream msg;
+                            msg << std::fixed << std::setprecision(3) << "Profiled movement started to " 
+                                << target_position << " from " << start_position << " (planned duration " 
+                                << duration << " s)";
+                            std::cout << "MOVE_VEL " << axis_str << ": " << msg.str() << "\n";
+                            publish_result("MOVE_VEL", axis_str, "SUCCESS", msg.str());
+                        }
+                    }
+                } else {
+                    std::cout << "Invalid MOVE_VEL command format: " << cmd << "\n";
+                    publish_result("MOVE_VEL", "ALL", "FAILED", "Expected MOVE_VEL/<axis>/<target>/<velocity>/<acceleration>");
+                }
+                
+            } else if (cmd.find("SET_APPROACH/") == 0) {
+                // Handle approach policy: "SET_APPROACH/X/POS/5000" (final approach moving positive,
+                // overshoot 5000), "SET_APPROACH/X/NEG/5000/100/2000" (with target range limits),
+                // "SET_APPROACH/X/OFF"
+                std::istringstream iss(cmd);
+                std::string approach_cmd, axis_str, mode_str, overshoot_str, min_str, max_str;
+                std::getline(iss, approach_cmd, '/');
+                std::getline(iss, axis_str, '/');
+                std::getline(iss, mode_str, '/');
+                std::getline(iss, overshoot_str, '/');
+                std::getline(iss, min_str, '/');
+                std::getline(iss, max_str);
+                
+                int controller = -1, axis = -1;
+                int direction = (mode_str == "POS") ? 1 : (mode_str == "NEG") ? -1 : 0;
+                
+                if (!parse_axis_name(axis_str, controller, axis)) {
+                    publish_result("SET_APPROACH", axis_str, "FAILED", "Invalid axis name");
+                } else if (direction == 0 && mode_str != "OFF") {
+                    publish_result("SET_APPROACH", axis_str, "FAILED", "Mode must be POS, NEG or OFF");
+                } else if (!g_controllers[controller].connected || !g_controllers[controller].axes_connected[axis]) {
+                    publish_result("SET_APPROACH", axis_str, "FAILED", "Axis not connected");
+                } else {
+                    // Configured controller target range is the default upper tuning limit
+                    Int32 current_range = g_saved_target_range[get_logical_axis(controller, axis)].load();
+                    if (current_range <= 0) ECC_controlTargetRange(g_controllers[controller].handle, axis, &current_range, 0);
+                    
+                    ApproachConfig config;
+                    config.direction = direction;
+                    if (!overshoot_str.empty()) config.overshoot = std::abs(std::atoi(overshoot_str.c_str()));
+                    if (!min_str.empty()) config.min_range = std::max(1, std::atoi(min_str.c_str()));
+                    config.max_range = max_str.empty() ? std::max<Int32>(current_range, config.min_range) 
+                                                       : std::max(config.min_range, std::atoi(max_str.c_str()));
+                    config.tuned_range = config.max_range;
+                    
+                    {
+                        std::lock_guard<std::mutex> lock(g_motion_mutex);
+                        g_approach_config[get_logical_axis(controller, axis)] = config;
+                    }
+                    
+                    std::string msg = (direction == 0) ? std::string("Approach policy disabled") :
+                        "Final approach " + mode_str + ", overshoot " + std::to_string(config.overshoot) + 
+                        ", target range " + std::to_string(config.min_range) + "-" + std::to_string(config.max_range);
+                    std::cout << "SET_APPROACH " << axis_str << ": " << msg << "\n";
+                    publish_result("SET_APPROACH", axis_str, "SUCCESS", msg);
+                }
+                
+            } else if (cmd.find("MOVE_QUEUE/") == 0) {
+                // Handle queued targets: "MOVE_QUEUE/Z/1000,1100,1200" appends to the axis queue,
+                // "MOVE_QUEUE/Z/CLEAR" drops targets that have not been started yet
+                std::istringstream iss(cmd);
+                std::string queue_cmd, axis_str, targets_str;
+                std::getline(iss, queue_cmd, '/');
+                std::getline(iss, axis_str, '/');
+                std::getline(iss, targets_str);
+                
+                // Validate the whole list before anything is queued
+                std::vector<int32_t> targets;
+                bool valid_targets = !targets_str.empty();
+                std::istringstream list(targets_str);
+                std::string item;
+                while (valid_targets && targets_str != "CLEAR" && std::getline(list, item, ',')) {
+                    char* end = nullptr;
+                    long value = std::strtol(item.c_str(), &end, 10);
+                    valid_targets = !item.empty() && *end == '\0' && value >= INT32_MIN && value <= INT32_MAX;
+                    targets.push_back(static_cast<int32_t>(value));
+                }
+                
+                int controller = -1, axis = -1;
+                if (!parse_axis_name(axis_str, controller, axis)) {
+                    publish_result("MOVE_QUEUE", axis_str, "FAILED", "Invalid axis name");
+                } else if (!g_controllers[controller].connected || !g_controllers[controller].axes_connected[axis]) {
+                    publish_result("MOVE_QUEUE", axis_str, "FAILED", "Axis not connected");
+                } else if (!valid_targets) {
+                    publish_result("MOVE_QUEUE", axis_str, "FAILED", "Expected comma-separated targets or CLEAR");
+                } else {
+                    int logical = get_logical_axis(controller, axis);
+                    if (targets_str == "CLEAR") {
+                        // An armed target is dropped too; the current leg still completes
+                        disarm_queue(logical);
+                        size_t dropped;
+                        {
+                            std::lock_guard<std::mutex> lock(g_motion_mutex);
+                            dropped = g_move_queues[logical].size();
+                            g_move_queues[logical].clear();
+                        }
+                        publish_result("MOVE_QUEUE", axis_str, "SUCCESS", "Dropped " + std::to_string(dropped) + " pending targets");
+                    } else {
+                        size_t pending = 0;
+                        bool full;
+                        {
+                            std::lock_guard<std::mutex> lock(g_motion_mutex);
+                            std::deque<int32_t>& queue = g_move_queues[logical];
+                            full = queue.size() + targets.size() > MOVE_QUEUE_CAPACITY;
+                            if (!full) {
+                                queue.insert(queue.end(), targets.begin(), targets.end());
+                                pending = queue.size();
+                            }
+                        }
+                        if (full) {
+                            publish_result("MOVE_QUEUE", axis_str, "FAILED", "Queue full (" + 
+                                           std::to_string(MOVE_QUEUE_CAPACITY) + " targets)");
+                        } else {
+                            std::cout << "MOVE_QUEUE " << axis_str << ": " << targets.size() << " targets queued\n";
+                            publish_result("MOVE_QUEUE", axis_str, "SUCCESS", "Queued " + std::to_string(targets.size()) + 
+                                           " targets (" + std::to_string(pending) + " pending)");
+                        }
+                    }
+                }
+                
             } else if (cmd.find("STOP/") == 0) {
                 // Handle STOP commands: "STOP/X" or "STOP/Y"
                 std::istringstream iss(cmd);
@@ -861,11 +2745,21 @@ void command_processor_thread() {
                         if (g_controllers[controller].connected && 
                             g_controllers[controller].axes_connected[axis]) {
                             
+                            int logical = get_logical_axis(controller, axis);
+                            std::lock_guard<std::mutex> axis_lock(g_axis_write_mutex[logical]);
+                            cancel_motion(logical, "Stopped by STOP command");
+                            restore_target_range(logical);
+                            
                             // Stop movement
                             Bln32 disable = 0;
-                            int result = ECC_controlMove(g_controllers[controller].handle, axis, &disable, 1);
+                            int result;
+                            {
+                                TraceScope trace(TRACE_COMMAND, TR_ECC_MOVE, cmd_id);
+                                result = ECC_controlMove(g_controllers[controller].handle, axis, &disable, 1);
+                            }
                             
                             if (result == 0) {
+                                g_closed_loop_enabled[logical] = false;
                                 std::cout << "Successfully stopped axis " << axis_str << "\n";
                                 
                                 // Publish success result
@@ -878,6 +2772,7 @@ void command_processor_thread() {
                                 }
                             } else {
                                 std::cout << "Failed to stop axis " << axis_str << "\n";
+                                request_snapshot("STOP/" + axis_str + ": failed to stop movement");
                                 
                                 // Publish failure result
                                 if (g_mqtt_connected) {
@@ -898,118 +2793,3217 @@ void command_processor_thread() {
                     std::cout << "Invalid STOP command format: " << cmd << "\n";
                 }
                 
-            } else {
-                std::cout << "Unknown command: " << cmd << "\n";
-            }
-        }
-        
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
-    
-    std::cout << "Command processor thread stopped\n";
-}
-
-bool initialize_mqtt() {
-    mosquitto_lib_init();
-    
-    g_mqtt_client = mosquitto_new(nullptr, true, nullptr);
-    if (!g_mqtt_client) {
-        std::cerr << "Failed to create MQTT client\n";
-        return false;
-    }
-
-    mosquitto_connect_callback_set(g_mqtt_client, mqtt_on_connect);
-    mosquitto_message_callback_set(g_mqtt_client, mqtt_on_message);
-    mosquitto_disconnect_callback_set(g_mqtt_client, mqtt_on_disconnect);
-
-    int rc = mosquitto_connect(g_mqtt_client, MQTT_BROKER.c_str(), MQTT_PORT, 60);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        std::cerr << "Failed to connect to MQTT broker: " << mosquitto_strerror(rc) << "\n";
-        mosquitto_destroy(g_mqtt_client);
-        return false;
-    }
-
-    rc = mosquitto_loop_start(g_mqtt_client);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        std::cerr << "Failed to start MQTT loop: " << mosquitto_strerror(rc) << "\n";
-        mosquitto_destroy(g_mqtt_client);
-        return false;
-    }
-
-    // Wait for connection
-    int wait_count = 0;
-    while (!g_mqtt_connected && wait_count < 50) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        wait_count++;
-    }
-
-    if (!g_mqtt_connected) {
-        std::cerr << "MQTT connection timeout\n";
-        return false;
-    }
-
-    std::cout << "MQTT connected successfully\n";
-    return true;
-}
-
-void cleanup_mqtt() {
-    if (g_mqtt_client) {
-        mosquitto_loop_stop(g_mqtt_client, true);
-        mosquitto_disconnect(g_mqtt_client);
-        mosquitto_destroy(g_mqtt_client);
-    }
-    mosquitto_lib_cleanup();
-}
-
-void mqtt_on_connect(struct mosquitto *mosq, void * /* userdata */, int result) {
-    if (result == 0) {
-        g_mqtt_connected = true;
-        std::cout << "MQTT connected to broker\n";
-        mosquitto_subscribe(mosq, nullptr, MQTT_TOPIC_COMMAND.c_str(), 0);
-        std::cout << "Subscribed to: " << MQTT_TOPIC_COMMAND << "\n";
-    } else {
-        std::cerr << "MQTT connection failed: " << result << "\n";
-    }
-}
-
-void mqtt_on_message(struct mosquitto * /* mosq */, void * /* userdata */, const struct mosquitto_message *message) {
-    if (!message->payload) return;
-    
-    std::string payload((char*)message->payload, message->payloadlen);
-    
-    {
-        std::lock_guard<std::mutex> lock(g_command_mutex);
-        g_command_queue.push(payload);
-    }
-}
-
-void mqtt_on_disconnect(struct mosquitto * /* mosq */, void * /* userdata */, int rc) {
-    g_mqtt_connected = false;
-    if (rc != 0) {
-        std::cerr << "MQTT unexpected disconnection\n";
-    }
-}
-
-bool initialize_controllers() {
-    struct EccInfo* info = nullptr;
-    int num_controllers = ECC_Check(&info);
-    
-    if (num_controllers <= 0) {
-        std::cerr << "No controllers found\n";
-        ECC_ReleaseInfo();
-        return false;
-    }
-
-    std::cout << "Found " << num_controllers << " controller(s):\n";
-
-    for (int i = 0; i < std::min(num_controllers, 2); ++i) {
-        Int32 id, handle;
-        Bln32 locked;
-        
-        if (ECC_getDeviceInfo(i, &id, &locked) != 0) continue;
-        if (locked) continue;
-        if (ECC_Connect(i, &handle) != 0) continue;
-
+            } else if (cmd.find("TRACE/") == 0) {
+                // Handle TRACE commands: "TRACE/ON", "TRACE/ON/100", "TRACE/OFF", "TRACE/DUMP"
+                std::istringstream iss(cmd);
+                std::string trace_cmd, action, every_str;
+                std::getline(iss, trace_cmd, '/');
+                std::getline(iss, action, '/');
+                std::getline(iss, every_str);
+                
+                std::string result_msg = std::to_string(get_nanosecond_timestamp()) + "/COMMAND/TRACE/ALL/";
+                
+                if (action == "ON") {
+                    int every_n = every_str.empty() ? 100 : std::atoi(every_str.c_str());
+                    if (every_n >= 1) {
+                        g_trace_every_n = every_n;
+                        std::cout << "Tracing enabled (every " << every_n << " samples)\n";
+                        result_msg += "SUCCESS/Tracing every " + std::to_string(every_n) + " samples";
+                    } else {
+                        result_msg += "FAILED/Invalid sampling interval";
+                    }
+                } else if (action == "OFF") {
+                    g_trace_every_n = 0;
+                    std::cout << "Tracing disabled\n";
+                    result_msg += "SUCCESS/Tracing disabled";
+                } else if (action == "DUMP") {
+                    std::string path = "ecc_trace_" + std::to_string(get_nanosecond_timestamp()) + ".json";
+                    std::ofstream file(path.c_str());
+                    if (file) {
+                        file << render_trace_json();
+                        std::cout << "Trace written to " << path << "\n";
+                        result_msg += "SUCCESS/Trace written to " + path;
+                    } else {
+                        std::cout << "Failed to write trace file " << path << "\n";
+                        result_msg += "FAILED/Cannot write " + path;
+                    }
+                } else {
+                    std::cout << "Invalid TRACE command format: " << cmd << "\n";
+                    result_msg += "FAILED/Unknown TRACE action";
+                }
+                
+                if (g_mqtt_connected) {
+                    mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_RESULT.c_str(), 
+                                    result_msg.length(), result_msg.c_str(), 1, false);
+                }
+                
+            } else if (cmd.find("RECORD/") == 0) {
+                // Handle RECORD commands: "RECORD/ON", "RECORD/ON/<directory>", "RECORD/OFF"
+                std::istringstream iss(cmd);
+                std::string record_cmd, action, directory;
+                std::getline(iss, record_cmd, '/');
+                std::getline(iss, action, '/');
+                std::getline(iss, directory);
+                
+                if (action == "ON") {
+                    if (g_recording.load()) {
+                        publish_result("RECORD", "ALL", "FAILED", "Already recording");
+                    } else {
+                        {
+                            std::lock_guard<std::mutex> lock(g_record_mutex);
+                            g_record_directory = directory.empty() ? RECORD_DEFAULT_DIRECTORY : directory;
+                            directory = g_record_directory;
+                        }
+                        g_recording = true;
+                        std::cout << "Recording to " << directory << "\n";
+                        publish_result("RECORD", "ALL", "SUCCESS", "Recording to " + directory);
+                    }
+                } else if (action == "OFF") {
+                    g_recording = false;
+                    std::cout << "Recording stopped\n";
+                    publish_result("RECORD", "ALL", "SUCCESS", "Recording stopped (" + 
+                                   std::to_string(g_record_samples.load()) + " samples, " + 
+                                   std::to_string(g_record_dropped.load()) + " dropped)");
+                } else {
+                    std::cout << "Invalid RECORD command format: " << cmd << "\n";
+                    publish_result("RECORD", "ALL", "FAILED", "Unknown RECORD action");
+                }
+                
+            } else if (cmd.find("MULTICAST/") == 0) {
+                // Handle MULTICAST commands: "MULTICAST/ON[/<group>[:<port>][/<samples_per_packet>[/<interface>]]]",
+                // "MULTICAST/OFF"
+                std::istringstream iss(cmd);
+                std::string multicast_cmd, action, address, samples_str, interface;
+                std::getline(iss, multicast_cmd, '/');
+                std::getline(iss, action, '/');
+                std::getline(iss, address, '/');
+                std::getline(iss, samples_str, '/');
+                std::getline(iss, interface);
+                
+                if (action == "ON") {
+                    std::string group = MULTICAST_DEFAULT_GROUP;
+                    uint16_t port = MULTICAST_DEFAULT_PORT;
+                    int samples = samples_str.empty() ? MULTICAST_DEFAULT_SAMPLES : std::atoi(samples_str.c_str());
+                    struct in_addr group_addr, interface_addr;
+                    if (g_multicast_enabled.load()) {
+                        publish_result("MULTICAST", "ALL", "FAILED", "Multicast already on");
+                    } else if (!parse_multicast_address(address, group, port) || 
+                               inet_pton(AF_INET, group.c_str(), &group_addr) != 1 || 
+                               !IN_MULTICAST(ntohl(group_addr.s_addr))) {
+                        publish_result("MULTICAST", "ALL", "FAILED", "Invalid multicast group: " + address);
+                    } else if (samples < 1 || samples > MULTICAST_MAX_SAMPLES) {
+                        publish_result("MULTICAST", "ALL", "FAILED", "Samples per packet must be 1-" + 
+                                       std::to_string(MULTICAST_MAX_SAMPLES));
+                    } else if (!interface.empty() && inet_pton(AF_INET, interface.c_str(), &interface_addr) != 1) {
+                        publish_result("MULTICAST", "ALL", "FAILED", "Invalid interface address: " + interface);
+                    } else {
+                        {
+                            std::lock_guard<std::mutex> lock(g_multicast_mutex);
+                            g_multicast_group = group;
+                            g_multicast_port = port;
+                            g_multicast_samples = static_cast<uint16_t>(samples);
+                            g_multicast_interface = interface;
+                            g_multicast_error.clear();
+                        }
+                        g_multicast_generation.fetch_add(1, std::memory_order_release);
+                        g_multicast_enabled = true;
+                        std::string target = group + ":" + std::to_string(port);
+                        std::cout << "Multicast to " << target << ", " << samples << " samples per packet\n";
+                        publish_result("MULTICAST", "ALL", "SUCCESS", "Multicast to " + target + ", " + 
+                                       std::to_string(samples) + " samples per packet");
+                    }
+                } else if (action == "OFF") {
+                    g_multicast_enabled = false;
+                    std::cout << "Multicast stopped\n";
+                    publish_result("MULTICAST", "ALL", "SUCCESS", "Multicast stopped (" + 
+                                   std::to_string(g_multicast_packets.load()) + " packets, " + 
+                                   std::to_string(g_multicast_dropped.load()) + " samples dropped)");
+                } else {
+                    std::cout << "Invalid MULTICAST command format: " << cmd << "\n";
+                    publish_result("MULTICAST", "ALL", "FAILED", "Unknown MULTICAST action");
+                }
+                
+            } else if (cmd.find("PICO/") == 0) {
+                // Handle PICO commands: "PICO/ON[/<device>[:<baud>]]", "PICO/OFF",
+                // "PICO/MODE/<SINGLE|BURST|TRIGGERED>[/<points>[/<nplc>]]"
+                // e.g. "PICO/ON//dev/ttyUSB0:19200", "PICO/MODE/BURST/500/0.1"
+                // TRIGGERED bursts are started by BURST position triggers (TRIGGER/ADD)
+                std::istringstream iss(cmd);
+                std::string pico_cmd, action;
+                std::getline(iss, pico_cmd, '/');
+                std::getline(iss, action, '/');
+                
+                if (action == "ON") {
+                    std::string device;
+                    std::getline(iss, device);
+                    int baud = PICO_DEFAULT_BAUD;
+                    size_t colon = device.rfind(':');
+                    if (colon != std::string::npos) {
+                        baud = std::atoi(device.c_str() + colon + 1);
+                        device.erase(colon);
+                    }
+                    if (device.empty()) device = PICO_DEFAULT_DEVICE;
+                    
+                    if (g_pico_enabled.load()) {
+                        publish_result("PICO", "ALL", "FAILED", "Picoammeter already on");
+                    } else if (pico_baud_constant(baud) == 0) {
+                        publish_result("PICO", "ALL", "FAILED", "Unsupported baud rate " + std::to_string(baud));
+                    } else {
+                        {
+                            std::lock_guard<std::mutex> lock(g_pico_mutex);
+                            g_pico_device = device;
+                            g_pico_baud = baud;
+                            g_pico_error.clear();
+                            g_pico_identity.clear();
+                        }
+                        g_pico_enabled = true;
+                        std::cout << "Picoammeter on " << device << " at " << baud << " baud\n";
+                        publish_result("PICO", "ALL", "SUCCESS", "Picoammeter on " + device + " at " + 
+                                       std::to_string(baud) + " baud");
+                    }
+                } else if (action == "OFF") {
+                    g_pico_enabled = false;
+                    std::cout << "Picoammeter stopped\n";
+                    publish_result("PICO", "ALL", "SUCCESS", "Picoammeter stopped (" + 
+                                   std::to_string(g_pico_readings.load()) + " readings)");
+                } else if (action == "MODE") {
+                    std::string mode, points_str, nplc_str;
+                    std::getline(iss, mode, '/');
+                    std::getline(iss, points_str, '/');
+                    std::getline(iss, nplc_str);
+                    int points = points_str.empty() ? PICO_DEFAULT_POINTS : std::atoi(points_str.c_str());
+                    double nplc = nplc_str.empty() ? PICO_DEFAULT_NPLC : std::atof(nplc_str.c_str());
+                    
+                    if (mode != "SINGLE" && mode != "BURST" && mode != "TRIGGERED") {
+                        publish_result("PICO", "ALL", "FAILED", "Mode must be SINGLE, BURST or TRIGGERED");
+                    } else if (points < 1 || points > static_cast<int>(PICO_MAX_BURST_POINTS)) {
+                        publish_result("PICO", "ALL", "FAILED", "Burst points must be 1-" + 
+                                       std::to_string(PICO_MAX_BURST_POINTS));
+                    } else if (!(nplc >= 0.01 && nplc <= 60)) {
+                        publish_result("PICO", "ALL", "FAILED", "NPLC must be 0.01-60");
+                    } else {
+                        {
+                            std::lock_guard<std::mutex> lock(g_pico_mutex);
+                            g_pico_mode = mode == "BURST" ? PICO_BURST : mode == "TRIGGERED" ? PICO_TRIGGERED : PICO_SINGLE;
+                            g_pico_points = static_cast<uint32_t>(points);
+                            g_pico_nplc = nplc;
+                        }
+                        g_pico_reconfigure = true;
+                        std::ostringstream summary;
+                        summary << "Picoammeter mode " << (mode == "SINGLE" ? std::string("single") : 
+                                                           (mode == "BURST" ? "burst of " : "triggered burst of ") + 
+                                                           std::to_string(points)) << ", NPLC " << nplc;
+                        std::cout << summary.str() << "\n";
+                        publish_result("PICO", "ALL", "SUCCESS", summary.str());
+                    }
+                } else {
+                    std::cout << "Invalid PICO command format: " << cmd << "\n";
+                    publish_result("PICO", "ALL", "FAILED", "Unknown PICO action");
+                }
+                
+            } else if (cmd.find("IMAGE/") == 0) {
+                // Handle IMAGE commands: "IMAGE/START/<axes>/<x0>/<x1>/<width>/<y0>/<y1>/<height>",
+                // "IMAGE/STOP", "IMAGE/REFRESH"
+                // e.g. "IMAGE/START/XY/0/100000/256/0/50000/128" (columns along X, rows along Y)
+                std::istringstream iss(cmd);
+                std::string image_cmd, action, axes;
+                std::getline(iss, image_cmd, '/');
+                std::getline(iss, action, '/');
+                
+                if (action == "START") {
+                    std::getline(iss, axes, '/');
+                    std::string fields[6];
+                    for (std::string& field : fields) std::getline(iss, field, '/');
+                    ScanGrid grid;
+                    std::string error;
+                    size_t axis_x = axes.size() == 2 ? std::string("XYZR").find(axes[0]) : std::string::npos;
+                    size_t axis_y = axes.size() == 2 ? std::string("XYZR").find(axes[1]) : std::string::npos;
+                    if (axis_x == std::string::npos || axis_y == std::string::npos || fields[5].empty()) {
+                        error = "Usage: IMAGE/START/<axes>/<x0>/<x1>/<width>/<y0>/<y1>/<height>";
+                    } else {
+                        grid.axis_x = static_cast<uint8_t>(axis_x);
+                        grid.axis_y = static_cast<uint8_t>(axis_y);
+                        grid.x0 = std::atoi(fields[0].c_str());
+                        grid.x1 = std::atoi(fields[1].c_str());
+                        grid.width = static_cast<uint32_t>(std::max(0, std::atoi(fields[2].c_str())));
+                        grid.y0 = std::atoi(fields[3].c_str());
+                        grid.y1 = std::atoi(fields[4].c_str());
+                        grid.height = static_cast<uint32_t>(std::max(0, std::atoi(fields[5].c_str())));
+                        check_scan_grid(grid, error);
+                    }
+                    
+                    if (!error.empty()) {
+                        publish_result("IMAGE", "ALL", "FAILED", error);
+                    } else {
+                        {
+                            std::lock_guard<std::mutex> lock(g_image_mutex);
+                            g_image_grid = grid;
+                            g_image_fused.clear();
+                        }
+                        uint32_t scan_id = g_image_scan_id.fetch_add(1) + 1;
+                        g_image_enabled = true;
+                        std::string summary = "Image scan " + std::to_string(scan_id) + ", " + std::to_string(grid.width) + 
+                                              "x" + std::to_string(grid.height) + " pixels on " + axes;
+                        if (!g_pico_enabled.load()) summary += " (picoammeter is off, send PICO/ON)";
+                        std::cout << summary << "\n";
+                        publish_result("IMAGE", "ALL", "SUCCESS", summary);
+                    }
+                } else if (action == "STOP") {
+                    g_image_enabled = false;
+                    std::cout << "Image scan stopped\n";
+                    publish_result("IMAGE", "ALL", "SUCCESS", "Image scan " + std::to_string(g_image_scan_id.load()) + 
+                                   " stopped (" + std::to_string(g_image_pairs.load()) + " pairs)");
+                } else if (action == "REFRESH") {
+                    g_image_refresh = true;
+                    publish_result("IMAGE", "ALL", "SUCCESS", "Resending all tiles");
+                } else {
+                    std::cout << "Invalid IMAGE command format: " << cmd << "\n";
+                    publish_result("IMAGE", "ALL", "FAILED", "Unknown IMAGE action");
+                }
+                
+            } else if (cmd.find("ALIGN/") == 0) {
+                // Handle ALIGN commands: "ALIGN/<LINEAR|CUBIC>[/<latency_budget_ms>]"
+                std::istringstream iss(cmd);
+                std::string align_cmd, method, latency_str;
+                std::getline(iss, align_cmd, '/');
+                std::getline(iss, method, '/');
+                std::getline(iss, latency_str);
+                
+                int latency_ms = latency_str.empty() ? static_cast<int>(ALIGN_DEFAULT_LATENCY_MS) : std::atoi(latency_str.c_str());
+                if (method != "LINEAR" && method != "CUBIC") {
+                    publish_result("ALIGN", "ALL", "FAILED", "Method must be LINEAR or CUBIC");
+                } else if (latency_ms < 1 || latency_ms > static_cast<int>(ALIGN_MAX_LATENCY_MS)) {
+                    publish_result("ALIGN", "ALL", "FAILED", "Latency budget must be 1-" + 
+                                   std::to_string(ALIGN_MAX_LATENCY_MS) + " ms");
+                } else {
+                    {
+                        std::lock_guard<std::mutex> lock(g_align_mutex);
+                        g_align_method = method == "CUBIC" ? ALIGN_CUBIC : ALIGN_LINEAR;
+                        g_align_latency_ms = static_cast<uint32_t>(latency_ms);
+                    }
+                    g_align_reconfigure = true;
+                    std::string summary = "Alignment " + method + ", latency budget " + std::to_string(latency_ms) + " ms";
+                    std::cout << summary << "\n";
+                    publish_result("ALIGN", "ALL", "SUCCESS", summary);
+                }
+                
+            } else if (cmd.find("TRIGGER/") == 0) {
+                // Handle TRIGGER commands:
+                // "TRIGGER/ADD/<name>/<axis>/<position>/<FWD|REV|BOTH>/<MARK|LINE|BURST>[/<hysteresis>]",
+                // "TRIGGER/REMOVE/<name>", "TRIGGER/CLEAR"
+                // e.g. "TRIGGER/ADD/line/X/12000/FWD/LINE" fires when X rises through 12000 nm
+                std::istringstream iss(cmd);
+                std::string trigger_cmd, action, name;
+                std::getline(iss, trigger_cmd, '/');
+                std::getline(iss, action, '/');
+                std::getline(iss, name, '/');
+                
+                if (action == "ADD") {
+                    std::string axis_str, position_str, direction, kind, hysteresis_str;
+                    std::getline(iss, axis_str, '/');
+                    std::getline(iss, position_str, '/');
+                    std::getline(iss, direction, '/');
+                    std::getline(iss, kind, '/');
+                    std::getline(iss, hysteresis_str);
+                    TriggerSpec spec;
+                    spec.name = name;
+                    size_t axis = axis_str.size() == 1 ? std::string("XYZR").find(axis_str[0]) : std::string::npos;
+                    char* end = nullptr;
+                    long position = std::strtol(position_str.c_str(), &end, 10);
+                    spec.hysteresis = hysteresis_str.empty() ? TRIGGER_DEFAULT_HYSTERESIS : std::atoi(hysteresis_str.c_str());
+                    
+                    std::string error;
+                    if (!check_trigger_name(name)) {
+                        error = "Name must be 1-" + std::to_string(TRIGGER_NAME_SIZE - 1) + " letters, digits, '_' or '-'";
+                    } else if (axis == std::string::npos) {
+                        error = "Invalid axis name";
+                    } else if (position_str.empty() || *end != '\0' || position < INT32_MIN || position > INT32_MAX) {
+                        error = "Invalid trigger position";
+                    } else if (direction != "FWD" && direction != "REV" && direction != "BOTH") {
+                        error = "Direction must be FWD, REV or BOTH";
+                    } else if (kind != "MARK" && kind != "LINE" && kind != "BURST") {
+                        error = "Action must be MARK, LINE or BURST";
+                    } else if (spec.hysteresis < 0 || spec.hysteresis > TRIGGER_MAX_HYSTERESIS) {
+                        error = "Hysteresis must be 0-" + std::to_string(TRIGGER_MAX_HYSTERESIS);
+                    }
+                    if (error.empty()) {
+                        spec.axis = static_cast<uint8_t>(axis);
+                        spec.position = static_cast<int32_t>(position);
+                        spec.direction = direction == "FWD" ? TRIGGER_FORWARD : direction == "REV" ? TRIGGER_REVERSE : TRIGGER_BOTH;
+                        spec.action = kind == "MARK" ? TRIGGER_MARK : kind == "LINE" ? TRIGGER_LINE : TRIGGER_BURST;
+                        std::lock_guard<std::mutex> lock(g_trigger_mutex);
+                        auto it = std::find_if(g_trigger_specs.begin(), g_trigger_specs.end(),
+                                               [&name](const TriggerSpec& t) { return t.name == name; });
+                        if (it != g_trigger_specs.end()) {
+                            *it = spec;
+                        } else if (g_trigger_specs.size() >= TRIGGER_MAX) {
+                            error = "Trigger table full (" + std::to_string(TRIGGER_MAX) + " triggers)";
+                        } else {
+                            g_trigger_specs.push_back(spec);
+                        }
+                        if (error.empty()) g_trigger_version.fetch_add(1, std::memory_order_release);
+                    }
+                    
+                    if (!error.empty()) {
+                        publish_result("TRIGGER", axis_str, "FAILED", error);
+                    } else {
+                        std::string summary = "Trigger " + name + ": " + axis_str + " " + position_str + " " + direction + 
+                                              " -> " + kind + ", hysteresis " + std::to_string(spec.hysteresis);
+                        if (spec.action == TRIGGER_BURST) {
+                            std::lock_guard<std::mutex> lock(g_pico_mutex);
+                            if (g_pico_mode != PICO_TRIGGERED) summary += " (picoammeter is not in TRIGGERED mode)";
+                        }
+                        std::cout << summary << "\n";
+                        publish_result("TRIGGER", axis_str, "SUCCESS", summary);
+                    }
+                } else if (action == "REMOVE" || action == "CLEAR") {
+                    size_t removed;
+                    {
+                        std::lock_guard<std::mutex> lock(g_trigger_mutex);
+                        size_t before = g_trigger_specs.size();
+                        if (action == "CLEAR") {
+                            g_trigger_specs.clear();
+                        } else {
+                            g_trigger_specs.erase(std::remove_if(g_trigger_specs.begin(), g_trigger_specs.end(),
+                                                                 [&name](const TriggerSpec& t) { return t.name == name; }),
+                                                  g_trigger_specs.end());
+                        }
+                        removed = before - g_trigger_specs.size();
+                        g_trigger_version.fetch_add(1, std::memory_order_release);
+                    }
+                    if (action == "REMOVE" && removed == 0) {
+                        publish_result("TRIGGER", "ALL", "FAILED", "No trigger named " + name);
+                    } else {
+                        publish_result("TRIGGER", "ALL", "SUCCESS", "Removed " + std::to_string(removed) + " triggers");
+                    }
+                } else {
+                    std::cout << "Invalid TRIGGER command format: " << cmd << "\n";
+                    publish_result("TRIGGER", "ALL", "FAILED", "Unknown TRIGGER action");
+                }
+                
+            } else if (cmd.find("STATS/") == 0) {
+                // Handle STATS commands: "STATS/ON[/<window_s>,...[/<interval_ms>]]", "STATS/OFF"
+                // e.g. "STATS/ON/1,10,60,600/500"
+                std::istringstream iss(cmd);
+                std::string stats_cmd, action, windows_str, interval_str;
+                std::getline(iss, stats_cmd, '/');
+                std::getline(iss, action, '/');
+                std::getline(iss, windows_str, '/');
+                std::getline(iss, interval_str);
+                
+                if (action == "ON") {
+                    std::vector<uint32_t> windows;
+                    std::string error;
+                    std::istringstream items(windows_str);
+                    std::string item;
+                    while (error.empty() && std::getline(items, item, ',')) {
+                        int window_s = std::atoi(item.c_str());
+                        if (window_s < 1 || window_s > static_cast<int>(STATS_MAX_WINDOW_S)) {
+                            error = "Windows must be 1-" + std::to_string(STATS_MAX_WINDOW_S) + " s";
+                        } else {
+                            windows.push_back(static_cast<uint32_t>(window_s));
+                        }
+                    }
+                    int interval_ms = interval_str.empty() ? static_cast<int>(STATS_DEFAULT_INTERVAL_MS) : std::atoi(interval_str.c_str());
+                    if (error.empty() && windows.size() > STATS_MAX_WINDOWS) {
+                        error = "At most " + std::to_string(STATS_MAX_WINDOWS) + " windows";
+                    } else if (error.empty() && (interval_ms < 100 || interval_ms > 60000)) {
+                        error = "Interval must be 100-60000 ms";
+                    }
+                    
+                    if (!error.empty()) {
+                        publish_result("STATS", "ALL", "FAILED", error);
+                    } else {
+                        std::string summary;
+                        {
+                            std::lock_guard<std::mutex> lock(g_stats_mutex);
+                            if (!windows.empty()) {
+                                std::sort(windows.begin(), windows.end());
+                                windows.erase(std::unique(windows.begin(), windows.end()), windows.end());
+                                g_stats_windows_s = windows;
+                            }
+                            g_stats_interval_ms = static_cast<uint32_t>(interval_ms);
+                            summary = "Statistics over ";
+                            for (size_t i = 0; i < g_stats_windows_s.size(); ++i) {
+                                summary += (i ? ", " : "") + std::to_string(g_stats_windows_s[i]);
+                            }
+                            summary += " s, every " + std::to_string(interval_ms) + " ms";
+                        }
+                        g_stats_reconfigure = true;
+                        g_stats_enabled = true;
+                        std::cout << summary << "\n";
+                        publish_result("STATS", "ALL", "SUCCESS", summary);
+                    }
+                } else if (action == "OFF") {
+                    g_stats_enabled = false;
+                    std::cout << "Statistics stopped\n";
+                    publish_result("STATS", "ALL", "SUCCESS", "Statistics stopped");
+                } else {
+                    std::cout << "Invalid STATS command format: " << cmd << "\n";
+                    publish_result("STATS", "ALL", "FAILED", "Unknown STATS action");
+                }
+                
+            } else if (cmd.find("AXIS_TOPICS/") == 0) {
+                // Handle AXIS_TOPICS commands: "AXIS_TOPICS/<ON|ONLY|OFF>[/<axis>=<decimation>,...]"
+                // e.g. "AXIS_TOPICS/ON/Z=10,R=100"
+                std::istringstream iss(cmd);
+                std::string topics_cmd, mode, decimations;
+                std::getline(iss, topics_cmd, '/');
+                std::getline(iss, mode, '/');
+                std::getline(iss, decimations);
+                
+                int new_mode = mode == "ON" ? AXIS_TOPICS_ON : mode == "ONLY" ? AXIS_TOPICS_ONLY : 
+                               mode == "OFF" ? AXIS_TOPICS_OFF : -1;
+                uint32_t new_decimation[4];
+                for (int a = 0; a < 4; ++a) new_decimation[a] = g_axis_decimation[a].load();
+                std::string error = new_mode < 0 ? "Mode must be ON, ONLY or OFF" : "";
+                
+                std::istringstream items(decimations);
+                std::string item;
+                while (error.empty() && std::getline(items, item, ',')) {
+                    size_t eq = item.find('=');
+                    int controller, axis;
+                    int decimation = eq == std::string::npos ? 0 : std::atoi(item.c_str() + eq + 1);
+                    if (eq == std::string::npos || !parse_axis_name(item.substr(0, eq), controller, axis) || decimation < 1) {
+                        error = "Invalid decimation: " + item;
+                    } else {
+                        new_decimation[get_logical_axis(controller, axis)] = decimation;
+                    }
+                }
+                
+                if (!error.empty()) {
+                    std::cout << "Invalid AXIS_TOPICS command: " << cmd << "\n";
+                    publish_result("AXIS_TOPICS", "ALL", "FAILED", error);
+                } else {
+                    for (int a = 0; a < 4; ++a) g_axis_decimation[a] = new_decimation[a];
+                    g_axis_topic_mode = new_mode;
+                    std::string summary = "Per-axis topics " + mode + " (decimation X " + std::to_string(new_decimation[0]) + 
+                                          ", Y " + std::to_string(new_decimation[1]) + ", Z " + 
+                                          std::to_string(new_decimation[2]) + ", R " + std::to_string(new_decimation[3]) + ")";
+                    std::cout << summary << "\n";
+                    publish_result("AXIS_TOPICS", "ALL", "SUCCESS", summary);
+                }
+                
+            } else if (cmd.find("SET_AXIS_RATE/") == 0) {
+                // Handle SET_AXIS_RATE command: "SET_AXIS_RATE/<axis>/<hz|MAX>", e.g. "SET_AXIS_RATE/R/100"
+                std::istringstream iss(cmd);
+                std::string rate_cmd, axis_name, rate_str;
+                std::getline(iss, rate_cmd, '/');
+                std::getline(iss, axis_name, '/');
+                std::getline(iss, rate_str);
+                
+                int controller, axis;
+                int hz = (rate_str == "MAX") ? 0 : std::atoi(rate_str.c_str());
+                if (!parse_axis_name(axis_name, controller, axis)) {
+                    publish_result("SET_AXIS_RATE", axis_name, "FAILED", "Unknown axis");
+                } else if (rate_str != "MAX" && (hz < AXIS_RATE_MIN_HZ || hz > 15000)) {
+                    publish_result("SET_AXIS_RATE", axis_name, "FAILED", "Rate must be " + 
+                                   std::to_string(AXIS_RATE_MIN_HZ) + "-15000 Hz or MAX");
+                } else {
+                    int logical = get_logical_axis(controller, axis);
+                    g_axis_rate_hz[logical] = hz;
+                    update_axis_schedule();
+                    uint32_t divider = static_cast<uint32_t>(g_axis_schedule[logical].load() >> 32);
+                    std::string summary = "Every " + std::to_string(divider) + " ticks (" + 
+                                          std::to_string(g_sample_rate_hz.load() / divider) + " Hz at " + 
+                                          std::to_string(g_sample_rate_hz.load()) + " Hz)";
+                    std::cout << "Axis " << axis_name << " sampling: " << summary << "\n";
+                    publish_result("SET_AXIS_RATE", axis_name, "SUCCESS", summary);
+                }
+                
+            } else if (cmd.find("GET_HISTORY/") == 0) {
+                // Handle GET_HISTORY command: "GET_HISTORY/<t0>/<t1>[/<decimation>[/TEXT|BINARY]]"
+                std::istringstream iss(cmd);
+                std::string history_cmd, t0_str, t1_str, decimation_str, format;
+                std::getline(iss, history_cmd, '/');
+                std::getline(iss, t0_str, '/');
+                std::getline(iss, t1_str, '/');
+                std::getline(iss, decimation_str, '/');
+                std::getline(iss, format);
+                
+                uint64_t now = get_nanosecond_timestamp();
+                uint64_t t0 = 0, t1 = 0;
+                int decimation = decimation_str.empty() ? 1 : std::atoi(decimation_str.c_str());
+                if (!parse_history_time(t0_str, now, t0) || !parse_history_time(t1_str, now, t1) || t1 < t0) {
+                    publish_result("GET_HISTORY", "ALL", "FAILED", "Invalid time range");
+                } else if (decimation < 1) {
+                    publish_result("GET_HISTORY", "ALL", "FAILED", "Invalid decimation: " + decimation_str);
+                } else if (!format.empty() && format != "TEXT" && format != "BINARY") {
+                    publish_result("GET_HISTORY", "ALL", "FAILED", "Unknown format: " + format);
+                } else {
+                    // Decoding and publishing a long range is left to the query thread, so
+                    // commands behind this one (STOP) are not held up
+                    HistoryQuery query;
+                    query.request_id = cmd_id;
+                    query.t0 = t0;
+                    query.t1 = t1;
+                    query.decimation = decimation;
+                    query.binary = format == "BINARY";
+                    bool queued = false;
+                    {
+                        std::lock_guard<std::mutex> lock(g_history_query_mutex);
+                        if (g_history_query_queue.size() < HISTORY_MAX_PENDING_QUERIES) {
+                            g_history_query_queue.push_back(query);
+                            queued = true;
+                        }
+                    }
+                    if (!queued) {
+                        publish_result("GET_HISTORY", "ALL", "FAILED", "Too many pending requests (" + 
+                                       std::to_string(HISTORY_MAX_PENDING_QUERIES) + ")");
+                    }
+                }
+                
+            } else if (cmd == "SNAPSHOT" || cmd.find("SNAPSHOT/") == 0) {
+                // Handle SNAPSHOT command: "SNAPSHOT" or "SNAPSHOT/<note>"
+                std::string note = cmd.size() > 9 ? cmd.substr(9) : "";
+                request_snapshot(note.empty() ? "Manual" : "Manual: " + note, true);
+                publish_result("SNAPSHOT", "ALL", "SUCCESS", "Capturing " + 
+                               std::to_string(SNAPSHOT_PRE_NS / 1000000) + " ms before and " + 
+                               std::to_string(SNAPSHOT_POST_NS / 1000000) + " ms after now");
+                
+            } else if (cmd == "BENCH" || cmd.find("BENCH/") == 0) {
+                // Handle BENCH command: "BENCH" or "BENCH/<duration_ms per phase>"
+                int duration_ms = 1000;
+                if (cmd.size() > 6) {
+                    duration_ms = std::max(100, std::min(10000, std::atoi(cmd.c_str() + 6)));
+                }
+                
+                // The logical axes the sampler reads: X, Y, Z on controller 0, R on controller 1
+                std::vector<BenchAxis> axes;
+                for (int logical = 0; logical < 4; ++logical) {
+                    int controller = (logical < 3) ? 0 : 1;
+                    int axis = (logical < 3) ? logical : 0;
+                    if (g_controllers[controller].connected && g_controllers[controller].axes_connected[axis]) {
+                        BenchAxis a;
+                        a.handle = g_controllers[controller].handle;
+                        a.axis = axis;
+                        a.name = get_axis_name(controller, axis);
+                        axes.push_back(a);
+                    }
+                }
+                
+                if (axes.empty()) {
+                    publish_result("BENCH", "ALL", "FAILED", "No connected axes");
+                } else if (g_bench_running) {
+                    publish_result("BENCH", "ALL", "FAILED", "A benchmark is already running");
+                } else {
+                    // The worker publishes the report; the previous one has finished
+                    if (bench_worker.joinable()) bench_worker.join();
+                    g_bench_abort_reason = nullptr;
+                    g_bench_running = true;
+                    bench_worker = std::thread(bench_worker_thread, axes, duration_ms);
+                }
+                
+            } else {
+                std::cout << "Unknown command: " << cmd << "\n";
+            }
+            
+            uint64_t cmd_end = get_monotonic_ns();
+            g_command_latency[cmd_type].observe_ns(cmd_end - cmd_start);
+            if (traced) {
+                trace_complete(TRACE_COMMAND, TR_CMD_EXECUTE, cmd_start, cmd_end, cmd_id);
+            }
+        }
+        
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    
+    if (bench_worker.joinable()) bench_worker.join();
+    std::cout << "Command processor thread stopped\n";
+}
+
+// Parse "X/1200" or "X/1200/Y/-300" from the setpoint topic into the per-axis slots.
+// Runs in the MQTT callback: no queueing, only the newest value per axis survives.
+void handle_setpoint_message(const char* payload, int length) {
+    std::string text(payload, length);
+    std::istringstream iss(text);
+    std::string axis_str, value_str;
+    uint64_t now = get_monotonic_ns();
+    
+    while (std::getline(iss, axis_str, '/') && std::getline(iss, value_str, '/')) {
+        // A malformed value must not become a target of 0: reject it and leave the slot alone
+        int controller = -1, axis = -1;
+        char* end = nullptr;
+        long value = std::strtol(value_str.c_str(), &end, 10);
+        if (!parse_axis_name(axis_str, controller, axis) || value_str.empty() || *end != '\0' ||
+            value < INT32_MIN || value > INT32_MAX) {
+            g_setpoint_errors.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        
+        int logical = get_logical_axis(controller, axis);
+        SetpointSlot& slot = g_setpoints[logical];
+        slot.target.store(static_cast<int32_t>(value), std::memory_order_relaxed);
+        slot.received_ns.store(now, std::memory_order_relaxed);
+        slot.sequence.fetch_add(1, std::memory_order_release);
+        g_setpoints_received.fetch_add(1, std::memory_order_relaxed);
+        abort_bench("setpoint");
+    }
+}
+
+// Active MOVE_VEL profile with tracking statistics (owned by the setpoint streamer)
+struct ProfiledMove {
+    bool active = false;
+    MotionProfile profile;
+    uint64_t start_ns = 0;
+    int32_t target_range = 0;
+    int32_t last_written = 0;
+    uint64_t last_tick = 0;
+    double error_sq_sum = 0;
+    uint64_t error_samples = 0;
+    int32_t max_error = 0;
+};
+
+// Online target range tuning: shrink after fast settles for better repeatability,
+// grow after slow settles or timeouts so the controller stops hunting
+void tune_approach_range(int logical_axis, double settle_s, bool timed_out) {
+    std::lock_guard<std::mutex> lock(g_motion_mutex);
+    ApproachConfig& config = g_approach_config[logical_axis];
+    if (config.direction == 0) return;
+    
+    if (timed_out || settle_s > APPROACH_SETTLE_SLOW_S) {
+        config.tuned_range = std::min(config.max_range, config.tuned_range + std::max(1, config.tuned_range / 2));
+    } else if (settle_s < APPROACH_SETTLE_FAST_S) {
+        config.tuned_range = std::max(config.min_range, config.tuned_range - config.tuned_range / 5);
+    }
+    if (!timed_out) {
+        config.settles++;
+        config.last_settle_s = settle_s;
+    }
+}
+
+// Stop supervising a move that overran its model-derived timeout. Closed loop stays on:
+// the controller keeps holding the target, and the client decides what to do next.
+void fail_tracked_move(TrackedMove& move, int logical_axis, const std::string& axis_name, double elapsed_s) {
+    move.active = false;
+    g_moves_timed_out.fetch_add(1, std::memory_order_relaxed);
+    if (move.approach) tune_approach_range(logical_axis, 0, true);
+    
+    std::ostringstream msg;
+    msg << std::fixed << std::setprecision(3) << "Target " << move.target << " not reached after " 
+        << elapsed_s << " s (ETA " << move.eta_s << " s, limit " << move.timeout_s << " s)";
+    publish_result("MOVE", axis_name, "TIMEOUT", msg.str());
+    request_snapshot("MOVE/" + axis_name + " timed out");
+    std::cout << "MOVE " << axis_name << " timed out: " << msg.str() << "\n";
+}
+
+// Advance a MOVE from the latest sample: switch from the overshoot point to the final
+// target, then report once the stage has stayed in range for the settle window
+void update_tracked_move(TrackedMove& move, int logical_axis, const LatestSample& latest, uint64_t now_ns) {
+    int controller = (logical_axis < 3) ? 0 : 1;
+    int axis = (logical_axis < 3) ? logical_axis : 0;
+    std::string axis_name = get_axis_name(controller, axis);
+    
+    double elapsed_s = live_elapsed_s(move.start_ns, move.checked_ns, move.frozen_ns, latest, now_ns);
+    if (elapsed_s > move.timeout_s) {
+        fail_tracked_move(move, logical_axis, axis_name, elapsed_s);
+        return;
+    }
+    
+    if (latest.monotonic_ns <= move.start_ns || !(latest.sample.valid_mask & (1 << logical_axis))) return;
+    int32_t measured = get_sample_axis(latest.sample, logical_axis);
+    
+    if (move.staged) {
+        // Overshoot point counts as reached within half the overshoot distance at most
+        int32_t reach = std::max(1, std::min(move.target_range, std::abs(move.target - move.via) / 2));
+        if (std::abs(measured - move.via) > reach) return;
+        
+        Int32 target = move.target;
+        if (ECC_controlTargetPosition(g_controllers[controller].handle, axis, &target, 1) != 0) {
+            move.active = false;
+            publish_result("MOVE", axis_name, "FAILED", "Failed to write final approach target");
+            request_snapshot("MOVE/" + axis_name + ": failed to write final approach target");
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(g_motion_mutex);
+            g_move_models[logical_axis].record(move.via - move.start, (latest.monotonic_ns - move.start_ns) / 1e9,
+                                               move.amplitude_mv, move.frequency_mhz);
+        }
+        move.staged = false;
+        move.final_leg_ns = now_ns;
+        return;
+    }
+    
+    if (latest.monotonic_ns <= move.final_leg_ns) return;
+    if (std::abs(measured - move.target) > move.target_range) {
+        move.in_range_since_ns = 0;
+        return;
+    }
+    if (move.in_range_since_ns == 0) move.in_range_since_ns = latest.monotonic_ns;
+    if (latest.monotonic_ns - move.in_range_since_ns < MOVE_SETTLE_WINDOW_NS) return;
+    
+    // The last leg runs from the overshoot point (approach) or the start to the first in-range sample
+    double leg_s = (move.in_range_since_ns - move.final_leg_ns) / 1e9;
+    double total_s = (move.in_range_since_ns - move.start_ns) / 1e9;
+    int32_t leg_from = (move.via != move.target) ? move.via : move.start;
+    move.active = false;
+    g_moves_completed.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(g_motion_mutex);
+        g_move_models[logical_axis].record(move.target - leg_from, leg_s, move.amplitude_mv, move.frequency_mhz);
+    }
+    if (move.approach) tune_approach_range(logical_axis, leg_s, false);
+    
+    std::ostringstream msg;
+    msg << std::fixed << std::setprecision(3) << "Reached " << measured << " (error " 
+        << (measured - move.target) << ", range " << move.target_range << ") in " << total_s 
+        << " s (ETA " << move.eta_s << " s)";
+    if (move.approach) msg << ", settled " << leg_s << " s after final approach";
+    publish_result("MOVE", axis_name, "COMPLETED", msg.str());
+    std::cout << "MOVE " << axis_name << " completed: " << msg.str() << "\n";
+}
+
+// Running MOVE_QUEUE sequence (owned by the setpoint streamer)
+struct QueueRun {
+    bool active = false;
+    int32_t current = 0;           // Target of the current leg
+    int32_t leg_from = 0;
+    int32_t target_range = 0;
+    int32_t amplitude_mv = 0;
+    int32_t frequency_mhz = 0;
+    uint64_t start_ns = 0;
+    uint64_t leg_start_ns = 0;
+    double leg_timeout_s = 0;
+    uint64_t in_range_since_ns = 0;
+    uint64_t checked_ns = 0;       // Leg timeout bookkeeping, as in TrackedMove
+    uint64_t frozen_ns = 0;
+    uint32_t reached = 0;
+};
+
+// End the run, e.g. when a MOVE or setpoint takes over the axis. Commands clear the
+// queue themselves (cancel_motion) so targets queued after them survive.
+void abandon_queue_run(QueueRun& run, int logical_axis, const std::string& status, const std::string& reason,
+                       bool drop_pending = true) {
+    disarm_queue(logical_axis);
+    size_t dropped = 0;
+    if (drop_pending) {
+        std::lock_guard<std::mutex> lock(g_motion_mutex);
+        dropped = g_move_queues[logical_axis].size();
+        g_move_queues[logical_axis].clear();
+    }
+    if (!run.active) return;
+    run.active = false;
+    int controller = (logical_axis < 3) ? 0 : 1;
+    int axis = (logical_axis < 3) ? logical_axis : 0;
+    std::string summary = " (" + std::to_string(run.reached) + " targets reached";
+    if (drop_pending) summary += ", " + std::to_string(dropped) + " dropped";
+    publish_result("MOVE_QUEUE", get_axis_name(controller, axis), status, reason + summary + ")");
+    if (status == "FAILED" || status == "TIMEOUT") request_snapshot("MOVE_QUEUE/" + get_axis_name(controller, axis) + ": " + reason);
+}
+
+// Leg bookkeeping shared by sampler-triggered transitions and the final settle
+void start_queue_leg(QueueRun& run, int logical_axis, int32_t from, int32_t to, uint64_t start_ns) {
+    run.leg_from = from;
+    run.current = to;
+    run.leg_start_ns = start_ns;
+    run.in_range_since_ns = 0;
+    run.checked_ns = 0;
+    run.frozen_ns = 0;
+    std::lock_guard<std::mutex> lock(g_motion_mutex);
+    run.leg_timeout_s = g_move_models[logical_axis].predict(to - from, run.amplitude_mv, run.frequency_mhz).timeout_s;
+}
+
+void finish_queue_leg(QueueRun& run, int logical_axis, uint64_t end_ns) {
+    run.reached++;
+    g_queue_steps.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(g_motion_mutex);
+    g_move_models[logical_axis].record(run.current - run.leg_from, (end_ns - run.leg_start_ns) / 1e9,
+                                       run.amplitude_mv, run.frequency_mhz);
+}
+
+// Take the first pending target off the queue, if there is one
+bool take_queued_target(int logical_axis, Int32& target) {
+    std::lock_guard<std::mutex> lock(g_motion_mutex);
+    std::deque<int32_t>& queue = g_move_queues[logical_axis];
+    if (queue.empty()) return false;
+    target = queue.front();
+    queue.pop_front();
+    return true;
+}
+
+// Begin a run with the first target taken off the queue; later targets are handed to the sampler
+void start_queue_run(QueueRun& run, int logical_axis, Int32 first, const LatestSample& latest, uint64_t now_ns) {
+    int controller = (logical_axis < 3) ? 0 : 1;
+    int axis = (logical_axis < 3) ? logical_axis : 0;
+    Int32 handle = g_controllers[controller].handle;
+    
+    run = QueueRun();
+    run.active = true;
+    run.start_ns = now_ns;
+    run.target_range = get_target_range(controller, axis);
+    get_drive_parameters(controller, axis, run.amplitude_mv, run.frequency_mhz);
+    int32_t from = (latest.sample.valid_mask & (1 << logical_axis)) ? get_sample_axis(latest.sample, logical_axis) : first;
+    start_queue_leg(run, logical_axis, from, first, now_ns);
+    
+    bool ok = ECC_controlTargetPosition(handle, axis, &first, 1) == 0;
+    if (ok && !g_closed_loop_enabled[logical_axis]) {
+        Bln32 enable = 1;
+        ok = ECC_controlMove(handle, axis, &enable, 1) == 0;
+        if (ok) g_closed_loop_enabled[logical_axis] = true;
+    }
+    if (!ok) abandon_queue_run(run, logical_axis, "FAILED", "Failed to write first target");
+}
+
+// Collect sampler-triggered transitions, arm the next target, and finish the run once
+// the last target has settled
+void update_queue_run(QueueRun& run, int logical_axis, const LatestSample& latest, uint64_t now_ns) {
+    int controller = (logical_axis < 3) ? 0 : 1;
+    int axis = (logical_axis < 3) ? logical_axis : 0;
+    std::string axis_name = get_axis_name(controller, axis);
+    QueueArm& arm = g_queue_arms[logical_axis];
+    
+    int state = arm.state.load(std::memory_order_acquire);
+    if (state == ARM_FIRED || state == ARM_FAILED) {
+        uint64_t fired_ns = arm.fired_ns.load(std::memory_order_relaxed);
+        int32_t next = arm.next.load(std::memory_order_relaxed);
+        arm.state.store(ARM_IDLE, std::memory_order_release);
+        if (state == ARM_FAILED) {
+            abandon_queue_run(run, logical_axis, "FAILED", "Failed to write target " + std::to_string(next));
+            return;
+        }
+        finish_queue_leg(run, logical_axis, fired_ns);
+        publish_result("MOVE_QUEUE", axis_name, "STEP", "Reached " + std::to_string(run.current) + 
+                       ", next " + std::to_string(next) + " (" + std::to_string(run.reached) + " reached)");
+        start_queue_leg(run, logical_axis, run.current, next, fired_ns);
+        state = ARM_IDLE;
+    }
+    
+    if (state == ARM_IDLE) {
+        // Armed under the mutex so cancel_motion cannot clear the queue in between
+        std::lock_guard<std::mutex> lock(g_motion_mutex);
+        std::deque<int32_t>& queue = g_move_queues[logical_axis];
+        if (!queue.empty()) {
+            arm.current.store(run.current, std::memory_order_relaxed);
+            arm.range.store(run.target_range, std::memory_order_relaxed);
+            arm.next.store(queue.front(), std::memory_order_relaxed);
+            queue.pop_front();
+            arm.state.store(ARM_ARMED, std::memory_order_release);
+            return;
+        }
+    } else {
+        state = ARM_ARMED;
+    }
+    
+    double leg_s = live_elapsed_s(run.leg_start_ns, run.checked_ns, run.frozen_ns, latest, now_ns);
+    if (leg_s > run.leg_timeout_s) {
+        g_moves_timed_out.fetch_add(1, std::memory_order_relaxed);
+        std::ostringstream msg;
+        msg << std::fixed << std::setprecision(3) << "Target " << run.current << " not reached after " 
+            << leg_s << " s (limit " << run.leg_timeout_s << " s)";
+        abandon_queue_run(run, logical_axis, "TIMEOUT", msg.str());
+        return;
+    }
+    
+    // Last target: wait for the settle window like a single MOVE
+    if (state != ARM_IDLE) return;
+    if (latest.monotonic_ns <= run.leg_start_ns || !(latest.sample.valid_mask & (1 << logical_axis))) return;
+    int32_t measured = get_sample_axis(latest.sample, logical_axis);
+    if (std::abs(measured - run.current) > run.target_range) {
+        run.in_range_since_ns = 0;
+        return;
+    }
+    if (run.in_range_since_ns == 0) run.in_range_since_ns = latest.monotonic_ns;
+    if (latest.monotonic_ns - run.in_range_since_ns < MOVE_SETTLE_WINDOW_NS) return;
+    
+    finish_queue_leg(run, logical_axis, run.in_range_since_ns);
+    run.active = false;
+    std::ostringstream msg;
+    msg << std::fixed << std::setprecision(3) << "Reached " << measured << " (error " << (measured - run.current) 
+        << "), " << run.reached << " targets in " << (run.in_range_since_ns - run.start_ns) / 1e9 << " s";
+    publish_result("MOVE_QUEUE", axis_name, "COMPLETED", msg.str());
+    std::cout << "MOVE_QUEUE " << axis_name << " completed: " << msg.str() << "\n";
+}
+
+// Writes the newest setpoint of each axis at most SETPOINT_RATE_HZ times per second.
+// Closed-loop control is enabled once and then left on, so each update is a single
+// ECC_controlTargetPosition call instead of a full MOVE. MOVE_VEL profiles are
+// streamed the same way, one intermediate target per period, and approach MOVEs
+// switch from the overshoot point to the final target here. MOVE_QUEUE runs are
+// started here and hand each next target to the sampler.
+void setpoint_streamer_thread() {
+    std::cout << "Setpoint streamer thread started (" << SETPOINT_RATE_HZ << " Hz max per axis)\n";
+    
+    struct PendingMotion {
+        bool active = false;
+        uint64_t received_ns = 0;
+        int32_t start_position = 0;
+        int32_t target = 0;
+    };
+    
+    std::array<uint64_t, 4> last_sequence = {0, 0, 0, 0};
+    std::array<PendingMotion, 4> pending;
+    std::array<ProfiledMove, 4> profiles;
+    std::array<TrackedMove, 4> tracked;
+    std::array<QueueRun, 4> queue_runs;
+    const auto interval = std::chrono::nanoseconds(1000000000 / SETPOINT_RATE_HZ);
+    auto next_time = std::chrono::steady_clock::now();
+    
+    while (g_running) {
+        // Leave the bus to a running benchmark
+        if (g_streamer_paused.load(std::memory_order_acquire)) {
+            g_streamer_idle.store(true, std::memory_order_release);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            next_time = std::chrono::steady_clock::now();
+            continue;
+        }
+        g_streamer_idle.store(false, std::memory_order_relaxed);
+        
+        LatestSample latest = g_latest_sample.load();
+        uint64_t now_ns = get_monotonic_ns();
+        std::array<MotionRequest, 4> requests;
+        
+        for (int logical = 0; logical < 4; ++logical) {
+            // STOP and MOVE hold the axis lock from cancel_motion through their own writes,
+            // so a pass either finishes before them or starts after and sees the cancel
+            std::lock_guard<std::mutex> axis_lock(g_axis_write_mutex[logical]);
+            {
+                std::lock_guard<std::mutex> lock(g_motion_mutex);
+                requests[logical] = g_motion_requests[logical];
+                g_motion_requests[logical] = MotionRequest();
+            }
+            
+            int controller = (logical < 3) ? 0 : 1;
+            int axis = (logical < 3) ? logical : 0;
+            std::string axis_name = get_axis_name(controller, axis);
+            Int32 handle = g_controllers[controller].handle;
+            ProfiledMove& move = profiles[logical];
+            TrackedMove& tracked_move = tracked[logical];
+            QueueRun& run = queue_runs[logical];
+            
+            if (requests[logical].cancel || requests[logical].start || requests[logical].start_tracking) {
+                abandon_queue_run(run, logical, "CANCELLED", requests[logical].start ? "Superseded by MOVE_VEL" :
+                                  requests[logical].start_tracking ? "Superseded by MOVE" : requests[logical].cancel_reason, 
+                                  false);
+            }
+            if (requests[logical].cancel && move.active) {
+                move.active = false;
+                publish_result("MOVE_VEL", axis_name, "CANCELLED", requests[logical].cancel_reason);
+            }
+            if ((requests[logical].cancel || requests[logical].start || requests[logical].start_tracking) && 
+                tracked_move.active) {
+                tracked_move.active = false;
+                publish_result("MOVE", axis_name, "CANCELLED", requests[logical].start ? "Superseded by MOVE_VEL" :
+                               requests[logical].start_tracking ? "Superseded by MOVE" : requests[logical].cancel_reason);
+            }
+            if (requests[logical].start_tracking) {
+                if (move.active) {
+                    move.active = false;
+                    publish_result("MOVE_VEL", axis_name, "CANCELLED", "Superseded by MOVE");
+                }
+                tracked_move = requests[logical].tracked;
+                tracked_move.active = true;
+            }
+            if (!tracked_move.active) restore_target_range(logical);
+            if (requests[logical].start) {
+                if (move.active) {
+                    publish_result("MOVE_VEL", axis_name, "CANCELLED", "Superseded by MOVE_VEL");
+                }
+                move = ProfiledMove();
+                move.active = true;
+                move.profile = requests[logical].profile;
+                move.target_range = requests[logical].target_range;
+                move.start_ns = now_ns;
+                move.last_written = move.profile.start;
+                move.last_tick = latest.tick;
+            }
+            
+            // Setpoint-to-motion: first sample that moved towards the target
+            PendingMotion& motion = pending[logical];
+            if (motion.active && latest.monotonic_ns > motion.received_ns && 
+                (latest.sample.valid_mask & (1 << logical))) {
+                int32_t position = get_sample_axis(latest.sample, logical);
+                int32_t moved = position - motion.start_position;
+                if (motion.target < motion.start_position) moved = -moved;
+                if (moved >= SETPOINT_MOTION_THRESHOLD || position == motion.target) {
+                    g_setpoint_motion_latency.observe_ns(latest.monotonic_ns - motion.received_ns);
+                    motion.active = false;
+                }
+            }
+            
+            SetpointSlot& slot = g_setpoints[logical];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence != last_sequence[logical]) {
+                uint64_t skipped = sequence - last_sequence[logical] - 1;
+                last_sequence[logical] = sequence;
+                g_setpoints_coalesced.fetch_add(skipped, std::memory_order_relaxed);
+                
+                if (move.active) {
+                    move.active = false;
+                    publish_result("MOVE_VEL", axis_name, "CANCELLED", "Superseded by setpoint stream");
+                }
+                if (tracked_move.active) {
+                    tracked_move.active = false;
+                    publish_result("MOVE", axis_name, "CANCELLED", "Superseded by setpoint stream");
+                }
+                abandon_queue_run(run, logical, "CANCELLED", "Superseded by setpoint stream");
+                
+                if (!g_controllers[controller].connected || !g_controllers[controller].axes_connected[axis]) {
+                    g_setpoint_errors.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                
+                Int32 target = slot.target.load(std::memory_order_relaxed);
+                uint64_t received_ns = slot.received_ns.load(std::memory_order_relaxed);
+                
+                if (ECC_controlTargetPosition(handle, axis, &target, 1) != 0) {
+                    g_setpoint_errors.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                
+                if (!g_closed_loop_enabled[logical]) {
+                    Bln32 enable = 1;
+                    if (ECC_controlMove(handle, axis, &enable, 1) != 0) {
+                        g_setpoint_errors.fetch_add(1, std::memory_order_relaxed);
+                        continue;
+                    }
+                    g_closed_loop_enabled[logical] = true;
+                }
+                
+                g_setpoints_written.fetch_add(1, std::memory_order_relaxed);
+                g_setpoint_write_latency.observe_ns(get_monotonic_ns() - received_ns);
+                
+                // Measure motion latency only when starting from rest at a distinct target
+                Int32 start_position = 0;
+                if (!motion.active && get_current_position(controller, axis, start_position) && 
+                    std::abs(target - start_position) > SETPOINT_MOTION_THRESHOLD) {
+                    motion.active = true;
+                    motion.received_ns = received_ns;
+                    motion.start_position = start_position;
+                    motion.target = target;
+                }
+                continue;
+            }
+            
+            if (tracked_move.active) {
+                update_tracked_move(tracked_move, logical, latest, now_ns);
+                if (!tracked_move.active) restore_target_range(logical);
+            }
+            
+            Int32 first_target;
+            if (!run.active) {
+                if (take_queued_target(logical, first_target)) {
+                    if (tracked_move.active) {
+                        tracked_move.active = false;
+                        publish_result("MOVE", axis_name, "CANCELLED", "Superseded by MOVE_QUEUE");
+                        restore_target_range(logical);
+                    }
+                    if (move.active) {
+                        move.active = false;
+                        publish_result("MOVE_VEL", axis_name, "CANCELLED", "Superseded by MOVE_QUEUE");
+                    }
+                    start_queue_run(run, logical, first_target, latest, now_ns);
+                }
+            } else {
+                update_queue_run(run, logical, latest, now_ns);
+            }
+            if (!move.active) continue;
+            
+            // Tracking error: commanded profile position at sample time vs measured
+            bool have_sample = latest.tick != move.last_tick && latest.monotonic_ns > move.start_ns &&
+                               (latest.sample.valid_mask & (1 << logical));
+            int32_t measured = get_sample_axis(latest.sample, logical);
+            if (have_sample) {
+                move.last_tick = latest.tick;
+                double t_sample = (latest.monotonic_ns - move.start_ns) / 1e9;
+                int32_t error = move.profile.position_at(t_sample) - measured;
+                move.error_sq_sum += static_cast<double>(error) * error;
+                move.error_samples++;
+                move.max_error = std::max(move.max_error, std::abs(error));
+            }
+            
+            // Stream the next intermediate target
+            double t = (now_ns - move.start_ns) / 1e9;
+            Int32 commanded = move.profile.position_at(t);
+            if (commanded != move.last_written || !g_closed_loop_enabled[logical]) {
+                bool ok = ECC_controlTargetPosition(handle, axis, &commanded, 1) == 0;
+                if (ok && !g_closed_loop_enabled[logical]) {
+                    Bln32 enable = 1;
+                    ok = ECC_controlMove(handle, axis, &enable, 1) == 0;
+                    if (ok) g_closed_loop_enabled[logical] = true;
+                }
+                if (!ok) {
+                    move.active = false;
+                    publish_result("MOVE_VEL", axis_name, "FAILED", "Failed to write intermediate target");
+                    request_snapshot("MOVE_VEL/" + axis_name + ": failed to write intermediate target");
+                    continue;
+                }
+                move.last_written = commanded;
+            }
+            
+            // Completion once the profile has ended and the stage is in target range
+            if (t >= move.profile.total_time) {
+                int32_t final_error = measured - move.profile.target;
+                bool settled = have_sample && std::abs(final_error) <= move.target_range;
+                bool timed_out = t >= move.profile.total_time + PROFILE_SETTLE_TIMEOUT_S;
+                
+                if (settled || timed_out) {
+                    double rms = move.error_samples ? std::sqrt(move.error_sq_sum / move.error_samples) : 0;
+                    std::ostringstream msg;
+                    msg << std::fixed << std::setprecision(3) << "Reached " << measured << " in " << t 
+                        << " s (planned " << move.profile.total_time << " s), tracking error max " 
+                        << move.max_error << " rms " << std::setprecision(1) << rms 
+                        << ", final error " << final_error;
+                    publish_result("MOVE_VEL", axis_name, settled ? "COMPLETED" : "FAILED", 
+                                   settled ? msg.str() : "Not settled: " + msg.str());
+                    std::cout << "MOVE_VEL " << axis_name << (settled ? " completed: " : " not settled: ") 
+                              << msg.str() << "\n";
+                    if (!settled) request_snapshot("MOVE_VEL/" + axis_name + " not settled");
+                    move.active = false;
+                }
+            }
+        }
+        
+        // Seen by BENCH, which only runs while no motion is supervised
+        for (int logical = 0; logical < 4; ++logical) {
+            g_axis_motion_active[logical].store(tracked[logical].active || profiles[logical].active || 
+                                                queue_runs[logical].active, std::memory_order_relaxed);
+        }
+        
+        next_time += interval;
+        std::this_thread::sleep_until(next_time);
+    }
+    
+    std::cout << "Setpoint streamer thread stopped\n";
+}
+
+// Axis map and rate stored in each segment header
+RecordSample make_record_sample(const PositionSample& sample) {
+    RecordSample record;
+    record.timestamp_ns = sample.timestamp_ns;
+    record.position[0] = sample.x_position;
+    record.position[1] = sample.y_position;
+    record.position[2] = sample.z_position;
+    record.position[3] = sample.r_position;
+    record.valid_mask = sample.valid_mask & 0x0F;
+    return record;
+}
+
+RecordSegmentInfo make_record_info(uint64_t dropped_total) {
+    static const char* const names[4] = {"X", "Y", "Z", "R"};
+    RecordSegmentInfo info;
+    info.sample_rate_hz = g_sample_rate_hz.load();
+    info.num_axes = 4;
+    info.dropped_total = dropped_total;
+    for (int logical = 0; logical < 4; ++logical) {
+        int controller = (logical < 3) ? 0 : 1;
+        int axis = (logical < 3) ? logical : 0;
+        RecordAxis& a = info.axes[logical];
+        std::memset(&a, 0, sizeof(a));
+        std::strncpy(a.name, names[logical], sizeof(a.name) - 1);
+        bool connected = g_controllers[controller].connected && g_controllers[controller].axes_connected[axis];
+        a.controller_id = connected ? g_controllers[controller].id : -1;
+        a.controller_index = controller;
+        a.axis = axis;
+    }
+    return info;
+}
+
+// Drains g_record_buffer into preallocated memory-mapped segments. Disk stalls only
+// delay this thread; the sampler keeps running and counts what it could not hand over.
+void recorder_thread() {
+    std::cout << "Recorder thread started\n";
+    
+    RecordingWriter writer;
+    FusedFileWriter fused_writer;
+    bool fused_failed = false;       // Not retried until the next RECORD/ON
+    std::vector<FusedRecord> fused;
+    bool active = false;
+    uint64_t dropped_at_start = 0;
+    uint64_t retry_after_ns = 0;     // Back off after a segment could not be opened
+    std::string last_segment;
+    PositionSample sample;
+    
+    while (g_running) {
+        bool recording = g_recording.load(std::memory_order_acquire);
+        if (recording && !active) {
+            std::string directory;
+            {
+                std::lock_guard<std::mutex> lock(g_record_mutex);
+                directory = g_record_directory;
+                g_record_error.clear();
+            }
+            mkdir(directory.c_str(), 0755);
+            writer.configure(directory, RECORD_SEGMENT_BYTES, RECORD_SEGMENT_SECONDS);
+            dropped_at_start = g_record_dropped.load();
+            retry_after_ns = 0;
+            active = true;
+        }
+        
+        // While recording drain in batches; after RECORD/OFF drain the rest, then close
+        size_t batch_limit = recording ? 4096 : RECORD_BUFFER_SAMPLES;
+        size_t drained = 0;
+        RecordSegmentInfo info = make_record_info(g_record_dropped.load() - dropped_at_start);
+        while (drained < batch_limit && g_record_buffer.try_read(sample)) {
+            drained++;
+            if (!active || get_monotonic_ns() < retry_after_ns) {
+                g_record_dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (writer.append(make_record_sample(sample), info)) {
+                g_record_samples.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                g_record_dropped.fetch_add(1, std::memory_order_relaxed);
+                retry_after_ns = get_monotonic_ns() + 1000000000ull;
+                std::lock_guard<std::mutex> lock(g_record_mutex);
+                if (g_record_error != writer.error()) {
+                    g_record_error = writer.error();
+                    std::cout << "Recorder: " << g_record_error << "\n";
+                }
+            }
+        }
+        writer.update_dropped(g_record_dropped.load() - dropped_at_start);
+        
+        // Fused picoammeter records go to their own file next to the segments
+        {
+            std::lock_guard<std::mutex> lock(g_record_mutex);
+            fused.swap(g_record_fused);
+        }
+        if (active && !fused.empty()) {
+            if (!fused_writer.is_open() && !fused_failed) {
+                std::string directory;
+                int method;
+                uint32_t latency_ms;
+                {
+                    std::lock_guard<std::mutex> lock(g_align_mutex);
+                    method = g_align_method;
+                    latency_ms = g_align_latency_ms;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(g_record_mutex);
+                    directory = g_record_directory;
+                }
+                bool opened = fused_writer.open(directory, get_nanosecond_timestamp(), static_cast<AlignMethod>(method), latency_ms);
+                std::lock_guard<std::mutex> lock(g_record_mutex);
+                if (opened) {
+                    g_record_fused_path = fused_writer.path();
+                    std::cout << "Recording fused records to " << g_record_fused_path << "\n";
+                } else {
+                    fused_failed = true;
+                    g_record_error = fused_writer.error();
+                    std::cout << "Recorder: " << g_record_error << "\n";
+                }
+            }
+            if (fused_writer.is_open() && fused_writer.append(fused.data(), fused.size())) {
+                g_record_fused_records.fetch_add(fused.size(), std::memory_order_relaxed);
+            } else {
+                fused_failed = true;
+                g_align_dropped.fetch_add(fused.size(), std::memory_order_relaxed);
+            }
+        }
+        fused.clear();
+        
+        if (writer.is_open() && writer.path() != last_segment) {
+            last_segment = writer.path();
+            g_record_segments.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(g_record_mutex);
+            g_record_segment = last_segment;
+            std::cout << "Recording segment " << last_segment << "\n";
+        }
+        
+        if (!recording && active) {
+            writer.close(g_record_dropped.load() - dropped_at_start);
+            fused_writer.close();
+            fused_failed = false;
+            active = false;
+            last_segment.clear();
+            std::lock_guard<std::mutex> lock(g_record_mutex);
+            g_record_segment.clear();
+            g_record_fused_path.clear();
+        }
+        
+        if (drained < batch_limit) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    
+    writer.close(g_record_dropped.load() - dropped_at_start);
+    fused_writer.close();
+    std::cout << "Recorder thread stopped\n";
+}
+
+// Compresses the sampler's copy of the stream into blocks (columnar, as in the archive)
+// and keeps the last HISTORY_WINDOW_S seconds of them for GET_HISTORY. Blocks close
+// after HISTORY_BLOCK_NS at the latest, so queries lag the live stream by at most that.
+void history_thread() {
+    std::cout << "History thread started\n";
+    
+    std::vector<RecordSample> pending;
+    pending.reserve(HISTORY_BLOCK_SAMPLES);
+    uint64_t block_start_ns = 0;
+    uint64_t held_samples = 0, held_bytes = 0;
+    PositionSample sample;
+    
+    while (g_running) {
+        size_t drained = 0;
+        while (g_history_buffer.try_read(sample)) {
+            drained++;
+            if (pending.empty()) block_start_ns = get_monotonic_ns();
+            pending.push_back(make_record_sample(sample));
+            if (pending.size() >= HISTORY_BLOCK_SAMPLES) break;
+        }
+        
+        if (!pending.empty() && (pending.size() >= HISTORY_BLOCK_SAMPLES || 
+                                 get_monotonic_ns() - block_start_ns >= HISTORY_BLOCK_NS)) {
+            std::shared_ptr<HistoryBlock> block = std::make_shared<HistoryBlock>();
+            archive_encode_block(pending.data(), pending.size(), block->index, block->data);
+            block->data.shrink_to_fit();
+            held_samples += block->index.count;
+            held_bytes += block->data.size() + sizeof(HistoryBlock);
+            pending.clear();
+            
+            uint64_t newest_ns = block->index.last_timestamp_ns;
+            std::lock_guard<std::mutex> lock(g_history_mutex);
+            g_history_blocks.push_back(block);
+            while (g_history_blocks.size() > 1 && 
+                   (g_history_blocks.front()->index.last_timestamp_ns + HISTORY_WINDOW_S * 1000000000ull < newest_ns ||
+                    held_bytes > HISTORY_MAX_BYTES)) {
+                held_samples -= g_history_blocks.front()->index.count;
+                held_bytes -= g_history_blocks.front()->data.size() + sizeof(HistoryBlock);
+                g_history_blocks.pop_front();
+            }
+            g_history_first_ns.store(g_history_blocks.front()->index.first_timestamp_ns, std::memory_order_relaxed);
+            g_history_samples.store(held_samples, std::memory_order_relaxed);
+            g_history_bytes.store(held_bytes, std::memory_order_relaxed);
+        }
+        
+        if (drained == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    
+    std::cout << "History thread stopped\n";
+}
+
+// Answers queued GET_HISTORY requests in order: chunks on MQTT_TOPIC_HISTORY, then the
+// command result with the sample and chunk counts
+void history_query_thread() {
+    std::cout << "History query thread started\n";
+    
+    while (g_running) {
+        HistoryQuery query;
+        bool has_query = false;
+        {
+            std::lock_guard<std::mutex> lock(g_history_query_mutex);
+            if (!g_history_query_queue.empty()) {
+                query = g_history_query_queue.front();
+                g_history_query_queue.pop_front();
+                has_query = true;
+            }
+        }
+        if (!has_query) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        
+        g_history_queries.fetch_add(1, std::memory_order_relaxed);
+        std::vector<RecordSample> samples;
+        bool complete = query_history(query.t0, query.t1, query.decimation, HISTORY_MAX_REPLY_SAMPLES, samples);
+        size_t chunks = publish_history(query.request_id, samples, query.binary);
+        
+        std::string msg = "Request " + std::to_string(query.request_id) + ": " + std::to_string(samples.size()) + 
+                          " samples in " + std::to_string(chunks) + " chunks on " + MQTT_TOPIC_HISTORY;
+        uint64_t first = g_history_first_ns.load();
+        if (first == 0) {
+            msg += ", history is empty";
+        } else if (query.t0 < first) {
+            msg += ", history starts at " + std::to_string(first);
+        }
+        if (!complete) {
+            msg += ", truncated at " + std::to_string(HISTORY_MAX_REPLY_SAMPLES) + " samples";
+        }
+        publish_result("GET_HISTORY", "ALL", "SUCCESS", msg);
+    }
+    
+    std::cout << "History query thread stopped\n";
+}
+
+// Writes the samples and status polls within [trigger - SNAPSHOT_PRE_NS, trigger + SNAPSHOT_POST_NS]
+// to SNAPSHOT_DIRECTORY/snapshot_<trigger_ns>: a recording segment, readable by ecc_archive,
+// and events.txt with the triggers and status flags.
+bool write_snapshot(uint64_t trigger_ns, const std::vector<SnapshotTrigger>& triggers,
+                    const std::vector<RecordSample>& window, uint64_t window_count,
+                    const std::deque<SnapshotStatus>& statuses, std::string& path, size_t& samples, std::string& error) {
+    uint64_t t0 = trigger_ns - SNAPSHOT_PRE_NS;
+    uint64_t t1 = trigger_ns + SNAPSHOT_POST_NS;
+    std::vector<RecordSample> selected;
+    for (uint64_t i = window_count > window.size() ? window_count - window.size() : 0; i < window_count; ++i) {
+        const RecordSample& r = window[i % window.size()];
+        if (r.timestamp_ns >= t0 && r.timestamp_ns <= t1) selected.push_back(r);
+    }
+    samples = selected.size();
+    
+    path = SNAPSHOT_DIRECTORY + "/snapshot_" + std::to_string(trigger_ns);
+    mkdir(SNAPSHOT_DIRECTORY.c_str(), 0755);
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+        error = "Cannot create " + path;
+        return false;
+    }
+    if (!selected.empty()) {
+        RecordingWriter writer;
+        writer.configure(path, RECORD_HEADER_SIZE + selected.size() * sizeof(RecordSample), RECORD_SEGMENT_SECONDS);
+        RecordSegmentInfo info = make_record_info(0);
+        for (const RecordSample& r : selected) {
+            if (!writer.append(r, info)) {
+                error = writer.error();
+                return false;
+            }
+        }
+        writer.close(0);
+    }
+    
+    std::ofstream events(path + "/events.txt");
+    events << "# Flight recorder snapshot, times in ns since epoch\n";
+    events << "# status <time> <X> <Y> <Z> <R>: 1 EOT forward, 2 EOT backward, 4 error, 8 in target range, - not connected\n";
+    events << "trigger " << trigger_ns << "\n";
+    events << "window " << t0 << " " << t1 << "\n";
+    events << "samples " << selected.size() << "\n";
+    for (const SnapshotTrigger& t : triggers) {
+        events << "event " << t.timestamp_ns << " " << t.reason << "\n";
+    }
+    for (const SnapshotStatus& st : statuses) {
+        if (st.timestamp_ns < t0 || st.timestamp_ns > t1) continue;
+        events << "status " << st.timestamp_ns;
+        for (int a = 0; a < 4; ++a) {
+            if (st.flags[a] & SNAPSHOT_FLAG_DISCONNECTED) {
+                events << " -";
+            } else {
+                events << " " << static_cast<int>(st.flags[a]);
+            }
+        }
+        events << "\n";
+    }
+    if (!events) {
+        error = "Cannot write " + path + "/events.txt";
+        return false;
+    }
+    return true;
+}
+
+// Keeps the last SNAPSHOT_WINDOW_SAMPLES samples and a few seconds of axis status flags.
+// A trigger (EOT or error flag rising, a sensor read failing, a burst of missed deadlines,
+// a failed command, SNAPSHOT) freezes the window around it once the post-trigger part is in.
+void flight_recorder_thread() {
+    std::cout << "Flight recorder thread started\n";
+    static const char* const names[4] = {"X", "Y", "Z", "R"};
+    
+    std::vector<RecordSample> window(SNAPSHOT_WINDOW_SAMPLES);
+    uint64_t window_count = 0;         // Samples stored so far; slot is count % size
+    uint64_t newest_ns = 0;
+    std::deque<SnapshotStatus> statuses;
+    uint8_t last_flags[4] = {0, 0, 0, 0};
+    uint8_t last_valid = 0;
+    uint64_t next_poll_ns = 0;
+    uint64_t deadline_check_ns = get_nanosecond_timestamp();
+    uint64_t deadlines_at_check = g_missed_deadlines.load();
+    
+    bool capturing = false;
+    uint64_t capture_ns = 0;
+    uint64_t holdoff_until_ns = 0;
+    std::vector<SnapshotTrigger> triggers, capture_triggers;
+    PositionSample sample;
+    
+    while (g_running) {
+        uint8_t expected = 0;
+        for (int logical = 0; logical < 4; ++logical) {
+            int controller = (logical < 3) ? 0 : 1;
+            int axis = (logical < 3) ? logical : 0;
+            if (g_controllers[controller].connected && g_controllers[controller].axes_connected[axis]) {
+                expected |= 1 << logical;
+            }
+        }
+        
+        size_t drained = 0;
+        while (drained < 4096 && g_snapshot_buffer.try_read(sample)) {
+            drained++;
+            RecordSample r = make_record_sample(sample);
+            window[window_count++ % window.size()] = r;
+            newest_ns = r.timestamp_ns;
+            // Only an axis due on this tick can have failed; skipped axes keep their last state
+            uint8_t lost = expected & last_valid & sample.read_mask & ~r.valid_mask;
+            if (lost) {
+                std::string axes;
+                for (int a = 0; a < 4; ++a) {
+                    if (lost & (1 << a)) axes += names[a];
+                }
+                triggers.push_back(SnapshotTrigger{r.timestamp_ns, "Position read failed on " + axes, false});
+            }
+            last_valid = (last_valid & ~sample.read_mask) | (r.valid_mask & sample.read_mask);
+        }
+        
+        // Status flags; skipped while BENCH has the bus
+        uint64_t now = get_nanosecond_timestamp();
+        if (now >= next_poll_ns && !g_sampler_paused.load(std::memory_order_acquire)) {
+            next_poll_ns = now + 1000000000ull / SNAPSHOT_STATUS_HZ;
+            SnapshotStatus st;
+            st.timestamp_ns = now;
+            for (int logical = 0; logical < 4; ++logical) {
+                int controller = (logical < 3) ? 0 : 1;
+                int axis = (logical < 3) ? logical : 0;
+                if (!(expected & (1 << logical))) {
+                    st.flags[logical] = SNAPSHOT_FLAG_DISCONNECTED;
+                    continue;
+                }
+                int handle = g_controllers[controller].handle;
+                Bln32 eot_fwd = 0, eot_bkwd = 0, error = 0, in_target = 0;
+                ECC_getStatusEotFwd(handle, axis, &eot_fwd);
+                ECC_getStatusEotBkwd(handle, axis, &eot_bkwd);
+                ECC_getStatusError(handle, axis, &error);
+                ECC_getStatusTargetRange(handle, axis, &in_target);
+                uint8_t flags = (eot_fwd ? SNAPSHOT_FLAG_EOT_FWD : 0) | (eot_bkwd ? SNAPSHOT_FLAG_EOT_BKWD : 0) |
+                                (error ? SNAPSHOT_FLAG_ERROR : 0) | (in_target ? SNAPSHOT_FLAG_IN_TARGET : 0);
+                uint8_t rising = flags & ~last_flags[logical];
+                if (rising & SNAPSHOT_FLAG_EOT_FWD) triggers.push_back(SnapshotTrigger{now, std::string("EOT forward on ") + names[logical], false});
+                if (rising & SNAPSHOT_FLAG_EOT_BKWD) triggers.push_back(SnapshotTrigger{now, std::string("EOT backward on ") + names[logical], false});
+                if (rising & SNAPSHOT_FLAG_ERROR) triggers.push_back(SnapshotTrigger{now, std::string("Axis error on ") + names[logical], false});
+                last_flags[logical] = flags;
+                st.flags[logical] = flags;
+            }
+            statuses.push_back(st);
+            while (statuses.front().timestamp_ns + SNAPSHOT_PRE_NS + SNAPSHOT_POST_NS < now) {
+                statuses.pop_front();
+            }
+        }
+        
+        if (now >= deadline_check_ns + 1000000000ull) {
+            uint64_t missed = g_missed_deadlines.load();
+            if (missed - deadlines_at_check >= SNAPSHOT_MISSED_DEADLINES) {
+                triggers.push_back(SnapshotTrigger{now, std::to_string(missed - deadlines_at_check) + 
+                                                   " missed sampler deadlines", false});
+            }
+            deadlines_at_check = missed;
+            deadline_check_ns = now;
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+            triggers.insert(triggers.end(), g_snapshot_triggers.begin(), g_snapshot_triggers.end());
+            g_snapshot_triggers.clear();
+        }
+        for (const SnapshotTrigger& t : triggers) {
+            if (capturing) {
+                capture_triggers.push_back(t);
+            } else if (!t.manual && t.timestamp_ns < holdoff_until_ns) {
+                g_snapshot_triggers_suppressed.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                capturing = true;
+                capture_ns = t.timestamp_ns;
+                capture_triggers.assign(1, t);
+                std::cout << "Snapshot triggered: " << t.reason << "\n";
+            }
+        }
+        triggers.clear();
+        
+        // Write once the post-trigger samples are in, or a bit later if the sampler stalled
+        if (capturing && (newest_ns >= capture_ns + SNAPSHOT_POST_NS || 
+                          now >= capture_ns + SNAPSHOT_POST_NS + 250000000ull)) {
+            std::string path, error;
+            size_t samples = 0;
+            if (write_snapshot(capture_ns, capture_triggers, window, window_count, statuses, path, samples, error)) {
+                g_snapshots_written.fetch_add(1, std::memory_order_relaxed);
+                {
+                    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+                    g_snapshot_last = path;
+                }
+                std::cout << "Snapshot written to " << path << "\n";
+                publish_result("SNAPSHOT", "ALL", "COMPLETED", "Snapshot " + path + ": " + std::to_string(samples) + 
+                               " samples, " + std::to_string(capture_triggers.size()) + " triggers, first: " + 
+                               capture_triggers.front().reason);
+            } else {
+                std::cout << "Snapshot failed: " << error << "\n";
+                publish_result("SNAPSHOT", "ALL", "FAILED", error);
+            }
+            capturing = false;
+            holdoff_until_ns = now + SNAPSHOT_HOLDOFF_NS;
+        }
+        
+        if (drained < 4096) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    
+    std::cout << "Flight recorder thread stopped\n";
+}
+
+// Render all metrics in Prometheus text exposition format (version 0.0.4)
+std::string render_metrics() {
+    std::ostringstream out;
+    
+    out << "# HELP ecc_sample_rate_hz Configured position sampling rate\n";
+    out << "# TYPE ecc_sample_rate_hz gauge\n";
+    out << "ecc_sample_rate_hz " << g_sample_rate_hz << "\n";
+    
+    out << "# HELP ecc_bench_recommended_rate_hz Maximum sustainable rate from the last BENCH (0 if not run)\n";
+    out << "# TYPE ecc_bench_recommended_rate_hz gauge\n";
+    out << "ecc_bench_recommended_rate_hz " << g_bench_recommended_rate_hz << "\n";
+    
+    out << "# HELP ecc_samples_captured_total Samples written to the position buffer\n";
+    out << "# TYPE ecc_samples_captured_total counter\n";
+    out << "ecc_samples_captured_total " << g_total_captured.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_samples_published_total Samples published to MQTT\n";
+    out << "# TYPE ecc_samples_published_total counter\n";
+    out << "ecc_samples_published_total " << g_total_published.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_samples_dropped_total Samples dropped because the position buffer was full\n";
+    out << "# TYPE ecc_samples_dropped_total counter\n";
+    out << "ecc_samples_dropped_total " << g_total_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_sampler_missed_deadlines_total Sampler ticks that finished after their deadline\n";
+    out << "# TYPE ecc_sampler_missed_deadlines_total counter\n";
+    out << "ecc_sampler_missed_deadlines_total " << g_missed_deadlines.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_position_buffer_depth Samples waiting in the position buffer\n";
+    out << "# TYPE ecc_position_buffer_depth gauge\n";
+    out << "ecc_position_buffer_depth " << g_position_buffer.available() << "\n";
+    
+    out << "# HELP ecc_position_buffer_capacity Position buffer capacity\n";
+    out << "# TYPE ecc_position_buffer_capacity gauge\n";
+    out << "ecc_position_buffer_capacity " << (BUFFER_SIZE * 4) << "\n";
+    
+    out << "# HELP ecc_command_queue_depth Commands waiting to be processed\n";
+    out << "# TYPE ecc_command_queue_depth gauge\n";
+    out << "ecc_command_queue_depth " << g_command_queue_depth.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_commands_superseded_total Queued MOVE commands replaced by a newer MOVE on the same axis\n";
+    out << "# TYPE ecc_commands_superseded_total counter\n";
+    out << "ecc_commands_superseded_total " << g_commands_superseded.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_moves_completed_total MOVE commands that settled in target range\n";
+    out << "# TYPE ecc_moves_completed_total counter\n";
+    out << "ecc_moves_completed_total " << g_moves_completed.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_moves_timed_out_total MOVE commands stopped after exceeding the predicted duration bound\n";
+    out << "# TYPE ecc_moves_timed_out_total counter\n";
+    out << "ecc_moves_timed_out_total " << g_moves_timed_out.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_position_read_errors_total Failed ECC_getPosition calls in the sampler\n";
+    out << "# TYPE ecc_position_read_errors_total counter\n";
+    out << "ecc_position_read_errors_total " << g_ecc_position_errors.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_latest_sample_hits_total Position queries served from the latest-sample slot\n";
+    out << "# TYPE ecc_latest_sample_hits_total counter\n";
+    out << "ecc_latest_sample_hits_total " << g_latest_sample_hits.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_latest_sample_fallbacks_total Position queries that needed a direct ECC_getPosition\n";
+    out << "# TYPE ecc_latest_sample_fallbacks_total counter\n";
+    out << "ecc_latest_sample_fallbacks_total " << g_latest_sample_fallbacks.load(std::memory_order_relaxed) << "\n";
+    
+    const char* axis_names[4] = {"X", "Y", "Z", "R"};
+    out << "# HELP ecc_axis_sample_rate_hz Rate at which the sampler reads each axis\n";
+    out << "# TYPE ecc_axis_sample_rate_hz gauge\n";
+    for (int i = 0; i < 4; ++i) {
+        out << "ecc_axis_sample_rate_hz{axis=\"" << axis_names[i] << "\"} " 
+            << g_sample_rate_hz.load(std::memory_order_relaxed) / (g_axis_schedule[i].load(std::memory_order_relaxed) >> 32) << "\n";
+    }
+    
+    out << "# HELP ecc_get_position_seconds ECC_getPosition call latency\n";
+    out << "# TYPE ecc_get_position_seconds histogram\n";
+    for (int i = 0; i < 4; ++i) {
+        g_ecc_position_latency[i].write_prometheus(out, "ecc_get_position_seconds", 
+                                                   std::string("axis=\"") + axis_names[i] + "\"");
+    }
+    
+    out << "# HELP ecc_mqtt_publish_seconds mosquitto_publish latency for position batches\n";
+    out << "# TYPE ecc_mqtt_publish_seconds histogram\n";
+    g_mqtt_publish_latency.write_prometheus(out, "ecc_mqtt_publish_seconds", "");
+    
+    out << "# HELP ecc_batches_published_total Position batches published to MQTT\n";
+    out << "# TYPE ecc_batches_published_total counter\n";
+    out << "ecc_batches_published_total " << g_batches_published.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_axis_messages_published_total Per-axis topic messages published to MQTT\n";
+    out << "# TYPE ecc_axis_messages_published_total counter\n";
+    out << "ecc_axis_messages_published_total " << g_axis_messages_published.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_publish_failures_total Position batches rejected by mosquitto_publish\n";
+    out << "# TYPE ecc_publish_failures_total counter\n";
+    out << "ecc_publish_failures_total " << g_publish_failures.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_mqtt_connected Whether the MQTT client is connected\n";
+    out << "# TYPE ecc_mqtt_connected gauge\n";
+    out << "ecc_mqtt_connected " << (g_mqtt_connected ? 1 : 0) << "\n";
+    
+    out << "# HELP ecc_mqtt_connects_total Successful MQTT (re)connections\n";
+    out << "# TYPE ecc_mqtt_connects_total counter\n";
+    out << "ecc_mqtt_connects_total " << g_mqtt_connects.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_mqtt_disconnects_total MQTT disconnections\n";
+    out << "# TYPE ecc_mqtt_disconnects_total counter\n";
+    out << "ecc_mqtt_disconnects_total " << g_mqtt_disconnects.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_controllers_connected Whether the ECC100 controllers are connected\n";
+    out << "# TYPE ecc_controllers_connected gauge\n";
+    out << "ecc_controllers_connected " << (g_controllers_connected ? 1 : 0) << "\n";
+    
+    out << "# HELP ecc_commands_total Commands received, by command type\n";
+    out << "# TYPE ecc_commands_total counter\n";
+    for (int i = 0; i < CMD_TYPE_COUNT; ++i) {
+        out << "ecc_commands_total{command=\"" << COMMAND_TYPE_NAMES[i] << "\"} " 
+            << g_command_counts[i].load(std::memory_order_relaxed) << "\n";
+    }
+    
+    out << "# HELP ecc_command_seconds Command handler execution time, by command type\n";
+    out << "# TYPE ecc_command_seconds histogram\n";
+    for (int i = 0; i < CMD_TYPE_COUNT; ++i) {
+        g_command_latency[i].write_prometheus(out, "ecc_command_seconds", 
+                                              std::string("command=\"") + COMMAND_TYPE_NAMES[i] + "\"");
+    }
+    
+    out << "# HELP ecc_setpoints_received_total Setpoints received on the setpoint topic\n";
+    out << "# TYPE ecc_setpoints_received_total counter\n";
+    out << "ecc_setpoints_received_total " << g_setpoints_received.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_setpoints_written_total Setpoints written with ECC_controlTargetPosition\n";
+    out << "# TYPE ecc_setpoints_written_total counter\n";
+    out << "ecc_setpoints_written_total " << g_setpoints_written.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_setpoints_coalesced_total Setpoints superseded before being written\n";
+    out << "# TYPE ecc_setpoints_coalesced_total counter\n";
+    out << "ecc_setpoints_coalesced_total " << g_setpoints_coalesced.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_setpoint_errors_total Invalid setpoints or failed ECC writes\n";
+    out << "# TYPE ecc_setpoint_errors_total counter\n";
+    out << "ecc_setpoint_errors_total " << g_setpoint_errors.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_setpoint_write_seconds Setpoint receive to target written\n";
+    out << "# TYPE ecc_setpoint_write_seconds histogram\n";
+    g_setpoint_write_latency.write_prometheus(out, "ecc_setpoint_write_seconds", "");
+    
+    out << "# HELP ecc_setpoint_motion_seconds Setpoint receive to first sampled motion towards target\n";
+    out << "# TYPE ecc_setpoint_motion_seconds histogram\n";
+    g_setpoint_motion_latency.write_prometheus(out, "ecc_setpoint_motion_seconds", "");
+    
+    out << "# HELP ecc_queue_steps_total MOVE_QUEUE targets reached\n";
+    out << "# TYPE ecc_queue_steps_total counter\n";
+    out << "ecc_queue_steps_total " << g_queue_steps.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_queue_transition_seconds In-range sample to next MOVE_QUEUE target written (sampler)\n";
+    out << "# TYPE ecc_queue_transition_seconds histogram\n";
+    g_queue_transition_latency.write_prometheus(out, "ecc_queue_transition_seconds", "");
+    
+    out << "# HELP ecc_recording Binary recorder active\n";
+    out << "# TYPE ecc_recording gauge\n";
+    out << "ecc_recording " << (g_recording.load(std::memory_order_relaxed) ? 1 : 0) << "\n";
+    
+    out << "# HELP ecc_record_samples_total Samples written to recording segments\n";
+    out << "# TYPE ecc_record_samples_total counter\n";
+    out << "ecc_record_samples_total " << g_record_samples.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_record_dropped_total Samples lost by the recorder (backlog full or disk error)\n";
+    out << "# TYPE ecc_record_dropped_total counter\n";
+    out << "ecc_record_dropped_total " << g_record_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_record_segments_total Recording segments opened\n";
+    out << "# TYPE ecc_record_segments_total counter\n";
+    out << "ecc_record_segments_total " << g_record_segments.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_record_backlog Samples waiting for the recorder\n";
+    out << "# TYPE ecc_record_backlog gauge\n";
+    out << "ecc_record_backlog " << g_record_buffer.available() << "\n";
+    
+    out << "# HELP ecc_history_samples Samples held in the in-memory history\n";
+    out << "# TYPE ecc_history_samples gauge\n";
+    out << "ecc_history_samples " << g_history_samples.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_history_bytes Memory used by the compressed history blocks\n";
+    out << "# TYPE ecc_history_bytes gauge\n";
+    out << "ecc_history_bytes " << g_history_bytes.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_history_dropped_total Samples lost because the history buffer was full\n";
+    out << "# TYPE ecc_history_dropped_total counter\n";
+    out << "ecc_history_dropped_total " << g_history_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_history_queries_total GET_HISTORY requests served\n";
+    out << "# TYPE ecc_history_queries_total counter\n";
+    out << "ecc_history_queries_total " << g_history_queries.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_shm_published_total Samples published to the shared-memory ring\n";
+    out << "# TYPE ecc_shm_published_total counter\n";
+    out << "ecc_shm_published_total " << g_shm_writer.published() << "\n";
+    
+    out << "# HELP ecc_stream_clients Subscribed TCP stream clients\n";
+    out << "# TYPE ecc_stream_clients gauge\n";
+    out << "ecc_stream_clients " << g_stream_clients.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_stream_bytes_sent_total Bytes sent to TCP stream clients\n";
+    out << "# TYPE ecc_stream_bytes_sent_total counter\n";
+    out << "ecc_stream_bytes_sent_total " << g_stream_bytes_sent.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_stream_slow_disconnects_total TCP stream clients dropped for not keeping up\n";
+    out << "# TYPE ecc_stream_slow_disconnects_total counter\n";
+    out << "ecc_stream_slow_disconnects_total " << g_stream_slow_disconnects.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_stream_dropped_total Samples lost because the stream buffer was full\n";
+    out << "# TYPE ecc_stream_dropped_total counter\n";
+    out << "ecc_stream_dropped_total " << g_stream_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_multicast_enabled UDP multicast sink active\n";
+    out << "# TYPE ecc_multicast_enabled gauge\n";
+    out << "ecc_multicast_enabled " << (g_multicast_enabled.load(std::memory_order_relaxed) ? 1 : 0) << "\n";
+    
+    out << "# HELP ecc_multicast_packets_total UDP multicast packets sent\n";
+    out << "# TYPE ecc_multicast_packets_total counter\n";
+    out << "ecc_multicast_packets_total " << g_multicast_packets.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_multicast_samples_total Samples sent in UDP multicast packets\n";
+    out << "# TYPE ecc_multicast_samples_total counter\n";
+    out << "ecc_multicast_samples_total " << g_multicast_samples_sent.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_multicast_send_errors_total UDP multicast packets the socket did not accept\n";
+    out << "# TYPE ecc_multicast_send_errors_total counter\n";
+    out << "ecc_multicast_send_errors_total " << g_multicast_send_errors.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_multicast_dropped_total Samples lost because the multicast buffer was full\n";
+    out << "# TYPE ecc_multicast_dropped_total counter\n";
+    out << "ecc_multicast_dropped_total " << g_multicast_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_pico_enabled Picoammeter channel active\n";
+    out << "# TYPE ecc_pico_enabled gauge\n";
+    out << "ecc_pico_enabled " << (g_pico_enabled.load(std::memory_order_relaxed) ? 1 : 0) << "\n";
+    
+    out << "# HELP ecc_pico_readings_total Picoammeter readings published\n";
+    out << "# TYPE ecc_pico_readings_total counter\n";
+    out << "ecc_pico_readings_total " << g_pico_readings.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_pico_messages_total Messages published on the current topic\n";
+    out << "# TYPE ecc_pico_messages_total counter\n";
+    out << "ecc_pico_messages_total " << g_pico_messages.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_pico_errors_total Picoammeter serial, timeout and instrument errors\n";
+    out << "# TYPE ecc_pico_errors_total counter\n";
+    out << "ecc_pico_errors_total " << g_pico_errors.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_align_fused_total Picoammeter readings fused with interpolated positions\n";
+    out << "# TYPE ecc_align_fused_total counter\n";
+    out << "ecc_align_fused_total " << g_align_fused.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_align_rejected_total Readings that could not be fused, by reason\n";
+    out << "# TYPE ecc_align_rejected_total counter\n";
+    out << "ecc_align_rejected_total{reason=\"late\"} " << g_align_late.load(std::memory_order_relaxed) << "\n";
+    out << "ecc_align_rejected_total{reason=\"expired\"} " << g_align_expired.load(std::memory_order_relaxed) << "\n";
+    out << "ecc_align_rejected_total{reason=\"gap\"} " << g_align_gaps.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_align_pending Readings waiting for the position samples after them\n";
+    out << "# TYPE ecc_align_pending gauge\n";
+    out << "ecc_align_pending " << g_align_pending.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_align_dropped_total Samples, readings or fused records lost to a full buffer\n";
+    out << "# TYPE ecc_align_dropped_total counter\n";
+    out << "ecc_align_dropped_total " << g_align_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_record_fused_total Fused records written while recording\n";
+    out << "# TYPE ecc_record_fused_total counter\n";
+    out << "ecc_record_fused_total " << g_record_fused_records.load(std::memory_order_relaxed) << "\n";
+    
+    {
+        std::lock_guard<std::mutex> lock(g_trigger_mutex);
+        out << "# HELP ecc_triggers Position triggers defined\n";
+        out << "# TYPE ecc_triggers gauge\n";
+        out << "ecc_triggers " << g_trigger_specs.size() << "\n";
+    }
+    
+    out << "# HELP ecc_trigger_fired_total Position trigger crossings, by action\n";
+    out << "# TYPE ecc_trigger_fired_total counter\n";
+    for (int i = 0; i < 3; ++i) {
+        out << "ecc_trigger_fired_total{action=\"" << TRIGGER_ACTION_NAMES[i] << "\"} " 
+            << g_trigger_fired[i].load(std::memory_order_relaxed) << "\n";
+    }
+    
+    out << "# HELP ecc_trigger_bursts_missed_total BURST crossings while no picoammeter burst was armed\n";
+    out << "# TYPE ecc_trigger_bursts_missed_total counter\n";
+    out << "ecc_trigger_bursts_missed_total " << g_trigger_bursts_missed.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_trigger_dropped_total Trigger events lost because the event buffer was full\n";
+    out << "# TYPE ecc_trigger_dropped_total counter\n";
+    out << "ecc_trigger_dropped_total " << g_trigger_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_trigger_burst_seconds Crossing sample to picoammeter INIT written\n";
+    out << "# TYPE ecc_trigger_burst_seconds histogram\n";
+    g_trigger_burst_latency.write_prometheus(out, "ecc_trigger_burst_seconds", "");
+    
+    out << "# HELP ecc_trigger_marker_seconds Crossing sample to marker published\n";
+    out << "# TYPE ecc_trigger_marker_seconds histogram\n";
+    g_trigger_marker_latency.write_prometheus(out, "ecc_trigger_marker_seconds", "");
+    
+    out << "# HELP ecc_stats_messages_total Messages published on the statistics topic\n";
+    out << "# TYPE ecc_stats_messages_total counter\n";
+    out << "ecc_stats_messages_total " << g_stats_messages.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_stats_dropped_total Samples lost because the statistics buffer was full\n";
+    out << "# TYPE ecc_stats_dropped_total counter\n";
+    out << "ecc_stats_dropped_total " << g_stats_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    {
+        static const char* const names[4] = {"X", "Y", "Z", "R"};
+        static const char* const stats[4][2] = {
+            {"ecc_position_mean", "Mean position over the window (nm/µ°)"},
+            {"ecc_position_stddev", "Position standard deviation over the window (nm/µ°)"},
+            {"ecc_position_peak_to_peak", "Position peak-to-peak over the window (nm/µ°)"},
+            {"ecc_position_drift_per_second", "Least-squares position drift rate over the window (nm/µ° per s)"}};
+        std::lock_guard<std::mutex> lock(g_stats_mutex);
+        size_t windows = g_stats_latest_windows_s.size();
+        std::streamsize precision = out.precision(12);     // Means of positions in the millions
+        for (int k = 0; k < 4; ++k) {
+            out << "# HELP " << stats[k][0] << " " << stats[k][1] << "\n";
+            out << "# TYPE " << stats[k][0] << " gauge\n";
+            for (size_t i = 0; i < g_stats_latest.size() && windows > 0; ++i) {
+                const StatsMoments& m = g_stats_latest[i];
+                if (m.count == 0) continue;
+                double value = k == 0 ? m.mean_x : k == 1 ? m.stddev() : k == 2 ? m.peak_to_peak() : m.drift_per_s();
+                out << stats[k][0] << "{axis=\"" << names[i / windows] << "\",window=\"" 
+                    << g_stats_latest_windows_s[i % windows] << "s\"} " << value << "\n";
+            }
+        }
+        out.precision(precision);
+    }
+    
+    out << "# HELP ecc_image_enabled Live image scan active\n";
+    out << "# TYPE ecc_image_enabled gauge\n";
+    out << "ecc_image_enabled " << (g_image_enabled.load(std::memory_order_relaxed) ? 1 : 0) << "\n";
+    
+    out << "# HELP ecc_image_pairs_total Position and current pairs binned into the image\n";
+    out << "# TYPE ecc_image_pairs_total counter\n";
+    out << "ecc_image_pairs_total " << g_image_pairs.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_image_outside_total Pairs whose position was outside the scan grid\n";
+    out << "# TYPE ecc_image_outside_total counter\n";
+    out << "ecc_image_outside_total " << g_image_outside.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_image_unmatched_total Fused records without a valid position on an image axis\n";
+    out << "# TYPE ecc_image_unmatched_total counter\n";
+    out << "ecc_image_unmatched_total " << g_image_unmatched.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_image_updates_total Image tile update messages published\n";
+    out << "# TYPE ecc_image_updates_total counter\n";
+    out << "ecc_image_updates_total " << g_image_updates.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_snapshots_total Flight recorder snapshots written\n";
+    out << "# TYPE ecc_snapshots_total counter\n";
+    out << "ecc_snapshots_total " << g_snapshots_written.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_snapshot_triggers_suppressed_total Automatic triggers ignored during the holdoff after a snapshot\n";
+    out << "# TYPE ecc_snapshot_triggers_suppressed_total counter\n";
+    out << "ecc_snapshot_triggers_suppressed_total " << g_snapshot_triggers_suppressed.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_snapshot_dropped_total Samples lost because the flight recorder buffer was full\n";
+    out << "# TYPE ecc_snapshot_dropped_total counter\n";
+    out << "ecc_snapshot_dropped_total " << g_snapshot_dropped.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# HELP ecc_metrics_scrapes_total Requests served by the metrics endpoint\n";
+    out << "# TYPE ecc_metrics_scrapes_total counter\n";
+    out << "ecc_metrics_scrapes_total " << g_metrics_scrapes.load(std::memory_order_relaxed) << "\n";
+    
+    return out.str();
+}
+
+// Render all trace rings as Chrome trace JSON (load in chrome://tracing or ui.perfetto.dev)
+std::string render_trace_json() {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    
+    bool first = true;
+    for (int t = 0; t < TRACE_THREAD_COUNT; ++t) {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+            << ",\"args\":{\"name\":\"" << TRACE_THREAD_NAMES[t] << "\"}}";
+        first = false;
+    }
+    
+    std::vector<TraceEvent> events;
+    for (int t = 0; t < TRACE_THREAD_COUNT; ++t) {
+        events.clear();
+        g_trace_buffers[t].snapshot(events);
+        
+        for (const TraceEvent& ev : events) {
+            bool command_event = ev.name >= TR_MQTT_RECEIVE;
+            out << ",\n{\"name\":\"" << TRACE_EVENT_NAMES[ev.name] << "\""
+                << ",\"cat\":\"" << (command_event ? "command" : "sample") << "\""
+                << ",\"ph\":\"" << ev.phase << "\""
+                << ",\"ts\":" << (ev.start_ns / 1000.0)
+                << ",\"pid\":1,\"tid\":" << t;
+            
+            if (ev.phase == 'X') {
+                out << ",\"dur\":" << (ev.duration_ns / 1000.0);
+            } else if (ev.phase == 'i') {
+                out << ",\"s\":\"t\"";
+            } else {
+                out << ",\"id\":" << ev.id;
+                if (ev.phase == 'f') out << ",\"bp\":\"e\"";
+            }
+            out << ",\"args\":{\"id\":" << ev.id << "}}";
+        }
+    }
+    
+    out << "\n]}\n";
+    return out.str();
+}
+
+// Write the whole buffer to a non-blocking socket, waiting at most timeout_ms per chunk
+bool send_all_nonblocking(int fd, const std::string& data, int timeout_ms) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            if (poll(&pfd, 1, timeout_ms) <= 0) return false;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Serve a single HTTP/1.0-style request and close (Prometheus does not need keep-alive)
+void serve_metrics_client(int client_fd) {
+    fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
+    
+    // Read until end of headers or timeout
+    std::string request;
+    char buf[1024];
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1000);
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (remaining_ms <= 0) return;
+        
+        struct pollfd pfd = {client_fd, POLLIN, 0};
+        if (poll(&pfd, 1, remaining_ms) <= 0) return;
+        
+        ssize_t n = recv(client_fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            request.append(buf, n);
+        } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        } else {
+            break;
+        }
+    }
+    
+    // Request line: "GET /metrics HTTP/1.1"
+    std::istringstream line(request.substr(0, request.find("\r\n")));
+    std::string method, path;
+    line >> method >> path;
+    
+    std::string status_line, content_type, body;
+    if (method != "GET") {
+        status_line = "HTTP/1.1 405 Method Not Allowed";
+        content_type = "text/plain";
+        body = "Method not allowed\n";
+    } else if (path == "/metrics" || path.find("/metrics?") == 0) {
+        g_metrics_scrapes.fetch_add(1, std::memory_order_relaxed);
+        status_line = "HTTP/1.1 200 OK";
+        content_type = "text/plain; version=0.0.4; charset=utf-8";
+        body = render_metrics();
+    } else if (path == "/trace") {
+        status_line = "HTTP/1.1 200 OK";
+        content_type = "application/json";
+        body = render_trace_json();
+    } else {
+        status_line = "HTTP/1.1 404 Not Found";
+        content_type = "text/plain";
+        body = "Not found (try /metrics or /trace)\n";
+    }
+    
+    std::ostringstream response;
+    response << status_line << "\r\n"
+             << "Content-Type: " << content_type << "\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+    send_all_nonblocking(client_fd, response.str(), 1000);
+}
+
+// Minimal non-blocking HTTP server for Prometheus scraping (reads atomics only)
+void metrics_http_thread() {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cerr << "Metrics server: failed to create socket: " << strerror(errno) << "\n";
+        return;
+    }
+    
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(TCP_PORT);
+    
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+        std::cerr << "Metrics server: failed to listen on port " << TCP_PORT << ": " << strerror(errno) << "\n";
+        close(listen_fd);
+        return;
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+    
+    std::cout << "Metrics server listening on http://0.0.0.0:" << TCP_PORT << "/metrics\n";
+    
+    while (g_running) {
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;  // Wake periodically to observe g_running
+        
+        int client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0) continue;
+        
+        serve_metrics_client(client_fd);
+        close(client_fd);
+    }
+    
+    close(listen_fd);
+    std::cout << "Metrics server stopped\n";
+}
+
+// Parses "SUBSCRIBE <TEXT|BINARY> [<axes> [<decimation>]]" into the client's filter
+bool parse_stream_subscribe(const std::string& line, StreamClient& client, std::string& error) {
+    std::istringstream iss(line);
+    std::string word, format, axes, decimation_str;
+    iss >> word >> format >> axes >> decimation_str;
+    if (word != "SUBSCRIBE") {
+        error = "Expected SUBSCRIBE <TEXT|BINARY> [<axes> [<decimation>]]";
+        return false;
+    }
+    if (format != "TEXT" && format != "BINARY") {
+        error = "Format must be TEXT or BINARY";
+        return false;
+    }
+    uint8_t axis_mask = axes.empty() ? 0x0F : 0;
+    for (char c : axes) {
+        int controller, axis;
+        if (!parse_axis_name(std::string(1, c), controller, axis)) {
+            error = std::string("Unknown axis ") + c;
+            return false;
+        }
+        axis_mask |= 1 << get_logical_axis(controller, axis);
+    }
+    int decimation = decimation_str.empty() ? 1 : std::atoi(decimation_str.c_str());
+    if (decimation < 1) {
+        error = "Invalid decimation: " + decimation_str;
+        return false;
+    }
+    client.binary = format == "BINARY";
+    client.axis_mask = axis_mask;
+    client.decimation = decimation;
+    return true;
+}
+
+// Appends the client's share of a batch (stream indexes first_index...) to its output
+void encode_stream_batch(StreamClient& client, const std::vector<PositionSample>& batch, uint64_t first_index) {
+    uint64_t end_index = first_index + batch.size();
+    if (client.next_index < first_index) client.next_index = first_index;  // Samples were lost
+    if (client.next_index >= end_index) return;
+    
+    uint64_t i = client.next_index;
+    if (client.binary) {
+        size_t header_pos = client.output.size();
+        client.output.resize(header_pos + sizeof(StreamFrameHeader));
+        StreamFrameHeader header;
+        header.magic = STREAM_FRAME_MAGIC;
+        header.version = STREAM_FRAME_VERSION;
+        header.axis_mask = client.axis_mask;
+        header.reserved = 0;
+        header.count = 0;
+        header.decimation = client.decimation;
+        header.first_index = i;
+        char record[sizeof(uint64_t) + 1 + 4 * sizeof(int32_t)];
+        for (; i < end_index; i += client.decimation) {
+            const PositionSample& sample = batch[i - first_index];
+            size_t n = sizeof(uint64_t);
+            std::memcpy(record, &sample.timestamp_ns, sizeof(uint64_t));
+            record[n++] = static_cast<char>(sample.valid_mask & 0x0F);
+            for (int a = 0; a < 4; ++a) {
+                if (!(client.axis_mask & (1 << a))) continue;
+                int32_t value = get_sample_axis(sample, a);
+                std::memcpy(record + n, &value, sizeof(value));
+                n += sizeof(value);
+            }
+            client.output.append(record, n);
+            header.count++;
+        }
+        std::memcpy(&client.output[header_pos], &header, sizeof(header));
+    } else {
+        for (; i < end_index; i += client.decimation) {
+            client.output += g_string_buffer.format_axes(batch[i - first_index], client.axis_mask);
+            client.output += '\n';
+        }
+    }
+    client.next_index = i;
+}
+
+// Sends what the socket takes without blocking. False if the connection failed.
+bool flush_stream_client(StreamClient& client) {
+    while (client.output_offset < client.output.size()) {
+        ssize_t n = send(client.fd, client.output.data() + client.output_offset, 
+                         client.output.size() - client.output_offset, MSG_NOSIGNAL);
+        if (n > 0) {
+            client.output_offset += n;
+            g_stream_bytes_sent.fetch_add(n, std::memory_order_relaxed);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return false;
+        }
+    }
+    if (client.output_offset == client.output.size()) {
+        client.output.clear();
+        client.output_offset = 0;
+    } else if (client.output_offset >= (1 << 20)) {
+        client.output.erase(0, client.output_offset);
+        client.output_offset = 0;
+    }
+    return true;
+}
+
+// Streams position batches straight to TCP clients on STREAM_PORT (protocol in ecc_stream.h).
+// One epoll loop; each client has its own send buffer and filter, and a client whose
+// unsent data exceeds STREAM_CLIENT_MAX_BUFFER is disconnected instead of holding up the rest.
+void stream_server_thread() {
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0) {
+        std::cerr << "Stream server: failed to create socket: " << strerror(errno) << "\n";
+        return;
+    }
+    
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(STREAM_PORT);
+    
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+        std::cerr << "Stream server: failed to listen on port " << STREAM_PORT << ": " << strerror(errno) << "\n";
+        close(listen_fd);
+        return;
+    }
+    
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    
+    std::cout << "Stream server listening on tcp://0.0.0.0:" << STREAM_PORT << "\n";
+    
+    std::map<int, StreamClient> clients;
+    std::vector<PositionSample> batch;
+    batch.reserve(STREAM_BUFFER_SAMPLES);
+    uint64_t stream_index = 0;
+    struct epoll_event events[64];
+    auto next_batch = std::chrono::steady_clock::now() + std::chrono::milliseconds(STREAM_BATCH_MS);
+    
+    auto remove_client = [&](int fd, const char* reason) {
+        auto it = clients.find(fd);
+        if (it == clients.end()) return;
+        if (it->second.subscribed) g_stream_clients.fetch_sub(1, std::memory_order_relaxed);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        clients.erase(it);
+        std::cout << "Stream client " << fd << " disconnected (" << reason << ")\n";
+    };
+    
+    // Registers EPOLLOUT only while output is pending
+    auto update_interest = [&](StreamClient& client) {
+        bool pending = client.output_offset < client.output.size();
+        if (pending == client.want_write) return;
+        struct epoll_event mod;
+        std::memset(&mod, 0, sizeof(mod));
+        mod.events = pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        mod.data.fd = client.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client.fd, &mod);
+        client.want_write = pending;
+    };
+    
+    // Encodes the batch for every subscriber; the batch's first sample has stream_index
+    auto send_batch = [&]() {
+        if (batch.empty()) return;
+        std::vector<int> slow;
+        for (auto& entry : clients) {
+            StreamClient& client = entry.second;
+            if (!client.subscribed) continue;
+            encode_stream_batch(client, batch, stream_index);
+            if (!flush_stream_client(client)) {
+                slow.push_back(client.fd);
+            } else if (client.output.size() - client.output_offset > STREAM_CLIENT_MAX_BUFFER) {
+                g_stream_slow_disconnects.fetch_add(1, std::memory_order_relaxed);
+                slow.push_back(client.fd);
+            } else {
+                update_interest(client);
+            }
+        }
+        for (int fd : slow) remove_client(fd, "send failed or too slow");
+        stream_index += batch.size();
+        batch.clear();
+    };
+    
+    while (g_running) {
+        auto now = std::chrono::steady_clock::now();
+        int timeout_ms = now >= next_batch ? 0 : 
+            static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next_batch - now).count()) + 1;
+        int n = epoll_wait(epoll_fd, events, 64, timeout_ms);
+        
+        for (int e = 0; e < n; ++e) {
+            int fd = events[e].data.fd;
+            if (fd == listen_fd) {
+                int client_fd;
+                while ((client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+                    if (clients.size() >= STREAM_MAX_CLIENTS) {
+                        const char* msg = "ERROR Too many clients\n";
+                        send(client_fd, msg, std::strlen(msg), MSG_NOSIGNAL);
+                        close(client_fd);
+                        continue;
+                    }
+                    StreamClient& client = clients[client_fd];
+                    client.fd = client_fd;
+                    struct epoll_event add;
+                    std::memset(&add, 0, sizeof(add));
+                    add.events = EPOLLIN;
+                    add.data.fd = client_fd;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &add);
+                }
+                continue;
+            }
+            
+            auto it = clients.find(fd);
+            if (it == clients.end()) continue;
+            StreamClient& client = it->second;
+            
+            if (events[e].events & EPOLLIN) {
+                char buf[512];
+                ssize_t got = recv(fd, buf, sizeof(buf), 0);
+                if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    remove_client(fd, "closed by client");
+                    continue;
+                }
+                if (got > 0 && !client.subscribed) {
+                    client.input.append(buf, got);
+                    size_t newline = client.input.find('\n');
+                    if (newline == std::string::npos && client.input.size() > 256) {
+                        remove_client(fd, "no SUBSCRIBE line");
+                        continue;
+                    }
+                    if (newline != std::string::npos) {
+                        std::string line = client.input.substr(0, newline);
+                        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+                        std::string error;
+                        if (!parse_stream_subscribe(line, client, error)) {
+                            std::string msg = "ERROR " + error + "\n";
+                            send(fd, msg.data(), msg.size(), MSG_NOSIGNAL);
+                            remove_client(fd, "invalid SUBSCRIBE");
+                            continue;
+                        }
+                        client.subscribed = true;
+                        client.next_index = stream_index;
+                        g_stream_clients.fetch_add(1, std::memory_order_relaxed);
+                        std::string axes;
+                        for (int a = 0; a < 4; ++a) {
+                            if (client.axis_mask & (1 << a)) axes += "XYZR"[a];
+                        }
+                        client.output += std::string("OK ") + (client.binary ? "BINARY " : "TEXT ") + axes + " " + 
+                                         std::to_string(client.decimation) + " " + std::to_string(stream_index) + "\n";
+                        std::cout << "Stream client " << fd << " subscribed: " << line << "\n";
+                    }
+                }
+            }
+            if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+                remove_client(fd, "connection error");
+                continue;
+            }
+            if (!flush_stream_client(client)) {
+                remove_client(fd, "send failed");
+                continue;
+            }
+            update_interest(client);
+        }
+        
+        if (std::chrono::steady_clock::now() < next_batch) continue;
+        next_batch += std::chrono::milliseconds(STREAM_BATCH_MS);
+        if (next_batch < std::chrono::steady_clock::now()) {
+            next_batch = std::chrono::steady_clock::now() + std::chrono::milliseconds(STREAM_BATCH_MS);
+        }
+        
+        // Samples the sampler could not hand over count towards the index where they were
+        // lost, so clients see the gap between the right two samples
+        IndexedSample item;
+        while (g_stream_buffer.try_read(item)) {
+            if (item.dropped_before > 0) {
+                send_batch();
+                stream_index += item.dropped_before;
+            }
+            batch.push_back(item.sample);
+        }
+        send_batch();
+    }
+    
+    while (!clients.empty()) remove_client(clients.begin()->first, "shutdown");
+    close(epoll_fd);
+    close(listen_fd);
+    std::cout << "Stream server stopped\n";
+}
+
+// Sends the position stream as fixed-size UDP multicast datagrams (format in ecc_multicast.h).
+// One send per packet however many PCs listen. Nothing waits for receivers, so a slow
+// network costs packets, not sampler time.
+void multicast_thread() {
+    std::cout << "Multicast thread started\n";
+    
+    int fd = -1;
+    struct sockaddr_in dest;
+    std::vector<char> packet;
+    MulticastPacketHeader header;
+    std::memset(&header, 0, sizeof(header));
+    uint64_t stream_index = 0;
+    uint64_t generation = 0;       // MULTICAST/ON the socket was opened for
+    uint64_t packet_started_ns = 0;
+    IndexedSample item;
+    
+    auto send_packet = [&]() {
+        if (header.count == 0) return;
+        size_t used = sizeof(header) + header.count * sizeof(MulticastSample);
+        std::memset(packet.data() + used, 0, packet.size() - used);
+        header.sample_rate_hz = g_sample_rate_hz.load(std::memory_order_relaxed);
+        std::memcpy(packet.data(), &header, sizeof(header));
+        if (sendto(fd, packet.data(), packet.size(), 0, (struct sockaddr*)&dest, sizeof(dest)) == (ssize_t)packet.size()) {
+            g_multicast_packets.fetch_add(1, std::memory_order_relaxed);
+            g_multicast_samples_sent.fetch_add(header.count, std::memory_order_relaxed);
+        } else {
+            g_multicast_send_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        header.sequence++;
+        header.count = 0;
+    };
+    
+    while (g_running) {
+        bool enabled = g_multicast_enabled.load(std::memory_order_acquire);
+        
+        // An OFF and ON between two passes still reopens the socket for the new group and port
+        if (fd >= 0 && enabled && g_multicast_generation.load(std::memory_order_acquire) != generation) {
+            send_packet();
+            close(fd);
+            fd = -1;
+        }
+        if (enabled && fd < 0) {
+            generation = g_multicast_generation.load(std::memory_order_acquire);
+            std::string group, interface;
+            uint16_t port, samples;
+            {
+                std::lock_guard<std::mutex> lock(g_multicast_mutex);
+                group = g_multicast_group;
+                port = g_multicast_port;
+                samples = g_multicast_samples;
+                interface = g_multicast_interface;
+            }
+            std::memset(&dest, 0, sizeof(dest));
+            dest.sin_family = AF_INET;
+            dest.sin_port = htons(port);
+            inet_pton(AF_INET, group.c_str(), &dest.sin_addr);
+            
+            fd = socket(AF_INET, SOCK_DGRAM, 0);
+            unsigned char ttl = MULTICAST_TTL;
+            unsigned char loop = 1;    // Receivers on this PC see the stream too
+            struct in_addr interface_addr;
+            interface_addr.s_addr = htonl(INADDR_ANY);
+            if (!interface.empty()) inet_pton(AF_INET, interface.c_str(), &interface_addr);
+            if (fd < 0 || setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0 ||
+                setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) != 0 ||
+                setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &interface_addr, sizeof(interface_addr)) != 0) {
+                std::lock_guard<std::mutex> lock(g_multicast_mutex);
+                g_multicast_error = std::string("Cannot open multicast socket: ") + strerror(errno);
+                std::cout << "Multicast: " << g_multicast_error << "\n";
+                if (fd >= 0) close(fd);
+                fd = -1;
+                g_multicast_enabled = false;
+                continue;
+            }
+            
+            packet.assign(multicast_packet_size(samples), 0);
+            header.magic = MULTICAST_MAGIC;
+            header.version = MULTICAST_VERSION;
+            header.samples_per_packet = samples;
+            header.session = static_cast<uint32_t>(get_nanosecond_timestamp() / 1000);
+            header.sequence = 0;
+            header.count = 0;
+            stream_index = 0;
+        }
+        
+        size_t drained = 0;
+        while (drained < MULTICAST_BUFFER_SAMPLES && g_multicast_buffer.try_read(item)) {
+            drained++;
+            if (fd < 0) continue;      // Left over from a failed start
+            
+            // Records in a packet are consecutive, so samples the sampler dropped end the packet
+            if (item.dropped_before > 0) {
+                send_packet();
+                stream_index += item.dropped_before;
+            }
+            const PositionSample& sample = item.sample;
+            if (header.count == 0) {
+                header.first_index = stream_index;
+                packet_started_ns = get_monotonic_ns();
+            }
+            MulticastSample record;
+            record.timestamp_ns = sample.timestamp_ns;
+            record.position[0] = sample.x_position;
+            record.position[1] = sample.y_position;
+            record.position[2] = sample.z_position;
+            record.position[3] = sample.r_position;
+            record.valid_mask = sample.valid_mask & 0x0F;
+            std::memcpy(packet.data() + sizeof(header) + header.count * sizeof(record), &record, sizeof(record));
+            header.count++;
+            stream_index++;
+            if (header.count == header.samples_per_packet) send_packet();
+        }
+        
+        if (fd >= 0) {
+            if (header.count > 0 && (!enabled || get_monotonic_ns() - packet_started_ns >= MULTICAST_FLUSH_NS)) {
+                send_packet();
+            }
+            if (!enabled) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        
+        if (drained == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    
+    if (fd >= 0) {
+        send_packet();
+        close(fd);
+    }
+    std::cout << "Multicast thread stopped\n";
+}
+
+bool pico_cancelled() {
+    return !g_running || !g_pico_enabled.load(std::memory_order_relaxed);
+}
+
+// Publishes readings on MQTT_TOPIC_CURRENT as "<timestamp_ns>/<current_A>" lines
+void publish_current_batch(const std::vector<CurrentReading>& readings) {
+    if (readings.empty() || !g_mqtt_connected) return;
+    std::string msg;
+    msg.reserve(readings.size() * 36);
+    char line[48];
+    for (const CurrentReading& reading : readings) {
+        int n = std::snprintf(line, sizeof(line), "%llu/%.6e", 
+                              static_cast<unsigned long long>(reading.timestamp_ns), reading.current_a);
+        if (!msg.empty()) msg += '\n';
+        msg.append(line, n);
+    }
+    int rc = mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_CURRENT.c_str(), msg.length(), msg.c_str(), 0, false);
+    if (rc == MOSQ_ERR_SUCCESS) {
+        g_pico_messages.fetch_add(1, std::memory_order_relaxed);
+        g_pico_readings.fetch_add(readings.size(), std::memory_order_relaxed);
+    } else {
+        g_publish_failures.fetch_add(1, std::memory_order_relaxed);
+        std::cout << "Failed to publish " << MQTT_TOPIC_CURRENT << ": " << mosquitto_strerror(rc) << "\n";
+    }
+}
+
+// Reads the picoammeter (ecc_picoammeter.h) and publishes its currents on MQTT_TOPIC_CURRENT.
+// Readings are stamped with get_nanosecond_timestamp, the clock of PositionSample, so a
+// current lines up with the positions around it by timestamp alone. Serial and instrument
+// errors close the port and retry after PICO_RETRY_NS; sampling is never affected.
+// In triggered mode each burst is armed in advance and started by a BURST position trigger:
+// the sampler posts the crossing, this thread sees it within PICO_TRIGGER_POLL_US and sends
+// only INIT. Crossings while a burst is running count as missed.
+void picoammeter_thread() {
+    std::cout << "Picoammeter thread started\n";
+    
+    Picoammeter meter(get_nanosecond_timestamp, pico_cancelled);
+    std::vector<CurrentReading> pending;
+    uint64_t last_publish_ns = 0;
+    uint64_t retry_at_ns = 0;
+    int mode = PICO_SINGLE;
+    uint32_t points = PICO_DEFAULT_POINTS;
+    
+    // Publishes the pending readings and hands them to the aligner
+    auto flush = [&]() {
+        if (pending.empty()) return;
+        {
+            std::lock_guard<std::mutex> lock(g_align_mutex);
+            if (g_align_readings.size() + pending.size() <= ALIGN_MAX_BACKLOG) {
+                g_align_readings.insert(g_align_readings.end(), pending.begin(), pending.end());
+            } else {
+                g_align_dropped.fetch_add(pending.size(), std::memory_order_relaxed);
+            }
+        }
+        publish_current_batch(pending);
+        pending.clear();
+    };
+    
+    auto fail = [&](const std::string& what) {
+        std::lock_guard<std::mutex> lock(g_pico_mutex);
+        g_pico_error = what + ": " + meter.error();
+        std::cout << "Picoammeter: " << g_pico_error << "\n";
+        g_pico_errors.fetch_add(1, std::memory_order_relaxed);
+        meter.close();
+        retry_at_ns = get_monotonic_ns() + PICO_RETRY_NS;
+    };
+    
+    while (g_running) {
+        bool enabled = g_pico_enabled.load(std::memory_order_acquire);
+        if (g_pico_reconfigure.exchange(false) || !enabled) {
+            flush();
+            meter.close();
+            retry_at_ns = 0;
+        }
+        if (!enabled || get_monotonic_ns() < retry_at_ns) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            continue;
+        }
+        
+        if (!meter.is_open()) {
+            std::string device, identity;
+            int baud;
+            double nplc;
+            {
+                std::lock_guard<std::mutex> lock(g_pico_mutex);
+                device = g_pico_device;
+                baud = g_pico_baud;
+                mode = g_pico_mode;
+                points = g_pico_points;
+                nplc = g_pico_nplc;
+            }
+            if (!meter.open(device, baud)) {
+                fail("Open failed");
+                continue;
+            }
+            if (!meter.configure(nplc, identity)) {
+                if (!pico_cancelled()) fail("Configuration failed");
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(g_pico_mutex);
+            g_pico_identity = identity;
+            g_pico_error.clear();
+            std::cout << "Picoammeter " << identity << " on " << device << "\n";
+        }
+        
+        bool ok;
+        if (mode == PICO_BURST) {
+            uint64_t init_ns;
+            ok = meter.start_burst(points, init_ns) && meter.fetch_burst(init_ns, pending);
+        } else if (mode == PICO_TRIGGERED) {
+            ok = meter.arm_burst(points);
+            uint64_t request_ns = 0;
+            if (ok) {
+                g_trigger_burst_request.store(0, std::memory_order_relaxed);   // Posted while not armed
+                g_pico_armed.store(true, std::memory_order_release);
+                while (!pico_cancelled() && !g_pico_reconfigure.load(std::memory_order_relaxed) &&
+                       (request_ns = g_trigger_burst_request.exchange(0, std::memory_order_acquire)) == 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(PICO_TRIGGER_POLL_US));
+                }
+                g_pico_armed.store(false, std::memory_order_release);
+                if (request_ns == 0) continue;     // Turned off or reconfigured while armed
+                uint64_t init_ns;
+                ok = meter.trigger_burst(init_ns);
+                g_trigger_burst_latency.observe_ns(get_monotonic_ns() - request_ns);
+                ok = ok && meter.fetch_burst(init_ns, pending);
+            }
+        } else {
+            CurrentReading reading;
+            ok = meter.read_single(reading);
+            if (ok) pending.push_back(reading);
+        }
+        if (!ok) {
+            if (!pico_cancelled()) fail("Read failed");
+            continue;
+        }
+        
+        uint64_t now = get_monotonic_ns();
+        if (mode != PICO_SINGLE || now - last_publish_ns >= PICO_PUBLISH_NS) {
+            flush();
+            last_publish_ns = now;
+        }
+    }
+    
+    std::cout << "Picoammeter thread stopped\n";
+}
+
+// Builds the live image of the running scan (ecc_image.h) from the aligner's fused records
+// and publishes the tiles that changed on MQTT_TOPIC_IMAGE at IMAGE_PUBLISH_HZ. After
+// IMAGE/STOP it keeps binning until the aligner has placed the readings taken before the
+// stop (at most the latency budget), then publishes the final tiles.
+void image_thread() {
+    std::cout << "Image thread started\n";
+    
+    ImageBuilder builder;
+    uint32_t scan_id = 0;
+    bool active = false;
+    uint64_t stop_ns = 0;              // Epoch time of IMAGE/STOP
+    uint64_t stop_deadline_ns = 0;
+    std::vector<FusedRecord> incoming;
+    std::string msg;
+    uint64_t next_publish_ns = get_monotonic_ns();
+    
+    while (g_running) {
+        bool enabled = g_image_enabled.load(std::memory_order_acquire);
+        uint32_t current_scan = g_image_scan_id.load(std::memory_order_acquire);
+        if (enabled && current_scan != scan_id) {
+            ScanGrid grid;
+            {
+                std::lock_guard<std::mutex> lock(g_image_mutex);
+                grid = g_image_grid;
+            }
+            builder.configure(grid, current_scan);
+            scan_id = current_scan;
+            active = true;
+            stop_deadline_ns = 0;
+            g_image_pairs = 0;
+            g_image_outside = 0;
+            g_image_unmatched = 0;
+        }
+        if (active && !enabled && stop_deadline_ns == 0) {
+            uint32_t latency_ms;
+            {
+                std::lock_guard<std::mutex> lock(g_align_mutex);
+                latency_ms = g_align_latency_ms;
+            }
+            stop_ns = get_nanosecond_timestamp();
+            stop_deadline_ns = get_monotonic_ns() + latency_ms * 1000000ull + 100000000ull;
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(g_image_mutex);
+            incoming.swap(g_image_fused);
+        }
+        bool caught_up = false;
+        if (active) {
+            const ScanGrid& grid = builder.grid();
+            uint8_t axes_mask = static_cast<uint8_t>((1 << grid.axis_x) | (1 << grid.axis_y));
+            uint64_t binned = 0, outside = 0, unmatched = 0;
+            for (const FusedRecord& record : incoming) {
+                if (stop_deadline_ns != 0 && record.timestamp_ns > stop_ns) {
+                    caught_up = true;
+                } else if ((record.valid_mask & axes_mask) != axes_mask) {
+                    unmatched++;
+                } else if (builder.add(record.position[grid.axis_x], record.position[grid.axis_y], record.current_a)) {
+                    binned++;
+                } else {
+                    outside++;
+                }
+            }
+            g_image_pairs.fetch_add(binned, std::memory_order_relaxed);
+            g_image_outside.fetch_add(outside, std::memory_order_relaxed);
+            g_image_unmatched.fetch_add(unmatched, std::memory_order_relaxed);
+        }
+        incoming.clear();
+        
+        bool finished = active && stop_deadline_ns != 0 && 
+                        (caught_up || !g_pico_enabled.load() || get_monotonic_ns() >= stop_deadline_ns);
+        if (active && g_image_refresh.exchange(false)) builder.mark_all_dirty();
+        if (active && (finished || get_monotonic_ns() >= next_publish_ns)) {
+            next_publish_ns = get_monotonic_ns() + 1000000000ull / IMAGE_PUBLISH_HZ;
+            while (builder.dirty_tiles() > 0 && g_mqtt_connected) {
+                builder.take_update(msg, IMAGE_MAX_TILES_PER_MESSAGE);
+                int rc = mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_IMAGE.c_str(), msg.size(), msg.data(), 0, false);
+                if (rc == MOSQ_ERR_SUCCESS) {
+                    g_image_updates.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    g_publish_failures.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+        if (finished) {
+            active = false;
+            stop_deadline_ns = 0;
+            std::cout << "Image scan " << scan_id << " finished: " << builder.pairs() << " pairs\n";
+        }
+        
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    
+    std::cout << "Image thread stopped\n";
+}
+
+// Fuses picoammeter readings with stage positions (ecc_align.h) while the picoammeter is on,
+// and hands the fused records to the image builder during a scan and to the recorder while
+// recording, so neither does its own time matching. Turning the picoammeter off flushes the
+// readings still waiting with the positions at hand.
+void align_thread() {
+    std::cout << "Align thread started\n";
+    
+    PositionAligner aligner;
+    bool active = false;
+    uint64_t disabled_ns = 0;          // Readings of the last batch still arrive after PICO/OFF
+    std::vector<CurrentReading> incoming;
+    std::vector<FusedRecord> fused;
+    PositionSample sample;
+    
+    auto configure = [&]() {
+        std::lock_guard<std::mutex> lock(g_align_mutex);
+        uint64_t max_gap = static_cast<uint64_t>(g_sample_interval_ns.load()) * ALIGN_MAX_GAP_INTERVALS;
+        aligner.configure(static_cast<AlignMethod>(g_align_method), g_align_latency_ms * 1000000ull, max_gap);
+    };
+    
+    while (g_running) {
+        bool enabled = g_pico_enabled.load(std::memory_order_acquire);
+        if (enabled && !active) {
+            configure();
+            active = true;
+        } else if (active && g_align_reconfigure.exchange(false)) {
+            configure();
+        }
+        if (enabled) {
+            disabled_ns = 0;
+        } else if (active && disabled_ns == 0) {
+            disabled_ns = get_monotonic_ns();
+        }
+        bool closing = active && !enabled && get_monotonic_ns() - disabled_ns >= 500000000ull;
+        
+        size_t drained = 0;
+        while (drained < ALIGN_BUFFER_SAMPLES && g_align_buffer.try_read(sample)) {
+            drained++;
+            int32_t position[4] = {sample.x_position, sample.y_position, sample.z_position, sample.r_position};
+            if (active) aligner.push_position(sample.timestamp_ns, position, sample.valid_mask & 0x0F);
+        }
+        {
+            std::lock_guard<std::mutex> lock(g_align_mutex);
+            incoming.swap(g_align_readings);
+        }
+        if (active) {
+            for (const CurrentReading& reading : incoming) aligner.push_reading(reading);
+        } else {
+            g_align_dropped.fetch_add(incoming.size(), std::memory_order_relaxed);
+        }
+        incoming.clear();
+        
+        if (active) {
+            aligner.emit(get_nanosecond_timestamp(), fused, closing);
+            g_align_fused.store(aligner.fused(), std::memory_order_relaxed);
+            g_align_late.store(aligner.late(), std::memory_order_relaxed);
+            g_align_expired.store(aligner.expired(), std::memory_order_relaxed);
+            g_align_gaps.store(aligner.gaps(), std::memory_order_relaxed);
+            g_align_pending.store(aligner.pending(), std::memory_order_relaxed);
+        }
+        if (!fused.empty()) {
+            if (g_image_enabled.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(g_image_mutex);
+                if (g_image_fused.size() + fused.size() <= ALIGN_MAX_BACKLOG) {
+                    g_image_fused.insert(g_image_fused.end(), fused.begin(), fused.end());
+                } else {
+                    g_align_dropped.fetch_add(fused.size(), std::memory_order_relaxed);
+                }
+            }
+            if (g_recording.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(g_record_mutex);
+                if (g_record_fused.size() + fused.size() <= ALIGN_MAX_BACKLOG) {
+                    g_record_fused.insert(g_record_fused.end(), fused.begin(), fused.end());
+                } else {
+                    g_align_dropped.fetch_add(fused.size(), std::memory_order_relaxed);
+                }
+            }
+            fused.clear();
+        }
+        if (closing) {
+            aligner.clear();
+            active = false;
+        }
+        
+        if (drained == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    
+    std::cout << "Align thread stopped\n";
+}
+
+// Publishes the sampler's trigger crossings on MQTT_TOPIC_TRIGGER, one message per crossing:
+// "<timestamp_ns>/<name>/<action>/<count>/<axis>/<position>/<FWD|REV>". The timestamp is
+// that of the crossing sample, so markers line up with the position stream; for LINE
+// triggers count is the line number.
+void trigger_thread() {
+    static const char* const names[4] = {"X", "Y", "Z", "R"};
+    std::cout << "Trigger thread started\n";
+    
+    TriggerEvent event;
+    char msg[128];
+    while (g_running) {
+        bool any = false;
+        while (g_trigger_events.try_read(event)) {
+            any = true;
+            if (!g_mqtt_connected) continue;
+            int n = std::snprintf(msg, sizeof(msg), "%llu/%s/%s/%u/%s/%d/%s", 
+                                  static_cast<unsigned long long>(event.timestamp_ns), event.name, 
+                                  TRIGGER_ACTION_NAMES[event.action], event.count, names[event.axis], event.position,
+                                  TRIGGER_DIRECTION_NAMES[event.direction]);
+            int rc = mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_TRIGGER.c_str(), n, msg, 0, false);
+            if (rc == MOSQ_ERR_SUCCESS) {
+                g_trigger_marker_latency.observe_ns(get_monotonic_ns() - event.monotonic_ns);
+            } else {
+                g_publish_failures.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (!any) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    
+    std::cout << "Trigger thread stopped\n";
+}
+
+// Rolling per-axis statistics (ecc_stats.h) over the STATS windows, published on
+// MQTT_TOPIC_STATS every interval. Only readings taken this tick count (not the values
+// held for axes SET_AXIS_RATE skips), so a slow axis is not weighted by the tick rate.
+// Message: a "<end_ns>" line, then per axis and window
+// "<axis>/<window_s>/<count>/<mean>/<stddev>/<min>/<max>/<peak_to_peak>/<drift_per_s>",
+// positions in nm/µ°; axes without readings in a window are left out.
+void stats_thread() {
+    static const char* const names[4] = {"X", "Y", "Z", "R"};
+    std::cout << "Statistics thread started\n";
+    
+    uint64_t origin_ns = get_nanosecond_timestamp();
+    AxisStatistics axes[4] = {AxisStatistics(origin_ns), AxisStatistics(origin_ns), 
+                              AxisStatistics(origin_ns), AxisStatistics(origin_ns)};
+    std::vector<uint32_t> windows;
+    uint32_t interval_ms = STATS_DEFAULT_INTERVAL_MS;
+    uint64_t keep_ns = 0;
+    bool active = false;
+    uint64_t next_publish_ns = 0;
+    std::vector<StatsMoments> results;
+    std::string msg;
+    PositionSample sample;
+    
+    while (g_running) {
+        bool enabled = g_stats_enabled.load(std::memory_order_acquire);
+        if (enabled && (!active || g_stats_reconfigure.exchange(false))) {
+            // Blocks already held are kept: a longer window fills in as time passes
+            std::lock_guard<std::mutex> lock(g_stats_mutex);
+            windows = g_stats_windows_s;
+            interval_ms = g_stats_interval_ms;
+            keep_ns = *std::max_element(windows.begin(), windows.end()) * 1000000000ull;
+            if (!active) {
+                origin_ns = get_nanosecond_timestamp();
+                for (AxisStatistics& axis : axes) axis.reset(origin_ns);
+                next_publish_ns = get_monotonic_ns() + interval_ms * 1000000ull;
+            }
+            active = true;
+        } else if (!enabled && active) {
+            active = false;
+            std::lock_guard<std::mutex> lock(g_stats_mutex);
+            g_stats_latest.clear();
+            g_stats_latest_windows_s.clear();
+        }
+        
+        size_t drained = 0;
+        while (drained < STATS_BUFFER_SAMPLES && g_stats_buffer.try_read(sample)) {
+            drained++;
+            if (!active) continue;
+            uint8_t mask = sample.valid_mask & 0x0F;    // Axes read in this tick
+            const int32_t position[4] = {sample.x_position, sample.y_position, sample.z_position, sample.r_position};
+            for (int a = 0; a < 4; ++a) {
+                if (mask & (1 << a)) axes[a].add(sample.timestamp_ns, position[a], keep_ns);
+            }
+        }
+        
+        if (active && get_monotonic_ns() >= next_publish_ns) {
+            next_publish_ns += interval_ms * 1000000ull;
+            if (next_publish_ns < get_monotonic_ns()) next_publish_ns = get_monotonic_ns() + interval_ms * 1000000ull;
+            uint64_t now = get_nanosecond_timestamp();
+            uint64_t end_ns = now - now % STATS_BLOCK_NS;
+            results.clear();
+            msg = std::to_string(end_ns);
+            char line[160];
+            for (int a = 0; a < 4; ++a) {
+                axes[a].advance(now, keep_ns);
+                for (uint32_t window_s : windows) {
+                    StatsMoments m = axes[a].window(window_s * 1000000000ull);
+                    results.push_back(m);
+                    if (m.count == 0) continue;
+                    int n = std::snprintf(line, sizeof(line), "\n%s/%u/%llu/%.3f/%.3f/%d/%d/%lld/%.4f", names[a], window_s,
+                                          static_cast<unsigned long long>(m.count), m.mean_x, m.stddev(), m.min, m.max,
+                                          static_cast<long long>(m.peak_to_peak()), m.drift_per_s());
+                    msg.append(line, n);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(g_stats_mutex);
+                g_stats_latest.swap(results);
+                g_stats_latest_windows_s = windows;
+            }
+            if (g_mqtt_connected) {
+                int rc = mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_STATS.c_str(), msg.size(), msg.data(), 0, false);
+                if (rc == MOSQ_ERR_SUCCESS) {
+                    g_stats_messages.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    g_publish_failures.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+        
+        if (drained == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    
+    std::cout << "Statistics thread stopped\n";
+}
+
+bool initialize_mqtt() {
+    mosquitto_lib_init();
+    
+    g_mqtt_client = mosquitto_new(nullptr, true, nullptr);
+    if (!g_mqtt_client) {
+        std::cerr << "Failed to create MQTT client\n";
+        return false;
+    }
+
+    mosquitto_connect_callback_set(g_mqtt_client, mqtt_on_connect);
+    mosquitto_message_callback_set(g_mqtt_client, mqtt_on_message);
+    mosquitto_disconnect_callback_set(g_mqtt_client, mqtt_on_disconnect);
+
+    int rc = mosquitto_connect(g_mqtt_client, MQTT_BROKER.c_str(), MQTT_PORT, 60);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        std::cerr << "Failed to connect to MQTT broker: " << mosquitto_strerror(rc) << "\n";
+        mosquitto_destroy(g_mqtt_client);
+        return false;
+    }
+
+    rc = mosquitto_loop_start(g_mqtt_client);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        std::cerr << "Failed to start MQTT loop: " << mosquitto_strerror(rc) << "\n";
+        mosquitto_destroy(g_mqtt_client);
+        return false;
+    }
+
+    // Wait for connection
+    int wait_count = 0;
+    while (!g_mqtt_connected && wait_count < 50) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        wait_count++;
+    }
+
+    if (!g_mqtt_connected) {
+        std::cerr << "MQTT connection timeout\n";
+        return false;
+    }
+
+    std::cout << "MQTT connected successfully\n";
+    return true;
+}
+
+void cleanup_mqtt() {
+    if (g_mqtt_client) {
+        mosquitto_loop_stop(g_mqtt_client, true);
+        mosquitto_disconnect(g_mqtt_client);
+        mosquitto_destroy(g_mqtt_client);
+    }
+    mosquitto_lib_cleanup();
+}
+
+void mqtt_on_connect(struct mosquitto *mosq, void * /* userdata */, int result) {
+    if (result == 0) {
+        g_mqtt_connected = true;
+        g_mqtt_connects.fetch_add(1, std::memory_order_relaxed);
+        std::cout << "MQTT connected to broker\n";
+        mosquitto_subscribe(mosq, nullptr, MQTT_TOPIC_COMMAND.c_str(), 0);
+        std::cout << "Subscribed to: " << MQTT_TOPIC_COMMAND << "\n";
+        mosquitto_subscribe(mosq, nullptr, MQTT_TOPIC_SETPOINT.c_str(), 0);
+        std::cout << "Subscribed to: " << MQTT_TOPIC_SETPOINT << "\n";
+    } else {
+        std::cerr << "MQTT connection failed: " << result << "\n";
+    }
+}
+
+void mqtt_on_message(struct mosquitto * /* mosq */, void * /* userdata */, const struct mosquitto_message *message) {
+    if (!message->payload) return;
+    
+    // Setpoints bypass the command queue
+    if (message->topic && MQTT_TOPIC_SETPOINT == message->topic) {
+        handle_setpoint_message((const char*)message->payload, message->payloadlen);
+        return;
+    }
+    
+    std::string payload((char*)message->payload, message->payloadlen);
+    
+    QueuedCommand command;
+    command.text = payload;
+    command.id = g_next_command_id.fetch_add(1, std::memory_order_relaxed);
+    command.received_ns = get_monotonic_ns();
+    
+    if (trace_enabled()) {
+        trace_instant(TRACE_MQTT, TR_MQTT_RECEIVE, command.received_ns, command.id);
+        trace_flow(TRACE_MQTT, TR_COMMAND_FLOW, 's', command.received_ns, command.id);
+    }
+    
+    // A newer MOVE supersedes a pending MOVE on the same axis, provided no other
+    // command for that axis (e.g. STOP) was queued after it
+    std::string superseded;
+    bool is_move = classify_command(payload) == CMD_MOVE;
+    std::string axis_str = is_move ? get_command_axis(payload) : "";
+    
+    {
+        std::lock_guard<std::mutex> lock(g_command_mutex);
+        if (is_move) {
+            for (auto it = g_command_queue.rbegin(); it != g_command_queue.rend(); ++it) {
+                if (get_command_axis(it->text) != axis_str) continue;
+                if (classify_command(it->text) == CMD_MOVE) {
+                    superseded = it->text;
+                    g_command_queue.erase(std::next(it).base());
+                }
+                break;
+            }
+        }
+        g_command_queue.push_back(command);
+        g_command_queue_depth.store(g_command_queue.size(), std::memory_order_relaxed);
+    }
+    
+    if (!superseded.empty()) {
+        g_commands_superseded.fetch_add(1, std::memory_order_relaxed);
+        std::string old_target = superseded.substr(superseded.rfind('/') + 1);
+        std::string new_target = payload.substr(payload.rfind('/') + 1);
+        std::cout << "Superseded queued command: " << superseded << " (by " << payload << ")\n";
+        
+        if (g_mqtt_connected) {
+            std::string timestamp = std::to_string(get_nanosecond_timestamp());
+            std::string result_msg = timestamp + "/COMMAND/MOVE/" + axis_str + "/SUPERSEDED/Movement to " + 
+                                     old_target + " replaced by movement to " + new_target;
+            mosquitto_publish(g_mqtt_client, nullptr, MQTT_TOPIC_RESULT.c_str(), 
+                            result_msg.length(), result_msg.c_str(), 1, false);
+        }
+    }
+}
+
+void mqtt_on_disconnect(struct mosquitto * /* mosq */, void * /* userdata */, int rc) {
+    g_mqtt_connected = false;
+    g_mqtt_disconnects.fetch_add(1, std::memory_order_relaxed);
+    if (rc != 0) {
+        std::cerr << "MQTT unexpected disconnection\n";
+    }
+}
+
+bool initialize_controllers() {
+    struct EccInfo* info = nullptr;
+    int num_controllers = ECC_Check(&info);
+    
+    if (num_controllers <= 0) {
+        std::cerr << "No controllers found\n";
+        ECC_ReleaseInfo();
+        return false;
+    }
+
+    std::cout << "Found " << num_controllers << " controller(s):\n";
+
+    for (int i = 0; i < std::min(num_controllers, 2); ++i) {
+        Int32 id, handle;
+        Bln32 locked;
+        
+        if (ECC_getDeviceInfo(i, &id, &locked) != 0) continue;
+        if (locked) continue;
+        if (ECC_Connect(i, &handle) != 0) continue;
+
         g_controllers[i].handle = handle;
         g_controllers[i].id = id;
         g_controllers[i].connected = true;
@@ -1052,7 +6046,9 @@ int main(int /* argc */, char* /* argv */[]) {
     std::cout << "==========================================\n";
     std::cout << "Target Rate: " << g_sample_rate_hz << " Hz\n";
     std::cout << "Buffer Size: " << BUFFER_SIZE << " samples\n";
-    std::cout << "MQTT Broker: " << MQTT_BROKER << ":" << MQTT_PORT << "\n\n";
+    std::cout << "MQTT Broker: " << MQTT_BROKER << ":" << MQTT_PORT << "\n";
+    std::cout << "Metrics: http://localhost:" << TCP_PORT << "/metrics\n";
+    std::cout << "Position stream: tcp://localhost:" << STREAM_PORT << "\n\n";
 
     if (!initialize_mqtt()) {
         std::cerr << "Failed to initialize MQTT. Exiting.\n";
@@ -1065,12 +6061,34 @@ int main(int /* argc */, char* /* argv */[]) {
         return 1;
     }
 
+    // Shared-memory feed for same-host readers; the stream works without it
+    static const char shm_axes[SHM_AXES][4] = {"X", "Y", "Z", "R"};
+    if (g_shm_writer.create(SHM_DEFAULT_NAME, SHM_DEFAULT_CAPACITY, shm_axes, get_nanosecond_timestamp())) {
+        g_shm_writer.set_sample_rate(g_sample_rate_hz);
+        std::cout << "Shared memory: " << SHM_DEFAULT_NAME << "\n";
+    } else {
+        std::cout << "Shared memory disabled: " << g_shm_writer.error() << "\n";
+    }
+
     // Start optimized threads
     std::vector<std::thread> threads;
     
     threads.emplace_back(high_speed_sampler_thread);   // Real-time sampling
     threads.emplace_back(batch_publisher_thread);      // Batched publishing
     threads.emplace_back(command_processor_thread);    // Command processing
+    threads.emplace_back(metrics_http_thread);         // Prometheus metrics
+    threads.emplace_back(setpoint_streamer_thread);    // Setpoint streaming
+    threads.emplace_back(recorder_thread);             // Binary recording
+    threads.emplace_back(history_thread);              // In-memory history
+    threads.emplace_back(flight_recorder_thread);      // Fault snapshots
+    threads.emplace_back(stream_server_thread);        // TCP position stream
+    threads.emplace_back(multicast_thread);            // UDP multicast sink
+    threads.emplace_back(picoammeter_thread);          // Picoammeter readings
+    threads.emplace_back(image_thread);                // Live image assembly
+    threads.emplace_back(align_thread);                // Position/detector alignment
+    threads.emplace_back(trigger_thread);              // Position trigger markers
+    threads.emplace_back(stats_thread);                // Rolling axis statistics
+    threads.emplace_back(history_query_thread);        // GET_HISTORY replies
 
     std::cout << "All threads started. System ready for high-frequency operation.\n";
     std::cout << "Press Ctrl+C to stop.\n\n";
@@ -1125,6 +6143,7 @@ int main(int /* argc */, char* /* argv */[]) {
         }
     }
 
+    g_shm_writer.close();
     cleanup_controllers();
     cleanup_mqtt();
     std::cout << "Shutdown complete.\n";
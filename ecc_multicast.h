@@ -0,0 +1,117 @@
+// Wire format of the UDP multicast position stream (MULTICAST/ON in ecc_mqtt_streaming)
+//
+// Every datagram has the same size: a MulticastPacketHeader followed by samples_per_packet
+// MulticastSample records, of which the first count are valid (a partial packet is only
+// sent when the stream is slow or stops, and is zero-padded). All fields are little-endian.
+//
+// Two counters let receivers tell losses apart:
+// - sequence increases by one per packet, so a jump means packets were lost on the network
+//   or in the receiver's socket buffer.
+// - first_index is the stream index of the first record; records in a packet are
+//   consecutive. Indexes count every sample taken while the sink was on, so a jump that
+//   the lost packets do not explain means the daemon itself dropped samples.
+// session changes whenever the sink is (re)started, which resets both counters.
+
+#ifndef ECC_MULTICAST_H
+#define ECC_MULTICAST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+const uint32_t MULTICAST_MAGIC = 0x4D434345;       // "ECCM" in little-endian byte order
+const uint16_t MULTICAST_VERSION = 1;
+const char* const MULTICAST_DEFAULT_GROUP = "239.255.42.1";
+const uint16_t MULTICAST_DEFAULT_PORT = 5400;
+const uint16_t MULTICAST_DEFAULT_SAMPLES = 56;     // 1440-byte datagrams, no IP fragmentation at MTU 1500
+const size_t MULTICAST_MAX_DATAGRAM = 65507;       // Largest UDP payload over IPv4
+
+struct __attribute__((packed)) MulticastPacketHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t samples_per_packet;   // Record slots in every datagram
+    uint32_t session;              // New value each time the sink starts
+    uint32_t count;                // Valid records in this datagram
+    uint64_t sequence;             // Packet number within the session
+    uint64_t first_index;          // Stream index of the first record
+    uint32_t sample_rate_hz;
+    uint32_t reserved;
+};
+
+struct __attribute__((packed)) MulticastSample {
+    uint64_t timestamp_ns;         // Nanoseconds since epoch, same clock as the MQTT stream
+    int32_t position[4];           // X, Y, Z, R
+    uint8_t valid_mask;            // Bit per axis, same as the MQTT stream
+};
+
+inline size_t multicast_packet_size(uint16_t samples_per_packet) {
+    return sizeof(MulticastPacketHeader) + samples_per_packet * sizeof(MulticastSample);
+}
+
+const uint16_t MULTICAST_MAX_SAMPLES =
+    (MULTICAST_MAX_DATAGRAM - sizeof(MulticastPacketHeader)) / sizeof(MulticastSample);
+
+// Parses "<group>", "<group>:<port>" or ":<port>"; missing parts keep their current value
+inline bool parse_multicast_address(const std::string& text, std::string& group, uint16_t& port) {
+    size_t colon = text.find(':');
+    std::string host = text.substr(0, colon);
+    if (!host.empty()) group = host;
+    if (colon != std::string::npos) {
+        char* end = nullptr;
+        long value = std::strtol(text.c_str() + colon + 1, &end, 10);
+        if (end == text.c_str() + colon + 1 || *end != '\0' || value <= 0 || value > 65535) return false;
+        port = static_cast<uint16_t>(value);
+    }
+    return true;
+}
+
+// Receiver-side loss accounting from the packet headers
+class MulticastGapTracker {
+public:
+    // Returns false for packets from before the last one (late or duplicated), which
+    // should not be used as new data
+    bool on_packet(const MulticastPacketHeader& header) {
+        if (!started_ || header.session != session_) {
+            if (started_) sessions_++;
+            started_ = true;
+            session_ = header.session;
+            next_sequence_ = header.sequence;
+            next_index_ = header.first_index;
+        }
+        if (header.sequence < next_sequence_) {
+            late_packets_++;
+            if (lost_packets_ > 0) lost_packets_--;   // Counted as lost when it was skipped
+            return false;
+        }
+        lost_packets_ += header.sequence - next_sequence_;
+        if (header.first_index > next_index_) skipped_samples_ += header.first_index - next_index_;
+        next_sequence_ = header.sequence + 1;
+        next_index_ = header.first_index + header.count;
+        packets_++;
+        samples_ += header.count;
+        return true;
+    }
+
+    uint64_t packets() const { return packets_; }
+    uint64_t samples() const { return samples_; }
+    uint64_t lost_packets() const { return lost_packets_; }
+    uint64_t late_packets() const { return late_packets_; }
+    // Index gaps: samples in lost packets plus samples the daemon dropped
+    uint64_t skipped_samples() const { return skipped_samples_; }
+    uint64_t sessions() const { return sessions_; }
+
+private:
+    bool started_ = false;
+    uint32_t session_ = 0;
+    uint64_t next_sequence_ = 0;
+    uint64_t next_index_ = 0;
+    uint64_t packets_ = 0;
+    uint64_t samples_ = 0;
+    uint64_t lost_packets_ = 0;
+    uint64_t late_packets_ = 0;
+    uint64_t skipped_samples_ = 0;
+    uint64_t sessions_ = 0;
+};
+
+#endif // ECC_MULTICAST_H
@@ -0,0 +1,155 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include "ecc_multicast.h"
+
+int open_receiver(const std::string& address, const std::string& interface);
+bool receive_packet(int fd, std::vector<char>& buffer, MulticastPacketHeader& header, int timeout_ms);
+int show_stats(int fd, double seconds);
+int dump_samples(int fd, uint64_t count);
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "ECC100 Multicast Position Receiver\n"
+                  << "Usage:\n"
+                  << "  " << argv[0] << " stats [seconds] [group[:port]] [interface]\n"
+                  << "  " << argv[0] << " dump [count] [group[:port]] [interface]\n";
+        return 1;
+    }
+
+    std::string command = argv[1];
+    std::string address = (argc >= 4) ? argv[3] : "";
+    std::string interface = (argc >= 5) ? argv[4] : "";
+
+    if (command != "stats" && command != "dump") {
+        std::cerr << "Invalid command or insufficient arguments\n";
+        return 1;
+    }
+    int fd = open_receiver(address, interface);
+    if (fd < 0) return 1;
+
+    int result;
+    if (command == "stats") {
+        result = show_stats(fd, (argc >= 3) ? std::atof(argv[2]) : 10.0);
+    } else {
+        result = dump_samples(fd, (argc >= 3) ? std::strtoull(argv[2], nullptr, 10) : 10);
+    }
+    close(fd);
+    return result;
+}
+
+// Joins the group on the given interface (default: chosen by the routing table)
+int open_receiver(const std::string& address, const std::string& interface) {
+    std::string group = MULTICAST_DEFAULT_GROUP;
+    uint16_t port = MULTICAST_DEFAULT_PORT;
+    struct ip_mreq membership;
+    if (!parse_multicast_address(address, group, port) ||
+        inet_pton(AF_INET, group.c_str(), &membership.imr_multiaddr) != 1) {
+        std::cerr << "Invalid multicast address: " << address << "\n";
+        return -1;
+    }
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (!interface.empty() && inet_pton(AF_INET, interface.c_str(), &membership.imr_interface) != 1) {
+        std::cerr << "Invalid interface address: " << interface << "\n";
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    int rcvbuf = 8 << 20;      // Rides out short scheduling stalls at full rate
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr = membership.imr_multiaddr;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+        std::cerr << "Cannot join " << group << ":" << port << ": " << strerror(errno) << "\n";
+        close(fd);
+        return -1;
+    }
+    std::cerr << "Listening on " << group << ":" << port << "\n";
+    return fd;
+}
+
+// Waits up to timeout_ms for one well-formed packet
+bool receive_packet(int fd, std::vector<char>& buffer, MulticastPacketHeader& header, int timeout_ms) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) return false;
+    ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+    if (n < (ssize_t)sizeof(header)) return false;
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    return header.magic == MULTICAST_MAGIC && header.version == MULTICAST_VERSION &&
+           header.count <= header.samples_per_packet &&
+           (size_t)n >= multicast_packet_size(header.samples_per_packet);
+}
+
+// Prints packet, sample and loss counts once per second and a total at the end
+int show_stats(int fd, double seconds) {
+    std::vector<char> buffer(MULTICAST_MAX_DATAGRAM);
+    MulticastPacketHeader header;
+    MulticastGapTracker tracker;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    auto next_report = start + std::chrono::seconds(1);
+    uint64_t last_samples = 0;
+
+    while (std::chrono::steady_clock::now() < end) {
+        if (receive_packet(fd, buffer, header, 100)) tracker.on_packet(header);
+        if (std::chrono::steady_clock::now() >= next_report) {
+            next_report += std::chrono::seconds(1);
+            std::cout << "packets " << tracker.packets() << ", samples " << tracker.samples()
+                      << " (+" << tracker.samples() - last_samples << "/s), lost packets " << tracker.lost_packets()
+                      << ", late " << tracker.late_packets() << ", skipped samples " << tracker.skipped_samples() << "\n";
+            last_samples = tracker.samples();
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t expected = tracker.samples() + tracker.skipped_samples();
+    std::cout << "Total: " << tracker.packets() << " packets, " << tracker.samples() << " samples in "
+              << std::fixed << std::setprecision(2) << elapsed << " s\n";
+    std::cout << "Lost: " << tracker.lost_packets() << " packets, " << tracker.skipped_samples() << " samples ("
+              << std::setprecision(4) << (expected ? 100.0 * tracker.skipped_samples() / expected : 0.0) << "%), "
+              << tracker.late_packets() << " late, " << tracker.sessions() << " sender restarts\n";
+    return 0;
+}
+
+// Prints samples in the MQTT stream format (ts/x/y/z/r, NaN for invalid axes)
+int dump_samples(int fd, uint64_t count) {
+    std::vector<char> buffer(MULTICAST_MAX_DATAGRAM);
+    MulticastPacketHeader header;
+    MulticastGapTracker tracker;
+    uint64_t printed = 0;
+
+    while (printed < count) {
+        if (!receive_packet(fd, buffer, header, 1000) || !tracker.on_packet(header)) continue;
+        for (uint32_t i = 0; i < header.count && printed < count; ++i, ++printed) {
+            MulticastSample sample;
+            std::memcpy(&sample, buffer.data() + sizeof(header) + i * sizeof(sample), sizeof(sample));
+            std::cout << sample.timestamp_ns;
+            for (int a = 0; a < 4; ++a) {
+                std::cout << "/";
+                if (sample.valid_mask & (1 << a)) {
+                    std::cout << sample.position[a];
+                } else {
+                    std::cout << "NaN";
+                }
+            }
+            std::cout << "\n";
+        }
+    }
+    if (tracker.skipped_samples() > 0) std::cerr << "Skipped " << tracker.skipped_samples() << " samples\n";
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Picoammeter simulator on a pseudo-terminal, for testing the daemon's driver without the
+// instrument. Answers the Keithley 6485 subset ecc_picoammeter.h uses. The simulated
+// current ramps from 0 to 1 nA once per wall-clock second (plus a 1 pA dither), so the
+// fractional second of each reading's true acquisition time can be read back from its
+// value: timestamp errors in the stream show up directly.
+
+struct SimState {
+    double nplc = 1.0;
+    uint32_t trigger_count = 1;
+    uint32_t buffer_points = 100;
+    bool zero_check = true;
+    bool burst_running = false;
+    uint64_t burst_start_ns = 0;
+    std::vector<std::pair<double, double>> buffer;   // Reading, seconds since the first one
+    std::vector<std::string> errors;
+    bool opc_pending = false;                        // *OPC? waiting for the burst
+};
+
+static volatile sig_atomic_t g_stop = 0;
+static std::mt19937 g_rng(7);
+
+uint64_t wall_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Ramp of the fractional wall-clock second at the middle of the integration window
+double simulated_current(uint64_t start_ns, double nplc) {
+    uint64_t mid_ns = start_ns + static_cast<uint64_t>(nplc / 60.0 * 0.5e9);
+    std::uniform_real_distribution<double> dither(-1e-12, 1e-12);
+    return (mid_ns % 1000000000ull) * 1e-18 + dither(g_rng);
+}
+
+// Seconds per reading: integration at 60 Hz line frequency plus conversion overhead
+double reading_period(const SimState& s) {
+    return s.nplc / 60.0 + 0.0005;
+}
+
+std::string format_reading(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%+.6EA", value);
+    return buffer;
+}
+
+void finish_burst_if_done(SimState& s, int fd) {
+    if (!s.burst_running) return;
+    double period = reading_period(s);
+    uint64_t now = wall_ns();
+    uint32_t total = std::min(s.trigger_count, s.buffer_points);
+    if (now < s.burst_start_ns + static_cast<uint64_t>(total * period * 1e9)) return;
+    s.buffer.clear();
+    for (uint32_t i = 0; i < total; ++i) {
+        uint64_t start = s.burst_start_ns + static_cast<uint64_t>(i * period * 1e9);
+        s.buffer.push_back(std::make_pair(simulated_current(start, s.nplc), i * period));
+    }
+    s.burst_running = false;
+    if (s.opc_pending) {
+        s.opc_pending = false;
+        const char* reply = "1\n";
+        if (write(fd, reply, 2) < 0) g_stop = 1;
+    }
+}
+
+void handle_command(SimState& s, const std::string& raw, int fd) {
+    std::string cmd = raw;
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    std::string reply;
+    bool has_reply = false;
+    auto arg = [&cmd]() { size_t space = cmd.find(' '); return space == std::string::npos ? std::string() : cmd.substr(space + 1); };
+
+    if (cmd == "*IDN?") {
+        reply = "KEITHLEY INSTRUMENTS INC.,MODEL 6485,0000000,SIM";
+        has_reply = true;
+    } else if (cmd == "*RST") {
+        s = SimState();
+    } else if (cmd == "*CLS") {
+        s.errors.clear();
+    } else if (cmd == "*OPC?") {
+        if (s.burst_running) {
+            s.opc_pending = true;     // Answered when the burst completes
+        } else {
+            reply = "1";
+            has_reply = true;
+        }
+    } else if (cmd == "SYST:LFR?") {
+        reply = "60";
+        has_reply = true;
+    } else if (cmd == "SYST:ERR?") {
+        reply = s.errors.empty() ? "0,\"No error\"" : s.errors.front();
+        if (!s.errors.empty()) s.errors.erase(s.errors.begin());
+        has_reply = true;
+    } else if (cmd.find("SYST:ZCH") == 0) {
+        s.zero_check = arg() != "OFF";
+    } else if (cmd.find("NPLC") == 0 || cmd.find("CURR:NPLC") == 0) {
+        double nplc = std::atof(arg().c_str());
+        if (nplc < 0.01 || nplc > 60) {
+            s.errors.push_back("-222,\"Data out of range\"");
+        } else {
+            s.nplc = nplc;
+        }
+    } else if (cmd.find("TRIG:COUN") == 0) {
+        s.trigger_count = std::max(1, std::atoi(arg().c_str()));
+    } else if (cmd.find("TRAC:POIN") == 0) {
+        int points = std::atoi(arg().c_str());
+        if (points < 1 || points > 2500) {
+            s.errors.push_back("-222,\"Data out of range\"");
+        } else {
+            s.buffer_points = points;
+        }
+    } else if (cmd == "TRAC:CLE") {
+        s.buffer.clear();
+    } else if (cmd == "INIT") {
+        s.burst_running = true;
+        s.burst_start_ns = wall_ns();
+    } else if (cmd == "READ?") {
+        if (s.zero_check) {
+            reply = format_reading(0.0) + ",+0.000000E+00";
+        } else {
+            uint64_t start = wall_ns();
+            usleep(static_cast<useconds_t>(reading_period(s) * 1e6));
+            reply = format_reading(simulated_current(start, s.nplc)) + ",+0.000000E+00";
+        }
+        has_reply = true;
+    } else if (cmd == "TRAC:DATA?") {
+        for (size_t i = 0; i < s.buffer.size(); ++i) {
+            char time[32];
+            std::snprintf(time, sizeof(time), "%+.6E", s.buffer[i].second);
+            reply += (i ? "," : "") + format_reading(s.zero_check ? 0.0 : s.buffer[i].first) + "," + time;
+        }
+        has_reply = true;
+    } else if (cmd.find("CURR:RANG") == 0 || cmd.find("FORM:ELEM") == 0 || cmd.find("TRAC:TST:FORM") == 0 ||
+               cmd.find("TRIG:DEL") == 0 || cmd.find("TRAC:FEED") == 0) {
+        // Accepted, no effect on the simulation
+    } else {
+        s.errors.push_back("-113,\"Undefined header\"");
+    }
+
+    if (has_reply) {
+        reply += "\n";
+        if (write(fd, reply.data(), reply.size()) < 0) g_stop = 1;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        std::cerr << "Cannot create pseudo-terminal: " << strerror(errno) << "\n";
+        return 1;
+    }
+    std::string slave = ptsname(master);
+    std::string link = (argc >= 2) ? argv[1] : "";
+    if (!link.empty()) {
+        unlink(link.c_str());
+        if (symlink(slave.c_str(), link.c_str()) != 0) {
+            std::cerr << "Cannot link " << link << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+    }
+    // Keep the slave open so the master does not see hangups between driver sessions
+    int keep = open(slave.c_str(), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    tcgetattr(keep, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(keep, TCSANOW, &tio);
+
+    signal(SIGINT, [](int) { g_stop = 1; });
+    signal(SIGTERM, [](int) { g_stop = 1; });
+    std::cout << "Picoammeter simulator on " << slave << (link.empty() ? "" : " (" + link + ")") << std::endl;
+
+    SimState state;
+    std::string input;
+    while (!g_stop) {
+        struct pollfd pfd = {master, POLLIN, 0};
+        if (poll(&pfd, 1, 1) > 0 && (pfd.revents & POLLIN)) {
+            char buffer[1024];
+            ssize_t n = read(master, buffer, sizeof(buffer));
+            if (n > 0) input.append(buffer, n);
+        }
+        size_t end;
+        while ((end = input.find_first_of("\r\n")) != std::string::npos) {
+            std::string line = input.substr(0, end);
+            input.erase(0, end + 1);
+            if (!line.empty()) handle_command(state, line, master);
+        }
+        finish_burst_if_done(state, master);
+    }
+
+    if (!link.empty()) unlink(link.c_str());
+    close(keep);
+    close(master);
+    return 0;
+}
@@ -0,0 +1,296 @@
+// SCPI picoammeter on a serial line (Keithley 6485/6487 command subset)
+//
+// Two acquisition modes:
+// - single: READ? per reading. Each reading is stamped with the midpoint between the moment
+//   the query left the UART (tcdrain) and the moment the reply arrived.
+// - burst: the instrument fills its buffer with points readings at its own pace
+//   (TRIG:COUN, TRAC:POIN) while the host waits, then TRAC:DATA? returns them with the
+//   instrument's relative time stamps (FORM:ELEM READ,TIME; TRAC:TST:FORM ABS). Host time of
+//   reading i is the moment INIT left the UART plus its relative time plus half the
+//   integration window (NPLC / line frequency), so the whole burst is on the host clock,
+//   stamped mid-integration like single readings, without per-reading round trips.
+//   A burst can also be armed ahead of time (arm_burst) and started later by sending only
+//   INIT (trigger_burst), which takes one line on the wire instead of six.
+// Host times come from the clock function given to the constructor. The daemon passes the
+// same clock that stamps PositionSample, so currents and positions need no alignment.
+// Long waits (a burst can take minutes at high NPLC) poll an optional cancel check every
+// 100 ms, so the owner can stop the driver without waiting for the instrument. Reply timeouts
+// run on CLOCK_MONOTONIC, not the stamping clock, so a wall clock step cannot cut or stretch them.
+
+#ifndef ECC_PICOAMMETER_H
+#define ECC_PICOAMMETER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+const int PICO_DEFAULT_BAUD = 9600;
+const uint32_t PICO_MAX_BURST_POINTS = 2500;   // Keithley 6485 buffer size
+const int PICO_REPLY_TIMEOUT_MS = 2000;
+const int PICO_BYTES_PER_READING = 29;         // "+1.234567E-09A,+1.234567E+02," on the wire
+
+struct CurrentReading {
+    uint64_t timestamp_ns;         // Host clock (same as PositionSample in the daemon)
+    double current_a;
+};
+
+inline speed_t pico_baud_constant(int baud) {
+    switch (baud) {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        default: return 0;
+    }
+}
+
+// Numbers of a comma-separated SCPI reply; unit suffixes such as "A" are ignored
+inline bool parse_scpi_numbers(const std::string& reply, std::vector<double>& out) {
+    out.clear();
+    const char* p = reply.c_str();
+    while (*p) {
+        char* end = nullptr;
+        double value = std::strtod(p, &end);
+        if (end == p) return false;
+        out.push_back(value);
+        p = end;
+        while (*p && *p != ',') ++p;
+        if (*p == ',') ++p;
+    }
+    return true;
+}
+
+class Picoammeter {
+public:
+    explicit Picoammeter(uint64_t (*clock_ns)(), bool (*cancelled)() = nullptr) 
+        : clock_ns_(clock_ns), cancelled_(cancelled) {}
+    ~Picoammeter() { close(); }
+
+    bool open(const std::string& device, int baud = PICO_DEFAULT_BAUD) {
+        close();
+        speed_t speed = pico_baud_constant(baud);
+        if (speed == 0) {
+            error_ = "Unsupported baud rate " + std::to_string(baud);
+            return false;
+        }
+        fd_ = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (fd_ < 0) {
+            error_ = "Cannot open " + device + ": " + strerror(errno);
+            return false;
+        }
+        struct termios tio;
+        if (tcgetattr(fd_, &tio) != 0) {
+            error_ = "Not a serial device: " + device;
+            close();
+            return false;
+        }
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tcsetattr(fd_, TCSANOW, &tio);
+        tcflush(fd_, TCIOFLUSH);
+        input_.clear();
+        device_ = device;
+        baud_ = baud;
+        return true;
+    }
+
+    void close() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool write_line(const std::string& command) {
+        std::string line = command + "\n";
+        size_t sent = 0;
+        while (sent < line.size()) {
+            ssize_t n = ::write(fd_, line.data() + sent, line.size() - sent);
+            if (n > 0) {
+                sent += n;
+            } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                struct pollfd pfd = {fd_, POLLOUT, 0};
+                poll(&pfd, 1, 100);
+            } else {
+                error_ = "Write failed: " + std::string(strerror(errno));
+                return false;
+            }
+        }
+        tcdrain(fd_);    // Returns once the last byte left the UART
+        return true;
+    }
+
+    // One reply line without the terminator
+    bool read_line(std::string& line, int timeout_ms) {
+        uint64_t deadline = monotonic_ns() + static_cast<uint64_t>(timeout_ms) * 1000000ull;
+        while (true) {
+            size_t newline = input_.find('\n');
+            if (newline != std::string::npos) {
+                line = input_.substr(0, newline);
+                input_.erase(0, newline + 1);
+                if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+                return true;
+            }
+            uint64_t now = monotonic_ns();
+            if (now >= deadline) {
+                error_ = "Timeout waiting for reply";
+                return false;
+            }
+            if (cancelled_ && cancelled_()) {
+                error_ = "Cancelled";
+                return false;
+            }
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            int wait_ms = static_cast<int>(std::min<uint64_t>((deadline - now) / 1000000ull + 1, 100));
+            if (poll(&pfd, 1, wait_ms) <= 0) continue;
+            char buffer[4096];
+            ssize_t n = ::read(fd_, buffer, sizeof(buffer));
+            if (n > 0) {
+                input_.append(buffer, n);
+            } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                error_ = "Read failed: " + std::string(n == 0 ? "device closed" : strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    bool query(const std::string& command, std::string& reply, int timeout_ms = PICO_REPLY_TIMEOUT_MS) {
+        return write_line(command) && read_line(reply, timeout_ms);
+    }
+
+    // Reset to a known state: zero check off, autorange, readings with relative time
+    bool configure(double nplc, std::string& identity) {
+        if (!write_line("*RST") || !write_line("*CLS") || !query("*IDN?", identity)) return false;
+        const char* setup[] = {"SYST:ZCH OFF", "CURR:RANG:AUTO ON", "FORM:ELEM READ,TIME", "TRAC:TST:FORM ABS", "TRIG:DEL 0"};
+        for (const char* command : setup) {
+            if (!write_line(command)) return false;
+        }
+        std::string frequency;
+        if (!query("SYST:LFR?", frequency)) return false;
+        line_frequency_hz_ = std::atof(frequency.c_str());
+        if (line_frequency_hz_ <= 0) line_frequency_hz_ = 50.0;
+        nplc_ = nplc;
+        return write_line("NPLC " + std::to_string(nplc)) && check_errors();
+    }
+
+    // SYST:ERR? until the queue is empty; false (with the first error) if there was one
+    bool check_errors() {
+        std::string reply, first;
+        for (int i = 0; i < 10; ++i) {
+            if (!query("SYST:ERR?", reply)) return false;
+            if (std::atoi(reply.c_str()) == 0) break;
+            if (first.empty()) first = reply;
+        }
+        if (!first.empty()) {
+            error_ = "Instrument error: " + first;
+            return false;
+        }
+        return true;
+    }
+
+    bool read_single(CurrentReading& out) {
+        if (!write_line("READ?")) return false;
+        uint64_t sent_ns = clock_ns_();
+        std::string reply;
+        if (!read_line(reply, PICO_REPLY_TIMEOUT_MS)) return false;
+        uint64_t received_ns = clock_ns_();
+        std::vector<double> values;
+        if (!parse_scpi_numbers(reply, values) || values.empty()) {
+            error_ = "Unexpected reply: " + reply;
+            return false;
+        }
+        out.timestamp_ns = sent_ns + (received_ns - sent_ns) / 2;
+        out.current_a = values[0];
+        return true;
+    }
+
+    // Arms the buffer for points readings; trigger_burst starts them
+    bool arm_burst(uint32_t points) {
+        if (points == 0 || points > PICO_MAX_BURST_POINTS) {
+            error_ = "Burst size must be 1-" + std::to_string(PICO_MAX_BURST_POINTS);
+            return false;
+        }
+        const std::string setup[] = {"TRAC:CLE", "TRAC:POIN " + std::to_string(points), "TRIG:COUN " + std::to_string(points),
+                                     "TRAC:FEED SENS", "TRAC:FEED:CONT NEXT"};
+        for (const std::string& command : setup) {
+            if (!write_line(command)) return false;
+        }
+        burst_points_ = points;
+        return true;
+    }
+
+    // Starts the armed burst; init_ns is the host time of INIT
+    bool trigger_burst(uint64_t& init_ns) {
+        if (!write_line("INIT")) return false;
+        init_ns = clock_ns_();
+        return true;
+    }
+
+    bool start_burst(uint32_t points, uint64_t& init_ns) {
+        return arm_burst(points) && trigger_burst(init_ns);
+    }
+
+    // Waits for the burst (*OPC?) and appends its readings on the host clock
+    bool fetch_burst(uint64_t init_ns, std::vector<CurrentReading>& out) {
+        // Integration time plus generous per-reading overhead
+        int timeout_ms = PICO_REPLY_TIMEOUT_MS + static_cast<int>(burst_points_ * (nplc_ / 50.0 + 0.005) * 1000);
+        std::string reply;
+        if (!query("*OPC?", reply, timeout_ms)) return false;
+        // Transfer time of the whole buffer at 10 bits per byte, plus the usual reply margin
+        int transfer_ms = static_cast<int>(static_cast<uint64_t>(burst_points_) * PICO_BYTES_PER_READING * 10 * 1000 / baud_);
+        if (!query("TRAC:DATA?", reply, PICO_REPLY_TIMEOUT_MS + transfer_ms)) return false;
+        std::vector<double> values;
+        if (!parse_scpi_numbers(reply, values) || values.size() % 2 != 0) {
+            error_ = "Unexpected buffer reply (" + std::to_string(reply.size()) + " bytes)";
+            return false;
+        }
+        double half_integration_s = nplc_ / line_frequency_hz_ / 2;
+        for (size_t i = 0; i + 1 < values.size(); i += 2) {
+            CurrentReading reading;
+            reading.current_a = values[i];
+            reading.timestamp_ns = init_ns + static_cast<uint64_t>((std::max(0.0, values[i + 1]) + half_integration_s) * 1e9);
+            out.push_back(reading);
+        }
+        return true;
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+    const std::string& device() const { return device_; }
+    const std::string& error() const { return error_; }
+
+private:
+    static uint64_t monotonic_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    uint64_t (*clock_ns_)();
+    bool (*cancelled_)();
+    int fd_ = -1;
+    int baud_ = PICO_DEFAULT_BAUD;
+    double nplc_ = 1.0;
+    double line_frequency_hz_ = 50.0;
+    uint32_t burst_points_ = 0;
+    std::string device_;
+    std::string input_;
+    std::string error_;
+};
+
+#endif // ECC_PICOAMMETER_H
@@ -0,0 +1,239 @@
+// Binary position recording shared by ecc_mqtt_streaming and the archive tools
+//
+// A recording is a directory of segment files. Each segment is preallocated and
+// memory-mapped: a fixed RECORD_HEADER_SIZE header (rate, axis map, start time,
+// counters) followed by packed 25-byte RecordSample records. record_count in the
+// header is advanced after each record is written, so a segment that was not
+// closed cleanly is still readable up to the last complete record. Closing a
+// segment truncates the preallocated tail.
+
+#ifndef ECC_RECORDER_H
+#define ECC_RECORDER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char RECORD_MAGIC[8] = {'E', 'C', 'C', 'R', 'E', 'C', '0', '1'};
+const uint32_t RECORD_VERSION = 1;
+const size_t RECORD_HEADER_SIZE = 4096;       // Page aligned so records start on a page
+const uint32_t RECORD_MAX_AXES = 4;
+
+struct __attribute__((packed)) RecordSample {
+    uint64_t timestamp_ns;     // Nanoseconds since epoch
+    int32_t position[RECORD_MAX_AXES];   // X, Y, Z, R
+    uint8_t valid_mask;        // Bit per axis, same as the MQTT stream
+};
+
+struct RecordAxis {
+    char name[4];              // "X", "Y", "Z", "R"
+    int32_t controller_id;     // ECC100 device ID, -1 if not connected
+    int32_t controller_index;
+    int32_t axis;
+};
+
+// Segment header, stored at offset 0 and zero padded to RECORD_HEADER_SIZE
+struct RecordHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t sample_rate_hz;
+    uint64_t start_time_ns;        // Epoch timestamp of the first record
+    uint64_t segment_index;        // Position within the recording, from 0
+    uint64_t record_count;         // Complete records after the header
+    uint64_t capacity;             // Preallocated records
+    uint64_t dropped_before;       // Samples lost since the recording started, before this segment
+    uint64_t dropped_in_segment;   // Samples lost while this segment was open
+    uint32_t closed;               // 1 after a clean close
+    uint32_t num_axes;
+    RecordAxis axes[RECORD_MAX_AXES];
+};
+
+// Everything a new segment needs besides the first sample
+struct RecordSegmentInfo {
+    uint32_t sample_rate_hz = 0;
+    uint32_t num_axes = 0;
+    RecordAxis axes[RECORD_MAX_AXES];
+    uint64_t dropped_total = 0;    // Samples lost so far in this recording
+};
+
+// Single-threaded writer; rotates segments by size, age or sample rate change
+class RecordingWriter {
+public:
+    RecordingWriter() {}
+    ~RecordingWriter() { close(0); }
+
+    void configure(const std::string& directory, uint64_t segment_bytes, uint32_t segment_seconds) {
+        directory_ = directory;
+        segment_bytes_ = segment_bytes;
+        segment_seconds_ = segment_seconds;
+        segment_index_ = 0;
+    }
+
+    // Returns false if the sample could not be stored (no segment could be opened)
+    bool append(const RecordSample& sample, const RecordSegmentInfo& info) {
+        if (header_ && (header_->record_count >= header_->capacity ||
+                        header_->sample_rate_hz != info.sample_rate_hz ||
+                        sample.timestamp_ns - header_->start_time_ns >= segment_seconds_ * 1000000000ull)) {
+            close(info.dropped_total);
+        }
+        if (!header_ && !open(sample.timestamp_ns, info)) return false;
+
+        RecordSample* records = reinterpret_cast<RecordSample*>(map_ + RECORD_HEADER_SIZE);
+        std::memcpy(&records[header_->record_count], &sample, sizeof(RecordSample));
+        __atomic_store_n(&header_->record_count, header_->record_count + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    void update_dropped(uint64_t dropped_total) {
+        if (header_) header_->dropped_in_segment = dropped_total - header_->dropped_before;
+    }
+
+    void close(uint64_t dropped_total) {
+        if (!header_) return;
+        if (dropped_total >= header_->dropped_before) update_dropped(dropped_total);
+        header_->closed = 1;
+        size_t used = RECORD_HEADER_SIZE + header_->record_count * sizeof(RecordSample);
+        msync(map_, used, MS_ASYNC);
+        munmap(map_, mapped_bytes_);
+        if (ftruncate(fd_, used) != 0) error_ = "ftruncate failed for " + path_;
+        ::close(fd_);
+        map_ = nullptr;
+        header_ = nullptr;
+        fd_ = -1;
+        segments_closed_++;
+    }
+
+    bool is_open() const { return header_ != nullptr; }
+    const std::string& path() const { return path_; }
+    const std::string& error() const { return error_; }
+    uint64_t segments_closed() const { return segments_closed_; }
+
+private:
+    bool open(uint64_t start_time_ns, const RecordSegmentInfo& info) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "/ecc_%020llu_%04llu.rec",
+                      static_cast<unsigned long long>(start_time_ns), static_cast<unsigned long long>(segment_index_));
+        path_ = directory_ + name;
+
+        uint64_t capacity = (segment_bytes_ - RECORD_HEADER_SIZE) / sizeof(RecordSample);
+        mapped_bytes_ = RECORD_HEADER_SIZE + capacity * sizeof(RecordSample);
+
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            error_ = "Cannot create " + path_;
+            return false;
+        }
+        // Reserve the blocks now so a full disk fails here instead of faulting in the mapping
+        if (posix_fallocate(fd_, 0, mapped_bytes_) != 0) {
+            error_ = "Cannot preallocate " + path_;
+            ::close(fd_);
+            unlink(path_.c_str());
+            fd_ = -1;
+            return false;
+        }
+        void* map = mmap(nullptr, mapped_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            error_ = "Cannot map " + path_;
+            ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        map_ = static_cast<char*>(map);
+        header_ = reinterpret_cast<RecordHeader*>(map_);
+
+        std::memset(map_, 0, RECORD_HEADER_SIZE);
+        std::memcpy(header_->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+        header_->version = RECORD_VERSION;
+        header_->header_size = RECORD_HEADER_SIZE;
+        header_->record_size = sizeof(RecordSample);
+        header_->sample_rate_hz = info.sample_rate_hz;
+        header_->start_time_ns = start_time_ns;
+        header_->segment_index = segment_index_++;
+        header_->capacity = capacity;
+        header_->dropped_before = info.dropped_total;
+        header_->num_axes = info.num_axes;
+        std::memcpy(header_->axes, info.axes, sizeof(info.axes));
+        error_.clear();
+        return true;
+    }
+
+    std::string directory_ = ".";
+    uint64_t segment_bytes_ = 256ull << 20;
+    uint32_t segment_seconds_ = 3600;
+    uint64_t segment_index_ = 0;
+    uint64_t segments_closed_ = 0;
+
+    int fd_ = -1;
+    char* map_ = nullptr;
+    size_t mapped_bytes_ = 0;
+    RecordHeader* header_ = nullptr;
+    std::string path_;
+    std::string error_;
+};
+
+// Read-only view of one segment
+class RecordingSegment {
+public:
+    RecordingSegment() {}
+    ~RecordingSegment() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || static_cast<size_t>(st.st_size) < RECORD_HEADER_SIZE) {
+            close();
+            return false;
+        }
+        size_ = st.st_size;
+        void* map = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            map_ = nullptr;
+            close();
+            return false;
+        }
+        map_ = static_cast<const char*>(map);
+        const RecordHeader* h = header();
+        if (std::memcmp(h->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 ||
+            h->record_size != sizeof(RecordSample) || h->header_size != RECORD_HEADER_SIZE) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (map_) munmap(const_cast<char*>(map_), size_);
+        if (fd_ >= 0) ::close(fd_);
+        map_ = nullptr;
+        fd_ = -1;
+        size_ = 0;
+    }
+
+    const RecordHeader* header() const { return reinterpret_cast<const RecordHeader*>(map_); }
+
+    // Complete records, also for a segment that is still being written
+    uint64_t count() const {
+        uint64_t n = __atomic_load_n(&header()->record_count, __ATOMIC_ACQUIRE);
+        uint64_t fit = (size_ - RECORD_HEADER_SIZE) / sizeof(RecordSample);
+        return n < fit ? n : fit;
+    }
+
+    const RecordSample* records() const { return reinterpret_cast<const RecordSample*>(map_ + RECORD_HEADER_SIZE); }
+
+private:
+    int fd_ = -1;
+    const char* map_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif // ECC_RECORDER_H
@@ -0,0 +1,279 @@
+// Shared-memory position feed between ecc_mqtt_streaming and same-host readers
+//
+// The sampler publishes every sample into a POSIX shared-memory ring (shm_open name
+// SHM_DEFAULT_NAME). Layout: a versioned ShmHeader page followed by a power-of-two
+// array of 64-byte slots. Each slot carries its own sequence number: the writer sets it
+// odd while the slot is being written and to 2 * (index + 1) when the sample with that
+// index is complete. A reader copies a slot and accepts it only if the sequence matched
+// before and after the copy, so readers never block the writer and never lock. A reader
+// that falls more than a ring behind notices from the sequence and skips ahead, counting
+// the samples it lost.
+
+#ifndef ECC_SHM_H
+#define ECC_SHM_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <time.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char SHM_MAGIC[8] = {'E', 'C', 'C', 'S', 'H', 'M', '0', '1'};
+const uint32_t SHM_VERSION = 1;
+const size_t SHM_HEADER_SIZE = 4096;
+const uint32_t SHM_AXES = 4;
+const char* const SHM_DEFAULT_NAME = "/ecc_positions";
+const uint64_t SHM_DEFAULT_CAPACITY = 1 << 16;     // Slots, 4 MiB (4.4 s at 15 kHz)
+
+struct ShmHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t slot_size;
+    uint32_t num_axes;
+    uint64_t capacity;                     // Slots, a power of two
+    uint64_t created_ns;                   // Epoch time the writer created the ring
+    int32_t writer_pid;
+    std::atomic<uint32_t> closed;          // 1 after the writer shut down cleanly
+    std::atomic<uint32_t> sample_rate_hz;
+    char axis_names[SHM_AXES][4];
+    alignas(64) std::atomic<uint64_t> head; // Samples published so far
+};
+
+struct alignas(64) ShmSlot {
+    std::atomic<uint64_t> sequence;        // 2 * (index + 1) when complete, odd while writing
+    std::atomic<uint64_t> timestamp_ns;    // Epoch, same clock as the MQTT stream
+    std::atomic<uint64_t> published_ns;    // CLOCK_MONOTONIC when the slot was completed
+    std::atomic<int32_t> position[SHM_AXES];
+    std::atomic<uint32_t> valid_mask;
+};
+
+// Sample as handed to readers
+struct ShmSample {
+    uint64_t index;                        // Position in the stream, gaps mean lost samples
+    uint64_t timestamp_ns;
+    uint64_t published_ns;
+    int32_t position[SHM_AXES];
+    uint8_t valid_mask;
+};
+
+inline uint64_t shm_monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Single writer (the sampler thread)
+class ShmWriter {
+public:
+    ShmWriter() {}
+    ~ShmWriter() { close(); }
+
+    bool create(const std::string& name, uint64_t capacity, const char axis_names[SHM_AXES][4], uint64_t now_ns) {
+        close();
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+            error_ = "Capacity must be a power of two";
+            return false;
+        }
+        // Always a fresh object; readers still mapping one from an earlier run must reopen
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            error_ = "Cannot create shared memory " + name;
+            return false;
+        }
+        size_ = SHM_HEADER_SIZE + capacity * sizeof(ShmSlot);
+        if (ftruncate(fd, size_) != 0) {
+            error_ = "Cannot size shared memory " + name;
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        void* map = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            error_ = "Cannot map shared memory " + name;
+            shm_unlink(name.c_str());
+            return false;
+        }
+        map_ = static_cast<char*>(map);
+        name_ = name;
+        // ftruncate zero-fills, so every slot sequence and the head start at 0
+        header_ = reinterpret_cast<ShmHeader*>(map_);
+        slots_ = reinterpret_cast<ShmSlot*>(map_ + SHM_HEADER_SIZE);
+        mask_ = capacity - 1;
+        std::memcpy(header_->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+        header_->version = SHM_VERSION;
+        header_->header_size = SHM_HEADER_SIZE;
+        header_->slot_size = sizeof(ShmSlot);
+        header_->num_axes = SHM_AXES;
+        header_->capacity = capacity;
+        header_->created_ns = now_ns;
+        header_->writer_pid = getpid();
+        std::memcpy(header_->axis_names, axis_names, sizeof(header_->axis_names));
+        header_->head.store(0, std::memory_order_release);
+        return true;
+    }
+
+    void publish(uint64_t timestamp_ns, const int32_t position[SHM_AXES], uint8_t valid_mask) {
+        uint64_t index = next_;
+        ShmSlot& slot = slots_[index & mask_];
+        slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+        for (uint32_t a = 0; a < SHM_AXES; ++a) slot.position[a].store(position[a], std::memory_order_relaxed);
+        slot.valid_mask.store(valid_mask, std::memory_order_relaxed);
+        slot.published_ns.store(shm_monotonic_ns(), std::memory_order_relaxed);
+        slot.sequence.store(2 * index + 2, std::memory_order_release);
+        next_ = index + 1;
+        header_->head.store(next_, std::memory_order_release);
+    }
+
+    void set_sample_rate(uint32_t rate_hz) {
+        if (header_) header_->sample_rate_hz.store(rate_hz, std::memory_order_relaxed);
+    }
+
+    void close() {
+        if (!map_) return;
+        header_->closed.store(1, std::memory_order_release);
+        munmap(map_, size_);
+        shm_unlink(name_.c_str());
+        map_ = nullptr;
+        header_ = nullptr;
+        slots_ = nullptr;
+        next_ = 0;
+    }
+
+    bool is_open() const { return header_ != nullptr; }
+    uint64_t published() const { return header_ ? header_->head.load(std::memory_order_relaxed) : 0; }
+    const std::string& error() const { return error_; }
+
+private:
+    std::string name_;
+    std::string error_;
+    char* map_ = nullptr;
+    size_t size_ = 0;
+    ShmHeader* header_ = nullptr;
+    ShmSlot* slots_ = nullptr;
+    uint64_t mask_ = 0;
+    uint64_t next_ = 0;
+};
+
+// Any number of readers, each with its own cursor
+class ShmReader {
+public:
+    enum Result { SAMPLE, EMPTY };
+
+    ShmReader() {}
+    ~ShmReader() { close(); }
+
+    bool open(const std::string& name = SHM_DEFAULT_NAME) {
+        close();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            error_ = "No shared memory " + name + " (is ecc_mqtt_streaming running?)";
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < SHM_HEADER_SIZE) {
+            error_ = "Shared memory " + name + " is not initialized";
+            ::close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        void* map = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            error_ = "Cannot map shared memory " + name;
+            return false;
+        }
+        map_ = static_cast<const char*>(map);
+        header_ = reinterpret_cast<const ShmHeader*>(map_);
+        if (std::memcmp(header_->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 || header_->version != SHM_VERSION ||
+            header_->slot_size != sizeof(ShmSlot) || header_->header_size != SHM_HEADER_SIZE ||
+            SHM_HEADER_SIZE + header_->capacity * sizeof(ShmSlot) > size_) {
+            error_ = "Shared memory " + name + " has an incompatible layout";
+            close();
+            return false;
+        }
+        slots_ = reinterpret_cast<const ShmSlot*>(map_ + SHM_HEADER_SIZE);
+        mask_ = header_->capacity - 1;
+        cursor_ = header_->head.load(std::memory_order_acquire);
+        lost_ = 0;
+        return true;
+    }
+
+    void close() {
+        if (map_) munmap(const_cast<char*>(map_), size_);
+        map_ = nullptr;
+        header_ = nullptr;
+        slots_ = nullptr;
+    }
+
+    // Next sample after the cursor. Samples overwritten before they could be read are
+    // skipped and added to lost().
+    Result next(ShmSample& out) {
+        while (true) {
+            uint64_t head = header_->head.load(std::memory_order_acquire);
+            if (cursor_ >= head) return EMPTY;
+            if (head - cursor_ > header_->capacity) {
+                lost_ += head - header_->capacity - cursor_;
+                cursor_ = head - header_->capacity;
+            }
+
+            const ShmSlot& slot = slots_[cursor_ & mask_];
+            uint64_t expected = 2 * cursor_ + 2;
+            uint64_t seq1 = slot.sequence.load(std::memory_order_acquire);
+            if (seq1 == expected) {
+                out.index = cursor_;
+                out.timestamp_ns = slot.timestamp_ns.load(std::memory_order_relaxed);
+                out.published_ns = slot.published_ns.load(std::memory_order_relaxed);
+                for (uint32_t a = 0; a < SHM_AXES; ++a) out.position[a] = slot.position[a].load(std::memory_order_relaxed);
+                out.valid_mask = static_cast<uint8_t>(slot.valid_mask.load(std::memory_order_relaxed));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) == seq1) {
+                    cursor_++;
+                    return SAMPLE;
+                }
+            }
+            // The writer lapped this slot while we read it; the loop skips ahead
+            if (seq1 < expected) return EMPTY;
+            lost_++;
+            cursor_++;
+        }
+    }
+
+    // Drop the backlog and continue with the next new sample
+    void skip_to_latest() { cursor_ = header_->head.load(std::memory_order_acquire); }
+
+    const ShmHeader& header() const { return *header_; }
+    bool writer_closed() const { return header_->closed.load(std::memory_order_acquire) != 0; }
+
+    // False once the writer closed the ring or its process is gone (killed without closing).
+    // A system call; check it while idle, not per sample.
+    bool writer_alive() const {
+        return !writer_closed() && (kill(header_->writer_pid, 0) == 0 || errno == EPERM);
+    }
+    uint64_t backlog() const { return header_->head.load(std::memory_order_acquire) - cursor_; }
+    uint64_t lost() const { return lost_; }
+    const std::string& error() const { return error_; }
+
+private:
+    const char* map_ = nullptr;
+    size_t size_ = 0;
+    const ShmHeader* header_ = nullptr;
+    const ShmSlot* slots_ = nullptr;
+    uint64_t mask_ = 0;
+    uint64_t cursor_ = 0;
+    uint64_t lost_ = 0;
+    std::string error_;
+};
+
+#endif // ECC_SHM_H
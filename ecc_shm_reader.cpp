@@ -0,0 +1,124 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "ecc_shm.h"
+
+int show_info(const std::string& name);
+int dump_samples(const std::string& name, uint64_t count);
+int measure_latency(const std::string& name, double seconds);
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "ECC100 Shared-Memory Position Reader\n"
+                  << "Usage:\n"
+                  << "  " << argv[0] << " info [name]\n"
+                  << "  " << argv[0] << " dump [count] [name]\n"
+                  << "  " << argv[0] << " latency [seconds] [name]\n";
+        return 1;
+    }
+
+    std::string command = argv[1];
+
+    if (command == "info") {
+        return show_info((argc >= 3) ? argv[2] : SHM_DEFAULT_NAME);
+    } else if (command == "dump") {
+        uint64_t count = (argc >= 3) ? std::strtoull(argv[2], nullptr, 10) : 10;
+        return dump_samples((argc >= 4) ? argv[3] : SHM_DEFAULT_NAME, count);
+    } else if (command == "latency") {
+        double seconds = (argc >= 3) ? std::atof(argv[2]) : 10.0;
+        return measure_latency((argc >= 4) ? argv[3] : SHM_DEFAULT_NAME, seconds);
+    }
+
+    std::cerr << "Invalid command or insufficient arguments\n";
+    return 1;
+}
+
+int show_info(const std::string& name) {
+    ShmReader reader;
+    if (!reader.open(name)) {
+        std::cerr << reader.error() << "\n";
+        return 1;
+    }
+    const ShmHeader& h = reader.header();
+    std::cout << "Shared memory: " << name << " (version " << h.version << ")\n";
+    std::cout << "Writer PID: " << h.writer_pid << (reader.writer_alive() ? "" : " (not running)") << "\n";
+    std::cout << "Created: " << h.created_ns << " ns since epoch\n";
+    std::cout << "Sample rate: " << h.sample_rate_hz.load() << " Hz\n";
+    std::cout << "Capacity: " << h.capacity << " slots of " << h.slot_size << " bytes\n";
+    std::cout << "Published: " << h.head.load() << " samples\n";
+    std::cout << "Axes:";
+    for (uint32_t a = 0; a < h.num_axes && a < SHM_AXES; ++a) std::cout << " " << h.axis_names[a];
+    std::cout << "\n";
+    return 0;
+}
+
+// Prints new samples in the MQTT stream format (ts/x/y/z/r, NaN for invalid axes)
+int dump_samples(const std::string& name, uint64_t count) {
+    ShmReader reader;
+    if (!reader.open(name)) {
+        std::cerr << reader.error() << "\n";
+        return 1;
+    }
+    ShmSample sample;
+    uint64_t printed = 0;
+    while (printed < count) {
+        if (reader.next(sample) == ShmReader::EMPTY) {
+            if (!reader.writer_alive()) break;
+            std::this_thread::yield();
+            continue;
+        }
+        std::cout << sample.timestamp_ns;
+        for (uint32_t a = 0; a < SHM_AXES; ++a) {
+            std::cout << "/";
+            if (sample.valid_mask & (1 << a)) {
+                std::cout << sample.position[a];
+            } else {
+                std::cout << "NaN";
+            }
+        }
+        std::cout << "\n";
+        printed++;
+    }
+    if (reader.lost() > 0) std::cerr << "Lost " << reader.lost() << " samples\n";
+    return 0;
+}
+
+// Polls the ring (yielding when empty) and reports publish-to-read latency, rate and lost samples
+int measure_latency(const std::string& name, double seconds) {
+    ShmReader reader;
+    if (!reader.open(name)) {
+        std::cerr << reader.error() << "\n";
+        return 1;
+    }
+    std::vector<uint32_t> latencies;
+    latencies.reserve(1 << 20);
+    ShmSample sample;
+    uint64_t samples = 0;
+    uint64_t start = shm_monotonic_ns();
+    uint64_t end = start + static_cast<uint64_t>(seconds * 1e9);
+
+    while (shm_monotonic_ns() < end) {
+        if (reader.next(sample) == ShmReader::EMPTY) {
+            if (!reader.writer_alive()) break;
+            std::this_thread::yield();
+            continue;
+        }
+        uint64_t now = shm_monotonic_ns();
+        samples++;
+        if (latencies.size() < latencies.capacity()) latencies.push_back(static_cast<uint32_t>(now - sample.published_ns));
+    }
+    double elapsed = (shm_monotonic_ns() - start) / 1e9;
+
+    std::cout << "Samples: " << samples << " in " << std::fixed << std::setprecision(2) << elapsed << " s ("
+              << std::setprecision(0) << samples / elapsed << " Hz), lost " << reader.lost() << "\n";
+    if (latencies.empty()) return 0;
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&latencies](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))] / 1000.0; };
+    std::cout << std::setprecision(3) << "Latency us: p50 " << pct(0.5) << ", p99 " << pct(0.99)
+              << ", p99.9 " << pct(0.999) << ", max " << latencies.back() / 1000.0 << "\n";
+    return 0;
+}
@@ -0,0 +1,129 @@
+// Rolling per-axis position statistics (STATS in ecc_mqtt_streaming)
+//
+// Each axis's readings are summarized into fixed blocks (STATS_BLOCK_NS). A block holds the
+// count, min, max, the means of time and position, and the centred second moments of both
+// plus their co-moment, all updated with Welford's method. A window is the merge of its
+// newest blocks (Chan et al.'s pairwise update), so every window length comes out of the
+// same blocks without keeping a sample. Centring matters here: a stage parked at 5 mm with
+// 2 nm of noise has a sum of squares near 2.5e13 and a variance near 4, which sums of raw
+// powers in doubles would lose entirely.
+//
+// From the merged moments: mean, sample standard deviation, min, max, peak-to-peak and the
+// drift rate, the least-squares slope of position over time (co-moment / time moment).
+
+#ifndef ECC_STATS_H
+#define ECC_STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <limits>
+
+const uint64_t STATS_BLOCK_NS = 100000000;      // Window resolution: 100 ms
+
+struct StatsMoments {
+    uint64_t count = 0;
+    double mean_t = 0;             // Seconds, relative to the accumulator's origin
+    double mean_x = 0;
+    double m2_t = 0;               // Sum of squared deviations of t from mean_t
+    double m2_x = 0;
+    double c_tx = 0;               // Sum of products of the t and x deviations
+    int32_t min = std::numeric_limits<int32_t>::max();
+    int32_t max = std::numeric_limits<int32_t>::min();
+
+    void add(double t, int32_t x) {
+        count++;
+        double dt = t - mean_t;
+        double dx = x - mean_x;
+        mean_t += dt / count;
+        mean_x += dx / count;
+        m2_t += dt * (t - mean_t);
+        m2_x += dx * (x - mean_x);
+        c_tx += dt * (x - mean_x);
+        min = std::min(min, x);
+        max = std::max(max, x);
+    }
+
+    void merge(const StatsMoments& other) {
+        if (other.count == 0) return;
+        if (count == 0) {
+            *this = other;
+            return;
+        }
+        double n = static_cast<double>(count + other.count);
+        double f = static_cast<double>(count) * other.count / n;
+        double dt = other.mean_t - mean_t;
+        double dx = other.mean_x - mean_x;
+        mean_t += dt * other.count / n;
+        mean_x += dx * other.count / n;
+        m2_t += other.m2_t + dt * dt * f;
+        m2_x += other.m2_x + dx * dx * f;
+        c_tx += other.c_tx + dt * dx * f;
+        count += other.count;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    double stddev() const { return count > 1 ? std::sqrt(m2_x / (count - 1)) : 0.0; }
+    int64_t peak_to_peak() const { return count > 0 ? static_cast<int64_t>(max) - min : 0; }
+    double drift_per_s() const { return m2_t > 0 ? c_tx / m2_t : 0.0; }
+};
+
+// One axis: closed blocks for the longest window plus the block being filled
+class AxisStatistics {
+public:
+    explicit AxisStatistics(uint64_t origin_ns = 0) : origin_ns_(origin_ns) {}
+
+    void reset(uint64_t origin_ns) {
+        origin_ns_ = origin_ns;
+        blocks_.clear();
+        current_ = StatsMoments();
+        current_start_ns_ = 0;
+    }
+
+    // keep_ns bounds the history held. A sample older than the block being filled (it was
+    // still in the sampler's buffer when advance closed its block) is counted in that block.
+    void add(uint64_t timestamp_ns, int32_t position, uint64_t keep_ns) {
+        advance(timestamp_ns, keep_ns);
+        current_.add(static_cast<int64_t>(timestamp_ns - origin_ns_) * 1e-9, position);
+    }
+
+    // Closes the block being filled once time has moved past it, even without samples
+    void advance(uint64_t now_ns, uint64_t keep_ns) {
+        uint64_t start = now_ns - now_ns % STATS_BLOCK_NS;
+        if (start <= current_start_ns_) return;
+        if (current_.count > 0) {
+            Block block;
+            block.start_ns = current_start_ns_;
+            block.moments = current_;
+            blocks_.push_back(block);
+        }
+        current_ = StatsMoments();
+        current_start_ns_ = start;
+        while (!blocks_.empty() && blocks_.front().start_ns + keep_ns < current_start_ns_) blocks_.pop_front();
+    }
+
+    // Merged moments of the closed blocks in the window_ns before the block being filled
+    StatsMoments window(uint64_t window_ns) const {
+        StatsMoments result;
+        uint64_t since = current_start_ns_ > window_ns ? current_start_ns_ - window_ns : 0;
+        for (auto it = blocks_.rbegin(); it != blocks_.rend() && it->start_ns >= since; ++it) {
+            result.merge(it->moments);
+        }
+        return result;
+    }
+
+private:
+    struct Block {
+        uint64_t start_ns;
+        StatsMoments moments;
+    };
+
+    uint64_t origin_ns_;
+    std::deque<Block> blocks_;
+    StatsMoments current_;
+    uint64_t current_start_ns_ = 0;
+};
+
+#endif // ECC_STATS_H
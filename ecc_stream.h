@@ -0,0 +1,45 @@
+// Wire format of the TCP position stream served by ecc_mqtt_streaming on STREAM_PORT
+//
+// A client connects and sends one line:
+//     SUBSCRIBE <TEXT|BINARY> [<axes> [<decimation>]]\n
+// e.g. "SUBSCRIBE BINARY XZ 10" for every 10th sample of X and Z. The server answers
+// "OK <TEXT|BINARY> <axes> <decimation> <index>\n", where index is the stream index of the
+// first sample it will send, or "ERROR <reason>\n" and closes.
+//
+// TEXT: one line per sample, "<timestamp_ns>/<a1>/<a2>..." with the selected axes in
+// X, Y, Z, R order and NaN for invalid readings (the MQTT format when all axes are selected).
+//
+// BINARY: frames of a StreamFrameHeader followed by count packed little-endian records:
+// uint64 timestamp_ns, uint8 valid mask (X=1, Y=2, Z=4, R=8), one int32 per selected axis.
+// Record i has stream index first_index + i * decimation. Indexes count every sample taken
+// while clients were subscribed, including ones the server lost, so a jump larger than the
+// decimation between records means samples were lost.
+
+#ifndef ECC_STREAM_H
+#define ECC_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+const uint32_t STREAM_FRAME_MAGIC = 0x42434345;   // "ECCB" in little-endian byte order
+const uint16_t STREAM_FRAME_VERSION = 1;
+
+struct __attribute__((packed)) StreamFrameHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t axis_mask;             // Selected axes, X=1, Y=2, Z=4, R=8
+    uint8_t reserved;
+    uint32_t count;                // Records in this frame
+    uint32_t decimation;
+    uint64_t first_index;          // Stream index of the first record
+};
+
+inline int stream_axis_count(uint8_t axis_mask) {
+    return ((axis_mask >> 0) & 1) + ((axis_mask >> 1) & 1) + ((axis_mask >> 2) & 1) + ((axis_mask >> 3) & 1);
+}
+
+inline size_t stream_record_size(uint8_t axis_mask) {
+    return sizeof(uint64_t) + sizeof(uint8_t) + sizeof(int32_t) * stream_axis_count(axis_mask);
+}
+
+#endif // ECC_STREAM_H
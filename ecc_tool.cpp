@@ -8,6 +8,8 @@
 #include <thread>
 #include <algorithm>
 #include "ecc.h"
+#include "ecc_bench.h"
+#include "ecc_move_model.h"
 
 void list_controllers();
 void move_axis(int stage_index, int axis, int position);
@@ -19,6 +21,7 @@ void monitor_position(int stage_index, int axis, int duration_seconds = 10);
 void set_axis_parameters(int stage_index, int axis, int amplitude = -1, int frequency = -1);
 void stop_movement(int stage_index, int axis);
 void save_configuration(int stage_index);
+void benchmark_controllers(int duration_ms = 1000);
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
@@ -32,7 +35,8 @@ int main(int argc, char* argv[]) {
                   << "  " << argv[0] << " monitor <stage_index> <axis> [duration_seconds]\n"
                   << "  " << argv[0] << " config <stage_index> <axis> [amplitude_mV] [frequency_mHz]\n"
                   << "  " << argv[0] << " stop <stage_index> <axis>\n"
-                  << "  " << argv[0] << " save <stage_index>\n";
+                  << "  " << argv[0] << " save <stage_index>\n"
+                  << "  " << argv[0] << " bench [duration_ms]\n";
         return 1;
     }
 
@@ -64,6 +68,9 @@ int main(int argc, char* argv[]) {
             stop_movement(std::atoi(argv[2]), std::atoi(argv[3]));
         } else if (command == "save" && argc >= 3) {
             save_configuration(std::atoi(argv[2]));
+        } else if (command == "bench") {
+            int duration = (argc >= 3) ? std::max(100, std::min(10000, std::atoi(argv[2]))) : 1000;
+            benchmark_controllers(duration);
         } else {
             std::cerr << "Invalid command or insufficient arguments\n";
             return 1;
@@ -777,10 +784,16 @@ void move_axis(int stage_index, int axis, int target_position) {
     std::cout << "\nMovement Progress:\n";
     std::cout << "Moving from " << current_pos << " to " << target_position << "\n";
 
+    // Timeout bound from the move-time model prior for this distance and drive setting
+    MoveTimeModel model;
+    MovePrediction prediction = model.predict(target_position - current_pos, current_amp, current_freq);
+    std::cout << "Predicted duration: " << std::fixed << std::setprecision(2) << prediction.eta_s 
+              << " s (timeout " << prediction.timeout_s << " s)\n";
+
     // Wait for movement to complete with better monitoring
     Int32 moving_status = 1;
     int timeout_count = 0;
-    const int max_timeout = 300; // 30 seconds timeout
+    const int max_timeout = static_cast<int>(std::ceil(prediction.timeout_s * 10)); // 100 ms polls
     Int32 last_pos = current_pos;
     int stuck_count = 0;
     
@@ -894,3 +907,55 @@ void move_axis(int stage_index, int axis, int target_position) {
     ECC_Close(handle);
     ECC_ReleaseInfo();
 }
+
+void benchmark_controllers(int duration_ms) {
+    struct EccInfo* info = nullptr;
+    int num_controllers = ECC_Check(&info);
+    if (num_controllers <= 0) {
+        std::cerr << "No controllers found.\n";
+        ECC_ReleaseInfo();
+        return;
+    }
+
+    // Connect every unlocked controller and collect its connected axes
+    std::vector<Int32> handles;
+    std::vector<BenchAxis> axes;
+    for (int i = 0; i < num_controllers; ++i) {
+        Int32 id, handle;
+        Bln32 locked;
+        if (ECC_getDeviceInfo(i, &id, &locked) != 0 || locked) {
+            std::cerr << "Skipping controller " << i << " (unavailable or locked)\n";
+            continue;
+        }
+        if (ECC_Connect(i, &handle) != 0) {
+            std::cerr << "Failed to connect to controller " << i << "\n";
+            continue;
+        }
+        handles.push_back(handle);
+
+        for (int axis = 0; axis < 3; ++axis) {
+            Bln32 connected = 0;
+            if (ECC_getStatusConnected(handle, axis, &connected) == 0 && connected) {
+                BenchAxis a;
+                a.handle = handle;
+                a.axis = axis;
+                a.name = "C" + std::to_string(i) + "/A" + std::to_string(axis);
+                axes.push_back(a);
+            }
+        }
+    }
+
+    if (axes.empty()) {
+        std::cerr << "No connected axes to benchmark.\n";
+    } else {
+        std::cout << "Benchmarking " << axes.size() << " axes (" << duration_ms 
+                  << " ms per phase)...\n\n";
+        BenchReport report = run_ecc_benchmark(axes, duration_ms);
+        std::cout << format_bench_report(report, axes.size());
+    }
+
+    for (Int32 handle : handles) {
+        ECC_Close(handle);
+    }
+    ECC_ReleaseInfo();
+}
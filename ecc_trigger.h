@@ -0,0 +1,164 @@
+// Position triggers evaluated by the sampler (TRIGGER in ecc_mqtt_streaming)
+//
+// A trigger watches one axis for crossings of a threshold: FWD fires when the position
+// rises through it, REV when it falls through it, BOTH on either. Each trigger has a
+// hysteresis band on the approach side of the threshold (centred on it for BOTH): after
+// a crossing the position has to leave the band on the other side before the trigger
+// can fire again, so stage noise around the threshold fires once, not on every sample.
+//
+// TriggerBank keeps up to TRIGGER_MAX triggers as arrays and evaluates all of them against
+// a sample without a branch per trigger: each comparison becomes one bit of a mask, and
+// the crossings of the tick come out as a single word that is almost always zero. Only
+// set bits cost anything further. The first valid sample of an axis only sets the side
+// its triggers are on; a trigger never fires because it was just defined.
+
+#ifndef ECC_TRIGGER_H
+#define ECC_TRIGGER_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+const size_t TRIGGER_MAX = 16;                  // Bits of the evaluation masks in use
+const size_t TRIGGER_NAME_SIZE = 16;            // Including the terminator
+
+enum TriggerDirection { TRIGGER_FORWARD = 1, TRIGGER_REVERSE = 2, TRIGGER_BOTH = 3 };
+enum TriggerAction { TRIGGER_MARK = 0, TRIGGER_LINE = 1, TRIGGER_BURST = 2 };
+
+const char* const TRIGGER_DIRECTION_NAMES[4] = {"", "FWD", "REV", "BOTH"};
+const char* const TRIGGER_ACTION_NAMES[3] = {"MARK", "LINE", "BURST"};
+
+struct TriggerSpec {
+    std::string name;
+    uint8_t axis = 0;              // Logical axis 0 = X ... 3 = R
+    int32_t position = 0;          // Threshold in nm/µ°
+    uint8_t direction = TRIGGER_FORWARD;
+    uint8_t action = TRIGGER_MARK;
+    int32_t hysteresis = 0;        // Re-arm distance in nm/µ°
+
+    bool same_definition(const TriggerSpec& other) const {
+        return name == other.name && axis == other.axis && position == other.position &&
+               direction == other.direction && action == other.action && hysteresis == other.hysteresis;
+    }
+};
+
+// One crossing, as handed from the sampler to the consumers
+struct TriggerEvent {
+    uint64_t timestamp_ns;         // Sample that crossed, same clock as PositionSample
+    uint64_t monotonic_ns;         // When the sampler stored that sample
+    uint32_t count;                // Crossings of this trigger since it was defined, from 1
+    int32_t position;              // Axis position in that sample
+    uint8_t axis;
+    uint8_t direction;             // TRIGGER_FORWARD or TRIGGER_REVERSE, as crossed
+    uint8_t action;
+    char name[TRIGGER_NAME_SIZE];
+};
+
+inline bool check_trigger_name(const std::string& name) {
+    if (name.empty() || name.size() >= TRIGGER_NAME_SIZE) return false;
+    for (char c : name) {
+        if (!(std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-')) return false;
+    }
+    return true;
+}
+
+class TriggerBank {
+public:
+    // Replaces the table. Triggers whose definition did not change keep their side and count.
+    void load(const std::vector<TriggerSpec>& specs, uint64_t version) {
+        TriggerSpec old_specs[TRIGGER_MAX];
+        uint32_t old_count[TRIGGER_MAX];
+        uint32_t old_side = side_, old_known = known_;
+        size_t old_size = size_;
+        for (size_t i = 0; i < old_size; ++i) {
+            old_specs[i] = specs_[i];
+            old_count[i] = count_[i];
+        }
+
+        size_ = std::min(specs.size(), TRIGGER_MAX);
+        forward_ = reverse_ = side_ = known_ = 0;
+        for (size_t i = 0; i < size_; ++i) {
+            const TriggerSpec& spec = specs[i];
+            specs_[i] = spec;
+            axis_[i] = spec.axis & 3;
+            int64_t h = std::max(0, spec.hysteresis);
+            int64_t lo = spec.position, hi = spec.position;
+            if (spec.direction == TRIGGER_FORWARD) {
+                lo -= h;
+            } else if (spec.direction == TRIGGER_REVERSE) {
+                hi += h;
+            } else {
+                lo -= h / 2;
+                hi += h - h / 2;
+            }
+            lo_[i] = static_cast<int32_t>(std::max<int64_t>(lo, INT32_MIN));
+            hi_[i] = static_cast<int32_t>(std::min<int64_t>(hi, INT32_MAX));
+            if (spec.direction & TRIGGER_FORWARD) forward_ |= 1u << i;
+            if (spec.direction & TRIGGER_REVERSE) reverse_ |= 1u << i;
+            count_[i] = 0;
+            for (size_t j = 0; j < old_size; ++j) {
+                if (!old_specs[j].same_definition(spec)) continue;
+                count_[i] = old_count[j];
+                side_ |= ((old_side >> j) & 1u) << i;
+                known_ |= ((old_known >> j) & 1u) << i;
+                break;
+            }
+        }
+        version_ = version;
+    }
+
+    // Crossings in this sample as a mask over the table; reverse gets those that fell
+    uint32_t evaluate(const int32_t position[4], uint8_t valid_mask, uint32_t& reverse) {
+        uint32_t above = 0, below = 0, valid = 0;
+        for (size_t i = 0; i < size_; ++i) {
+            int32_t p = position[axis_[i]];
+            above |= static_cast<uint32_t>(p >= hi_[i]) << i;
+            below |= static_cast<uint32_t>(p < lo_[i]) << i;
+            valid |= static_cast<uint32_t>((valid_mask >> axis_[i]) & 1) << i;
+        }
+        // Inside the band the side is unchanged; an invalid axis holds it too
+        uint32_t side = (above | (side_ & ~below)) & valid;
+        side |= side_ & ~valid;
+        uint32_t changed = (side ^ side_) & known_;
+        reverse = changed & ~side & reverse_;
+        uint32_t fired = (changed & side & forward_) | reverse;
+        side_ = side;
+        known_ |= valid;
+        return fired;
+    }
+
+    // Fills the event for trigger i, which fired in the sample given
+    void fire(size_t i, uint64_t timestamp_ns, uint64_t monotonic_ns, const int32_t position[4], bool reverse,
+              TriggerEvent& event) {
+        event.timestamp_ns = timestamp_ns;
+        event.monotonic_ns = monotonic_ns;
+        event.count = ++count_[i];
+        event.position = position[axis_[i]];
+        event.axis = axis_[i];
+        event.direction = reverse ? TRIGGER_REVERSE : TRIGGER_FORWARD;
+        event.action = specs_[i].action;
+        std::strncpy(event.name, specs_[i].name.c_str(), TRIGGER_NAME_SIZE - 1);
+        event.name[TRIGGER_NAME_SIZE - 1] = '\0';
+    }
+
+    size_t size() const { return size_; }
+    uint64_t version() const { return version_; }
+    const TriggerSpec& spec(size_t i) const { return specs_[i]; }
+
+private:
+    size_t size_ = 0;
+    uint64_t version_ = 0;
+    uint8_t axis_[TRIGGER_MAX];
+    int32_t lo_[TRIGGER_MAX];      // Below lo the trigger is on the low side...
+    int32_t hi_[TRIGGER_MAX];      // ...at or above hi on the high side
+    uint32_t count_[TRIGGER_MAX];
+    uint32_t forward_ = 0, reverse_ = 0;
+    uint32_t side_ = 0;            // Bit set: high side
+    uint32_t known_ = 0;           // Bit set: side taken from a valid sample
+    TriggerSpec specs_[TRIGGER_MAX];
+};
+
+#endif // ECC_TRIGGER_H